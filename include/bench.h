@@ -0,0 +1,37 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "common.h"
+
+// Microbenchmarks for the simulation hot paths, run with --bench. Each
+// returns how many of its checks failed, 0 for those without any.
+// Only commandCompile, instancing, uniformRing and terrainTiles touch
+// the renderer, on DZNullBackend.
+namespace Bench
+{
+    u32 runAll();
+
+    u32 biomeLookup(u32 seed);
+    u32 perlinBatch(u32 seed);
+    u32 chunkMesh(u32 seed);
+    u32 terrainLOD();
+    u32 chunkLookup(u32 seed);
+    u32 chunkDeterminism(u32 seed);
+    u32 chunkStore(u32 seed);
+    u32 fogOfWar(u32 seed, u32 los);
+    u32 viewshed(u32 seed);
+    u32 pathfinding(u32 seed);
+    u32 heightQuery(u32 seed);
+    u32 scheduler(u32 seed);
+    u32 simulation();
+    u32 commandCompile(u32 seed);
+    u32 instancing(u32 seed);
+    u32 uniformRing();
+    u32 terrainTiles(u32 seed);
+    u32 culling(u32 seed);
+    u32 selection(u32 seed);
+    u32 separation(u32 seed);
+    u32 worldSave(u32 seed);
+}
+
+#endif // _BENCH_H
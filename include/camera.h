@@ -3,6 +3,7 @@
 #include <math.h>
 #include "common.h"
 #include "geometry.h"
+#include "frustum.h"
 
 #ifndef _CAMERA_H
 #define _CAMERA_H
@@ -30,7 +31,8 @@ struct Camera
     glm::mat4 getViewMatrix() const;
     glm::mat4 getProjectionMatrix(glm::vec2 screen_dim) const;
     glm::vec3 getViewDirection() const;
-    std::array<glm::vec3, 4> getFrustrumBounds(glm::vec2 screen_dim) const; 
+    // What getCameraData draws
+    Frustum getFrustum(glm::vec2 screen_dim) const;
 
     CameraData getCameraData(glm::vec2 screen_dim) const;
 
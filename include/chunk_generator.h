@@ -0,0 +1,86 @@
+#include <vector>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+
+#include "common.h"
+#include "geometry.h"
+#include "terrain.h"
+#include "thread_pool.h"
+#include "chunk_store.h"
+
+#ifndef _CHUNK_GENERATOR_H
+#define _CHUNK_GENERATOR_H
+
+struct ChunkGenStats
+{
+    u64 generated;
+    // Of those, read back from the ChunkStore rather than generated
+    u64 loaded;
+    f64 chunks_per_second;
+    f64 avg_generation_ms;
+};
+
+// Builds chunks on a worker pool. Requests are keyed by chunk origin,
+// workers always pick the queued origin closest to the current focus,
+// and finished chunks wait in a completion queue until the game thread
+// collects them. With a store, chunks are loaded from it when saved
+// before and saved to it once generated.
+struct ChunkGenerator
+{
+    ChunkGenerator(
+            u32 seed,
+            f32 chunk_size,
+            const KDTree &kd,
+            u32 num_workers,
+            ChunkStore *store = nullptr
+        );
+
+    // Returns false if the origin is already queued or being generated
+    bool request(v2f origin);
+    bool isPending(v2f origin);
+
+    void setFocus(v2f focus);
+
+    // Drains the completion queue, call once per frame
+    std::vector<std::pair<v2f, Chunk>> collect();
+    // Drops the queued requests, waits for the chunks being built and
+    // drops those too, so nothing read from the store before now
+    // arrives later
+    void cancel();
+
+    ChunkGenStats getStats();
+
+private:
+    const u32 seed;
+    const f32 chunk_size;
+    const KDTree kd;
+    // Outlives the generator, may be nullptr
+    ChunkStore *const store;
+
+    std::mutex mutex;
+    std::vector<v2f> queued;
+    std::set<v2f> pending;
+    std::vector<std::pair<v2f, Chunk>> completed;
+    v2f focus;
+    // Taken off queued and not completed yet
+    u32 building;
+    std::condition_variable built;
+
+    // Metrics, guarded by mutex
+    u64 generated;
+    u64 loaded;
+    f64 total_generation_ms;
+    u64 generated_this_window;
+    f64 chunks_per_second;
+    std::chrono::steady_clock::time_point window_start;
+
+    // Declared last so workers are joined before the state above goes away
+    std::unique_ptr<ThreadPool> pool;
+
+    void generateNext();
+};
+
+#endif // _CHUNK_GENERATOR_H
@@ -0,0 +1,74 @@
+#include <vector>
+#include <memory>
+
+#include "common.h"
+#include "geometry.h"
+
+#ifndef _CHUNK_MAP_H
+#define _CHUNK_MAP_H
+
+struct Chunk;
+
+// Open-addressing hash map from integer chunk coordinates to chunks.
+// Linear probing over a power of two table, erase shifts the entries
+// after it back instead of leaving tombstones. Chunks are kept behind
+// unique_ptr so pointers to them stay valid when the table grows.
+struct ChunkMap
+{
+    ChunkMap();
+    ~ChunkMap();
+
+    ChunkMap(ChunkMap &&) = default;
+    ChunkMap &operator=(ChunkMap &&) = default;
+
+    Chunk *find(v2i coord) const;
+    bool contains(v2i coord) const;
+
+    // Returns the chunk already at coord if there is one
+    Chunk &insert(v2i coord, Chunk &&chunk);
+    bool erase(v2i coord);
+    void clear();
+
+    u32 size() const;
+    u32 capacity() const;
+    // Changes whenever a chunk is added or removed, lets caches built
+    // over the resident chunks notice they are stale
+    u64 epoch() const;
+    // epoch() right after the chunk at coord was inserted, 0 if there is
+    // none. Differs from a cached value when the chunk was regenerated.
+    u64 insertedAt(v2i coord) const;
+
+    template <typename F>
+    void forEach(F &&fn)
+    {
+        for (auto &slot : slots)
+            if (slot.chunk)
+                fn(slot.coord, *slot.chunk);
+    }
+
+    template <typename F>
+    void forEach(F &&fn) const
+    {
+        for (const auto &slot : slots)
+            if (slot.chunk)
+                fn(slot.coord, (const Chunk &) *slot.chunk);
+    }
+
+private:
+    struct Slot
+    {
+        v2i coord;
+        std::unique_ptr<Chunk> chunk;
+        u64 inserted_at;
+    };
+
+    std::vector<Slot> slots;
+    u32 count;
+    u64 change_epoch;
+
+    static u32 hash(v2i coord);
+    u32 probe(v2i coord) const;
+    void grow();
+};
+
+#endif // _CHUNK_MAP_H
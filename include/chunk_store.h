@@ -0,0 +1,135 @@
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "common.h"
+#include "geometry.h"
+#include "terrain.h"
+
+#ifndef _CHUNK_STORE_H
+#define _CHUNK_STORE_H
+
+// Bumped whenever ChunkRecord or generation changes, older files are
+// started over
+#define CHUNK_STORE_VERSION (1)
+#define CHUNK_STORE_MAGIC   (0x46525a44) // "DZRF"
+
+// Chunks per side of a region file
+#define REGION_SIDE (16)
+#define REGION_CHUNKS (REGION_SIDE * REGION_SIDE)
+// Records start on page boundaries, so loading a chunk touches only its
+// own pages
+#define CHUNK_RECORD_BYTES (32768)
+#define REGION_HEADER_BYTES (4096)
+#define REGION_FILE_BYTES (REGION_HEADER_BYTES + REGION_CHUNKS * CHUNK_RECORD_BYTES)
+
+// Marks a record whose payload was completely written, set last
+#define CHUNK_RECORD_WRITTEN (0x4b4e4843) // "CHNK"
+
+struct RegionHeader
+{
+    u32 magic;
+    u32 version;
+    u32 seed;
+    f32 chunk_size;
+    u32 record_bytes;
+    s32 x;
+    s32 y;
+};
+
+// Everything about a chunk that is not derived from the rest. The mesh
+// is rebuilt from the heights, which is cheap next to the noise.
+struct ChunkRecord
+{
+    u32 state;
+    // Of everything after it
+    u32 checksum;
+    f32 heights[VERTS_PER_CHUNK];
+    u8 material_indices[TILES_PER_CHUNK];
+    u8 navigable[TILES_PER_CHUNK];
+    // Explored and visible tiles, FogOfWar fades the visible ones once
+    // the chunk is back
+    u8 los_indices[TILES_PER_CHUNK];
+};
+
+static_assert(sizeof(ChunkRecord) <= CHUNK_RECORD_BYTES, "ChunkRecord must fit its slot");
+static_assert(sizeof(RegionHeader) <= REGION_HEADER_BYTES, "RegionHeader must fit its page");
+
+struct ChunkStoreStats
+{
+    u64 loads;
+    u64 saves;
+    // Not in the store yet
+    u64 misses;
+    // Failed the checksum, regenerated
+    u64 corrupt;
+    u32 regions;
+};
+
+// Chunks kept on disk between runs and evictions, in region files of
+// REGION_SIDE^2 chunks under directory/<seed>/. Each region is mapped
+// whole, records are read and written in place and the file starts
+// out sparse, so a chunk costs disk space once it is saved and loading
+// it is a few page faults.
+//
+// Records are written payload first and marked written last, a record
+// cut short by a crash fails the checksum and is generated again.
+// Safe to use from several threads as long as no two write the same
+// chunk at once.
+struct ChunkStore
+{
+    ChunkStore(const std::string &directory, u32 seed, f32 chunk_size);
+    ~ChunkStore();
+
+    std::optional<Chunk> load(v2i coord);
+    // False if the region file cannot be used
+    bool save(v2i coord, const Chunk &chunk);
+    // Replaces the LOS and navigable tiles of a saved chunk, false if
+    // it is not saved
+    bool saveTiles(v2i coord, const u8 *los_indices, const u8 *navigable);
+    // The chunk is generated again the next time it is loaded
+    void erase(v2i coord);
+    // Every saved chunk that passes its checksum, in the region files
+    // on disk whether opened yet or not. The record stays valid as long
+    // as the store, until the chunk is saved again.
+    void forEach(const std::function<void(v2i coord, const ChunkRecord &record)> &fn);
+    // Writes the mapped pages back to the files
+    void flush();
+
+    ChunkStoreStats getStats();
+
+    static u32 checksum(const u8 *data, size_t size);
+
+private:
+    struct Region
+    {
+        int fd;
+        u8 *data;
+    };
+
+    const std::string directory;
+    const u32 seed;
+    const f32 chunk_size;
+
+    std::mutex mutex;
+    std::map<v2i, Region> regions;
+
+    std::atomic<u64> loads;
+    std::atomic<u64> saves;
+    std::atomic<u64> misses;
+    std::atomic<u64> corrupt;
+
+    // Maps the region, creating or starting it over as needed. nullptr
+    // if the file cannot be used.
+    ChunkRecord *record(v2i coord);
+    u8 *openRegion(v2i region);
+    // Around changes to a record's payload
+    void beginWrite(ChunkRecord *saved);
+    void endWrite(ChunkRecord *saved);
+    static bool isWritten(const ChunkRecord *saved);
+};
+
+#endif // _CHUNK_STORE_H
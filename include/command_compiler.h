@@ -0,0 +1,116 @@
+#include <vector>
+
+#include "common.h"
+#include "renderer.h"
+
+#ifndef _COMMAND_COMPILER_H
+#define _COMMAND_COMPILER_H
+
+// Sort key of a draw, most significant first. A pass is everything
+// queued after one SET_PIPELINE, passes keep the order they were queued
+// in since there is no depth buffer to sort them out. Within a pass the
+// draws are grouped by pipeline and mesh, the sequence number keeps
+// draws with the same key in queue order.
+#define SORT_KEY_PASS_BITS     (12)
+#define SORT_KEY_PIPELINE_BITS (8)
+#define SORT_KEY_MESH_BITS     (20)
+#define SORT_KEY_SEQUENCE_BITS (24)
+
+static_assert(SORT_KEY_PASS_BITS + SORT_KEY_PIPELINE_BITS
+            + SORT_KEY_MESH_BITS + SORT_KEY_SEQUENCE_BITS == 64,
+              "Sort key fields must fill 64 bits");
+
+struct CommandCompileStats
+{
+    u32 commands_in;
+    u32 commands_out;
+    u32 draws;
+    u32 passes;
+    u32 pipelines_dropped;
+    u32 buffer_binds_dropped;
+    u32 texture_binds_dropped;
+    // Passes whose draws needed fewer binds in queue order than sorted,
+    // left that way
+    u32 passes_in_queue_order;
+    // More passes or draws than the key has room for, the draws were
+    // left in queue order and only the redundant commands dropped
+    bool unsorted;
+};
+
+// Turns the queue the systems filled into the one the backend runs.
+// Every draw is captured with the pipeline and bindings in effect when
+// it was queued, the draws are sorted and then only the state that
+// differs from the previous draw is set again. Whatever order comes
+// out, every draw sees the same state it would have seen in the queue.
+// Draws of one pass are assumed not to depend on each other's order,
+// which holds as long as they do not overlap on screen.
+struct DZCommandCompiler
+{
+    // Leave the draws in queue order, still dropping redundant state
+    bool sort_draws;
+
+    DZCommandCompiler();
+
+    // out is overwritten, commands is left alone
+    void compile(
+            const std::vector<DZRenderCommand> &commands,
+            std::vector<DZRenderCommand> &out
+        );
+
+    // Of the last compile
+    const CommandCompileStats &getStats() const;
+
+    static u64 sortKey(u32 pass, DZPipeline pipeline, DZMesh mesh, u32 sequence);
+
+    // True if b draws what a does, pass by pass, every draw seeing the
+    // pipeline and bindings it sees in a. For checking compile without a
+    // GPU, slow.
+    static bool sameDraws(
+            const std::vector<DZRenderCommand> &a,
+            const std::vector<DZRenderCommand> &b
+        );
+
+private:
+    // Kind and stage of the slot in the high bits, so binds sorted by
+    // slot come out vertex buffers first. Setting a pipeline puts the
+    // texture array in fragment texture 0, that is a resource of
+    // DZInvalid there.
+    struct Bound
+    {
+        u32 slot;
+        size_t resource;
+        size_t offset;
+
+        bool sameAs(const Bound &other) const
+        {
+            return resource == other.resource && offset == other.offset;
+        }
+    };
+
+    struct Draw
+    {
+        u64 key;
+        u32 pass;
+        DZPipeline pipeline;
+        // Range of bound_states in effect for the draw
+        u32 state_begin;
+        u32 state_count;
+        DZRenderCommand command;
+    };
+
+    std::vector<Draw> draws;
+    std::vector<Bound> bound_states;
+    // Only the last one counts, the clear happens before any command
+    bool has_clear_color;
+    glm::vec3 clear_color;
+
+    CommandCompileStats stats;
+
+    void capture(const std::vector<DZRenderCommand> &commands);
+    void sortPasses();
+    // Bindings that differ from one draw to the next over [begin, end)
+    u32 stateChanges(u32 begin, u32 end) const;
+    void emit(std::vector<DZRenderCommand> &out);
+};
+
+#endif // _COMMAND_COMPILER_H
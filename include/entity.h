@@ -24,4 +24,7 @@ struct Team
     u32 team;
 };
 
+// Picked by the player's last drag box
+struct Selected {};
+
 #endif // ENTITY_H
@@ -0,0 +1,33 @@
+#include <array>
+#include <optional>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "geometry.h"
+
+#ifndef _FRUSTUM_H
+#define _FRUSTUM_H
+
+// The volume a view projection matrix draws, as six planes facing in.
+// Built for glm's -1 to 1 clip depth, which contains Metal's 0 to 1, so
+// the tests can only err on the side of drawing.
+struct Frustum
+{
+    // xyz is the normal and w the offset, p is inside a plane when
+    // dot(xyz, p) + w >= 0
+    std::array<glm::vec4, 6> planes;
+    // Index bits are x, y and depth, set for the positive clip side
+    std::array<glm::vec3, 8> corners;
+
+    static Frustum fromMatrix(const glm::mat4 &view_projection);
+
+    // Conservative, boxes near a corner may pass without intersecting
+    bool intersectsBox(glm::vec3 min, glm::vec3 max) const;
+    bool intersectsSphere(glm::vec3 center, f32 radius) const;
+
+    // The xy extent of what the frustum holds between the two heights,
+    // none if it does not reach them
+    std::optional<AArect2f> groundBounds(f32 z_min, f32 z_max) const;
+};
+
+#endif // _FRUSTUM_H
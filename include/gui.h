@@ -1,8 +1,17 @@
 #ifndef _GUI_H
 #define _GUI_H
+#include <vector>
+#include <entt.hpp>
 #include "geometry.h"
 #include "model.h"
 #include "renderer.h"
+#include "camera.h"
+#include "frustum.h"
+#include "spatial_hash.h"
+
+// A click is a drag box this many pixels across, so it picks what is
+// under the cursor
+#define SELECTION_MIN_PIXELS (6)
 
 struct GUI
 {
@@ -11,7 +20,19 @@ struct GUI
     Model selection_rect_model; 
     int x_start, y_start, x_curr, y_curr;
     GUI();
-    AArect2f selection_to_worldspace(Camera camera);
+    // The part of the view inside the drag box
+    Frustum selection_frustum(const Camera &camera, glm::vec2 screen_dim) const;
+    // Ground under the drag box between z_min and z_max, empty if none
+    AArect2f selection_to_worldspace(const Camera &camera, glm::vec2 screen_dim, f32 z_min, f32 z_max) const;
+    // Entities with a Model whose bounds are inside the drag box, found
+    // through the cells under it
+    std::vector<entt::entity> select_units(
+            const entt::registry &registry,
+            const SpatialHash &spatial,
+            const Camera &camera,
+            glm::vec2 screen_dim,
+            f32 z_min,
+            f32 z_max) const;
 };
 
 #endif // _GUI_H
@@ -0,0 +1,61 @@
+#include "common.h"
+#include "geometry.h"
+
+#ifndef _HASH_RNG_H
+#define _HASH_RNG_H
+
+// Streams of HashRNG numbers used by terrain generation, so two uses of
+// the same key never see the same numbers
+#define RNG_STREAM_BIOME_POINTS (0u)
+#define RNG_STREAM_MATERIAL     (1u)
+#define RNG_STREAM_BIOME_BLEND  (2u)
+
+// Counter based random numbers: each value is a hash of the key, a
+// stream and a counter, so there is no state to share or advance and
+// any value can be had in any order, from any thread. Chunks are keyed
+// by the world seed and their coordinates, and use the tile index as
+// the counter, so a chunk is the same however and whenever it is made.
+struct HashRNG
+{
+    u64 key;
+
+    explicit HashRNG(u32 seed)
+        : key { mix(seed) }
+    {
+    }
+
+    HashRNG(u32 seed, v2i coord)
+        : key { mix(mix(seed) ^ ((u64) (u32) coord.x << 32 | (u32) coord.y)) }
+    {
+    }
+
+    // Uniform over all of u32
+    u32 get(u32 stream, u32 counter) const
+    {
+        return (u32) (mix(key ^ mix((u64) stream << 32 | counter)) >> 32);
+    }
+
+    // Uniform over [0, bound), the modulo bias is far below anything
+    // generation could show for small bounds
+    u32 below(u32 stream, u32 counter, u32 bound) const
+    {
+        return get(stream, counter) % bound;
+    }
+
+    // Uniform over [0, 1)
+    f64 unit(u32 stream, u32 counter) const
+    {
+        return get(stream, counter) * (1.0 / 4294967296.0);
+    }
+
+    // The splitmix64 finaliser, every input bit affects every output bit
+    static u64 mix(u64 x)
+    {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+};
+
+#endif // _HASH_RNG_H
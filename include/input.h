@@ -153,16 +153,16 @@ struct InputState
         SET_KEY_DOWN(SDL_SCANCODE_B, DZKey::B);
         SET_KEY_DOWN(SDL_SCANCODE_N, DZKey::N);
         SET_KEY_DOWN(SDL_SCANCODE_M, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F1, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F2, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F3, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F4, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F5, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F6, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F7, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F8, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F9, DZKey::M);
-        SET_KEY_DOWN(SDL_SCANCODE_F10, DZKey::M);
+        SET_KEY_DOWN(SDL_SCANCODE_F1, DZKey::F1);
+        SET_KEY_DOWN(SDL_SCANCODE_F2, DZKey::F2);
+        SET_KEY_DOWN(SDL_SCANCODE_F3, DZKey::F3);
+        SET_KEY_DOWN(SDL_SCANCODE_F4, DZKey::F4);
+        SET_KEY_DOWN(SDL_SCANCODE_F5, DZKey::F5);
+        SET_KEY_DOWN(SDL_SCANCODE_F6, DZKey::F6);
+        SET_KEY_DOWN(SDL_SCANCODE_F7, DZKey::F7);
+        SET_KEY_DOWN(SDL_SCANCODE_F8, DZKey::F8);
+        SET_KEY_DOWN(SDL_SCANCODE_F9, DZKey::F9);
+        SET_KEY_DOWN(SDL_SCANCODE_F10, DZKey::F10);
         SET_KEY_DOWN(SDL_SCANCODE_ESCAPE, DZKey::ESC);
         SET_KEY_DOWN(SDL_SCANCODE_BACKSPACE, DZKey::BACKSPACE);
         SET_KEY_DOWN(SDL_SCANCODE_UP, DZKey::UP);
@@ -0,0 +1,60 @@
+#include <vector>
+#include <unordered_map>
+
+#include "common.h"
+#include "renderer.h"
+
+#ifndef _INSTANCING_H
+#define _INSTANCING_H
+
+// One instance as the shader reads it, InstanceUniforms in
+// basic_shader.metal. The padding keeps the array stride at the 16 byte
+// alignment of the matrix.
+struct ModelInstance
+{
+    glm::mat4 model_matrix;
+    u32 textured;
+    u32 lit;
+    u32 material_index;
+    u32 padding;
+};
+
+static_assert(sizeof(ModelInstance) == 80, "ModelInstance must match InstanceUniforms");
+
+// Collects a frame's instances by mesh, then uploads them into one
+// slice of the uniform ring and draws each mesh once, however many
+// entities use it.
+struct InstanceBatcher
+{
+    InstanceBatcher();
+
+    void add(DZMesh mesh, const ModelInstance &instance);
+
+    // Binds the instances to vertex 2 and fragment 1 and queues a
+    // DRAW_INSTANCED per mesh, after whatever pipeline and scene
+    // bindings are queued already. Clears the instances for the next
+    // frame.
+    void flush(DZRenderer &renderer);
+
+    // Of the last flush
+    u32 getDrawCount() const;
+    u32 getInstanceCount() const;
+
+private:
+    struct Group
+    {
+        DZMesh mesh;
+        std::vector<ModelInstance> instances;
+    };
+
+    // Kept across frames so their vectors keep their capacity, groups
+    // left empty for a frame are dropped
+    std::vector<Group> groups;
+    std::unordered_map<DZMesh, u32> group_of;
+    std::vector<ModelInstance> staging;
+
+    u32 draw_count;
+    u32 instance_count;
+};
+
+#endif // _INSTANCING_H
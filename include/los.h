@@ -0,0 +1,150 @@
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <entt.hpp>
+
+#include "common.h"
+#include "geometry.h"
+#include "chunk_map.h"
+
+#ifndef _LOS_H
+#define _LOS_H
+
+// los_indices values: 0 never seen, LOS_VISIBLE while observed, fading
+// one step per frame down to LOS_EXPLORED once nobody sees the tile
+#define LOS_VISIBLE  (255)
+#define LOS_EXPLORED (100)
+
+// Set in Chunk::observers while the tile is on the fading list
+#define LOS_FADING_BIT     (0x8000)
+#define LOS_OBSERVER_MASK  (0x7fff)
+
+// Height of a unit's eyes above the ground of its tile, for occlusion
+#define LOS_EYE_HEIGHT (1.5f)
+
+// Tiles [x0, x1] of row dy, relative to the centre of a stamp
+struct LOSRun
+{
+    s16 dy;
+    s16 x0;
+    s16 x1;
+};
+
+// One tile of a viewshed, in the order computeViewshed visits them.
+// Indices are into the (2 * extent + 1)^2 window around the centre.
+struct LOSViewshedStep
+{
+    u32 index;
+    // The two tiles of the previous ring the ray to the centre passes
+    // between, and how far it is from the first to the second
+    u32 behind0;
+    u32 behind1;
+    f32 frac;
+    f32 inv_distance;
+};
+
+// The tiles an entity currently counts as an observer of: every tile
+// whose centre is within radius tiles of the centre of the entity's
+// tile, or only the visible runs of those when occlusion is on
+struct LOSStamp
+{
+    v2i center;
+    f32 radius;
+    std::vector<LOSRun> runs;
+};
+
+struct FogOfWarStats
+{
+    u32 observers;
+    u32 restamped;
+    u32 tiles_touched;
+    u32 fading;
+    u32 rebuilds;
+    u32 viewsheds;
+    // Chunks that arrived or left in the last update, and the stamps
+    // over them that were counted again
+    u32 chunks_recounted;
+    u32 stamps_recounted;
+};
+
+// Keeps los_indices up to date from LineOfSight entities without
+// redrawing every circle every frame. Each tile counts the entities that
+// see it, an entity that moves to another tile only adds and removes
+// the row spans that differ between its old and new circle, and only
+// tiles that lost their last observer are faded. With occlusion on, a
+// unit that moves recomputes its viewshed and swaps its old runs for
+// the new ones instead.
+//
+// Registers an on_destroy hook on the registry, so must outlive it or
+// stay at the same address while connected.
+struct FogOfWar
+{
+    FogOfWar(entt::registry &registry, ChunkMap &chunks, f32 chunk_size);
+    ~FogOfWar();
+
+    // Once per frame. Chunks added or evicted since the last update are
+    // counted again with the stamps that reach them.
+    void update();
+
+    // Lets terrain higher than a unit's eyes hide what is behind it
+    void setOcclusion(bool enabled);
+    bool getOcclusion() const;
+
+    FogOfWarStats getStats() const;
+
+private:
+    entt::registry &registry;
+    ChunkMap &chunks;
+    const f32 tile_width;
+
+    // Row half widths of the disc of each radius in use, indexed by |dy|
+    std::unordered_map<f32, std::vector<s32>> discs;
+    // Visiting order of the viewshed of each radius, built on first use
+    std::unordered_map<f32, std::vector<LOSViewshedStep>> viewshed_steps;
+
+    bool occlusion;
+    bool needs_rebuild;
+
+    // Scratch for computeViewshed, (2 * extent + 1)^2 around the centre
+    std::vector<f32> window_heights;
+    std::vector<f32> horizon;
+    std::vector<u8> window_visible;
+    std::vector<LOSRun> spare_runs;
+
+    u64 chunk_epoch;
+    // ChunkMap::insertedAt of the chunks counted so far, a chunk whose
+    // value changed was regenerated
+    std::map<v2i, u64> resident;
+    // Global tile coordinates of tiles fading to LOS_EXPLORED
+    std::vector<v2i> fading;
+    FogOfWarStats stats;
+
+    v2i tileFromPos(v2f pos) const;
+    const std::vector<s32> &disc(f32 radius);
+    const std::vector<LOSViewshedStep> &viewshedSteps(f32 radius);
+
+    // Ground heights of the disc around center into window_heights
+    void gatherHeights(v2i center, const std::vector<s32> &half_widths);
+    // Fills stamp.runs with the tiles of its disc not hidden by terrain
+    void computeViewshed(LOSStamp &stamp);
+
+    void stamp(const LOSStamp &from, const LOSStamp &to);
+    void applyRuns(const LOSStamp &stamp, s32 delta);
+    void unstamp(const LOSStamp &stamp);
+    // Adds delta to every tile in [x0, x1] of global row y
+    void addSpan(s32 y, s32 x0, s32 x1, s32 delta);
+    void addObservers(u16 *observers, u8 *los, s32 count);
+    void removeObservers(u16 *observers, s32 count, v2i first_tile);
+    void fade();
+    // Recounts observers from scratch, after the occlusion mode changed
+    void rebuild();
+    // Recounts only the chunks that arrived or left and the stamps over
+    // them
+    void recountChunks();
+    // No observers, every tile brighter than explored fading
+    void resetChunk(v2i coord, Chunk &chunk);
+
+    void onStampDestroyed(entt::registry &registry, entt::entity entity);
+};
+
+#endif // _LOS_H
@@ -2,12 +2,6 @@
 #include <optional>
 #include <fstream>
 
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-#include <Metal/Metal.hpp>
-#include <simd/simd.h>
-
 #include "common.h"
 #include "vertex.h"
 
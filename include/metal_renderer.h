@@ -0,0 +1,118 @@
+#ifndef _METAL_RENDERER_H
+#define _METAL_RENDERER_H
+
+#include <string>
+#include <vector>
+
+#include <SDL_render.h>
+
+#include <QuartzCore/QuartzCore.hpp>
+
+#include <Metal/Metal.hpp>
+#include <Metal/MTLBuffer.hpp>
+#include <Metal/MTLRenderCommandEncoder.hpp>
+#include <Metal/MTLResource.hpp>
+#include <Metal/MTLTexture.hpp>
+#include <Metal/MTLEvent.hpp>
+
+#include "renderer.h"
+#include "window.h"
+
+
+#define DEFAULT_PIXEL_FORMAT MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB
+
+struct DZMetalBackend : DZRenderBackend
+{
+    SDL_Renderer *sdl_renderer;
+
+    CA::MetalLayer *swapchain;
+
+    MTL::Device *device;
+    MTL::CommandQueue *queue;
+
+    // Signalled with the number of each frame as the GPU finishes it
+    MTL::SharedEvent *render_event;
+    u64 submitted_frames;
+
+    MTL::ClearColor clear_color;
+
+    // SOA meshes
+    struct 
+    {
+        DZMesh num = 0;
+        std::vector<u32> num_elements;
+        std::vector<MTL::PrimitiveType> primitive_type;
+        std::vector<MTL::Buffer *> vertex;
+        std::vector<MTL::Buffer *> index;
+        // Released slots, reused before the vectors grow
+        std::vector<DZMesh> free;
+    } mesh_buffers;
+
+    std::vector<MTL::Function *> shaders;
+    std::vector<MTL::RenderPipelineState *> pipelines;
+
+    std::vector<MTL::Buffer *> general_buffers;
+    std::vector<DZBuffer> free_general_buffers;
+
+    std::vector<MTL::Texture *> textures;
+    std::vector<MTL::Texture *> texture_arrays;
+
+    MTL::SamplerState *sampler_state;
+
+    DZMetalBackend(DZWindow &window);
+
+    ~DZMetalBackend() override;
+
+    void waitForRenderFinish() override;
+    void waitForFrame(u64 frame) override;
+    u64 finishedFrame() override;
+    void execute(const std::vector<DZRenderCommand> &commands) override;
+
+    std::vector<DZShader> compileShaders(std::string shader_src, std::vector<std::string> main_fns) override;
+
+    DZPipeline createPipeline(
+            DZShader vertex_shader,
+            DZShader fragment_shader
+        ) override;
+
+    DZMesh createMesh(const MeshData &mesh_data) override;
+    DZMesh createMesh(
+            const void *vertices,
+            size_t size,
+            u32 num_vertices,
+            PrimitiveType primitive_type
+        ) override;
+
+    DZBuffer createBufferOfSize(size_t size, StorageMode mode) override;
+    void setBufferOfSize(DZBuffer buffer, void *data, size_t size) override;
+    void setBufferRange(DZBuffer buffer, size_t offset, const void *data, size_t size) override;
+
+    void releaseMesh(DZMesh mesh) override;
+    void releaseBuffer(DZBuffer buffer) override;
+
+    DZTexture createTexture(TextureData &texture_data) override;
+
+    DZTextureArray createTextureArray(
+            std::vector<TextureData> texture_datas
+        ) override;
+
+private:
+    DZMesh addMesh(
+            u32 num_elements,
+            MTL::PrimitiveType primitive_type,
+            MTL::Buffer *vertex,
+            MTL::Buffer *index
+        );
+
+    template <typename T>
+    MTL::Buffer* newBufferFromData(
+            std::vector<T> data, 
+            MTL::ResourceOptions options 
+                = MTL::ResourceStorageModeManaged
+        );
+
+    // Remove copy constructor
+    DZMetalBackend(const DZMetalBackend&) = delete;
+};
+
+#endif // _METAL_RENDERER_H
@@ -1,5 +1,6 @@
 #include<stdlib.h>
 #include<vector>
+#include<algorithm>
 
 #include "renderer.h"
 #include "transform.h"
@@ -15,33 +16,40 @@ struct ModelUniforms
     u32 material_index;
 };
 
+// Bounding radius of a model made from meshes alone, the vertices are
+// not known
+#define MODEL_DEFAULT_RADIUS (1.0f)
+
 struct Model
 {
-    DZBuffer uniform_buffer;
     std::vector<DZMesh> meshes;
     bool textured;
     bool lit;
+    // Of a sphere around the origin holding every vertex, for culling
+    f32 radius;
 
-    static Model fromMeshes(DZRenderer &renderer, const std::vector<DZMesh> &meshes)
+    static Model fromMeshes(const std::vector<DZMesh> &meshes)
     {
-        auto uniform_buffer = 
-            renderer.createBufferOfSize(
-                sizeof(ModelUniforms), StorageMode::SHARED);
-
-        return { uniform_buffer, meshes, false, false };
+        return { meshes, false, false, MODEL_DEFAULT_RADIUS };
     }
 
     static Model fromMeshDatas(DZRenderer &renderer, const std::vector<MeshData> &mesh_datas)
     {
         std::vector<DZMesh> meshes;
+        f32 radius = 0.0f;
 
         for (const auto &mesh : mesh_datas)
         {
             DZMesh dz_mesh = renderer.createMesh(mesh);
             meshes.push_back(dz_mesh);
+
+            for (const auto &vertex : mesh.vertices)
+                radius = std::max(radius, glm::length(glm::vec3(vertex.pos)));
         }
 
-        return fromMeshes(renderer, meshes);
+        Model model = fromMeshes(meshes);
+        model.radius = radius;
+        return model;
     }
 
     void render(DZRenderer &renderer, const Transform &transform) const
@@ -52,18 +60,18 @@ struct Model
             this->textured
         };
 
-        renderer.setBufferOfSize(
-                this->uniform_buffer, &uniforms, sizeof(ModelUniforms));
+        const UniformSlice slice =
+            renderer.allocateUniforms(&uniforms, sizeof(ModelUniforms));
 
         renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
                     Binding<DZBuffer>::Vertex(
-                        this->uniform_buffer, 2)));
+                        slice.buffer, 2, slice.offset)));
 
         renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
                     Binding<DZBuffer>::Fragment(
-                        this->uniform_buffer, 1)));
+                        slice.buffer, 1, slice.offset)));
 
         for (const auto &mesh : this->meshes)
         {
@@ -4,17 +4,27 @@
 #include "transform.h"
 #include "geometry.h"
 #include "terrain.h"
-
-#include <PerlinNoise.hpp>
+#include "steering.h"
 
 
 #define TIMESCALE 0.1
 
-void updateMovement(float move_speed, Transform &transform, v3f target, u32 seed, Terrain &terrain)
+// flow is the step from Pathfinder::flowDirection, zero once on the
+// target's tile or when there is no known way, where the unit heads
+// straight for the target as before. push is from Separation, added
+// on top and the step kept at most move_speed long.
+void updateMovement(float move_speed, Transform &transform, v3f target, v2f flow, v2f push, Terrain &terrain)
 {
     glm::vec3 to_target = glm::vec3(target.x, target.y, target.z) - transform.pos;
     glm::vec3 dir = glm::length(to_target) == 0.0f ? glm::vec3(0.0f) : glm::normalize(to_target);
 
+    if (flow.x != 0.0f || flow.y != 0.0f)
+        dir = glm::vec3(flow.x, flow.y, 0.0f);
+
+    dir += glm::vec3(push.x, push.y, 0.0f) * SEPARATION_WEIGHT;
+    if (glm::length(dir) > 1.0f)
+        dir = glm::normalize(dir);
+
     //transform.rotation.z = glm::degrees(atan2(dir.z, dir.x));
     glm::vec3 mov = dir * move_speed;
    
@@ -26,19 +36,7 @@ void updateMovement(float move_speed, Transform &transform, v3f target, u32 seed
     if(chunk->navigable[terrain.getTileIndexFromPos(v2f{newpos.x, newpos.y})] == 0)
     {
     transform.pos += mov;
-    
-    v2f v2target {target.x, target.y};
-    v2f self {transform.pos.x, transform.pos.y};
-    // TODO: MAKE BETTER CHECK IF UNIT IS IN VISIBLE
-    if(v2target.distanceFrom(self) < 140.0)
-        {
-            const siv::PerlinNoise perlin(seed);
-            f32 perlin_scale = 0.005f;
-            f32 noise_scale = 16.0f;
-            u32 octaves = 9;
-
-            transform.pos.z = noise_scale * perlin.octave2D((self.x) * perlin_scale, (self.y) * perlin_scale, octaves);
-        }
+    transform.pos.z = terrain.heightAt(v2f { transform.pos.x, transform.pos.y });
     }
 }
 
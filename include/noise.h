@@ -0,0 +1,63 @@
+#include <array>
+#include <PerlinNoise.hpp>
+
+#include "common.h"
+
+#ifndef _NOISE_H
+#define _NOISE_H
+
+// Beyond this many octaves a float lane has no fractional bits left at
+// the coordinates we sample and the amplitude is below float epsilon,
+// so the extra octaves only cost time
+#define NOISE_MAX_OCTAVES (24)
+
+// Max absolute difference from siv::PerlinNoise::octave2D (which works
+// in double) for coordinates within a few thousand units of the origin
+#define NOISE_BATCH_TOLERANCE (1e-4)
+
+// Evaluates siv::PerlinNoise::octave2D for many points at once, 8 lanes
+// at a time with AVX2 or 4 with SSE4.1, picked at runtime, with a plain
+// float loop as fallback. Takes a copy of the permutation so it can be
+// shared between threads.
+struct PerlinBatch
+{
+    enum class Path
+    {
+        SCALAR, SSE41, AVX2
+    };
+
+    explicit PerlinBatch(const siv::PerlinNoise &perlin);
+
+    // out[i] = octave2D(xs[i], ys[i], octaves, persistence)
+    void octave2D(
+            const f32 *xs,
+            const f32 *ys,
+            f32 *out,
+            u32 count,
+            s32 octaves,
+            f32 persistence = 0.5f
+        ) const;
+
+    // out[j * nx + i] = octave2D(x0 + i * step, y0 + j * step, ...)
+    void octave2DGrid(
+            f32 x0,
+            f32 y0,
+            f32 step,
+            u32 nx,
+            u32 ny,
+            f32 *out,
+            s32 octaves,
+            f32 persistence = 0.5f
+        ) const;
+
+    Path path;
+
+    static Path bestPath();
+    static const char *pathName(Path path);
+
+private:
+    // Doubled so index + 1 never needs wrapping, s32 for AVX2 gathers
+    alignas(32) std::array<s32, 512> perm;
+};
+
+#endif // _NOISE_H
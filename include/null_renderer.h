@@ -0,0 +1,111 @@
+#ifndef _NULL_RENDERER_H
+#define _NULL_RENDERER_H
+
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+
+struct NullRenderStats
+{
+    u64 frames;
+    u64 commands;
+    u64 draws;
+    u64 instances;
+    u64 bytes_uploaded;
+    u32 live_meshes;
+    u32 live_buffers;
+    // Commands and calls naming a resource that does not exist, which
+    // the Metal backend would crash or draw garbage on
+    u32 invalid_handles;
+    // waitForFrame calls that had to wait for the pretend GPU
+    u32 stalls;
+};
+
+// Backend that needs no GPU or window, for headless servers and CI. It
+// hands out handles like DZMetalBackend does and keeps what is uploaded
+// and the commands of the last frame in memory, so they can be checked.
+struct DZNullBackend : DZRenderBackend
+{
+    struct NullMesh
+    {
+        bool live;
+        u32 num_elements;
+        PrimitiveType primitive_type;
+        std::vector<u8> vertices;
+        std::vector<u32> indices;
+    };
+
+    struct NullBuffer
+    {
+        bool live;
+        StorageMode mode;
+        std::vector<u8> contents;
+    };
+
+    std::vector<NullMesh> meshes;
+    std::vector<DZMesh> free_meshes;
+
+    std::vector<NullBuffer> buffers;
+    std::vector<DZBuffer> free_buffers;
+
+    u32 num_shaders;
+    u32 num_pipelines;
+    u32 num_textures;
+    u32 num_texture_arrays;
+
+    std::vector<DZRenderCommand> last_frame;
+
+    // Frames a pretend GPU lags behind execute, the last latency frames
+    // count as in flight until waited for
+    u32 latency;
+    u64 executed_frames;
+    u64 finished_frames;
+
+    DZNullBackend();
+
+    const NullRenderStats &getStats() const;
+
+    void waitForRenderFinish() override;
+    void waitForFrame(u64 frame) override;
+    u64 finishedFrame() override;
+    void execute(const std::vector<DZRenderCommand> &commands) override;
+
+    // Hands out a handle per entry point, nothing is compiled
+    std::vector<DZShader> compileShaders(std::string shader_src, std::vector<std::string> main_fns) override;
+
+    DZPipeline createPipeline(
+            DZShader vertex_shader,
+            DZShader fragment_shader
+        ) override;
+
+    DZMesh createMesh(const MeshData &mesh_data) override;
+    DZMesh createMesh(
+            const void *vertices,
+            size_t size,
+            u32 num_vertices,
+            PrimitiveType primitive_type
+        ) override;
+
+    DZBuffer createBufferOfSize(size_t size, StorageMode mode) override;
+    void setBufferOfSize(DZBuffer buffer, void *data, size_t size) override;
+    void setBufferRange(DZBuffer buffer, size_t offset, const void *data, size_t size) override;
+
+    void releaseMesh(DZMesh mesh) override;
+    void releaseBuffer(DZBuffer buffer) override;
+
+    DZTexture createTexture(TextureData &texture_data) override;
+
+    DZTextureArray createTextureArray(
+            std::vector<TextureData> texture_datas
+        ) override;
+
+private:
+    NullRenderStats stats;
+
+    DZMesh addMesh(NullMesh &&mesh);
+    bool validMesh(DZMesh mesh) const;
+    bool validBuffer(DZBuffer buffer) const;
+};
+
+#endif // _NULL_RENDERER_H
@@ -0,0 +1,185 @@
+#include <array>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "common.h"
+#include "geometry.h"
+#include "chunk_map.h"
+#include "terrain.h"
+
+#ifndef _PATHFINDING_H
+#define _PATHFINDING_H
+
+// Step costs, octile distance times ten
+#define PATH_STRAIGHT_COST (10)
+#define PATH_DIAGONAL_COST (14)
+#define PATH_UNREACHABLE   (0xffffffffu)
+
+// Open stretches of a chunk edge longer than this get a portal every
+// this many tiles, so routes across open ground do not all funnel
+// through the middle of each edge
+#define PATH_MAX_ENTRANCE (16)
+
+// Goals whose flow fields are kept around
+#define PATH_FLOW_FIELD_CACHE (4)
+
+// ChunkFlow::dir values besides the eight steps, east first and
+// counter-clockwise
+#define FLOW_AT_GOAL (8)
+#define FLOW_NONE    (255)
+
+// Where the tiles on both sides of the edge between a chunk and its
+// east (axis 0) or north (axis 1) neighbour are navigable, as offsets
+// along the edge of the portal tiles
+struct EdgeEntrances
+{
+    u64 inserted_at[2];
+    std::vector<s32> offsets;
+};
+
+// Portals of one chunk and the cost between every pair of them
+struct ChunkNav
+{
+    u64 inserted_at;
+    // ChunkMap::epoch() it was last found up to date in
+    u64 checked_epoch;
+    // Offsets of the portals on each side, east north west south
+    std::array<std::vector<s32>, 4> sides;
+    std::array<u32, 5> side_begin;
+    // Local tile index of every portal, side by side in the order above
+    std::vector<u32> portals;
+    // cost[i * portals.size() + j], PATH_UNREACHABLE if there is no way
+    // between them inside the chunk
+    std::vector<u32> cost;
+    // By local tile index, tiles that reach each other inside the chunk
+    // share a region. Numbered from 1, 0 where blocked.
+    std::vector<u16> regions;
+};
+
+// Step of every tile of one chunk towards the goal of a FlowField
+struct ChunkFlow
+{
+    u64 inserted_at;
+    u64 nav_version;
+    // FlowField::generation it was last checked against
+    u64 generation;
+    // Cost to the goal through each portal when this was built
+    std::vector<u32> seeds;
+    u32 cost[TILES_PER_CHUNK];
+    u8 dir[TILES_PER_CHUNK];
+};
+
+// Everything units heading for the same tile share. The portal costs
+// come from one Dijkstra over the portal graph, the tile steps of a
+// chunk are filled in the first time a unit in it asks.
+struct FlowField
+{
+    v2i goal;
+    u64 chunk_epoch;
+    u64 nav_version;
+    // Bumped whenever the portal costs are recomputed
+    u64 generation;
+    u64 last_used;
+    // Cost to the goal from every portal, by chunk
+    std::map<v2i, std::vector<u32>> portal_costs;
+    std::map<v2i, std::unique_ptr<ChunkFlow>> chunk_flows;
+};
+
+struct PathStats
+{
+    u32 chunk_navs_built;
+    u32 chunk_flows_built;
+    u32 flow_fields_built;
+    u32 searches;
+    u32 route_cache_hits;
+};
+
+// Paths over Chunk::navigable, where 0 is walkable. Long routes are
+// searched over the portals between chunks rather than tile by tile,
+// groups heading for one goal share a flow field. Everything is built
+// lazily from the resident chunks and rebuilt when ChunkMap::insertedAt
+// says a chunk was regenerated.
+struct Pathfinder
+{
+    Pathfinder(ChunkMap &chunks, f32 chunk_size);
+
+    // Waypoints from the portal route, ending at to. False if to cannot
+    // be reached through the resident chunks. Routes are cached by the
+    // region of the start chunk and goal tile until the resident chunks
+    // change.
+    bool findPath(v2f from, v2f to, std::vector<v2f> &waypoints);
+
+    // Unit vector to move in from pos towards goal, or zero at the goal
+    // tile and where there is no way there
+    v2f flowDirection(v2f goal, v2f pos);
+
+    // Fills in the flow towards goal in every chunk in coords. Until the
+    // next call that is not const, flowDirection(field, pos) only reads
+    // and can be called from several threads at once.
+    const FlowField &prepareFlow(v2f goal, const std::vector<v2i> &coords);
+    // As above for a field from prepareFlow, also zero in chunks that
+    // were not prepared
+    v2f flowDirection(const FlowField &field, v2f pos) const;
+
+    // For when navigable changes without the chunk being regenerated
+    void invalidate(v2i coord);
+
+    PathStats getStats() const;
+
+private:
+    struct PortalSeed
+    {
+        u32 tile;
+        u32 cost;
+        u8 dir;
+    };
+
+    struct Route
+    {
+        u64 chunk_epoch;
+        u64 nav_version;
+        std::vector<v2i> portal_tiles;
+    };
+
+    ChunkMap &chunks;
+    const f32 chunk_size;
+    const f32 tile_width;
+
+    // Bumped by invalidate, drops routes and portal costs like a new epoch
+    u64 nav_version;
+    u64 use_counter;
+    u64 pruned_epoch;
+
+    std::map<std::pair<v2i, u32>, EdgeEntrances> edges;
+    std::map<v2i, ChunkNav> navs;
+    std::vector<std::unique_ptr<FlowField>> flow_fields;
+    // By start chunk, its region holding the start tile and goal tile
+    std::map<std::tuple<v2i, u32, v2i>, Route> routes;
+
+    PathStats stats;
+
+    v2i tileFromPos(v2f pos) const;
+    v2f posFromTile(v2i tile) const;
+
+    // Drops what belongs to chunks that are gone, once per epoch
+    void prune();
+
+    const EdgeEntrances &edgeEntrances(v2i coord, u32 axis);
+    const ChunkNav *chunkNav(v2i coord);
+    FlowField &flowField(v2i goal);
+    void computePortalCosts(FlowField &field);
+    const ChunkFlow *chunkFlow(FlowField &field, v2i coord);
+
+    // Multi-source Dijkstra inside one chunk. dir is the step towards
+    // the cheapest seed, seeds keep their own.
+    static void localDijkstra(
+            const Chunk &chunk,
+            const std::vector<PortalSeed> &seeds,
+            u32 *cost,
+            u8 *dir
+        );
+};
+
+#endif // _PATHFINDING_H
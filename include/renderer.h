@@ -3,29 +3,12 @@
 
 #include <string>
 #include <vector>
-
-#include <SDL_render.h>
-
-#include <QuartzCore/QuartzCore.hpp>
-
-#include <Metal/Metal.hpp>
-#include <Metal/MTLBuffer.hpp>
-#include <Metal/MTLRenderCommandEncoder.hpp>
-#include <Metal/MTLResource.hpp>
-#include <Metal/MTLTexture.hpp>
-#include <Metal/MTLEvent.hpp>
+#include <memory>
 
 #include "mesh.h"
 #include "camera.h"
 #include "sun.h"
 #include "texture.h"
-#include "window.h"
-
-#define EVENT_INIT               0
-#define EVENT_WAITING_FOR_RENDER 1
-#define EVENT_RENDER_FINISH      2
-
-#define DEFAULT_PIXEL_FORMAT MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB
 
 typedef size_t DZMesh;
 typedef size_t DZBuffer;
@@ -58,18 +41,28 @@ struct Binding
     ShaderStage shader_stage;
     T resource;
     u32 binding;
+    // Bytes into a buffer the shader sees as its start, 0 for textures
+    size_t offset;
 
-    static Binding Fragment(T resource, u32 binding)
+    static Binding Fragment(T resource, u32 binding, size_t offset = 0)
     {
-        return Binding { ShaderStage::FRAGMENT, resource, binding };
+        return Binding { ShaderStage::FRAGMENT, resource, binding, offset };
     }
 
-    static Binding Vertex(T resource, u32 binding)
+    static Binding Vertex(T resource, u32 binding, size_t offset = 0)
     {
-        return Binding { ShaderStage::VERTEX, resource, binding };
+        return Binding { ShaderStage::VERTEX, resource, binding, offset };
     }
 };
 
+// Where DZRenderer::allocateUniforms put the data, valid for the frame
+// being queued only
+struct UniformSlice
+{
+    DZBuffer buffer;
+    size_t offset;
+};
+
 struct DZRenderCommand
 {
     enum RenderCommandType
@@ -78,9 +71,30 @@ struct DZRenderCommand
         SET_CLEAR_COLOR,
         BIND_BUFFER,
         BIND_TEXTURE,
-        DRAW_MESH
+        DRAW_MESH,
+        DRAW_INDEXED,
+        DRAW_INSTANCED
     } type;
 
+    // Draws a mesh's vertices through an index buffer it does not own,
+    // so one index buffer can serve many meshes of the same layout
+    struct IndexedDraw
+    {
+        DZMesh mesh;
+        // u16 indices
+        DZBuffer index_buffer;
+        u32 index_count;
+    };
+
+    // Draws a mesh instance_count times, the shader finds each
+    // instance's data at base_instance + its instance id
+    struct InstancedDraw
+    {
+        DZMesh mesh;
+        u32 instance_count;
+        u32 base_instance;
+    };
+
     union 
     {
         glm::vec3 clear_color;
@@ -88,6 +102,8 @@ struct DZRenderCommand
         Binding<DZTexture> texture_binding;
         DZTexture texture;
         DZMesh mesh;
+        IndexedDraw indexed_draw;
+        InstancedDraw instanced_draw;
         DZPipeline pipeline;
     };
 
@@ -133,52 +149,119 @@ struct DZRenderCommand
         return ret;
     }
 
-};
-
-struct DZRenderer 
-{
-    SDL_Renderer *sdl_renderer;
-
-    CA::MetalLayer *swapchain;
-
-    MTL::Device *device;
-    MTL::CommandQueue *queue;
-
-    MTL::SharedEvent *render_event;
-
-    MTL::ClearColor clear_color;
-
-    std::vector<DZRenderCommand> command_queue;
+    static DZRenderCommand DrawIndexed(DZMesh mesh, DZBuffer index_buffer, u32 index_count)
+    {
+        DZRenderCommand ret;
+        ret.type = DRAW_INDEXED;
+        ret.indexed_draw = IndexedDraw { mesh, index_buffer, index_count };
+        return ret;
+    }
 
-    // SOA meshes
-    struct 
+    static DZRenderCommand DrawInstanced(DZMesh mesh, u32 instance_count, u32 base_instance)
     {
-        DZMesh num = 0;
-        std::vector<u32> num_elements;
-        std::vector<MTL::PrimitiveType> primitive_type;
-        std::vector<MTL::Buffer *> vertex;
-        std::vector<MTL::Buffer *> index;
-    } mesh_buffers;
+        DZRenderCommand ret;
+        ret.type = DRAW_INSTANCED;
+        ret.instanced_draw = InstancedDraw { mesh, instance_count, base_instance };
+        return ret;
+    }
 
-    std::vector<MTL::Function *> shaders;
-    std::vector<MTL::RenderPipelineState *> pipelines;
+};
 
-    std::vector<MTL::Buffer *> general_buffers;
+// What DZRenderer hands its work to. Handles are indices into whatever
+// the backend keeps, and a released handle may be handed out again.
+struct DZRenderBackend
+{
+    virtual ~DZRenderBackend() = default;
+
+    virtual void waitForRenderFinish() = 0;
+    // Frames count the calls to execute from 1. Blocks until the GPU is
+    // done with the given one and everything before it.
+    virtual void waitForFrame(u64 frame) = 0;
+    // The last frame the GPU is done with, 0 before the first
+    virtual u64 finishedFrame() = 0;
+    virtual void execute(const std::vector<DZRenderCommand> &commands) = 0;
+
+    virtual std::vector<DZShader> compileShaders(std::string shader_src, std::vector<std::string> main_fns) = 0;
+    virtual DZPipeline createPipeline(DZShader vertex_shader, DZShader fragment_shader) = 0;
+
+    virtual DZMesh createMesh(const MeshData &mesh_data) = 0;
+    virtual DZMesh createMesh(
+            const void *vertices,
+            size_t size,
+            u32 num_vertices,
+            PrimitiveType primitive_type
+        ) = 0;
+
+    virtual DZBuffer createBufferOfSize(size_t size, StorageMode mode) = 0;
+    virtual void setBufferOfSize(DZBuffer buffer, void *data, size_t size) = 0;
+    virtual void setBufferRange(DZBuffer buffer, size_t offset, const void *data, size_t size) = 0;
+
+    virtual void releaseMesh(DZMesh mesh) = 0;
+    virtual void releaseBuffer(DZBuffer buffer) = 0;
+
+    virtual DZTexture createTexture(TextureData &texture_data) = 0;
+    virtual DZTextureArray createTextureArray(std::vector<TextureData> texture_datas) = 0;
+};
 
-    std::vector<MTL::Texture *> textures;
-    std::vector<MTL::Texture *> texture_arrays;
+struct DZCommandCompiler;
+struct CommandCompileStats;
+struct UniformRing;
 
-    MTL::SamplerState *sampler_state;
+// Frames queued on the CPU while the GPU still draws earlier ones
+#define FRAMES_IN_FLIGHT (3)
 
-    DZRenderer(DZWindow &window);
+// Collects the frame's commands and passes everything else on to the
+// backend, DZMetalBackend for the game or DZNullBackend headless
+struct DZRenderer 
+{
+    std::unique_ptr<DZRenderBackend> backend;
 
+    std::vector<DZRenderCommand> command_queue;
+    // command_queue sorted and without redundant state, what the backend
+    // is handed when compile_commands is set
+    std::vector<DZRenderCommand> compiled_queue;
+    std::unique_ptr<DZCommandCompiler> compiler;
+
+    // Per frame data the shaders read, rewritten every frame
+    std::unique_ptr<UniformRing> uniforms;
+
+    // Checks every write against the frames still on the GPU and logs
+    // the ones that would change what the GPU reads. Slower.
+    bool validate_in_flight;
+    // Runs the queue through the compiler before executing it. Off by
+    // default, with models drawn instanced there is little left to drop
+    // and compiling costs more than it saves.
+    bool compile_commands;
+
+    explicit DZRenderer(
+            std::unique_ptr<DZRenderBackend> backend,
+            u32 frames_in_flight = FRAMES_IN_FLIGHT
+        );
     ~DZRenderer();
 
+    // Waits for every frame queued so far
     void waitForRenderFinish();
+    // Waits until the GPU is done with the frame that last used this
+    // frame's part of the uniform ring, and frees what was released
+    // since. Call before queueing anything for the frame.
+    void beginFrame();
 
     void enqueueCommand(DZRenderCommand command);
     void executeCommandQueue();
 
+    // The frame being queued, counting from 1
+    u64 getFrame() const;
+    u32 getFramesInFlight() const;
+    // Writes that validate_in_flight caught, since the start
+    u32 getInFlightViolations() const;
+
+    // Copies data into this frame's part of the ring, aligned for any
+    // buffer binding. Bind with the slice's buffer and offset.
+    UniformSlice allocateUniforms(const void *data, size_t size);
+
+    // Of the last executeCommandQueue
+    const CommandCompileStats &getCompileStats() const;
+
     std::vector<DZShader> compileShaders(std::string shader_src, std::vector<std::string> main_fns);
 
     DZPipeline createPipeline(
@@ -188,9 +271,25 @@ struct DZRenderer
 
     std::vector<DZMesh> createMeshes(const std::vector<MeshData> &mesh_datas);
     DZMesh createMesh(const MeshData &mesh_data);
+    // For vertex formats other than Vertex, no index buffer of its own
+    DZMesh createMesh(
+            const void *vertices,
+            size_t size,
+            u32 num_vertices,
+            PrimitiveType primitive_type
+        );
 
     DZBuffer createBufferOfSize(size_t size, StorageMode mode = StorageMode::SHARED);
+    // The GPU may still be reading the buffer for an earlier frame, data
+    // that changes every frame belongs in allocateUniforms instead
     void setBufferOfSize(DZBuffer buffer, void *data, size_t size);
+    // Writes size bytes at offset, the same goes as for setBufferOfSize
+    void setBufferRange(DZBuffer buffer, size_t offset, const void *data, size_t size);
+
+    // Released once the GPU is done with every frame queued so far, the
+    // handle may be handed out again after that
+    void releaseMesh(DZMesh mesh);
+    void releaseBuffer(DZBuffer buffer);
 
     DZTexture createTexture(TextureData &texture_data);
 
@@ -199,12 +298,28 @@ struct DZRenderer
         );
 
 private:
-    template <typename T>
-    MTL::Buffer* newBufferFromData(
-            std::vector<T> data, 
-            MTL::ResourceOptions options 
-                = MTL::ResourceStorageModeManaged
-        );
+    struct PendingRelease
+    {
+        // The last frame queued when it was released
+        u64 frame;
+        bool mesh;
+        size_t handle;
+    };
+
+    u32 frames_in_flight;
+    u64 frame;
+    // beginFrame has run for frame
+    bool frame_begun;
+    std::vector<PendingRelease> pending_releases;
+
+    // Last frame each buffer was bound in, for validate_in_flight
+    std::vector<u64> buffer_frames;
+    u32 in_flight_violations;
+
+    void releasePending(u64 finished);
+    void recordBufferUse(const std::vector<DZRenderCommand> &queue);
+    // Counts a write to a buffer the GPU may still read, if validating
+    void checkWrite(DZBuffer buffer);
 
     // Remove copy constructor
     DZRenderer(const DZRenderer&) = delete;
@@ -1,9 +1,18 @@
+#include <array>
+#include <vector>
+
 #include <entt.hpp>
 
 #include "camera.h"
 #include "renderer.h"
 #include "sun.h"
+#include "los.h"
+#include "pathfinding.h"
 #include "terrain.h"
+#include "instancing.h"
+#include "spatial_hash.h"
+#include "steering.h"
+#include "world_save.h"
 
 #ifndef _SCENE_H
 #define _SCENE_H
@@ -18,6 +27,17 @@ struct SceneUniforms
     float elapsed_time;
 };
 
+// Where RenderSystem::updateData put this frame's uniforms, the terrain
+// tiles are uploaded by GameSystem::terrainGeneration
+struct FrameUniforms
+{
+    UniformSlice scene;
+    UniformSlice light;
+    TerrainTileBindings terrain;
+    // One per Terrain::visible
+    std::vector<UniformSlice> chunks;
+};
+
 struct Scene
 {
     entt::registry registry;
@@ -25,18 +45,33 @@ struct Scene
     Sun sun;
     Terrain terrain;
     Camera camera;
+    FogOfWar fog;
+    Pathfinder pathfinder;
+    SpatialHash spatial;
+    // Scratch for TickSystem::unitMovement
+    Separation separation;
+    // Writes F5 saves in the background
+    WorldSaver saver;
     s32 debug_texture;
     s32 LOS_ON;
+    // Simulation::getAlpha for the ticks being drawn
+    f32 tick_alpha;
+    // Of the window, set before the game systems run
+    glm::vec2 screen_dim;
 
     DZPipeline terrain_pipeline;
     DZPipeline model_pipeline;
     DZPipeline gui_pipeline;
     DZPipeline fow_pipeline;
 
-    DZBuffer scene_uniform_buffer;
-    DZBuffer light_buffer;
+    // Filled by the render systems each frame
+    FrameUniforms uniforms;
+    InstanceBatcher model_instances;
 
-    Scene(DZRenderer &renderer, DZPipeline terrain_pipeline, DZPipeline model_pipeline, DZPipeline gui_pipeline, DZPipeline fow_pipeline);
+    // The terrain keeps its chunks under store_directory, none when it
+    // is empty
+    Scene(DZRenderer &renderer, DZPipeline terrain_pipeline, DZPipeline model_pipeline, DZPipeline gui_pipeline, DZPipeline fow_pipeline,
+            const std::string &store_directory = "");
 
     void render(DZRenderer &renderer, const glm::vec2 &screen_dim);
 };
@@ -0,0 +1,119 @@
+#include <vector>
+#include <string>
+#include <functional>
+
+#include "common.h"
+#include "thread_pool.h"
+
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+// The low bits of a SystemAccess mask are resources, shared state that
+// is not a component, defined next to the systems that use them. The
+// rest are handed out to component types the first time they are used.
+#define SYSTEM_RESOURCE_BITS (16)
+#define SYSTEM_ACCESS_BITS   (64)
+
+u32 nextComponentAccessBit();
+
+template <typename Component>
+u64 componentAccessBit()
+{
+    static const u64 bit = 1ull << nextComponentAccessBit();
+    return bit;
+}
+
+// What a system reads and writes. Two systems may run at the same time
+// unless one of them writes something the other touches.
+struct SystemAccess
+{
+    u64 read_mask;
+    u64 write_mask;
+    // Runs on the thread that calls SystemScheduler::run, for systems
+    // that talk to the renderer or the window
+    bool main_thread;
+
+    SystemAccess()
+        : read_mask  { 0 }
+        , write_mask { 0 }
+        , main_thread { false }
+    {}
+
+    SystemAccess &reads(u64 resources)  { read_mask  |= resources; return *this; }
+    SystemAccess &writes(u64 resources) { write_mask |= resources; return *this; }
+    SystemAccess &onMainThread()        { main_thread = true;      return *this; }
+
+    template <typename... Components>
+    SystemAccess &reads()  { read_mask  |= (componentAccessBit<Components>() | ... | 0); return *this; }
+
+    template <typename... Components>
+    SystemAccess &writes() { write_mask |= (componentAccessBit<Components>() | ... | 0); return *this; }
+
+    bool conflictsWith(const SystemAccess &other) const
+    {
+        return (write_mask & (other.read_mask | other.write_mask))
+            || (other.write_mask & read_mask);
+    }
+};
+
+struct SystemTiming
+{
+    std::string name;
+    // From the start of SystemScheduler::run
+    f64 start_ms;
+    f64 duration_ms;
+    bool main_thread;
+    // On the longest chain of dependent systems, by duration
+    bool critical;
+};
+
+// Runs a list of systems as a dependency graph. A system waits for every
+// system added before it whose access conflicts with its own, so the
+// result is the same as running them in order, and the rest run on the
+// pool at the same time. The graph is rebuilt every run.
+struct SystemGraph
+{
+    explicit SystemGraph(ThreadPool &pool);
+
+    // From the last run, in the order the systems were added
+    const std::vector<SystemTiming> &getTimings() const;
+    f64  getFrameMs() const;
+    void logTimings() const;
+
+protected:
+    void addNode(const char *name, SystemAccess access);
+    void run(const std::function<void(u32)> &invoke);
+
+private:
+    ThreadPool &pool;
+
+    std::vector<SystemAccess> accesses;
+    std::vector<SystemTiming> timings;
+    f64 frame_ms;
+};
+
+template <typename... Args>
+struct SystemScheduler : SystemGraph
+{
+    using System = std::function<void(Args...)>;
+
+    explicit SystemScheduler(ThreadPool &pool)
+        : SystemGraph(pool)
+    {}
+
+    void add(const char *name, System system, SystemAccess access)
+    {
+        systems.push_back(std::move(system));
+        addNode(name, access);
+    }
+
+    void run(Args... args)
+    {
+        SystemGraph::run([&](u32 index) { systems[index](args...); });
+    }
+
+private:
+    std::vector<System> systems;
+};
+
+#endif // _SCHEDULER_H
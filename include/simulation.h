@@ -0,0 +1,60 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "common.h"
+
+#ifndef _SIMULATION_H
+#define _SIMULATION_H
+
+#define DEFAULT_TICK_RATE (30)
+
+// Beyond this many ticks in one frame the simulation slows down rather
+// than falling further behind
+#define MAX_TICKS_PER_FRAME (8)
+
+// Fixed rate clock for the simulation and the thread its ticks run on.
+// Every frame adds its measured time and runs as many whole ticks as
+// fit, what is left over says how far between the last two ticks to
+// draw. The ticks run while the main thread submits the frame and waits
+// for the GPU, so the main thread must not touch the simulated state
+// between begin and finish.
+struct Simulation
+{
+    explicit Simulation(u32 tick_rate);
+    ~Simulation();
+
+    void setTickRate(u32 tick_rate);
+    u32  getTickRate() const;
+    f64  getTickSeconds() const;
+    u64  getTickCount() const;
+
+    // Adds a frame's time, returns how many ticks are due
+    u32  accumulate(f64 frame_seconds);
+    // How far the clock is past the last tick that is due, 0 to 1
+    f32  getAlpha() const;
+
+    // Runs ticks(n) on the simulation thread, finishes the previous
+    // ticks first
+    void begin(u32 n, std::function<void(u32)> ticks);
+    void finish();
+
+private:
+    u32 tick_rate;
+    f64 accumulator;
+    u64 tick_count;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::function<void()> job;
+    bool busy;
+    bool stopping;
+
+    void threadLoop();
+
+    Simulation(const Simulation&) = delete;
+};
+
+#endif // _SIMULATION_H
@@ -0,0 +1,152 @@
+#include <optional>
+#include <vector>
+#include <unordered_map>
+#include <entt.hpp>
+
+#include "common.h"
+#include "geometry.h"
+
+#ifndef _SPATIAL_HASH_H
+#define _SPATIAL_HASH_H
+
+// World units per side of a cell, a few units wide
+#define SPATIAL_CELL_SIZE (8.0f)
+// How far past a frustum's footprint entities are looked for, covering
+// model sizes and how far they moved since the last update
+#define ENTITY_CULL_MARGIN (4.0f)
+// Past this share of every entity under a frustum's footprint, testing
+// them all is cheaper than visiting them cell by cell. About where the
+// two cost the same in Bench::culling.
+#define ENTITY_CULL_SCAN_FRACTION (0.4f)
+
+// Where SpatialHash keeps an entity, index is into the cell's list
+struct SpatialEntry
+{
+    v2i cell;
+    u32 index;
+};
+
+struct SpatialHashStats
+{
+    u32 entities;
+    u32 cells;
+    // Entities that changed cell in the last update
+    u32 moved;
+};
+
+// Uniform grid over the xy of every Transform, hashed by cell so the
+// world needs no bounds. An entity is only moved between cells when its
+// cell changes, so update() is one comparison per entity that stayed.
+//
+// Registers an on_destroy hook on the registry, so must outlive it or
+// stay at the same address while connected.
+struct SpatialHash
+{
+    SpatialHash(entt::registry &registry, f32 cell_size);
+    ~SpatialHash();
+
+    // Once per tick, after everything that moves entities. Entities
+    // created since are only found after it.
+    void update();
+
+    // Calls fn with every entity in a cell the rect touches, which
+    // includes some outside the rect
+    template <typename F>
+    void forEachNear(AArect2f rect, F &&fn) const
+    {
+        forEachCellNear(rect, [&](const std::vector<entt::entity> &entities)
+        {
+            for (entt::entity entity : entities)
+                fn(entity);
+            return true;
+        });
+    }
+    // As above, unless those cells hold more than limit entities. Then
+    // fn is never called and it returns false, having looked at no more
+    // cells than it took to pass the limit.
+    template <typename F>
+    bool forEachNearUpTo(AArect2f rect, u32 limit, F &&fn) const
+    {
+        thread_local std::vector<const std::vector<entt::entity> *> near;
+        near.clear();
+
+        u32 count = 0;
+        forEachCellNear(rect, [&](const std::vector<entt::entity> &entities)
+        {
+            count += entities.size();
+            near.push_back(&entities);
+            return count <= limit;
+        });
+        if (count > limit)
+            return false;
+
+        for (const std::vector<entt::entity> *entities : near)
+            for (entt::entity entity : *entities)
+                fn(entity);
+        return true;
+    }
+
+    // Append to out, unordered. Positions are the current ones, but an
+    // entity that left its cell since the last update can be missed,
+    // and one that lost its Transform since is skipped.
+    void findInRect(AArect2f rect, std::vector<entt::entity> &out) const;
+    void findInRadius(v2f pos, f32 radius, std::vector<entt::entity> &out) const;
+    // Nearest first, rings of cells out from pos until none can be closer
+    std::vector<entt::entity> findNClosest(v2f pos, u32 n) const;
+
+    f32 getCellSize() const;
+    SpatialHashStats getStats() const;
+
+private:
+    entt::registry &registry;
+    const f32 cell_size;
+
+    std::unordered_map<u64, std::vector<entt::entity>> cells;
+    u32 entities;
+    u32 moved;
+
+    v2i cellOf(v2f pos) const;
+    // Empty once the Transform is gone, until the next update drops it
+    std::optional<v2f> posOf(entt::entity entity) const;
+    static u64 keyOf(v2i cell);
+    static v2i cellOfKey(u64 key);
+
+    // fn returns false to stop early
+    template <typename F>
+    void forEachCellNear(AArect2f rect, F &&fn) const
+    {
+        const v2i first = cellOf(rect.pos);
+        const v2i last = cellOf(rect.pos + rect.dim);
+        const u64 span = (u64) (last.x - first.x + 1) * (u64) (last.y - first.y + 1);
+
+        // A rect over more cells than there are is cheaper the other way
+        if (span > cells.size())
+        {
+            for (const auto &[key, entities] : cells)
+            {
+                const v2i cell = cellOfKey(key);
+                if (cell.x < first.x || cell.x > last.x || cell.y < first.y || cell.y > last.y)
+                    continue;
+                if (!fn(entities))
+                    return;
+            }
+            return;
+        }
+
+        for (s32 y = first.y; y <= last.y; y++)
+        {
+            for (s32 x = first.x; x <= last.x; x++)
+            {
+                auto found = cells.find(keyOf(v2i { x, y }));
+                if (found != cells.end() && !fn(found->second))
+                    return;
+            }
+        }
+    }
+
+    void insert(entt::entity entity, SpatialEntry &entry);
+    void remove(const SpatialEntry &entry);
+    void onEntryDestroyed(entt::registry &registry, entt::entity entity);
+};
+
+#endif // _SPATIAL_HASH_H
@@ -0,0 +1,69 @@
+#include <vector>
+
+#include "common.h"
+#include "thread_pool.h"
+
+#ifndef _STEERING_H
+#define _STEERING_H
+
+// Unit centres closer than this push each other apart, units are a
+// world unit across
+#define SEPARATION_RADIUS (1.0f)
+// Of a unit's step, how much a full push is worth next to where it is
+// heading
+#define SEPARATION_WEIGHT (1.5f)
+
+struct SeparationStats
+{
+    u32 units;
+    u32 cells;
+    f32 cell_size;
+};
+
+// Boids separation on a uniform grid rebuilt from scratch every tick.
+// Units are counting sorted by cell into x and y arrays, so the three
+// cells of a grid row around a unit are one contiguous run and the
+// neighbour test is a straight loop over it, four units at a time with
+// SSE2.
+//
+// Fill xs and ys with one entry per unit, then compute. push_x and
+// push_y get the same order back.
+struct Separation
+{
+    explicit Separation(f32 radius);
+
+    std::vector<f32> xs;
+    std::vector<f32> ys;
+
+    // Away from the neighbours, 1 - distance / radius for each and at
+    // most 1 long in total
+    std::vector<f32> push_x;
+    std::vector<f32> push_y;
+
+    // Spread over jobs when given
+    void compute(ThreadPool *jobs);
+
+    const SeparationStats &getStats() const;
+
+private:
+    const f32 radius;
+
+    // Sorted by cell, row major
+    std::vector<f32> sorted_x;
+    std::vector<f32> sorted_y;
+    std::vector<u32> sorted_unit;
+    // First sorted unit of each cell, plus one past the end
+    std::vector<u32> cell_start;
+    std::vector<u32> unit_cell;
+
+    f32 origin_x, origin_y;
+    f32 cell_size;
+    s32 grid_w, grid_h;
+
+    SeparationStats stats;
+
+    void sort();
+    void computeRange(u32 begin, u32 end);
+};
+
+#endif // _STEERING_H
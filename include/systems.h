@@ -9,6 +9,8 @@
 #include "renderer.h"
 #include "input.h"
 #include "gui.h"
+#include "scheduler.h"
+#include "tick_systems.h"
 //#define INPUTSYSTEM_ARGS Scene &scene, GUI &gui, SDL_Event e, const u8 *key_state, const u8 *prev_key_state, double delta_time
 //namespace InputSystem 
 //{
@@ -17,7 +19,9 @@
 //    void worldCamera(INPUTSYSTEM_ARGS);
 //}
 
-#define GAMESYSTEM_ARGS DZRenderer &renderer, Scene &scene, InputState &input, GUI &gui, double delta_time
+#define GAMESYSTEM_ARGS DZRenderer &renderer, Scene &scene, InputState &input, GUI &gui, ThreadPool &jobs, double delta_time
+
+using GameSystems = SystemScheduler<DZRenderer&, Scene&, InputState&, GUI&, ThreadPool&, double>;
 
 namespace GameSystem
 {
@@ -25,12 +29,15 @@ namespace GameSystem
     void scrollWheel(GAMESYSTEM_ARGS);
     void debugControl(GAMESYSTEM_ARGS);
     void cameraMovement(GAMESYSTEM_ARGS);
-    void unitMovement(GAMESYSTEM_ARGS);
-    void LOS(GAMESYSTEM_ARGS);
     void terrainGeneration(GAMESYSTEM_ARGS);
+
+    // Not scheduled, a load replaces the entities, camera and terrain
+    // every other system uses. Run after the game systems, between
+    // ticks, so a save sees a consistent world.
+    void saveAndLoad(GAMESYSTEM_ARGS);
 }
 
-#define RENDERSYSTEM_ARGS DZRenderer &renderer, const Scene &scene, InputState &input, const glm::vec2 &screen_dim, GUI &gui, float elapsed_time
+#define RENDERSYSTEM_ARGS DZRenderer &renderer, Scene &scene, InputState &input, const glm::vec2 &screen_dim, GUI &gui, float elapsed_time
 
 namespace RenderSystem
 {
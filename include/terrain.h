@@ -1,5 +1,8 @@
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <string>
 #include <PerlinNoise.hpp>
 
 #include "common.h"
@@ -8,6 +11,8 @@
 #include "renderer.h"
 #include "term_renderer.h"
 #include "asset.h"
+#include "chunk_map.h"
+#include "terrain_tiles.h"
 
 #pragma once
 
@@ -17,7 +22,20 @@
 #define TILES_PER_SIDE  (64)
 #define TILES_PER_CHUNK (TILES_PER_SIDE * TILES_PER_SIDE)
 
+// Tiles share their corners, so a chunk mesh is a grid of
+// (TILES_PER_SIDE + 1)^2 vertices drawn with two triangles per tile
+#define VERTS_PER_SIDE   (TILES_PER_SIDE + 1)
+#define VERTS_PER_CHUNK  (VERTS_PER_SIDE * VERTS_PER_SIDE)
+#define INDICES_PER_CHUNK (TILES_PER_CHUNK * 6)
+
+// LOD n draws every 2^n-th grid vertex, 64/32/16/8 quads per side
+#define TERRAIN_LOD_LEVELS (4)
+// The coarsest LOD whose quads stay below this size on screen is used
+#define LOD_MAX_QUAD_PIXELS (12.0f)
+
 #define VORONOI_BIOMES (500)
+// Distance at which a biome point's 8 / d^2 weight drops below 0.001
+#define BIOME_CUTOFF_RADIUS (89.4427191f)
 
 #define NUM_TEXTURES_PER_BIOME 7
 
@@ -31,6 +49,22 @@
 
 #define NUM_BIOMES (7)
 
+// Chunks requested around the camera, in chunks from the centre one.
+// 1 covers the 3x3 around the target, anything beyond is generated ahead
+// of time. Chunks in view are requested as well, however far out.
+#define DEFAULT_PREFETCH_RADIUS (2)
+
+// Chunks beyond the prefetch radius are evicted once the resident ones
+// use more than this, counting CPU and GPU copies
+#define DEFAULT_TERRAIN_MEMORY_BUDGET (32u << 20)
+
+// Chunks drawn at most, those farthest from the camera target are left
+// out when more are in view
+#define MAX_VISIBLE_CHUNKS (256)
+
+// Where the game keeps its ChunkStore, relative to the working directory
+#define DEFAULT_CHUNK_STORE_DIRECTORY "chunk_store"
+
 #define START_AREA (80)
 #define WORLDSIZE (2000)
 
@@ -40,52 +74,55 @@ struct BiomePoint
     u8 biome;
 };
 
-struct BNode
-{
-    BNode *parent;
-    BNode *left_child;
-    BNode *right_child;
-    BiomePoint p;
-
-    float x_bound_left, x_bound_right, y_bound_bottom, y_bound_top;
-
-    void add_recur_x(const BiomePoint &bp);
-    void add_recur_y(const BiomePoint &bp);
-    BNode(BiomePoint bp)
-        : p {bp}
-        , left_child{nullptr}
-        , right_child{nullptr}
-        , parent{nullptr}
-    { }
-};
-
+// 2D tree over the biome points stored in a single array. Every
+// range [lo, hi) is split at its median, which is the node itself,
+// alternating x and y with depth, so there is no per-node allocation
+// and no child pointers to chase.
 struct KDTree 
 {
-    // TODO: Could use an allocator for the std::array 
-    //       for faster memory lookup (contiguous memory)
-    BNode *root;
+    std::array<BiomePoint, VORONOI_BIOMES> nodes;
 
-    KDTree();
     void add(const std::array<BiomePoint, VORONOI_BIOMES> &bpoints);
-    std::vector<BiomePoint> find_n_closest(v2f pos, s32 n);
+
+    const BiomePoint &find_nearest(v2f pos) const;
+    // Nearest first
+    std::vector<BiomePoint> find_n_closest(v2f pos, s32 n) const;
+    // Appends to out, unordered
+    void find_in_radius(v2f pos, f32 radius, std::vector<BiomePoint> &out) const;
+
+private:
+    void build(u32 lo, u32 hi, u32 depth);
 };
 
-struct Tile
+// Compact vertex for the terrain grid, 16 bytes instead of the 88 of
+// Vertex. The normal is snorm8 with w unused, tangent and bitangent are
+// derived from it in the shader. Must match TerrainVertex in
+// terrain_shader.metal and LOS_shader.metal.
+struct TerrainVertex
 {
-    // North, East, South, West
-    Vertex vertices[4];
+    f32 pos[3];
+    s8 normal[4];
+
+    TerrainVertex() = default;
+    TerrainVertex(glm::vec3 pos, glm::vec3 normal);
 };
 
-struct ChunkData
+static_assert(sizeof(TerrainVertex) == 16, "TerrainVertex must stay 16 bytes");
+
+// A triangle list over the chunk vertex grid
+struct LODIndexBuffer
 {
-    glm::mat4 model_matrix;
-    s32 chunk_index;
+    DZBuffer buffer;
+    u32 count;
 };
 
-struct MegaChunkData
+// Must match ChunkUniforms in terrain_shader.metal and LOS_shader.metal
+struct ChunkData
 {
-    u8 material_indices[TILES_PER_SIDE * TILES_PER_SIDE * 9];
-    u8 los_indices[TILES_PER_SIDE * TILES_PER_SIDE * 9];
+    glm::mat4 model_matrix;
+    // TerrainTiles slots of the 3x3 around the chunk, row by row from
+    // -x -y, the chunk itself at 4
+    s32 neighbour_slots[9];
 };
 
 struct Chunk
@@ -95,49 +132,160 @@ struct Chunk
     u8 material_indices[TILES_PER_SIDE * TILES_PER_SIDE];
     u8 los_indices[TILES_PER_SIDE * TILES_PER_SIDE];
     u8 navigable[TILES_PER_SIDE * TILES_PER_SIDE];
+    // Line of sight observers per tile, maintained by FogOfWar
+    u16 observers[TILES_PER_SIDE * TILES_PER_SIDE];
+    // Rows of los_indices FogOfWar changed since TerrainTiles uploaded them
+    u64 los_dirty_rows;
+    // Where TerrainTiles keeps the tiles on the GPU, TERRAIN_NO_SLOT if not
+    u32 tile_slot;
     
-    MeshData mesh_data;
+    // vertices[y * VERTS_PER_SIDE + x] is the corner at (x, y) * tile width
+    std::vector<TerrainVertex> vertices;
+    // Just the heights of the same corners, for gameplay queries
+    std::vector<f32> heights;
+    f32 min_height;
+    f32 max_height;
 
     bool mesh_registered;
     DZMesh mesh;
-    DZBuffer local_uniforms_buffer;
 
-    Chunk(v2f chunk_start, u32 seed, f32 chunk_size, const std::array<BiomePoint, VORONOI_BIOMES> &bps);//KDTree *kd);
+    // Terrain::cache_frame when the chunk was last near the camera
+    u64 last_used;
+
+    // Depends only on its arguments, so a chunk can be made on any
+    // thread, in any order, and made again the same after eviction
+    Chunk(v2f chunk_start, u32 seed, f32 chunk_size, const KDTree &kd);
+    // The mesh of saved heights, every tile zeroed for the caller to
+    // fill in
+    Chunk(v2f chunk_start, f32 chunk_size, std::vector<f32> heights);
 
-    void updateUniforms(DZRenderer &renderer, s32 chunk_index);
+    // Registers the mesh the first time, the uniforms are only valid
+    // for the frame being queued
+    UniformSlice updateUniforms(DZRenderer &renderer, const std::array<s32, 9> &neighbour_slots);
+    // Gives the mesh back to the renderer
+    void releaseGPU(DZRenderer &renderer);
+    size_t memoryUsage() const;
 
+    void buildVertices(const std::vector<f32> &heights, f32 tile_width);
     v2f  getPosFromTileIndex(u32 tile_index, f32 tile_width);
+    // Height of the drawn surface at local, relative to the chunk origin
+    f32  heightAt(v2f local, f32 tile_width) const;
+};
+
+
+// What an evicted chunk keeps, everything else is regenerated from the
+// seed when it is requested again
+struct PersistedChunk
+{
+    u8 los_indices[TILES_PER_SIDE * TILES_PER_SIDE];
+    u8 navigable[TILES_PER_SIDE * TILES_PER_SIDE];
 };
 
+struct TerrainCacheStats
+{
+    u32 resident;
+    u32 persisted;
+    size_t bytes_used;
+    size_t memory_budget;
+    u64 evictions;
+};
+
+struct ChunkGenerator;
+struct ChunkStore;
+
+struct VisibleChunk
+{
+    v2i coord;
+    Chunk *chunk;
+    // Which of Terrain::lod_index_buffers it is drawn with
+    LODIndexBuffer lod;
+};
 
 struct Terrain
 {
     const f32 chunk_size;
     const u32 seed;
-    DZBuffer terrain_uniform_buffer;
     DZPipeline terrain_pipeline;
+    // Index buffers shared by all chunks, keyed by lodKey and built the
+    // first time a chunk needs that combination
+    std::unordered_map<u32, LODIndexBuffer> lod_index_buffers;
 
-    std::map<v2f, Chunk> chunks;
-    std::array<Chunk*, 9> visible;
+    ChunkMap chunks;
+    // In the camera frustum, nearest to the camera target first
+    std::vector<VisibleChunk> visible;
+    // Of the resident chunks, what the frustum test assumes for the rest
+    f32 min_height;
+    f32 max_height;
 
     std::array<BiomePoint, VORONOI_BIOMES> bps;
-    //KDTree kd;
-
-    Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed);
+    KDTree kd;
+
+    u32 prefetch_radius;
+    // Declared before the generator, whose workers use it
+    std::unique_ptr<ChunkStore> store;
+    std::unique_ptr<ChunkGenerator> generator;
+    std::unique_ptr<TerrainTiles> tiles;
+
+    size_t memory_budget;
+    u64 cache_frame;
+    u64 evictions;
+    // Of evicted chunks the store could not keep, or all of them
+    // without one. Counted against memory_budget.
+    std::map<v2i, PersistedChunk> persisted;
+
+    // Chunks are kept on disk under store_directory between evictions
+    // and runs, none are when it is empty
+    Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed, const std::string &store_directory = "");
+    // Saves the resident chunks to the store
+    ~Terrain();
+
+    static std::array<BiomePoint, VORONOI_BIOMES> generateBiomePoints(u32 seed);
+
+    // An edge shared with a coarser neighbour only uses the vertices the
+    // neighbour has on that edge, which closes the seam between them.
+    // Neighbour levels are clamped to at least level.
+    static u32 lodKey(u32 level, u32 north, u32 east, u32 south, u32 west);
+    static std::vector<u16> generateIndices(u32 lod_key);
 
     void seedNoise(u32 seed);
 
-    void createChunk(DZRenderer &renderer, glm::vec2 pos_in_chunk);
+    // Queues the chunk containing pos for background generation
+    void requestChunk(glm::vec2 pos_in_chunk);
+    // Moves finished chunks into chunks, returns how many arrived
+    u32  collectChunks();
+    // Requests the chunks within prefetch_radius of focus, nearest ring
+    // first, collects the finished ones and evicts over the budget
+    void stream(DZRenderer &renderer, v2f focus);
+    // Evicts the least recently used chunks, farthest from focus first,
+    // until the cache fits memory_budget. Chunks within prefetch_radius
+    // of focus are never evicted.
+    void evictChunks(DZRenderer &renderer, v2f focus);
+    // Drops every chunk, including persisted state and the ones being
+    // generated. Resident chunks are saved to the store first, the
+    // chunks come back from there as they were.
+    void clear(DZRenderer &renderer);
+    TerrainCacheStats getCacheStats() const;
     void termRender(DZTermRenderer &term, glm::vec2 pos);
-    void updateLOS(glm::vec2 pos, int LOS);
 
     // TODO(ronja): bad form to name a method getX() if it does not return anything
-    void    getVisible(Camera &camera);
+    // Collects the resident chunks in the frustum and requests the
+    // missing ones
+    void    getVisible(const Camera &camera, glm::vec2 screen_dim);
+    u32     selectLOD(const Camera &camera, v2f chunk_origin) const;
+    // Picks the LOD of every visible chunk, after getVisible
+    void    updateLOD(DZRenderer &renderer, const Camera &camera);
     v2f     getChunkOriginFromPos(v2f pos);
+    v2i     getChunkCoordFromPos(v2f pos) const;
     Chunk*  getChunkFromPos(v2f pos);
     int     getTileIndexFromPos(v2f pos);
-
-    void updateUniforms(DZRenderer &renderer, std::array<Chunk*, 9> visible) const;
+    // Height of the full detail surface, 0 outside the resident chunks
+    f32     heightAt(v2f pos) const;
+
+    // Brings the GPU copies of the visible chunks' tiles up to date,
+    // after getVisible
+    TerrainTileBindings uploadTiles(DZRenderer &renderer);
+    // For Chunk::updateUniforms, after uploadTiles
+    std::array<s32, 9> neighbourSlots(v2i coord) const;
 
 };
 
@@ -0,0 +1,91 @@
+#include <array>
+#include <vector>
+
+#include "common.h"
+#include "renderer.h"
+
+#ifndef _TERRAIN_TILES_H
+#define _TERRAIN_TILES_H
+
+// Slots in each copy of the tile buffers to begin with, doubled when
+// more chunks are visible. Slot 0 stays zeroed and stands in for chunks
+// that are not drawn, the spare ones keep chunks that just left the
+// view, so looking back does not upload them again.
+#define TERRAIN_TILE_SLOTS (32)
+#define TERRAIN_NO_SLOT    (0)
+
+struct Chunk;
+
+// What the terrain and fog of war passes bind for the frame
+struct TerrainTileBindings
+{
+    DZBuffer materials;
+    DZBuffer los;
+};
+
+// Of the last upload
+struct TerrainUploadStats
+{
+    u32 material_bytes;
+    u32 los_bytes;
+    // Chunks that got a slot, their materials are uploaded once per copy
+    u32 assigned;
+    // What copying both for every visible chunk each frame would be
+    u32 full_copy_bytes;
+};
+
+// Material and LOS tiles of the chunks near the camera, kept on the GPU
+// between frames. Each chunk gets a slot and the chunk uniforms say
+// which slots it and its neighbours are in, so the view moving only
+// changes those. Materials are uploaded when a chunk gets its slot and
+// LOS rows when FogOfWar changed them.
+//
+// Every frame in flight has its own copy of the buffers, the copy of the
+// frame being queued is the only one written. Changes are kept for every
+// copy until that copy comes round again.
+struct TerrainTiles
+{
+    TerrainTiles(DZRenderer &renderer);
+
+    // Gives each visible chunk a slot and brings this frame's copy up
+    // to date with them
+    TerrainTileBindings upload(DZRenderer &renderer, const std::vector<Chunk*> &visible);
+    // TERRAIN_NO_SLOT unless the chunk was visible in the last upload
+    s32 slotOf(const Chunk *chunk) const;
+
+    // Before the chunk is destroyed
+    void release(Chunk &chunk);
+    void releaseAll();
+
+    u32 getSlotCount() const;
+    const TerrainUploadStats &getStats() const;
+
+private:
+    struct Slot
+    {
+        Chunk *chunk;
+        // upload count when it was last visible
+        u64 last_used;
+    };
+
+    struct Copy
+    {
+        DZBuffer materials;
+        DZBuffer los;
+        // What changed in each slot since this copy was last written
+        std::vector<bool> stale_materials;
+        std::vector<u64> stale_rows;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<Copy> copies;
+    u64 uploads;
+    TerrainUploadStats stats;
+
+    // Replaces every copy's buffers with ones of slot_count slots
+    void allocate(DZRenderer &renderer, u32 slot_count);
+    u32 assign(Chunk &chunk);
+    void uploadRows(DZRenderer &renderer, DZBuffer buffer, u32 slot, const u8 *los, u64 rows);
+};
+
+#endif // _TERRAIN_TILES_H
@@ -0,0 +1,44 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "common.h"
+
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+struct ThreadPool
+{
+    explicit ThreadPool(u32 num_threads);
+    ~ThreadPool();
+
+    void enqueue(std::function<void()> job);
+    u32  size() const;
+
+    // Calls fn(begin, end) over [0, count) in pieces of at least
+    // min_piece, on the workers and the calling thread, and returns once
+    // every piece is done. The caller works through the pieces itself
+    // and only waits on ones a worker has already started, so this can
+    // be called from a job running on the same pool.
+    void parallelFor(u32 count, u32 min_piece, const std::function<void(u32, u32)> &fn);
+
+    // Leaves one core for the game thread
+    static u32 defaultThreadCount();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+
+    std::mutex mutex;
+    std::condition_variable job_available;
+    bool stopping;
+
+    void workerLoop();
+
+    ThreadPool(const ThreadPool&) = delete;
+};
+
+#endif // _THREAD_POOL_H
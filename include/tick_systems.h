@@ -0,0 +1,44 @@
+#include "common.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+
+#ifndef _TICK_SYSTEMS_H
+#define _TICK_SYSTEMS_H
+
+// Parts of the scene the systems declare access to besides components.
+// Every game system reads the input.
+#define RESOURCE_RENDERER   (1ull << 0)
+#define RESOURCE_CAMERA     (1ull << 1)
+// The resident chunks and everything generated with them
+#define RESOURCE_CHUNKS     (1ull << 2)
+// Chunk::observers and los_indices, and the FogOfWar itself
+#define RESOURCE_FOG        (1ull << 3)
+#define RESOURCE_PATHFINDER (1ull << 4)
+#define RESOURCE_GUI        (1ull << 5)
+// Flags and settings kept directly in Scene
+#define RESOURCE_SETTINGS   (1ull << 6)
+// The SpatialHash over entity positions
+#define RESOURCE_SPATIAL    (1ull << 7)
+
+// Run at the fixed tick rate on the simulation thread, see Simulation.
+// They only get the scene, the main thread may be using the rest.
+#define TICKSYSTEM_ARGS Scene &scene, ThreadPool &jobs, double delta_time
+
+using TickSystems = SystemScheduler<Scene&, ThreadPool&, double>;
+
+namespace TickSystem
+{
+    // Must run before anything that moves units
+    void previousTransforms(TICKSYSTEM_ARGS);
+    void unitMovement(TICKSYSTEM_ARGS);
+    // After anything that moves units
+    void spatialIndex(TICKSYSTEM_ARGS);
+    void LOS(TICKSYSTEM_ARGS);
+}
+
+// The tick systems the game runs, in order. Shared with the headless
+// build, which has no window or input.
+void addTickSystems(TickSystems &systems);
+
+#endif // _TICK_SYSTEMS_H
@@ -24,4 +24,20 @@ struct Transform
     }
 };
 
+// Where a Transform was at the previous simulation tick, so it can be
+// drawn between ticks
+struct PreviousTransform
+{
+    Transform transform;
+};
+
+inline Transform interpolate(const Transform &from, const Transform &to, float alpha)
+{
+    Transform result;
+    result.pos      = glm::mix(from.pos, to.pos, alpha);
+    result.scale    = glm::mix(from.scale, to.scale, alpha);
+    result.rotation = glm::mix(from.rotation, to.rotation, alpha);
+    return result;
+}
+
 #endif
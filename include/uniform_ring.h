@@ -0,0 +1,50 @@
+#include <vector>
+
+#include "common.h"
+#include "renderer.h"
+
+#ifndef _UNIFORM_RING_H
+#define _UNIFORM_RING_H
+
+// Metal wants constant buffer offsets on 256 bytes
+#define UNIFORM_ALIGNMENT       (256)
+#define UNIFORM_RING_FRAME_SIZE (1 << 20)
+
+// Linear allocator for data that changes every frame. Each frame in
+// flight gets a region, a buffer of its own, that is filled from the
+// start and reused frames_in_flight frames later. A region that runs
+// out is replaced by one twice the size, the old buffer is released
+// when the region comes round again.
+struct UniformRing
+{
+    // Check that a region is not reused while its frame is on the GPU
+    bool validate;
+
+    UniformRing(DZRenderBackend &backend, u32 frames_in_flight, size_t frame_size);
+
+    // Starts filling the region of frame, finished is the last frame the
+    // GPU is done with. Returns 1 if the region was still in flight.
+    u32 beginFrame(u64 frame, u64 finished);
+    UniformSlice allocate(const void *data, size_t size);
+
+    // Most bytes a single frame has used
+    size_t getPeakBytes() const;
+
+private:
+    struct Region
+    {
+        DZBuffer buffer;
+        size_t size;
+        size_t used;
+        // The frame that last filled it
+        u64 frame;
+        std::vector<DZBuffer> retired;
+    };
+
+    DZRenderBackend &backend;
+    std::vector<Region> regions;
+    u32 current;
+    size_t peak_bytes;
+};
+
+#endif // _UNIFORM_RING_H
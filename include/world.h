@@ -6,6 +6,7 @@ struct World
 {
     Scene scene;
 
-    std::vector<std::function<void(GAMESYSTEM_ARGS)>> game_systems;
+    GameSystems game_systems;
+    TickSystems tick_systems;
     std::vector<std::function<void(RENDERSYSTEM_ARGS)>> render_systems;
 };
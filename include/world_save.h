@@ -0,0 +1,93 @@
+#include <string>
+#include <thread>
+#include <vector>
+#include <entt.hpp>
+
+#include "common.h"
+#include "camera.h"
+#include "terrain.h"
+
+#ifndef _WORLD_SAVE_H
+#define _WORLD_SAVE_H
+
+// Bumped whenever the saved components or the layout change, older
+// saves are refused
+#define WORLD_SAVE_VERSION (1)
+#define WORLD_SAVE_MAGIC   (0x56535a44) // "DZSV"
+
+// Where F5 saves and F9 loads, relative to the working directory
+#define DEFAULT_WORLD_SAVE_PATH "world.dzsave"
+
+struct WorldSaveHeader
+{
+    u32 magic;
+    u32 version;
+    // Of the terrain, the chunks themselves are regenerated from it
+    u32 seed;
+    f32 chunk_size;
+    // Of everything after the header
+    u32 checksum;
+    u32 entities;
+    u64 payload_bytes;
+};
+
+struct WorldSaveStats
+{
+    u32 entities;
+    // Distinct models the entities refer to
+    u32 models;
+    // Chunks with saved LOS and navigable tiles
+    u32 chunks;
+    u64 bytes;
+    // On the calling thread, the world is only read during it
+    f64 snapshot_ms;
+    // On the writer thread
+    f64 write_ms;
+};
+
+// Saves of the entities, the camera and what the player changed about
+// the terrain. Entities keep their ids and versions, with Transform,
+// MoveSpeed, LineOfSight, Health, Team and Model. Components derived
+// from those, like SpatialEntry and LOSStamp, are rebuilt by their
+// systems after a load.
+//
+// A Model is saved as an index into a table of the distinct ones, the
+// mesh handles in it are only valid while the program creates its
+// meshes in the same order. Terrain is saved as the LOS and navigable
+// tiles of every resident, persisted and stored chunk, the rest is
+// regenerated from the seed. A load writes the saved tiles back into
+// the ChunkStore and drops the chunks stored since.
+//
+// The snapshot is taken on the calling thread between ticks, so it is
+// consistent, and written to disk on a background thread.
+struct WorldSaver
+{
+    WorldSaver();
+    // Finishes a save still being written
+    ~WorldSaver();
+
+    // Waits for the previous save first, the file is replaced once the
+    // new one is completely written
+    void save(const entt::registry &registry, const Terrain &terrain, const Camera &camera, const std::string &path);
+    // Replaces the entities, camera and terrain state with the save at
+    // path. False with the world untouched if it cannot be read or is
+    // not a save of this terrain.
+    bool load(const std::string &path, entt::registry &registry, Terrain &terrain, Camera &camera, DZRenderer &renderer);
+    // False if the last save could not be written
+    bool wait();
+
+    // Of the last save, once it is written
+    WorldSaveStats getStats();
+
+    static std::vector<u8> snapshot(const entt::registry &registry, const Terrain &terrain, const Camera &camera, WorldSaveStats *stats = nullptr);
+    static bool restore(const std::vector<u8> &data, entt::registry &registry, Terrain &terrain, Camera &camera, DZRenderer &renderer);
+
+private:
+    std::thread writer;
+    bool written;
+    WorldSaveStats stats;
+
+    static bool write(const std::string &path, const std::vector<u8> &data);
+};
+
+#endif // _WORLD_SAVE_H
@@ -9,20 +9,21 @@
 
 using namespace metal;
 
-struct Vertex
+// Matches TerrainVertex in terrain.h
+struct TerrainVertex
 {
-    float3 position;
-    float3 normal;
-    float3 tangent;
-    float3 bitangent;
-    float3 color;
-    float2 uv;
+    packed_float3 position;
+    packed_char4 normal;
 };
 
+// The chunk is in the middle of the 3x3 of neighbour_slots
+#define CENTER_CHUNK 4
+
+// Matches ChunkData in terrain.h
 struct ChunkUniforms
 {
     float4x4 model_matrix;
-    int32_t chunk_index;
+    int32_t neighbour_slots[9];
 };
 
 struct CameraData
@@ -41,12 +42,6 @@ struct GlobalUniforms
     float u_time;
 };
 
-struct TerrainUniforms 
-{
-    uint8_t texture_indices[3 * 3 * 64 * 64];    
-    uint8_t los_indices[3 * 3 * 64 * 64]; 
-};
-
 struct v2f
 {
     float4 position [[position]];
@@ -57,13 +52,13 @@ struct v2f
 v2f vertex vertexMain( 
         uint vertex_id [[ vertex_id ]],
         constant GlobalUniforms &global_uniforms [[ buffer(0) ]],
-        device const Vertex *vertices [[ buffer(1) ]],
+        device const TerrainVertex *vertices [[ buffer(1) ]],
         constant ChunkUniforms  &local_uniforms  [[ buffer(2) ]]
     )
 {
     v2f o;
-    o.local_position = float4(vertices[vertex_id].position, 1.0);
-    o.world_position = local_uniforms.model_matrix * float4(vertices[vertex_id].position, 1.0);
+    o.local_position = float4(float3(vertices[vertex_id].position), 1.0);
+    o.world_position = local_uniforms.model_matrix * float4(float3(vertices[vertex_id].position), 1.0);
     o.position = global_uniforms.camera.projection_matrix * global_uniforms.camera.view_matrix * o.world_position;
     return o;
 };
@@ -105,7 +100,7 @@ uint8_t get_chunk_index(float2 pos, int32_t chunk_index)
     return ret;
 }
 
-uint16_t tile_index_from_pos(float2 pos, int32_t chunk_index)
+uint tile_index_from_pos(float2 pos, int32_t slot)
 {
     if (pos.x < 0)
     {
@@ -126,14 +121,14 @@ uint16_t tile_index_from_pos(float2 pos, int32_t chunk_index)
     float tile_width = CHUNK_SIZE / TILES_PER_SIDE;
     int x = floor(pos.x / tile_width);
     int y = floor(pos.y / tile_width);
-    return TILES_PER_CHUNK * chunk_index + (y * TILES_PER_SIDE + x);
+    return TILES_PER_CHUNK * slot + (y * TILES_PER_SIDE + x);
 }
 
-int32_t get_los_index(float2 pos, uint8_t const constant *los_index, bool LOS_ON, int32_t chunk_index)
+int32_t get_los_index(float2 pos, device const uint8_t *los_index, bool LOS_ON, int32_t slot)
 {
     if(LOS_ON)
     {
-         return los_index[tile_index_from_pos(pos, chunk_index)];
+         return los_index[tile_index_from_pos(pos, slot)];
     }
     else
     {
@@ -184,15 +179,14 @@ float fbm(float2 pos)
 half4 fragment fragmentMain( 
         v2f in [[stage_in]],
         constant GlobalUniforms &global_uniforms [[ buffer(0) ]],
-        constant TerrainUniforms &terrain_uniforms [[ buffer(1) ]],
+        device const uint8_t *los_indices [[ buffer(1) ]],
         constant ChunkUniforms  &local_uniforms  [[ buffer(2) ]]
     )
 {
     float2 pos = in.local_position.xy;
-    uint8_t chunk_index = local_uniforms.chunk_index;
-    chunk_index = get_chunk_index(pos, chunk_index);
+    uint8_t chunk_index = get_chunk_index(pos, CENTER_CHUNK);
 
-    uint8_t los = get_los_index(pos, &terrain_uniforms.los_indices[0], global_uniforms.LOS_ON, chunk_index); 
+    uint8_t los = get_los_index(pos, los_indices, global_uniforms.LOS_ON, local_uniforms.neighbour_slots[chunk_index]); 
 
     if(los == 0) 
     {
@@ -50,6 +50,16 @@ struct ModelUniforms
     bool lit;
 };
 
+// ModelInstance in instancing.h
+struct InstanceUniforms
+{
+    float4x4 model_matrix;
+    uint textured;
+    uint lit;
+    uint material_index;
+    uint padding;
+};
+
 v2f vertex vertexMain( 
         uint vertex_id [[ vertex_id ]],
         constant GlobalUniforms &global_uniforms [[ buffer(0) ]],
@@ -72,6 +82,31 @@ v2f vertex vertexMain(
     return o;
 };
 
+v2f vertex vertexInstanced( 
+        uint vertex_id [[ vertex_id ]],
+        uint instance_id [[ instance_id ]],
+        constant GlobalUniforms &global_uniforms [[ buffer(0) ]],
+        device const Vertex *vertices [[ buffer(1) ]],
+        device const InstanceUniforms *instances [[ buffer(2) ]]
+    )
+{
+    const float4x4 model_matrix = instances[instance_id].model_matrix;
+
+    v2f o;
+    o.local_position = vertices[vertex_id].position;
+    o.world_position = model_matrix * vertices[vertex_id].position;
+
+    o.position = global_uniforms.camera.projection_matrix * global_uniforms.camera.view_matrix * o.world_position;
+
+    o.color = half3 ( vertices[vertex_id].color.xyz );
+
+    o.T = vertices[vertex_id].tangent.xyz;
+    o.B = vertices[vertex_id].bitangent.xyz;
+    o.N = normalize(model_matrix * vertices[vertex_id].normal).xyz;
+
+    return o;
+};
+
     half3 blend(float2 pos, texture2d_array<half> tex, sampler tex_sampler, int index)
     {
         half3 color(0.0);
@@ -19,14 +19,11 @@ struct v2f
     half3 color;
 };
 
-struct Vertex
+// Matches TerrainVertex in terrain.h
+struct TerrainVertex
 {
-    float3 position;
-    float3 normal;
-    float3 tangent;
-    float3 bitangent;
-    float3 color;
-    float2 uv;
+    packed_float3 position;
+    packed_char4 normal;
 };
 
 struct CameraData
@@ -51,16 +48,15 @@ struct PointLight
     float falloff;
 };
 
-struct TerrainUniforms 
-{
-    uint8_t texture_indices[3 * 3 * 64 * 64];    
-    uint8_t los_indices[3 * 3 * 64 * 64]; 
-};
+// The chunk is in the middle of the 3x3 of neighbour_slots
+#define CENTER_CHUNK 4
 
+// Matches ChunkData in terrain.h. The material and LOS buffers hold
+// 64 * 64 tiles per slot.
 struct ChunkUniforms
 {
     float4x4 model_matrix;
-    int32_t chunk_index;
+    int32_t neighbour_slots[9];
 };
 
 struct [[nodiscard]] neighbor
@@ -88,21 +84,26 @@ struct [[nodiscard]] neighbor
 v2f vertex vertexMain( 
         uint vertex_id [[ vertex_id ]],
         constant GlobalUniforms &global_uniforms [[ buffer(0) ]],
-        device const Vertex *vertices [[ buffer(1) ]],
+        device const TerrainVertex *vertices [[ buffer(1) ]],
         constant ChunkUniforms  &local_uniforms  [[ buffer(2) ]]
     )
 {
     v2f o;
-    o.local_position = float4(vertices[vertex_id].position, 1.0);
-    o.world_position = local_uniforms.model_matrix * float4(vertices[vertex_id].position, 1.0);
+    o.local_position = float4(float3(vertices[vertex_id].position), 1.0);
+    o.world_position = local_uniforms.model_matrix * float4(float3(vertices[vertex_id].position), 1.0);
     o.position = global_uniforms.camera.projection_matrix * global_uniforms.camera.view_matrix * o.world_position;
-    o.color = half3 ( vertices[vertex_id].color );
+    o.color = half3 ( 1.0 );
+
+    // Same construction as Vertex::calculateTangentAndBitangent
+    float3 N = normalize(float3(vertices[vertex_id].normal.xyz) / 127.0);
+    float3 c1 = cross(N, float3(0.0, 0.0, 1.0));
+    float3 c2 = cross(N, float3(0.0, 1.0, 0.0));
+    float3 T = normalize(length(c1) > length(c2) ? c1 : c2);
 
-    o.T = vertices[vertex_id].tangent.xyz;
-    o.B = vertices[vertex_id].bitangent.xyz;
-    o.N = vertices[vertex_id].normal.xyz;
+    o.T = T;
+    o.B = cross(T, N);
+    o.N = N;
 
-    //o.textures = TerrainUniforms.texture_index;
     return o;
 };
 
@@ -119,7 +120,7 @@ float2 xy_glsl_mod(float2 in, float mod)
     return ret;
 }
 
-uint16_t tile_index_from_pos(float2 pos, int chunk_index)
+uint tile_index_from_pos(float2 pos, int slot)
 {
     if (pos.x < 0)
     {
@@ -140,7 +141,7 @@ uint16_t tile_index_from_pos(float2 pos, int chunk_index)
     float tile_width = CHUNK_SIZE / TILES_PER_SIDE;
     int x = floor(pos.x / tile_width);
     int y = floor(pos.y / tile_width);
-    return TILES_PER_CHUNK * chunk_index + (y * TILES_PER_SIDE + x);
+    return TILES_PER_CHUNK * slot + (y * TILES_PER_SIDE + x);
 }
 
 int32_t get_chunk_index(float2 pos, int32_t chunk_index)
@@ -209,14 +210,15 @@ void get_neighbors(float2 frag_pos, int32_t chunk_index, thread neighbor *nbors)
     }
 };
 
-void set_materials(thread neighbor *nbors, uint8_t const constant *texture_index, uint8_t const constant *los_index, int n_nbor, bool LOS_ON)
+void set_materials(thread neighbor *nbors, device const uint8_t *texture_index, device const uint8_t *los_index, constant int32_t *slots, int n_nbor, bool LOS_ON)
 {
     for(int i = 0; i < n_nbor; i++)
     {
-        nbors[i].material = texture_index[tile_index_from_pos(nbors[i].pos, nbors[i].chunk_index)];
+        uint tile_index = tile_index_from_pos(nbors[i].pos, slots[nbors[i].chunk_index]);
+        nbors[i].material = texture_index[tile_index];
         if(LOS_ON)
         {
-             nbors[i].los = los_index[tile_index_from_pos(nbors[i].pos, nbors[i].chunk_index)];
+             nbors[i].los = los_index[tile_index];
         }
         else
         {
@@ -299,16 +301,17 @@ half4 fragment fragmentMain(
         v2f in [[stage_in]],
         constant GlobalUniforms &global_uniforms [[ buffer(0) ]],
         constant ChunkUniforms &local_uniforms [[ buffer(1) ]],
-        constant TerrainUniforms &terrain_uniforms [[ buffer(2) ]],
+        device const uint8_t *materials [[ buffer(2) ]],
         constant PointLight *lights [[ buffer(3) ]],
+        device const uint8_t *los [[ buffer(4) ]],
         texture2d_array<half> terrain_textures [[ texture(0) ]],
         sampler texture_sampler [[ sampler(0) ]]
     )
 {    
     neighbor nbors[4];
-    get_neighbors(in.local_position.xy, local_uniforms.chunk_index, nbors);
+    get_neighbors(in.local_position.xy, CENTER_CHUNK, nbors);
     set_proportions(nbors, 4, in.local_position.xy);
-    set_materials(nbors, &terrain_uniforms.texture_indices[0], &terrain_uniforms.los_indices[0], 4, global_uniforms.LOS_ON);
+    set_materials(nbors, materials, los, &local_uniforms.neighbour_slots[0], 4, global_uniforms.LOS_ON);
     
     half3 texture = blend(in.local_position.xy, nbors, 4, terrain_textures, texture_sampler);
     
@@ -0,0 +1,2691 @@
+#include <chrono>
+#include <map>
+#include <queue>
+#include <random>
+#include <algorithm>
+#include <set>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "terrain.h"
+#include "noise.h"
+#include "chunk_map.h"
+#include "los.h"
+#include "entity.h"
+#include "transform.h"
+#include "pathfinding.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include "simulation.h"
+#include "renderer.h"
+#include "null_renderer.h"
+#include "command_compiler.h"
+#include "instancing.h"
+#include "terrain_tiles.h"
+#include "spatial_hash.h"
+#include "frustum.h"
+#include "camera.h"
+#include "gui.h"
+#include "steering.h"
+#include "chunk_store.h"
+#include "world_save.h"
+#include "model.h"
+#include "logger.h"
+
+namespace
+{
+    // Keeps the optimiser from discarding benchmark results
+    volatile f64 sink;
+
+    template <typename F>
+    f64 timeMs(F &&fn)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const auto end = std::chrono::steady_clock::now();
+        const std::chrono::duration<double, std::milli> elapsed = end - start;
+        return elapsed.count();
+    }
+
+    bool walkableTile(const ChunkMap &chunks, v2i tile)
+    {
+        const v2i coord {
+            (s32) std::floor((f32) tile.x / TILES_PER_SIDE),
+            (s32) std::floor((f32) tile.y / TILES_PER_SIDE)
+        };
+        const Chunk *chunk = chunks.find(coord);
+        return chunk && chunk->navigable[
+            (tile.y - coord.y * TILES_PER_SIDE) * TILES_PER_SIDE
+            + tile.x - coord.x * TILES_PER_SIDE] == 0;
+    }
+
+    // Walkable tiles of a square of chunks, flattened once
+    struct TileGrid
+    {
+        v2i min_tile;
+        s32 side;
+        std::vector<u8> open;
+    };
+
+    // Plain tile A* over the grid, the per-unit search a flow field
+    // replaces. Returns the cost or PATH_UNREACHABLE.
+    u32 tileAStar(const TileGrid &grid, v2i start, v2i goal)
+    {
+        static const s32 step_x[8] = { 1, 1, 0, -1, -1, -1,  0,  1 };
+        static const s32 step_y[8] = { 0, 1, 1,  1,  0, -1, -1, -1 };
+
+        const v2i min_tile = grid.min_tile;
+        const s32 side = grid.side;
+
+        auto heuristic = [&](s32 x, s32 y)
+        {
+            const u32 dx = std::abs(x - goal.x);
+            const u32 dy = std::abs(y - goal.y);
+            return PATH_STRAIGHT_COST * std::max(dx, dy)
+                 + (PATH_DIAGONAL_COST - PATH_STRAIGHT_COST) * std::min(dx, dy);
+        };
+
+        auto walkable = [&](s32 x, s32 y)
+        {
+            x -= min_tile.x;
+            y -= min_tile.y;
+            return x >= 0 && y >= 0 && x < side && y < side && grid.open[y * side + x];
+        };
+
+        using Entry = std::pair<u32, u32>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+        std::vector<u32> cost(side * side, PATH_UNREACHABLE);
+
+        auto index = [&](s32 x, s32 y) { return (u32) ((y - min_tile.y) * side + x - min_tile.x); };
+
+        cost[index(start.x, start.y)] = 0;
+        open.push({ heuristic(start.x, start.y), index(start.x, start.y) });
+
+        while (!open.empty())
+        {
+            const auto [f, i] = open.top();
+            open.pop();
+
+            const s32 x = min_tile.x + (s32) (i % side);
+            const s32 y = min_tile.y + (s32) (i / side);
+            const u32 c = cost[i];
+            if (f > c + heuristic(x, y))
+                continue;
+            if (x == goal.x && y == goal.y)
+                return c;
+
+            for (u32 d = 0; d < 8; d++)
+            {
+                const s32 nx = x + step_x[d];
+                const s32 ny = y + step_y[d];
+                if (!walkable(nx, ny))
+                    continue;
+                if ((d & 1) && (!walkable(nx, y) || !walkable(x, ny)))
+                    continue;
+
+                const u32 nc = c + ((d & 1) ? PATH_DIAGONAL_COST : PATH_STRAIGHT_COST);
+                if (nc < cost[index(nx, ny)])
+                {
+                    cost[index(nx, ny)] = nc;
+                    open.push({ nc + heuristic(nx, ny), index(nx, ny) });
+                }
+            }
+        }
+
+        return PATH_UNREACHABLE;
+    }
+
+    // Chunks from -radius to radius on both axes. Copies of the chunk at
+    // the origin where generation is not what is measured, real chunks
+    // where the heights matter.
+    ChunkMap chunkGrid(u32 seed, f32 chunk_size, s32 radius, bool copy_prototype)
+    {
+        KDTree kd;
+        kd.add(Terrain::generateBiomePoints(seed));
+
+        std::optional<Chunk> prototype;
+        if (copy_prototype)
+            prototype.emplace(v2f { 0.0f, 0.0f }, seed, chunk_size, kd);
+
+        ChunkMap chunks;
+        for (s32 x = -radius; x <= radius; x++)
+        {
+            for (s32 y = -radius; y <= radius; y++)
+            {
+                if (prototype)
+                    chunks.insert(v2i { x, y }, Chunk(*prototype));
+                else
+                    chunks.insert(v2i { x, y }, Chunk(v2f { x * chunk_size, y * chunk_size }, seed, chunk_size, kd));
+            }
+        }
+        return chunks;
+    }
+
+    struct BiomeWeights
+    {
+        f64 table[NUM_BIOMES];
+        f64 total;
+        u8 nearest;
+    };
+}
+
+u32 Bench::runAll()
+{
+    u32 failures = 0;
+    failures += Bench::biomeLookup(616u);
+    failures += Bench::perlinBatch(616u);
+    failures += Bench::chunkMesh(616u);
+    failures += Bench::terrainLOD();
+    failures += Bench::chunkLookup(616u);
+    failures += Bench::chunkDeterminism(616u);
+    failures += Bench::chunkStore(616u);
+    failures += Bench::fogOfWar(616u, 5);
+    failures += Bench::fogOfWar(616u, 15);
+    failures += Bench::viewshed(616u);
+    failures += Bench::pathfinding(616u);
+    failures += Bench::heightQuery(616u);
+    failures += Bench::scheduler(616u);
+    failures += Bench::simulation();
+    failures += Bench::commandCompile(616u);
+    failures += Bench::instancing(616u);
+    failures += Bench::uniformRing();
+    failures += Bench::terrainTiles(616u);
+    failures += Bench::culling(616u);
+    failures += Bench::selection(616u);
+    failures += Bench::separation(616u);
+    failures += Bench::worldSave(616u);
+
+    if (failures)
+        Log::error("Bench: %u checks failed", failures);
+    return failures;
+}
+
+u32 Bench::biomeLookup(u32 seed)
+{
+    Log::info("Bench: biome lookup (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const s32 chunks_per_side = 8;
+    const s32 num_chunks = chunks_per_side * chunks_per_side;
+
+    auto bps = Terrain::generateBiomePoints(seed);
+    KDTree kd;
+    f64 build_ms = timeMs([&]{ kd.add(bps); });
+
+    std::vector<BiomeWeights> brute(num_chunks * TILES_PER_CHUNK);
+    std::vector<BiomeWeights> indexed(num_chunks * TILES_PER_CHUNK);
+
+    auto tilePos = [&](s32 chunk, u32 tile)
+    {
+        v2f origin {
+            (chunk % chunks_per_side - chunks_per_side / 2) * chunk_size,
+            (chunk / chunks_per_side - chunks_per_side / 2) * chunk_size
+        };
+        return v2f {
+            origin.x + (tile % TILES_PER_SIDE) * tile_width,
+            origin.y + (tile / TILES_PER_SIDE) * tile_width
+        };
+    };
+
+    // The loop Chunk::Chunk used to run: every point for every tile
+    f64 brute_ms = timeMs([&]{
+        for (s32 c = 0; c < num_chunks; c++)
+        {
+            for (u32 i = 0; i < TILES_PER_CHUNK; i++)
+            {
+                v2f pos = tilePos(c, i);
+                BiomeWeights &w = brute[c * TILES_PER_CHUNK + i];
+                memset(&w, 0, sizeof(w));
+
+                f64 min_dist = INFINITY;
+                for (const BiomePoint &bp : bps)
+                {
+                    f64 sq_distance = bp.position.distanceSqFrom(pos);
+                    if (min_dist > sq_distance)
+                    {
+                        min_dist = sq_distance;
+                        w.nearest = bp.biome;
+                    }
+                    f64 recip_dist = 8.0 / sq_distance;
+                    if (recip_dist < 0.001)
+                        recip_dist = 0.0;
+                    w.table[bp.biome] += recip_dist;
+                    w.total += recip_dist;
+                }
+            }
+        }
+    });
+
+    std::vector<BiomePoint> candidates;
+    f64 indexed_ms = timeMs([&]{
+        for (s32 c = 0; c < num_chunks; c++)
+        {
+            v2f origin = tilePos(c, 0);
+            candidates.clear();
+            kd.find_in_radius(
+                    v2f { origin.x + chunk_size / 2, origin.y + chunk_size / 2 },
+                    BIOME_CUTOFF_RADIUS + chunk_size * M_SQRT1_2,
+                    candidates
+                );
+
+            for (u32 i = 0; i < TILES_PER_CHUNK; i++)
+            {
+                v2f pos = tilePos(c, i);
+                BiomeWeights &w = indexed[c * TILES_PER_CHUNK + i];
+                memset(&w, 0, sizeof(w));
+
+                for (const BiomePoint &bp : candidates)
+                {
+                    f64 recip_dist = 8.0 / bp.position.distanceSqFrom(pos);
+                    if (recip_dist < 0.001)
+                        continue;
+                    w.table[bp.biome] += recip_dist;
+                    w.total += recip_dist;
+                }
+
+                if (w.total == 0.0)
+                    w.nearest = kd.find_nearest(pos).biome;
+            }
+        }
+    });
+
+    u32 mismatches = 0;
+    f64 max_error = 0.0;
+    for (size_t i = 0; i < brute.size(); i++)
+    {
+        if (brute[i].total == 0.0)
+        {
+            if (indexed[i].total != 0.0 || indexed[i].nearest != brute[i].nearest)
+                mismatches++;
+            continue;
+        }
+        for (u32 b = 0; b < NUM_BIOMES; b++)
+            max_error = std::max(max_error, std::abs(brute[i].table[b] - indexed[i].table[b]));
+    }
+
+    // k-nearest against a full scan
+    const u32 num_queries = 10000;
+    const s32 k = 8;
+    srand(seed);
+    std::vector<v2f> queries(num_queries);
+    for (auto &q : queries)
+        q = v2f { (f32) (rand() % WORLDSIZE - WORLDSIZE / 2), (f32) (rand() % WORLDSIZE - WORLDSIZE / 2) };
+
+    f64 knn_ms = timeMs([&]{
+        f64 acc = 0.0;
+        for (const auto &q : queries)
+            acc += kd.find_n_closest(q, k).back().position.x;
+        sink = acc;
+    });
+
+    f64 knn_brute_ms = timeMs([&]{
+        f64 acc = 0.0;
+        std::vector<f64> distances(VORONOI_BIOMES);
+        for (const auto &q : queries)
+        {
+            for (u32 i = 0; i < VORONOI_BIOMES; i++)
+                distances[i] = bps[i].position.distanceSqFrom(q);
+            std::nth_element(distances.begin(), distances.begin() + k - 1, distances.end());
+            acc += distances[k - 1];
+        }
+        sink = acc;
+    });
+
+    Log::info("\ttree build:            %8.3f ms", build_ms);
+    Log::info("\tbrute force:           %8.3f ms/chunk", brute_ms / num_chunks);
+    Log::info("\tindexed:               %8.3f ms/chunk (%.1fx)", indexed_ms / num_chunks, brute_ms / indexed_ms);
+    Log::info("\tmismatches:            %u tiles, max weight error %g", mismatches, max_error);
+    Log::info("\t%d-nearest x%u:      %8.3f ms tree, %8.3f ms scan", k, num_queries, knn_ms, knn_brute_ms);
+
+    return 0;
+}
+
+u32 Bench::perlinBatch(u32 seed)
+{
+    Log::info("Bench: batch perlin (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const f32 perlin_scale = 0.005f;
+    const s32 height_octaves = 9;
+    const s32 material_octaves = 200;
+    const s32 chunks_per_side = 4;
+    const s32 num_chunks = chunks_per_side * chunks_per_side;
+    const u32 grid_side = TILES_PER_SIDE + 1;
+
+    const siv::PerlinNoise perlin(seed);
+    const siv::PerlinNoise otherperlin(1010620);
+    PerlinBatch batch(perlin);
+    PerlinBatch otherbatch(otherperlin);
+
+    auto chunkOrigin = [&](s32 chunk)
+    {
+        return v2f {
+            (chunk % chunks_per_side - chunks_per_side / 2) * chunk_size,
+            (chunk / chunks_per_side - chunks_per_side / 2) * chunk_size
+        };
+    };
+
+    // What Chunk::Chunk used to do: both noises at all 4 corners of
+    // every tile, in double
+    std::vector<f64> reference(num_chunks * grid_side * grid_side * 2);
+    f64 per_tile_ms = timeMs([&]{
+        f64 acc = 0.0;
+        for (s32 c = 0; c < num_chunks; c++)
+        {
+            v2f origin = chunkOrigin(c);
+            f64 *heights = &reference[c * grid_side * grid_side * 2];
+            f64 *material = heights + grid_side * grid_side;
+
+            for (u32 i = 0; i < TILES_PER_SIDE; i++)
+            {
+                for (u32 j = 0; j < TILES_PER_SIDE; j++)
+                {
+                    for (u32 k = 0; k < 4; k++)
+                    {
+                        u32 x = i + (k == 2 || k == 3);
+                        u32 y = j + (k == 1 || k == 2);
+                        f64 sx = (origin.x + x * tile_width) * perlin_scale;
+                        f64 sy = (origin.y + y * tile_width) * perlin_scale;
+                        heights[y * grid_side + x] = perlin.octave2D(sx, sy, height_octaves);
+                        material[y * grid_side + x] = otherperlin.octave2D(sx, sy, material_octaves);
+                    }
+                }
+            }
+            acc += heights[0];
+        }
+        sink = acc;
+    });
+
+    std::vector<f32> batched(reference.size());
+    auto gridPass = [&]
+    {
+        for (s32 c = 0; c < num_chunks; c++)
+        {
+            v2f origin = chunkOrigin(c);
+            f32 *heights = &batched[c * grid_side * grid_side * 2];
+            f32 *material = heights + grid_side * grid_side;
+
+            batch.octave2DGrid(
+                    origin.x * perlin_scale, origin.y * perlin_scale,
+                    tile_width * perlin_scale,
+                    grid_side, grid_side,
+                    heights, height_octaves
+                );
+            otherbatch.octave2DGrid(
+                    origin.x * perlin_scale, origin.y * perlin_scale,
+                    tile_width * perlin_scale,
+                    grid_side, grid_side,
+                    material, material_octaves
+                );
+        }
+        sink = batched[0];
+    };
+
+    f64 grid_ms = timeMs(gridPass);
+
+    f64 max_error = 0.0;
+    for (size_t i = 0; i < reference.size(); i++)
+        max_error = std::max(max_error, std::abs(reference[i] - (f64) batched[i]));
+
+    Log::info("\tper-tile corners (siv): %8.3f ms/chunk", per_tile_ms / num_chunks);
+    Log::info("\tgrid (%s):          %8.3f ms/chunk (%.1fx)",
+            PerlinBatch::pathName(batch.path), grid_ms / num_chunks, per_tile_ms / grid_ms);
+    Log::info("\tmax error:              %g (tolerance %g)%s",
+            max_error, NOISE_BATCH_TOLERANCE, max_error > NOISE_BATCH_TOLERANCE ? " FAILED" : "");
+
+    // Raw throughput of each path the CPU supports
+    const PerlinBatch::Path best = PerlinBatch::bestPath();
+    for (PerlinBatch::Path path : { PerlinBatch::Path::SCALAR, PerlinBatch::Path::SSE41, PerlinBatch::Path::AVX2 })
+    {
+        if (path > best)
+            break;
+
+        batch.path = path;
+        otherbatch.path = path;
+        f64 ms = timeMs(gridPass);
+        f64 samples = (f64) num_chunks * grid_side * grid_side * (height_octaves + NOISE_MAX_OCTAVES);
+        Log::info("\t%-8s %8.3f ms/chunk, %6.1f M octave samples/s",
+                PerlinBatch::pathName(path), ms / num_chunks, samples / ms / 1000.0);
+    }
+
+    return 0;
+}
+
+u32 Bench::chunkMesh(u32 seed)
+{
+    Log::info("Bench: chunk mesh (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const s32 num_chunks = 16;
+
+    KDTree kd;
+    kd.add(Terrain::generateBiomePoints(seed));
+
+    size_t vertex_bytes = 0;
+    f64 build_ms = timeMs([&]{
+        for (s32 c = 0; c < num_chunks; c++)
+        {
+            Chunk chunk(v2f { c * chunk_size, 0.0f }, seed, chunk_size, kd);
+            vertex_bytes = chunk.vertices.size() * sizeof(TerrainVertex);
+        }
+    });
+
+    // What genMeshFromTiles used to produce, 4 Vertex and 6 u32 per tile
+    const size_t quad_bytes = TILES_PER_CHUNK * (4 * sizeof(Vertex) + 6 * sizeof(u32));
+    const size_t index_bytes = INDICES_PER_CHUNK * sizeof(u16);
+
+    Log::info("\tgeneration:           %8.3f ms/chunk", build_ms / num_chunks);
+    Log::info("\tper-tile quads:       %8zu bytes/chunk", quad_bytes);
+    Log::info("\tshared grid:          %8zu bytes/chunk (%.1fx), plus %zu bytes of indices shared by all chunks",
+            vertex_bytes, (f64) quad_bytes / vertex_bytes, index_bytes);
+
+    return 0;
+}
+
+u32 Bench::terrainLOD()
+{
+    Log::info("Bench: terrain LOD");
+
+    for (u32 level = 0; level < TERRAIN_LOD_LEVELS; level++)
+    {
+        std::vector<u16> indices;
+        f64 ms = timeMs([&]{ indices = Terrain::generateIndices(Terrain::lodKey(level, 0, 0, 0, 0)); });
+        Log::info("\tlevel %u: %6zu triangles, %zu index bytes, built in %.3f ms",
+                level, indices.size() / 3, indices.size() * sizeof(u16), ms);
+    }
+
+    // Segments along the x = TILES_PER_SIDE edge of one chunk have to be
+    // exactly the segments along the x = 0 edge of its east neighbour,
+    // otherwise there is a crack
+    auto edgeSegments = [](const std::vector<u16> &indices, u32 edge_x)
+    {
+        std::set<std::pair<u32, u32>> segments;
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            for (u32 e = 0; e < 3; e++)
+            {
+                u16 a = indices[t + e];
+                u16 b = indices[t + (e + 1) % 3];
+                if (a % VERTS_PER_SIDE == edge_x && b % VERTS_PER_SIDE == edge_x)
+                {
+                    u32 ya = a / VERTS_PER_SIDE;
+                    u32 yb = b / VERTS_PER_SIDE;
+                    segments.insert({ std::min(ya, yb), std::max(ya, yb) });
+                }
+            }
+        }
+        return segments;
+    };
+
+    u32 cracks = 0;
+    for (u32 west = 0; west < TERRAIN_LOD_LEVELS; west++)
+    {
+        for (u32 east = 0; east < TERRAIN_LOD_LEVELS; east++)
+        {
+            auto west_chunk = Terrain::generateIndices(Terrain::lodKey(west, west, east, west, west));
+            auto east_chunk = Terrain::generateIndices(Terrain::lodKey(east, east, east, east, west));
+            if (edgeSegments(west_chunk, TILES_PER_SIDE) != edgeSegments(east_chunk, 0))
+                cracks++;
+        }
+    }
+
+    Log::info("\tseams with cracks:    %u of %u level pairs", cracks, TERRAIN_LOD_LEVELS * TERRAIN_LOD_LEVELS);
+
+    return 0;
+}
+
+u32 Bench::chunkLookup(u32 seed)
+{
+    Log::info("Bench: chunk lookup (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const s32 radius = 5;
+    const u32 num_lookups = 10000;
+
+    // One real chunk copied everywhere, generation is not what is measured
+    ChunkMap hashed = chunkGrid(seed, chunk_size, radius, true);
+    std::map<v2f, Chunk> tree;
+    hashed.forEach([&](v2i coord, const Chunk &chunk)
+    {
+        tree.emplace(v2f { coord.x * chunk_size, coord.y * chunk_size }, chunk);
+    });
+
+    // Includes positions just outside the loaded area, which miss
+    srand(seed);
+    const f32 extent = (radius + 1) * chunk_size;
+    std::vector<v2f> positions(num_lookups);
+    for (auto &pos : positions)
+    {
+        pos = v2f {
+            (f32) rand() / RAND_MAX * 2.0f * extent - extent,
+            (f32) rand() / RAND_MAX * 2.0f * extent - extent
+        };
+    }
+
+    // What Terrain::getChunkFromPos used to do
+    u32 tree_hits = 0;
+    f64 tree_ms = timeMs([&]{
+        for (const v2f &pos : positions)
+        {
+            v2f origin {
+                (f32) (s32) (std::floor(pos.x / chunk_size) * chunk_size),
+                (f32) (s32) (std::floor(pos.y / chunk_size) * chunk_size)
+            };
+            if (tree.contains(origin))
+                tree_hits += tree.find(origin)->second.navigable[0] == 0;
+        }
+    });
+
+    u32 hash_hits = 0;
+    f64 hash_ms = timeMs([&]{
+        for (const v2f &pos : positions)
+        {
+            v2i coord {
+                (s32) std::floor(pos.x / chunk_size),
+                (s32) std::floor(pos.y / chunk_size)
+            };
+            if (const Chunk *chunk = hashed.find(coord))
+                hash_hits += chunk->navigable[0] == 0;
+        }
+    });
+
+    Log::info("\t%u chunks, %u lookups (%u hits)", hashed.size(), num_lookups, hash_hits);
+    Log::info("\tstd::map<v2f>:        %8.3f ms (%.1f ns/lookup)", tree_ms, tree_ms * 1e6 / num_lookups);
+    Log::info("\tChunkMap:             %8.3f ms (%.1f ns/lookup, %.1fx)%s",
+            hash_ms, hash_ms * 1e6 / num_lookups, tree_ms / hash_ms,
+            tree_hits != hash_hits ? " MISMATCH" : "");
+
+    return tree_hits != hash_hits;
+}
+
+u32 Bench::fogOfWar(u32 seed, u32 los)
+{
+    Log::info("Bench: fog of war (seed %u, los %u)", seed, los);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const s32 radius = 3;
+    const u32 num_units = 300;
+    const u32 num_frames = 100;
+
+    ChunkMap redrawn = chunkGrid(seed, chunk_size, radius, true);
+    ChunkMap counted = chunkGrid(seed, chunk_size, radius, true);
+    // For the chunks that arrive later, before any are stamped
+    const Chunk prototype(*counted.find(v2i { 0, 0 }));
+
+    // Units wander within the loaded area, about a tile every few frames
+    srand(seed);
+    const f32 extent = radius * chunk_size;
+    auto frand = [] { return (f32) rand() / RAND_MAX * 2.0f - 1.0f; };
+    std::vector<v2f> positions(num_units);
+    std::vector<v2f> velocities(num_units);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        positions[i] = v2f { frand() * extent, frand() * extent };
+        velocities[i] = v2f { frand() * tile_width * 0.3f, frand() * tile_width * 0.3f };
+    }
+
+    auto step = [&]
+    {
+        for (u32 i = 0; i < num_units; i++)
+        {
+            positions[i] = positions[i] + velocities[i];
+            if (std::abs(positions[i].x) > extent)
+                velocities[i].x = -velocities[i].x;
+            if (std::abs(positions[i].y) > extent)
+                velocities[i].y = -velocities[i].y;
+        }
+    };
+
+    const std::vector<v2f> start = positions;
+
+    // What GameSystem::LOS used to do: fade every tile, then redraw
+    // every circle. Stamps from the unit's tile like FogOfWar does, so
+    // the two can be compared tile for tile.
+    const f32 r = los / tile_width;
+    f64 redrawn_ms = timeMs([&]{
+        for (u32 frame = 0; frame < num_frames; frame++)
+        {
+            step();
+
+            redrawn.forEach([](v2i, Chunk &chunk)
+            {
+                for (auto &los_index : chunk.los_indices)
+                    if (los_index > LOS_EXPLORED) los_index -= 1;
+            });
+
+            for (const v2f &pos : positions)
+            {
+                const s32 cx = (s32) std::floor(pos.x / tile_width);
+                const s32 cy = (s32) std::floor(pos.y / tile_width);
+                for (s32 dy = -(s32) r; dy <= (s32) r; dy++)
+                {
+                    for (s32 dx = -(s32) r; dx <= (s32) r; dx++)
+                    {
+                        if ((f32) (dx * dx + dy * dy) > r * r)
+                            continue;
+
+                        const s32 tx = cx + dx;
+                        const s32 ty = cy + dy;
+                        const v2i coord {
+                            (s32) std::floor((f32) tx / TILES_PER_SIDE),
+                            (s32) std::floor((f32) ty / TILES_PER_SIDE)
+                        };
+                        if (Chunk *chunk = redrawn.find(coord))
+                        {
+                            chunk->los_indices[
+                                (ty - coord.y * TILES_PER_SIDE) * TILES_PER_SIDE
+                                + tx - coord.x * TILES_PER_SIDE
+                            ] = LOS_VISIBLE;
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    positions = start;
+    srand(seed);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        frand(); frand();
+        velocities[i] = v2f { frand() * tile_width * 0.3f, frand() * tile_width * 0.3f };
+    }
+
+    entt::registry registry;
+    std::vector<entt::entity> units(num_units);
+    for (auto &unit : units)
+    {
+        unit = registry.create();
+        registry.emplace<Transform>(unit);
+        registry.emplace<LineOfSight>(unit, los);
+    }
+
+    u32 restamped = 0;
+    u32 tiles_touched = 0;
+    u32 mismatches = 0;
+    u32 recount_mismatches = 0;
+    f64 counted_ms;
+    // Of an update, without and with occlusion
+    f64 unchanged_ms[2];
+    f64 arrived_ms[2];
+    f64 recount_all_ms[2];
+    {
+        FogOfWar fog(registry, counted, chunk_size);
+        counted_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                step();
+                for (u32 i = 0; i < num_units; i++)
+                {
+                    Transform &transform = registry.get<Transform>(units[i]);
+                    transform.pos.x = positions[i].x;
+                    transform.pos.y = positions[i].y;
+                }
+
+                fog.update();
+                restamped += fog.getStats().restamped;
+                tiles_touched += fog.getStats().tiles_touched;
+            }
+        });
+
+        counted.forEach([&](v2i coord, Chunk &chunk)
+        {
+            const Chunk *other = redrawn.find(coord);
+            for (u32 i = 0; i < TILES_PER_CHUNK; i++)
+                mismatches += chunk.los_indices[i] != other->los_indices[i];
+        });
+
+        // Observer counts after chunks come and go, against counting
+        // everything again
+        auto counts = [&]
+        {
+            std::vector<u16> all;
+            counted.forEach([&](v2i, const Chunk &chunk)
+            {
+                for (u16 observers : chunk.observers)
+                    all.push_back(observers & LOS_OBSERVER_MASK);
+            });
+            return all;
+        };
+        auto recountAll = [&]
+        {
+            fog.setOcclusion(!fog.getOcclusion());
+            fog.setOcclusion(!fog.getOcclusion());
+            fog.update();
+        };
+
+        for (bool occlusion : { false, true })
+        {
+            fog.setOcclusion(occlusion);
+            fog.update();
+
+            // One arrives at the edge as when streaming, then one in
+            // the middle is evicted and another regenerated
+            unchanged_ms[occlusion] = timeMs([&]{ fog.update(); });
+            counted.insert(v2i { radius + 1, occlusion }, Chunk(prototype));
+            arrived_ms[occlusion] = timeMs([&]{ fog.update(); });
+            counted.erase(v2i { 0, 0 });
+            counted.erase(v2i { 1, 1 });
+            counted.insert(v2i { 1, 1 }, Chunk(prototype));
+            fog.update();
+            const std::vector<u16> incremental = counts();
+
+            recountAll();
+            const std::vector<u16> full = counts();
+            for (size_t i = 0; i < full.size(); i++)
+                recount_mismatches += full[i] != incremental[i];
+
+            recount_all_ms[occlusion] = timeMs(recountAll);
+        }
+
+        registry.clear();
+    }
+
+    Log::info("\t%u units, %u frames, %u chunks", num_units, num_frames, redrawn.size());
+    Log::info("\tdecay + redraw:       %8.3f ms (%.1f us/frame)",
+            redrawn_ms, redrawn_ms * 1e3 / num_frames);
+    Log::info("\tFogOfWar:             %8.3f ms (%.1f us/frame, %.1fx), %.1f restamps/frame, %.0f tiles/frame%s",
+            counted_ms, counted_ms * 1e3 / num_frames, redrawn_ms / counted_ms,
+            (f64) restamped / num_frames, (f64) tiles_touched / num_frames,
+            mismatches ? " MISMATCH" : "");
+    if (mismatches)
+        Log::info("\t%u tiles differ", mismatches);
+    for (u32 occlusion = 0; occlusion < 2; occlusion++)
+    {
+        Log::info("\t%s   %8.3f ms with a chunk arriving, %.3f ms without, %.3f ms recounting everything",
+                occlusion ? "occluded:" : "disc:    ", arrived_ms[occlusion], unchanged_ms[occlusion], recount_all_ms[occlusion]);
+    }
+    Log::info("\t%u observer counts differ from recounting everything%s",
+            recount_mismatches, recount_mismatches ? " MISMATCH" : "");
+
+    return (mismatches != 0) + (recount_mismatches != 0);
+}
+
+u32 Bench::viewshed(u32 seed)
+{
+    Log::info("Bench: viewshed (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const s32 radius = 2;
+    const u32 num_units = 200;
+    const u32 num_frames = 20;
+
+    // Real chunks, occlusion depends on the heights
+    ChunkMap chunks = chunkGrid(seed, chunk_size, radius, false);
+
+    for (u32 los : { 5u, 15u, 40u })
+    {
+        f64 ms[2];
+        u64 disc_tiles = 0;
+        u64 visible_tiles = 0;
+
+        for (bool occlusion : { false, true })
+        {
+            entt::registry registry;
+            FogOfWar fog(registry, chunks, chunk_size);
+            fog.setOcclusion(occlusion);
+
+            srand(seed);
+            const f32 extent = chunk_size * 1.5f;
+            std::vector<entt::entity> units(num_units);
+            for (auto &unit : units)
+            {
+                unit = registry.create();
+                Transform &transform = registry.emplace<Transform>(unit);
+                transform.pos.x = (f32) rand() / RAND_MAX * 2.0f * extent - extent;
+                transform.pos.y = (f32) rand() / RAND_MAX * 2.0f * extent - extent;
+                registry.emplace<LineOfSight>(unit, los);
+            }
+            fog.update();
+
+            // Every unit steps a tile every frame, so every one restamps
+            u32 restamped = 0;
+            ms[occlusion] = timeMs([&]{
+                for (u32 frame = 0; frame < num_frames; frame++)
+                {
+                    for (u32 i = 0; i < num_units; i++)
+                    {
+                        Transform &transform = registry.get<Transform>(units[i]);
+                        transform.pos.x += (i & 1 ? 1.0f : -1.0f) * tile_width;
+                        transform.pos.y += (frame & 1 ? 1.0f : -1.0f) * tile_width;
+                    }
+                    fog.update();
+                    restamped += fog.getStats().restamped;
+                }
+            });
+            ms[occlusion] /= restamped;
+
+            if (occlusion)
+            {
+                registry.view<LOSStamp>().each([&](const LOSStamp &stamp)
+                {
+                    for (const LOSRun &run : stamp.runs)
+                        visible_tiles += run.x1 - run.x0 + 1;
+                });
+            }
+            else
+            {
+                registry.view<LOSStamp>().each([&](const LOSStamp &stamp)
+                {
+                    const s32 r = (s32) stamp.radius;
+                    for (s32 dy = -r; dy <= r; dy++)
+                        disc_tiles += 2 * (s32) std::floor(std::sqrt(stamp.radius * stamp.radius - dy * dy)) + 1;
+                });
+            }
+
+            registry.clear();
+        }
+
+        Log::info("\tlos %2u (%4.1f tiles): disc %6.2f us/unit, occluded %6.2f us/unit, %4.1f%% of the disc visible",
+                los, los / tile_width, ms[0] * 1e3, ms[1] * 1e3,
+                100.0 * visible_tiles / disc_tiles);
+    }
+
+    return 0;
+}
+
+u32 Bench::pathfinding(u32 seed)
+{
+    Log::info("Bench: pathfinding (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const s32 radius = 3;
+    const u32 num_queries = 200;
+    const u32 num_units = 5000;
+
+    // Generated terrain is all navigable for now, so wall it up
+    std::minstd_rand rng(seed);
+    ChunkMap chunks = chunkGrid(seed, chunk_size, radius, true);
+    for (s32 x = -radius; x <= radius; x++)
+    {
+        for (s32 y = -radius; y <= radius; y++)
+        {
+            Chunk &chunk = *chunks.find(v2i { x, y });
+            for (u32 wall = 0; wall < 6; wall++)
+            {
+                const bool vertical = rng() & 1;
+                const s32 at = rng() % TILES_PER_SIDE;
+                const s32 from = rng() % TILES_PER_SIDE;
+                const s32 length = 20 + rng() % 30;
+                for (s32 i = from; i < std::min(from + length, TILES_PER_SIDE); i++)
+                {
+                    const s32 tx = vertical ? at : i;
+                    const s32 ty = vertical ? i : at;
+                    chunk.navigable[ty * TILES_PER_SIDE + tx] = 1;
+                }
+            }
+        }
+    }
+
+    const s32 extent = (radius + 1) * TILES_PER_SIDE;
+    auto randomTile = [&]
+    {
+        while (true)
+        {
+            v2i tile {
+                (s32) (rng() % (2 * extent)) - extent + TILES_PER_SIDE / 2,
+                (s32) (rng() % (2 * extent)) - extent + TILES_PER_SIDE / 2
+            };
+            tile.x = std::clamp(tile.x, -radius * TILES_PER_SIDE, (radius + 1) * TILES_PER_SIDE - 1);
+            tile.y = std::clamp(tile.y, -radius * TILES_PER_SIDE, (radius + 1) * TILES_PER_SIDE - 1);
+            if (walkableTile(chunks, tile))
+                return tile;
+        }
+    };
+    auto center = [&](v2i tile) { return v2f { (tile.x + 0.5f) * tile_width, (tile.y + 0.5f) * tile_width }; };
+
+    TileGrid grid {
+        v2i { -radius * TILES_PER_SIDE, -radius * TILES_PER_SIDE },
+        (2 * radius + 1) * TILES_PER_SIDE,
+        {}
+    };
+    grid.open.resize(grid.side * grid.side);
+    for (s32 y = 0; y < grid.side; y++)
+        for (s32 x = 0; x < grid.side; x++)
+            grid.open[y * grid.side + x] = walkableTile(chunks, v2i { grid.min_tile.x + x, grid.min_tile.y + y });
+
+    std::vector<std::pair<v2i, v2i>> queries(num_queries);
+    for (auto &query : queries)
+        query = { randomTile(), randomTile() };
+
+    Pathfinder pathfinder(chunks, chunk_size);
+    std::vector<v2f> waypoints;
+
+    // A different set of queries first, which pays for building the
+    // portals of every chunk without warming the route cache
+    std::vector<std::pair<v2i, v2i>> warmup(num_queries);
+    for (auto &query : warmup)
+        query = { randomTile(), randomTile() };
+
+    f64 warm_ms = timeMs([&]{
+        for (const auto &[from, to] : warmup)
+            pathfinder.findPath(center(from), center(to), waypoints);
+    });
+
+    u32 hpa_found = 0;
+    f64 hpa_ms = timeMs([&]{
+        for (const auto &[from, to] : queries)
+            hpa_found += pathfinder.findPath(center(from), center(to), waypoints);
+    });
+    f64 cached_ms = timeMs([&]{
+        for (const auto &[from, to] : queries)
+            pathfinder.findPath(center(from), center(to), waypoints);
+    });
+
+    u32 tile_found = 0;
+    f64 tile_ms = timeMs([&]{
+        for (const auto &[from, to] : queries)
+            tile_found += tileAStar(grid, from, to) != PATH_UNREACHABLE;
+    });
+
+    Log::info("\t%u chunks, %u queries, %u reachable by tile A*, %u by HPA*",
+            chunks.size(), num_queries, tile_found, hpa_found);
+    Log::info("\ttile A*:              %8.3f ms (%.1f us/query)", tile_ms, tile_ms * 1e3 / num_queries);
+    Log::info("\tHPA*, building portals: %6.3f ms (%u chunks)", warm_ms, pathfinder.getStats().chunk_navs_built);
+    Log::info("\tHPA*:                 %8.3f ms (%.1f us/query, %.1fx)",
+            hpa_ms, hpa_ms * 1e3 / num_queries, tile_ms / hpa_ms);
+    Log::info("\tHPA* cached:          %8.3f ms (%.2f us/query)", cached_ms, cached_ms * 1e3 / num_queries);
+
+    // Other starts in the chunks the cached routes start in, blocked or
+    // walled off ones must not be answered from the cache
+    u32 wrong_reachability = 0;
+    for (const auto &[from, to] : queries)
+    {
+        const v2i origin {
+            (s32) std::floor((f32) from.x / TILES_PER_SIDE) * TILES_PER_SIDE,
+            (s32) std::floor((f32) from.y / TILES_PER_SIDE) * TILES_PER_SIDE
+        };
+        const v2i other { origin.x + (s32) (rng() % TILES_PER_SIDE), origin.y + (s32) (rng() % TILES_PER_SIDE) };
+
+        const bool reachable = walkableTile(chunks, other) && tileAStar(grid, other, to) != PATH_UNREACHABLE;
+        wrong_reachability += pathfinder.findPath(center(other), center(to), waypoints) != reachable;
+    }
+    Log::info("\t%u other starts in the same chunks answered wrongly%s",
+            wrong_reachability, wrong_reachability ? ", MISMATCH" : "");
+
+    // Thousands of units, one goal
+    const v2i goal = randomTile();
+    std::vector<v2i> units(num_units);
+    for (auto &unit : units)
+        unit = randomTile();
+
+    const PathStats before = pathfinder.getStats();
+    f64 field_ms = timeMs([&]{
+        for (const v2i &unit : units)
+            sink = sink + pathfinder.flowDirection(center(goal), center(unit)).x;
+    });
+    f64 lookup_ms = timeMs([&]{
+        for (const v2i &unit : units)
+            sink = sink + pathfinder.flowDirection(center(goal), center(unit)).x;
+    });
+    const PathStats after = pathfinder.getStats();
+
+    // Per-unit searches for a sample, scaled up
+    const u32 sample = 50;
+    f64 per_unit_ms = timeMs([&]{
+        for (u32 i = 0; i < sample; i++)
+            sink = sink + tileAStar(grid, units[i], goal);
+    }) * num_units / sample;
+
+    // Walk every unit down the field tile by tile
+    u32 arrived = 0;
+    u32 blocked = 0;
+    for (const v2i &unit : units)
+    {
+        v2i tile = unit;
+        for (u32 step = 0; step < 8 * (u32) extent; step++)
+        {
+            const v2f dir = pathfinder.flowDirection(center(goal), center(tile));
+            if (dir.x == 0.0f && dir.y == 0.0f)
+            {
+                arrived += tile.x == goal.x && tile.y == goal.y;
+                break;
+            }
+            tile = v2i {
+                tile.x + (dir.x > 0.5f) - (dir.x < -0.5f),
+                tile.y + (dir.y > 0.5f) - (dir.y < -0.5f)
+            };
+            if (!walkableTile(chunks, tile))
+            {
+                blocked++;
+                break;
+            }
+        }
+    }
+
+    Log::info("\t%u units to one goal, %u chunk fields built, %u portal searches",
+            num_units, after.chunk_flows_built - before.chunk_flows_built,
+            after.flow_fields_built - before.flow_fields_built);
+    Log::info("\ttile A* per unit:     %8.3f ms (estimated from %u units)", per_unit_ms, sample);
+    Log::info("\tflow field, first:    %8.3f ms (%.1fx)", field_ms, per_unit_ms / field_ms);
+    Log::info("\tflow field, after:    %8.3f ms (%.2f us/unit)", lookup_ms, lookup_ms * 1e3 / num_units);
+    Log::info("\t%u of %u units reach the goal following it, %u walk into walls", arrived, num_units, blocked);
+
+    return wrong_reachability;
+}
+
+u32 Bench::heightQuery(u32 seed)
+{
+    Log::info("Bench: height query (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const s32 radius = 2;
+    const u32 num_queries = 10000;
+
+    ChunkMap chunks = chunkGrid(seed, chunk_size, radius, false);
+
+    srand(seed);
+    const f32 extent = (radius + 0.5f) * chunk_size;
+    std::vector<v2f> positions(num_queries);
+    for (auto &pos : positions)
+    {
+        pos = v2f {
+            (f32) rand() / RAND_MAX * 2.0f * extent - extent,
+            (f32) rand() / RAND_MAX * 2.0f * extent - extent
+        };
+    }
+
+    // Same as Terrain::heightAt, which needs a renderer to construct
+    auto heightAt = [&](v2f pos)
+    {
+        const v2i coord {
+            (s32) std::floor(pos.x / chunk_size),
+            (s32) std::floor(pos.y / chunk_size)
+        };
+        const Chunk *chunk = chunks.find(coord);
+        if (!chunk)
+            return 0.0f;
+        return chunk->heightAt(v2f { pos.x - coord.x * chunk_size, pos.y - coord.y * chunk_size }, tile_width);
+    };
+
+    // What updateMovement used to do for every unit near the camera target
+    std::vector<f32> old_heights(num_queries);
+    f64 perlin_ms = timeMs([&]{
+        for (u32 i = 0; i < num_queries; i++)
+        {
+            const siv::PerlinNoise perlin(616u);
+            f32 perlin_scale = 0.005f;
+            f32 noise_scale = 16.0f;
+            u32 octaves = 9;
+            old_heights[i] = noise_scale * perlin.octave2D(positions[i].x * perlin_scale, positions[i].y * perlin_scale, octaves);
+        }
+    });
+
+    std::vector<f32> new_heights(num_queries);
+    f64 cached_ms = timeMs([&]{
+        for (u32 i = 0; i < num_queries; i++)
+            new_heights[i] = heightAt(positions[i]);
+    });
+
+    // The queries should land exactly on the mesh vertices
+    f32 vertex_error = 0.0f;
+    chunks.forEach([&](v2i, const Chunk &chunk)
+    {
+        for (u32 y = 0; y < VERTS_PER_SIDE; y += 8)
+        {
+            for (u32 x = 0; x < VERTS_PER_SIDE; x += 8)
+            {
+                const f32 h = chunk.heightAt(v2f { x * tile_width, y * tile_width }, tile_width);
+                vertex_error = std::max(vertex_error, std::abs(h - chunk.vertices[y * VERTS_PER_SIDE + x].pos[2]));
+            }
+        }
+    });
+
+    f64 old_error = 0.0;
+    for (u32 i = 0; i < num_queries; i++)
+        old_error += std::abs(old_heights[i] - new_heights[i]);
+    sink = new_heights[num_queries / 2];
+
+    Log::info("\tper unit Perlin:      %8.3f ms (%.3f us/query)", perlin_ms, perlin_ms * 1e3 / num_queries);
+    Log::info("\tcached heightfield:   %8.3f ms (%.3f us/query)", cached_ms, cached_ms * 1e3 / num_queries);
+    Log::info("\terror at vertices:    %8.5f", vertex_error);
+    Log::info("\told height off mesh:  %8.3f on average", old_error / num_queries);
+
+    return 0;
+}
+
+u32 Bench::scheduler(u32 seed)
+{
+    Log::info("Bench: system scheduler (seed %u)", seed);
+
+    u32 failures = 0;
+    ThreadPool pool(ThreadPool::defaultThreadCount());
+    Log::info("\t%u pool threads and the calling one", pool.size());
+
+    // Unit movement split into pieces, the per unit work of updateMovement
+    {
+        const f32 chunk_size = 100.0f;
+        const f32 tile_width = chunk_size / TILES_PER_SIDE;
+        const s32 radius = 2;
+        const u32 num_units = 100000;
+        const u32 num_frames = 20;
+
+        ChunkMap chunks = chunkGrid(seed, chunk_size, radius, false);
+
+        srand(seed);
+        const f32 extent = radius * chunk_size;
+        std::vector<v3f> start(num_units);
+        for (auto &pos : start)
+        {
+            pos.x = (f32) rand() / RAND_MAX * 2.0f * extent - extent;
+            pos.y = (f32) rand() / RAND_MAX * 2.0f * extent - extent;
+            pos.z = 0.0f;
+        }
+
+        auto step = [&](v3f &pos, u32 i)
+        {
+            const v2f next {
+                pos.x + (i & 1 ? 0.1f : -0.1f),
+                pos.y + (i & 2 ? 0.1f : -0.1f)
+            };
+            const v2i coord {
+                (s32) std::floor(next.x / chunk_size),
+                (s32) std::floor(next.y / chunk_size)
+            };
+            const Chunk *chunk = chunks.find(coord);
+            if (!chunk)
+                return;
+
+            const v2f local { next.x - coord.x * chunk_size, next.y - coord.y * chunk_size };
+            const u32 tile = std::min((u32) (local.y / tile_width), (u32) TILES_PER_SIDE - 1) * TILES_PER_SIDE
+                           + std::min((u32) (local.x / tile_width), (u32) TILES_PER_SIDE - 1);
+            if (chunk->navigable[tile] != 0)
+                return;
+
+            pos.x = next.x;
+            pos.y = next.y;
+            pos.z = chunk->heightAt(local, tile_width);
+        };
+
+        std::vector<v3f> serial = start;
+        f64 serial_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+                for (u32 i = 0; i < num_units; i++)
+                    step(serial[i], i);
+        });
+
+        std::vector<v3f> parallel = start;
+        f64 parallel_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                pool.parallelFor(num_units, 256, [&](u32 begin, u32 end)
+                {
+                    for (u32 i = begin; i < end; i++)
+                        step(parallel[i], i);
+                });
+            }
+        });
+
+        u32 mismatches = 0;
+        for (u32 i = 0; i < num_units; i++)
+            mismatches += serial[i].x != parallel[i].x || serial[i].y != parallel[i].y || serial[i].z != parallel[i].z;
+
+        Log::info("\t%u units, %u frames", num_units, num_frames);
+        Log::info("\tmovement serial:      %8.3f ms/frame", serial_ms / num_frames);
+        Log::info("\tmovement parallelFor: %8.3f ms/frame (%.1fx)%s",
+                parallel_ms / num_frames, serial_ms / parallel_ms,
+                mismatches ? " MISMATCH" : "");
+        failures += mismatches != 0;
+    }
+
+    // Two independent chains joined at the end, each system busy for a
+    // fixed time. With a core for each chain the frame takes as long as
+    // the longer one plus the join, 2 ms.
+    {
+        auto busy = [](f64 ms)
+        {
+            const auto until = std::chrono::steady_clock::now()
+                             + std::chrono::duration<double, std::milli>(ms);
+            while (std::chrono::steady_clock::now() < until)
+                ;
+        };
+
+        const u64 A = 1ull << 0;
+        const u64 B = 1ull << 1;
+        const u64 C = 1ull << 2;
+        const u64 D = 1ull << 3;
+
+        SystemScheduler<f64> graph(pool);
+        graph.add("a1", busy, SystemAccess().writes(A));
+        graph.add("b1", busy, SystemAccess().writes(B));
+        graph.add("a2", busy, SystemAccess().reads(A).writes(C));
+        graph.add("b2", busy, SystemAccess().reads(B).writes(D));
+        graph.add("b3", busy, SystemAccess().writes(D));
+        graph.add("join", busy, SystemAccess().reads(C | D).onMainThread());
+
+        const u32 num_frames = 20;
+        f64 frame_ms = 0.0;
+        for (u32 frame = 0; frame < num_frames; frame++)
+        {
+            graph.run(0.5);
+            frame_ms += graph.getFrameMs();
+        }
+
+        Log::info("\tgraph of 6 x 0.5 ms:  %8.3f ms/frame", frame_ms / num_frames);
+        graph.logTimings();
+
+        SystemScheduler<> empty(pool);
+        for (u32 i = 0; i < 5; i++)
+            empty.add("empty", []{}, SystemAccess().writes(1ull << i));
+
+        const u32 num_runs = 1000;
+        f64 empty_ms = timeMs([&]{
+            for (u32 run = 0; run < num_runs; run++)
+                empty.run();
+        });
+        Log::info("\t5 empty systems:      %8.3f us/frame", empty_ms * 1e3 / num_runs);
+    }
+
+    return failures;
+}
+
+u32 Bench::simulation()
+{
+    Log::info("Bench: fixed tick simulation");
+
+    // A unit chasing a target that circles it, integrated once with the
+    // frame time as before and once at a fixed tick rate, at several
+    // frame rates with some jitter. Compared 10 s in.
+    struct Chaser
+    {
+        v2f pos;
+        f64 time;
+
+        void step(f64 dt)
+        {
+            time += dt;
+            const v2f target { 20.0f * (f32) std::cos(time), 20.0f * (f32) std::sin(time) };
+            const v2f to { target.x - pos.x, target.y - pos.y };
+            const f32 distance = std::sqrt(to.x * to.x + to.y * to.y);
+            if (distance < 0.001f)
+                return;
+
+            const f32 move = std::min(distance, 15.0f * (f32) dt);
+            pos.x += to.x / distance * move;
+            pos.y += to.y / distance * move;
+        }
+    };
+
+    const f64 duration = 10.0;
+    const u32 tick_rate = 30;
+    const u32 frame_rates[] = { 30, 60, 144, 240 };
+
+    std::vector<v2f> variable;
+    std::vector<v2f> fixed;
+    for (u32 fps : frame_rates)
+    {
+        srand(fps);
+        auto frameTime = [&] { return (1.0 + 0.2 * ((f64) rand() / RAND_MAX - 0.5)) / fps; };
+
+        Chaser chaser { v2f { 0.0f, 0.0f }, 0.0 };
+        f64 time = 0.0;
+        while (time < duration)
+        {
+            const f64 dt = std::min(frameTime(), duration - time);
+            chaser.step(dt);
+            time += dt;
+        }
+        variable.push_back(chaser.pos);
+
+        Simulation clock(tick_rate);
+        Chaser ticked { v2f { 0.0f, 0.0f }, 0.0 };
+        const u64 last_tick = (u64) (duration * tick_rate);
+        u64 tick = 0;
+        while (tick < last_tick)
+        {
+            const u32 ticks = clock.accumulate(frameTime());
+            for (u32 i = 0; i < ticks && tick < last_tick; i++, tick++)
+                ticked.step(clock.getTickSeconds());
+        }
+        fixed.push_back(ticked.pos);
+    }
+
+    auto spread = [](const std::vector<v2f> &positions)
+    {
+        f32 largest = 0.0f;
+        for (const v2f &a : positions)
+            for (const v2f &b : positions)
+                largest = std::max(largest, (f32) a.distanceFrom(b));
+        return largest;
+    };
+
+    Log::info("\tend positions at 30-240 fps, largest difference:");
+    Log::info("\tframe time steps:     %8.5f", spread(variable));
+    Log::info("\t%u Hz ticks:          %8.5f", tick_rate, spread(fixed));
+
+    // Ticks running while the main thread does the rest of the frame
+    auto busy = [](f64 ms)
+    {
+        const auto until = std::chrono::steady_clock::now()
+                         + std::chrono::duration<double, std::milli>(ms);
+        while (std::chrono::steady_clock::now() < until)
+            ;
+    };
+
+    Simulation simulation(tick_rate);
+    const u32 num_frames = 20;
+    f64 overlapped_ms = timeMs([&]{
+        for (u32 frame = 0; frame < num_frames; frame++)
+        {
+            simulation.begin(1, [&](u32) { busy(2.0); });
+            busy(2.0);
+            simulation.finish();
+        }
+    });
+
+    Log::info("\t2 ms ticks + 2 ms frame: %8.3f ms/frame (%u hardware threads)",
+            overlapped_ms / num_frames, std::thread::hardware_concurrency());
+
+    return 0;
+}
+
+u32 Bench::commandCompile(u32 seed)
+{
+    Log::info("Bench: render command compile (seed %u)", seed);
+
+    auto backend = std::make_unique<DZNullBackend>();
+    DZNullBackend &null_backend = *backend;
+    DZRenderer renderer(std::move(backend));
+
+    const std::vector<DZShader> shaders
+        = renderer.compileShaders("", { "vertexMain", "fragmentMain" });
+    const DZPipeline terrain_pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+    const DZPipeline model_pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+    const DZPipeline gui_pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+    const DZPipeline fow_pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+
+    u8 pixel[4] = { 255, 0, 255, 255 };
+    TextureData texture_data(1, 1, 4, pixel);
+    const DZTexture texture = renderer.createTexture(texture_data);
+
+    const DZBuffer scene_uniforms = renderer.createBufferOfSize(256);
+    const DZBuffer light = renderer.createBufferOfSize(256);
+    const DZBuffer terrain_uniforms = renderer.createBufferOfSize(256);
+
+    // The nine visible chunks at a couple of LODs
+    const u32 num_chunks = 9;
+    const DZBuffer lod_indices[2] = {
+        renderer.createBufferOfSize(6 * sizeof(u16)),
+        renderer.createBufferOfSize(3 * sizeof(u16))
+    };
+    std::vector<DZMesh> chunk_meshes;
+    std::vector<DZBuffer> chunk_uniforms;
+    for (u32 i = 0; i < num_chunks; i++)
+    {
+        chunk_meshes.push_back(renderer.createMesh(MeshData::UnitPlane()));
+        chunk_uniforms.push_back(renderer.createBufferOfSize(256));
+    }
+
+    // Units made of a few shared meshes each, queued in spawn order
+    const u32 num_units = 2000;
+    const u32 num_unit_meshes = 6;
+    std::vector<DZMesh> unit_meshes;
+    for (u32 i = 0; i < num_unit_meshes; i++)
+        unit_meshes.push_back(renderer.createMesh(MeshData::UnitPlane()));
+
+    srand(seed);
+    std::vector<std::vector<DZMesh>> units(num_units);
+    std::vector<DZBuffer> unit_uniforms;
+    for (auto &unit : units)
+    {
+        const u32 parts = rand() % 3 + 1;
+        for (u32 i = 0; i < parts; i++)
+            unit.push_back(unit_meshes[rand() % num_unit_meshes]);
+        unit_uniforms.push_back(renderer.createBufferOfSize(256));
+    }
+
+    // The passes RenderSystem queues, scene and light rebound by each
+    auto terrainPass = [&](DZPipeline pipeline, u32 terrain_binding, u32 local_binding)
+    {
+        renderer.enqueueCommand(DZRenderCommand::SetPipeline(pipeline));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(scene_uniforms, 0)));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Vertex(scene_uniforms, 0)));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(light, 3)));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(terrain_uniforms, terrain_binding)));
+        for (u32 i = 0; i < num_chunks; i++)
+        {
+            renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Vertex(chunk_uniforms[i], 2)));
+            renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(chunk_uniforms[i], local_binding)));
+            renderer.enqueueCommand(DZRenderCommand::DrawIndexed(chunk_meshes[i], lod_indices[i & 1], (i & 1) ? 3 : 6));
+        }
+    };
+
+    // Each unit's meshes drawn separately, as Model::render did, or
+    // instanced, as it does now
+    InstanceBatcher batcher;
+    auto queueFrame = [&](bool instanced)
+    {
+        renderer.enqueueCommand(DZRenderCommand::SetClearColor(glm::vec3(0.1f, 0.1f, 0.2f)));
+        terrainPass(terrain_pipeline, 2, 1);
+
+        renderer.enqueueCommand(DZRenderCommand::SetPipeline(model_pipeline));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(scene_uniforms, 0)));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Vertex(scene_uniforms, 0)));
+        renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(light, 3)));
+        for (u32 i = 0; i < num_units; i++)
+        {
+            if (instanced)
+            {
+                const ModelInstance instance { glm::mat4(1.0f), 0, 0, 0, 0 };
+                for (DZMesh mesh : units[i])
+                    batcher.add(mesh, instance);
+                continue;
+            }
+
+            renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Vertex(unit_uniforms[i], 2)));
+            renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(unit_uniforms[i], 1)));
+            for (DZMesh mesh : units[i])
+                renderer.enqueueCommand(DZRenderCommand::DrawMesh(mesh));
+        }
+        if (instanced)
+            batcher.flush(renderer);
+
+        // The texture preview, over the texture array
+        renderer.enqueueCommand(DZRenderCommand::SetPipeline(gui_pipeline));
+        renderer.enqueueCommand(DZRenderCommand::BindTexture(Binding<DZTexture>::Fragment(texture, 0)));
+        renderer.enqueueCommand(DZRenderCommand::DrawMesh(unit_meshes[0]));
+
+        terrainPass(fow_pipeline, 1, 2);
+    };
+
+    const u32 num_frames = 20;
+    bool same = true;
+    for (bool instanced : { false, true })
+    {
+        std::vector<DZRenderCommand> recorded;
+        f64 execute_ms = 0.0;
+        f64 compile_ms = 0.0;
+        bool frames_same = true;
+        for (u32 frame = 0; frame < num_frames; frame++)
+        {
+            queueFrame(instanced);
+            recorded = renderer.command_queue;
+
+            renderer.compile_commands = false;
+            execute_ms += timeMs([&]{ renderer.executeCommandQueue(); });
+
+            renderer.command_queue = recorded;
+            renderer.compile_commands = true;
+            compile_ms += timeMs([&]{ renderer.executeCommandQueue(); });
+            frames_same = frames_same && DZCommandCompiler::sameDraws(recorded, null_backend.last_frame);
+        }
+        same = same && frames_same;
+
+        const CommandCompileStats &stats = renderer.getCompileStats();
+        Log::info("	%s: %u units, %u draws in %u passes, %u left in queue order",
+                instanced ? "instanced" : "per unit", num_units, stats.draws, stats.passes, stats.passes_in_queue_order);
+        Log::info("	commands:             %8u queued, %u executed", stats.commands_in, stats.commands_out);
+        Log::info("	dropped:              %8u pipelines, %u buffer binds, %u texture binds",
+                stats.pipelines_dropped, stats.buffer_binds_dropped, stats.texture_binds_dropped);
+        Log::info("	execute:              %8.3f ms/frame", execute_ms / num_frames);
+        Log::info("	compile + execute:    %8.3f ms/frame%s", compile_ms / num_frames,
+                frames_same ? "" : " MISMATCH");
+    }
+    renderer.compile_commands = false;
+    Log::info("	invalid handles:      %8u", null_backend.getStats().invalid_handles);
+
+    return !same;
+}
+
+u32 Bench::instancing(u32 seed)
+{
+    Log::info("Bench: instanced models (seed %u)", seed);
+
+    auto backend = std::make_unique<DZNullBackend>();
+    const DZNullBackend &null_backend = *backend;
+    DZRenderer renderer(std::move(backend));
+
+    const u32 num_meshes = 4;
+    std::vector<DZMesh> meshes;
+    for (u32 i = 0; i < num_meshes; i++)
+        meshes.push_back(renderer.createMesh(MeshData::UnitPlane()));
+
+    const u32 unit_counts[] = { 10, 100, 1000, 10000 };
+    const u32 num_frames = 20;
+
+    srand(seed);
+    for (u32 num_units : unit_counts)
+    {
+        entt::registry registry;
+        for (u32 i = 0; i < num_units; i++)
+        {
+            const entt::entity unit = registry.create();
+            Transform transform;
+            transform.pos = glm::vec3(rand() % 200, rand() % 200, 0.0f);
+            registry.emplace<Transform>(unit, transform);
+
+            // A body and sometimes a second part, from a few shared meshes
+            std::vector<DZMesh> parts { meshes[rand() % num_meshes] };
+            if (rand() % 2)
+                parts.push_back(meshes[rand() % num_meshes]);
+            registry.emplace<Model>(unit, Model { parts, false, false, MODEL_DEFAULT_RADIUS });
+        }
+
+        // What Model::render queued per entity
+        u32 separate_draws = 0;
+        registry.view<Model>().each([&](const auto &model) { separate_draws += model.meshes.size(); });
+
+        InstanceBatcher batcher;
+        const u64 draws_before = null_backend.getStats().draws;
+        const f64 ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                registry
+                    .view<Transform, Model>()
+                    .each(
+                            [&](const auto &transform, const auto &model)
+                            {
+                                const ModelInstance instance { transform.asMat4(), 0, 0, 0, 0 };
+                                for (DZMesh mesh : model.meshes)
+                                    batcher.add(mesh, instance);
+                            }
+                        );
+                batcher.flush(renderer);
+                renderer.executeCommandQueue();
+            }
+        });
+        const u64 draws = (null_backend.getStats().draws - draws_before) / num_frames;
+
+        Log::info("\t%5u units:          %8.3f ms/frame, %llu draws for %u instances (%u without instancing)",
+                num_units, ms / num_frames, (unsigned long long) draws, batcher.getInstanceCount(), separate_draws);
+    }
+
+    Log::info("\tinvalid handles:      %8u", null_backend.getStats().invalid_handles);
+
+    return 0;
+}
+
+u32 Bench::uniformRing()
+{
+    Log::info("Bench: uniform ring, %u frames in flight", FRAMES_IN_FLIGHT);
+
+    // A GPU two frames behind, the chunk uniforms of a frame written
+    // once into long lived buffers as before and once into the ring
+    const u32 num_frames = 100;
+    const u32 num_chunks = 9;
+    ChunkData chunk_data {};
+
+    auto run = [&](bool ring)
+    {
+        auto backend = std::make_unique<DZNullBackend>();
+        backend->latency = 2;
+        const DZNullBackend &null_backend = *backend;
+        DZRenderer renderer(std::move(backend));
+        renderer.validate_in_flight = true;
+
+        const std::vector<DZShader> shaders
+            = renderer.compileShaders("", { "vertexMain", "fragmentMain" });
+        const DZPipeline pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+        const DZMesh mesh = renderer.createMesh(MeshData::UnitPlane());
+
+        std::vector<DZBuffer> buffers;
+        for (u32 i = 0; i < num_chunks; i++)
+            buffers.push_back(renderer.createBufferOfSize(sizeof(ChunkData)));
+
+        const f64 ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                renderer.beginFrame();
+                renderer.enqueueCommand(DZRenderCommand::SetPipeline(pipeline));
+                for (u32 i = 0; i < num_chunks; i++)
+                {
+                    chunk_data.neighbour_slots[4] = frame * num_chunks + i;
+                    UniformSlice slice { buffers[i], 0 };
+                    if (ring)
+                        slice = renderer.allocateUniforms(&chunk_data, sizeof(ChunkData));
+                    else
+                        renderer.setBufferOfSize(buffers[i], &chunk_data, sizeof(ChunkData));
+
+                    renderer.enqueueCommand(DZRenderCommand::BindBuffer(
+                                Binding<DZBuffer>::Vertex(slice.buffer, 2, slice.offset)));
+                    renderer.enqueueCommand(DZRenderCommand::DrawMesh(mesh));
+                }
+                renderer.executeCommandQueue();
+            }
+        });
+
+        Log::info("\t%-21s %8.3f ms/frame, %u overwrites in flight, %u stalls, %u invalid handles",
+                ring ? "ring:" : "long lived buffers:", ms / num_frames,
+                renderer.getInFlightViolations(), null_backend.getStats().stalls,
+                null_backend.getStats().invalid_handles);
+    };
+
+    run(false);
+    run(true);
+
+    return 0;
+}
+
+u32 Bench::terrainTiles(u32 seed)
+{
+    Log::info("Bench: terrain tile uploads (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    const s32 radius = 3;
+    const u32 num_units = 200;
+    const u32 num_frames = 400;
+    // The camera crosses into the next chunk this often
+    const u32 frames_per_chunk = 25;
+
+    // Materials differ per chunk, so a chunk in the wrong slot shows
+    ChunkMap chunks = chunkGrid(seed, chunk_size, radius, true);
+    for (s32 x = -radius; x <= radius; x++)
+    {
+        for (s32 y = -radius; y <= radius; y++)
+        {
+            Chunk &chunk = *chunks.find(v2i { x, y });
+            for (u32 i = 0; i < TILES_PER_CHUNK; i++)
+                chunk.material_indices[i] = (u8) (i + x * 7 + y * 13);
+        }
+    }
+
+    auto backend = std::make_unique<DZNullBackend>();
+    backend->latency = 2;
+    const DZNullBackend &null_backend = *backend;
+    DZRenderer renderer(std::move(backend));
+    renderer.validate_in_flight = true;
+
+    const std::vector<DZShader> shaders
+        = renderer.compileShaders("", { "vertexMain", "fragmentMain" });
+    const DZPipeline pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+    const DZMesh mesh = renderer.createMesh(MeshData::UnitPlane());
+
+    TerrainTiles tiles(renderer);
+
+    entt::registry registry;
+    FogOfWar fog(registry, chunks, chunk_size);
+
+    // Units wander around the middle, the camera sweeps across and back
+    srand(seed);
+    auto frand = [] { return (f32) rand() / RAND_MAX * 2.0f - 1.0f; };
+    std::vector<entt::entity> units(num_units);
+    std::vector<v2f> velocities(num_units);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        units[i] = registry.create();
+        Transform &transform = registry.emplace<Transform>(units[i]);
+        transform.pos = glm::vec3(frand() * chunk_size * 1.5f, frand() * chunk_size * 1.5f, 0.0f);
+        registry.emplace<LineOfSight>(units[i], 5u);
+        velocities[i] = v2f { frand() * tile_width * 0.3f, frand() * tile_width * 0.3f };
+    }
+
+    u64 uploaded = 0;
+    u64 full_copy = 0;
+    u32 peak = 0;
+    u32 assigned = 0;
+    u32 mismatches = 0;
+
+    const f64 ms = timeMs([&]{
+        for (u32 frame = 0; frame < num_frames; frame++)
+        {
+            renderer.beginFrame();
+
+            for (u32 i = 0; i < num_units; i++)
+            {
+                Transform &transform = registry.get<Transform>(units[i]);
+                transform.pos.x += velocities[i].x;
+                transform.pos.y += velocities[i].y;
+                if (std::abs(transform.pos.x) > chunk_size * 1.5f)
+                    velocities[i].x = -velocities[i].x;
+                if (std::abs(transform.pos.y) > chunk_size * 1.5f)
+                    velocities[i].y = -velocities[i].y;
+            }
+            fog.update();
+
+            // -2 to 2 and back
+            const s32 leg = (s32) (frame / frames_per_chunk % 8);
+            const s32 center_x = leg <= 4 ? leg - 2 : 6 - leg;
+
+            std::vector<Chunk*> visible(9);
+            for (s32 i = 0; i < 9; i++)
+                visible[i] = chunks.find(v2i { center_x + i % 3 - 1, i / 3 - 1 });
+
+            const TerrainTileBindings bindings = tiles.upload(renderer, visible);
+            const TerrainUploadStats &stats = tiles.getStats();
+            const u32 bytes = stats.material_bytes + stats.los_bytes;
+            uploaded += bytes;
+            full_copy += stats.full_copy_bytes;
+            peak = std::max(peak, bytes);
+            assigned += stats.assigned;
+
+            // What the shaders would read through the neighbour slots
+            const auto &materials = null_backend.buffers[bindings.materials].contents;
+            const auto &los = null_backend.buffers[bindings.los].contents;
+            for (Chunk *chunk : visible)
+            {
+                const s32 slot = tiles.slotOf(chunk);
+                mismatches += slot == TERRAIN_NO_SLOT;
+                mismatches += memcmp(&materials[slot * TILES_PER_CHUNK], chunk->material_indices, TILES_PER_CHUNK) != 0;
+                mismatches += memcmp(&los[slot * TILES_PER_CHUNK], chunk->los_indices, TILES_PER_CHUNK) != 0;
+            }
+
+            renderer.enqueueCommand(DZRenderCommand::SetPipeline(pipeline));
+            renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(bindings.materials, 2)));
+            renderer.enqueueCommand(DZRenderCommand::BindBuffer(Binding<DZBuffer>::Fragment(bindings.los, 4)));
+            renderer.enqueueCommand(DZRenderCommand::DrawMesh(mesh));
+            renderer.executeCommandQueue();
+        }
+    });
+
+    registry.clear();
+
+    Log::info("\t%u units, %u frames, camera crosses a chunk border every %u frames",
+            num_units, num_frames, frames_per_chunk);
+    Log::info("\tcopying all visible:  %8.1f KB/frame", full_copy / 1024.0 / num_frames);
+    Log::info("\tdirty tiles:          %8.1f KB/frame (%.1fx less), %.1f KB peak, %u slots assigned, %8.3f ms/frame",
+            uploaded / 1024.0 / num_frames, (f64) full_copy / uploaded, peak / 1024.0, assigned, ms / num_frames);
+    Log::info("\t%u overwrites in flight, %u invalid handles%s",
+            renderer.getInFlightViolations(), null_backend.getStats().invalid_handles,
+            mismatches ? ", MISMATCH" : "");
+    if (mismatches)
+        Log::info("\t%u chunks differ from what was uploaded", mismatches);
+
+    return mismatches != 0;
+}
+
+u32 Bench::culling(u32 seed)
+{
+    Log::info("Bench: frustum culling (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 world_half = 1000.0f;
+    const f32 margin = ENTITY_CULL_MARGIN;
+    const u32 num_units = 10000;
+    const u32 num_frames = 50;
+    const glm::vec2 screen_dim(2560.0f, 1440.0f);
+    u32 failures = 0;
+
+    // Units over a world much wider than the view, a few metres tall
+    srand(seed);
+    auto frand = [] { return (f32) rand() / RAND_MAX * 2.0f - 1.0f; };
+
+    entt::registry registry;
+    SpatialHash spatial(registry, SPATIAL_CELL_SIZE);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        const entt::entity unit = registry.create();
+        Transform &transform = registry.emplace<Transform>(unit);
+        transform.pos = glm::vec3(frand() * world_half, frand() * world_half, (frand() + 1.0f) * 10.0f);
+        registry.emplace<Model>(unit, Model { {}, false, false, MODEL_DEFAULT_RADIUS });
+    }
+    spatial.update();
+
+    const f32 zooms[] = { 3.0f, 6.0f, 24.0f, 128.0f };
+    for (f32 zoom : zooms)
+    {
+        Camera camera;
+        camera.zoom_level = zoom;
+        camera.target = glm::vec3(frand() * world_half * 0.5f, frand() * world_half * 0.5f, 0.0f);
+        camera.position = camera.target + glm::vec3(10.0f, 10.0f, 10.0f);
+
+        const Frustum frustum = camera.getFrustum(screen_dim);
+
+        // Chunks, as Terrain::getVisible picks them
+        u32 chunks = 0;
+        u32 chunks_tested = 0;
+        const f64 chunk_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                chunks = 0;
+                chunks_tested = 0;
+                const std::optional<AArect2f> ground = frustum.groundBounds(0.0f, 20.0f);
+                if (!ground)
+                    continue;
+
+                const s32 x0 = (s32) std::floor(ground->pos.x / chunk_size);
+                const s32 y0 = (s32) std::floor(ground->pos.y / chunk_size);
+                const s32 x1 = (s32) std::floor((ground->pos.x + ground->dim.x) / chunk_size);
+                const s32 y1 = (s32) std::floor((ground->pos.y + ground->dim.y) / chunk_size);
+                for (s32 y = y0; y <= y1; y++)
+                {
+                    for (s32 x = x0; x <= x1; x++)
+                    {
+                        chunks_tested++;
+                        chunks += frustum.intersectsBox(
+                                glm::vec3(x * chunk_size, y * chunk_size, 0.0f),
+                                glm::vec3((x + 1) * chunk_size, (y + 1) * chunk_size, 20.0f));
+                    }
+                }
+            }
+        });
+
+        // Every entity against the frustum
+        u32 scanned = 0;
+        const f64 scan_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                scanned = 0;
+                registry
+                    .view<Transform, Model>()
+                    .each(
+                            [&](const Transform &transform, const Model &model)
+                            {
+                                scanned += frustum.intersectsSphere(transform.pos, model.radius);
+                            }
+                        );
+            }
+        });
+
+        // Only the cells under the frustum
+        auto nearFrustum = [&]() -> std::optional<AArect2f>
+        {
+            const std::optional<AArect2f> ground = frustum.groundBounds(-margin, 20.0f + margin);
+            if (!ground)
+                return std::nullopt;
+            return AArect2f {
+                v2f { ground->pos.x - margin, ground->pos.y - margin },
+                v2f { ground->dim.x + 2 * margin, ground->dim.y + 2 * margin }
+            };
+        };
+        u32 culled = 0;
+        u32 visited = 0;
+        const f64 hash_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                culled = 0;
+                visited = 0;
+                const std::optional<AArect2f> near = nearFrustum();
+                if (!near)
+                    continue;
+
+                spatial.forEachNear(*near, [&](entt::entity entity)
+                {
+                    visited++;
+                    const Model *model = registry.try_get<Model>(entity);
+                    if (model)
+                        culled += frustum.intersectsSphere(registry.get<Transform>(entity).pos, model->radius);
+                });
+            }
+        });
+
+        // As RenderSystem::models does, by cell unless the cells hold
+        // more than ENTITY_CULL_SCAN_FRACTION of the units
+        u32 picked = 0;
+        bool by_cell = false;
+        const f64 picked_ms = timeMs([&]{
+            for (u32 frame = 0; frame < num_frames; frame++)
+            {
+                picked = 0;
+                const std::optional<AArect2f> near = nearFrustum();
+                const u32 limit = spatial.getStats().entities * ENTITY_CULL_SCAN_FRACTION;
+                by_cell = near && spatial.forEachNearUpTo(*near, limit, [&](entt::entity entity)
+                {
+                    const Model *model = registry.try_get<Model>(entity);
+                    if (model)
+                        picked += frustum.intersectsSphere(registry.get<Transform>(entity).pos, model->radius);
+                });
+                if (by_cell)
+                    continue;
+
+                registry
+                    .view<Transform, Model>()
+                    .each(
+                            [&](const Transform &transform, const Model &model)
+                            {
+                                picked += frustum.intersectsSphere(transform.pos, model.radius);
+                            }
+                        );
+            }
+        });
+
+        Log::info("\tzoom %5.1f: %3u chunks of %3u tested (3x3 before), %8.4f ms",
+                zoom, chunks, chunks_tested, chunk_ms / num_frames);
+        Log::info("\t            %5u of %u units drawn, full scan %8.3f ms, spatial hash %8.3f ms (%u visited)",
+                culled, num_units, scan_ms / num_frames, hash_ms / num_frames, visited);
+        Log::info("\t            picked %-12s %8.3f ms%s",
+                by_cell ? "spatial hash" : "full scan", picked_ms / num_frames,
+                culled != scanned || picked != scanned ? ", MISMATCH" : "");
+        failures += (culled != scanned) + (picked != scanned);
+    }
+
+    registry.clear();
+
+    return failures;
+}
+
+u32 Bench::selection(u32 seed)
+{
+    Log::info("Bench: spatial queries and drag-box selection (seed %u)", seed);
+
+    const f32 world_half = 250.0f;
+    const u32 num_units = 10000;
+    const u32 num_queries = 200;
+    const u32 n_closest = 16;
+    const glm::vec2 screen_dim(1280.0f, 720.0f);
+
+    srand(seed);
+    auto frand = [] { return (f32) rand() / RAND_MAX * 2.0f - 1.0f; };
+
+    entt::registry registry;
+    SpatialHash spatial(registry, SPATIAL_CELL_SIZE);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        const entt::entity unit = registry.create();
+        Transform &transform = registry.emplace<Transform>(unit);
+        transform.pos = glm::vec3(frand() * world_half, frand() * world_half, 0.0f);
+        registry.emplace<Model>(unit, Model { {}, false, false, MODEL_DEFAULT_RADIUS });
+    }
+
+    const f64 build_ms = timeMs([&]{ spatial.update(); });
+
+    // Every unit takes a step, a few cross into the next cell
+    std::vector<v2f> velocities(num_units);
+    for (v2f &velocity : velocities)
+        velocity = v2f { frand() * 0.1f, frand() * 0.1f };
+    const f64 move_ms = timeMs([&]{
+        u32 i = 0;
+        registry.view<Transform>().each([&](Transform &transform)
+        {
+            transform.pos.x += velocities[i].x;
+            transform.pos.y += velocities[i].y;
+            i++;
+        });
+        spatial.update();
+    });
+
+    std::vector<v2f> centers(num_queries);
+    for (v2f &center : centers)
+        center = v2f { frand() * world_half, frand() * world_half };
+
+    auto posOf = [&](entt::entity entity)
+    {
+        const Transform &transform = registry.get<Transform>(entity);
+        return v2f { transform.pos.x, transform.pos.y };
+    };
+    auto sorted = [](std::vector<entt::entity> entities)
+    {
+        std::sort(entities.begin(), entities.end());
+        return entities;
+    };
+
+    u32 mismatches = 0;
+    u64 found = 0;
+    std::vector<entt::entity> hashed;
+    std::vector<entt::entity> scanned;
+
+    // Rects about a screen of units across
+    const f64 rect_ms = timeMs([&]{
+        for (const v2f &center : centers)
+        {
+            hashed.clear();
+            spatial.findInRect(AArect2f { center, v2f { 30.0f, 20.0f } }, hashed);
+            found += hashed.size();
+        }
+    });
+    auto scanRect = [&](v2f center)
+    {
+        scanned.clear();
+        registry.view<Transform>().each([&](entt::entity entity, const Transform &transform)
+        {
+            if (transform.pos.x >= center.x && transform.pos.x <= center.x + 30.0f
+                && transform.pos.y >= center.y && transform.pos.y <= center.y + 20.0f)
+                scanned.push_back(entity);
+        });
+    };
+    const f64 rect_scan_ms = timeMs([&]{
+        for (const v2f &center : centers)
+            scanRect(center);
+    });
+    for (const v2f &center : centers)
+    {
+        scanRect(center);
+        hashed.clear();
+        spatial.findInRect(AArect2f { center, v2f { 30.0f, 20.0f } }, hashed);
+        mismatches += sorted(hashed) != sorted(scanned);
+    }
+    Log::info("\t%u units: built in %.3f ms, moved and updated in %.3f ms (%u changed cell)",
+            num_units, build_ms, move_ms, spatial.getStats().moved);
+    Log::info("\trect 30x20:     %8.4f ms/query, %5.1f found (full scan %.4f ms)",
+            rect_ms / num_queries, (f64) found / num_queries, rect_scan_ms / num_queries);
+
+    found = 0;
+    const f64 radius_ms = timeMs([&]{
+        for (const v2f &center : centers)
+        {
+            hashed.clear();
+            spatial.findInRadius(center, 12.0f, hashed);
+            found += hashed.size();
+        }
+    });
+    for (const v2f &center : centers)
+    {
+        scanned.clear();
+        registry.view<Transform>().each([&](entt::entity entity, const Transform &)
+        {
+            if (posOf(entity).distanceSqFrom(center) <= 12.0 * 12.0)
+                scanned.push_back(entity);
+        });
+        hashed.clear();
+        spatial.findInRadius(center, 12.0f, hashed);
+        mismatches += sorted(hashed) != sorted(scanned);
+    }
+    Log::info("\tradius 12:      %8.4f ms/query, %5.1f found",
+            radius_ms / num_queries, (f64) found / num_queries);
+
+    const f64 nearest_ms = timeMs([&]{
+        for (const v2f &center : centers)
+            found += spatial.findNClosest(center, n_closest).size();
+    });
+    for (const v2f &center : centers)
+    {
+        std::vector<std::pair<f64, entt::entity>> all;
+        registry.view<Transform>().each([&](entt::entity entity, const Transform &)
+        {
+            all.emplace_back(posOf(entity).distanceSqFrom(center), entity);
+        });
+        std::partial_sort(all.begin(), all.begin() + n_closest, all.end());
+
+        const std::vector<entt::entity> nearest = spatial.findNClosest(center, n_closest);
+        for (u32 i = 0; i < n_closest; i++)
+            mismatches += posOf(nearest[i]).distanceSqFrom(center) != all[i].first;
+    }
+    Log::info("\t%u closest:     %8.4f ms/query", n_closest, nearest_ms / num_queries);
+
+    // Drag boxes of a few sizes over a view of the middle
+    Camera camera;
+    camera.zoom_level = 12.0f;
+    GUI gui;
+
+    const v2i boxes[] = { v2i { 0, 0 }, v2i { 200, 150 }, v2i { 1280, 720 } };
+    for (v2i box : boxes)
+    {
+        gui.selection.pos = v2i { 640 - box.x / 2, 360 - box.y / 2 };
+        gui.selection.dim = box;
+
+        std::vector<entt::entity> selected;
+        const f64 select_ms = timeMs([&]{
+            for (u32 i = 0; i < num_queries; i++)
+                selected = gui.select_units(registry, spatial, camera, screen_dim, 0.0f, 0.0f);
+        });
+
+        const Frustum frustum = gui.selection_frustum(camera, screen_dim);
+        scanned.clear();
+        registry.view<Transform, Model>().each([&](entt::entity entity, const Transform &transform, const Model &model)
+        {
+            if (frustum.intersectsSphere(transform.pos, model.radius))
+                scanned.push_back(entity);
+        });
+        mismatches += sorted(selected) != sorted(scanned);
+
+        Log::info("\tdrag box %4dx%-4d %8.4f ms, %5zu selected",
+                box.x, box.y, select_ms / num_queries, selected.size());
+    }
+
+    // Entities that lost their Transform since the last update are
+    // still in their cells, queries skip them
+    std::vector<entt::entity> stripped;
+    for (entt::entity entity : registry.view<Transform>())
+    {
+        stripped.push_back(entity);
+        if (stripped.size() == num_units / 10)
+            break;
+    }
+    registry.remove<Transform>(stripped.begin(), stripped.end());
+    std::sort(stripped.begin(), stripped.end());
+
+    u32 found_stripped = 0;
+    auto countStripped = [&](const std::vector<entt::entity> &entities)
+    {
+        for (entt::entity entity : entities)
+            found_stripped += std::binary_search(stripped.begin(), stripped.end(), entity);
+    };
+    for (const v2f &center : centers)
+    {
+        hashed.clear();
+        spatial.findInRect(AArect2f { center, v2f { 30.0f, 20.0f } }, hashed);
+        spatial.findInRadius(center, 12.0f, hashed);
+        countStripped(hashed);
+        countStripped(spatial.findNClosest(center, n_closest));
+    }
+    countStripped(gui.select_units(registry, spatial, camera, screen_dim, 0.0f, 0.0f));
+    mismatches += found_stripped;
+
+    Log::info("\t%u differ from a full scan, %u without a Transform found%s",
+            mismatches - found_stripped, found_stripped, mismatches ? ", MISMATCH" : "");
+    registry.clear();
+
+    return mismatches;
+}
+
+u32 Bench::separation(u32 seed)
+{
+    Log::info("Bench: separation steering (seed %u)", seed);
+
+    const u32 num_units = 5000;
+    const u32 num_ticks = 200;
+    const u32 num_checked = 200;
+    // Per tick, units are a world unit across
+    const f32 step = 0.5f;
+
+    srand(seed);
+    auto frand = [] { return (f32) rand() / RAND_MAX * 2.0f - 1.0f; };
+
+    std::vector<f32> start_x(num_units);
+    std::vector<f32> start_y(num_units);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        start_x[i] = frand() * 100.0f;
+        start_y[i] = frand() * 100.0f;
+    }
+
+    // Every unit heads for the origin, as unitMovement would without
+    // terrain in the way
+    auto move = [&](Separation &separation, bool avoid)
+    {
+        for (size_t i = 0; i < separation.xs.size(); i++)
+        {
+            const f32 to_x = -separation.xs[i];
+            const f32 to_y = -separation.ys[i];
+            const f32 to_length = std::sqrt(to_x * to_x + to_y * to_y);
+
+            f32 dir_x = to_length > 0.0f ? to_x / to_length : 0.0f;
+            f32 dir_y = to_length > 0.0f ? to_y / to_length : 0.0f;
+            if (avoid)
+            {
+                dir_x += separation.push_x[i] * SEPARATION_WEIGHT;
+                dir_y += separation.push_y[i] * SEPARATION_WEIGHT;
+            }
+
+            const f32 length = std::sqrt(dir_x * dir_x + dir_y * dir_y);
+            const f32 scale = std::min(step, to_length) / std::max(length, 1.0f);
+            separation.xs[i] += dir_x * scale;
+            separation.ys[i] += dir_y * scale;
+        }
+    };
+
+    // Pairs less than half a unit apart, drawn on top of each other
+    auto overlapping = [&](const Separation &separation)
+    {
+        u32 pairs = 0;
+        for (u32 i = 0; i < num_units; i++)
+        {
+            for (u32 j = i + 1; j < num_units; j++)
+            {
+                const f32 dx = separation.xs[i] - separation.xs[j];
+                const f32 dy = separation.ys[i] - separation.ys[j];
+                pairs += dx * dx + dy * dy < 0.25f;
+            }
+        }
+        return pairs;
+    };
+
+    ThreadPool pool(ThreadPool::defaultThreadCount());
+
+    auto run = [&](bool avoid, ThreadPool *jobs, f64 &compute_ms)
+    {
+        Separation separation(SEPARATION_RADIUS);
+        separation.xs = start_x;
+        separation.ys = start_y;
+
+        compute_ms = 0.0;
+        for (u32 tick = 0; tick < num_ticks; tick++)
+        {
+            compute_ms += timeMs([&]{ separation.compute(jobs); });
+            move(separation, avoid);
+        }
+        compute_ms /= num_ticks;
+
+        return separation;
+    };
+
+    f64 unused_ms;
+    f64 single_ms;
+    f64 parallel_ms;
+    const Separation stacked = run(false, nullptr, unused_ms);
+    const Separation single = run(true, nullptr, single_ms);
+    const Separation parallel = run(true, &pool, parallel_ms);
+
+    // The grid against every pair, for the final crowd
+    Separation check(SEPARATION_RADIUS);
+    check.xs = single.xs;
+    check.ys = single.ys;
+    check.compute(nullptr);
+
+    f32 worst_error = 0.0f;
+    for (u32 i = 0; i < num_checked; i++)
+    {
+        f32 sum_x = 0.0f;
+        f32 sum_y = 0.0f;
+        for (u32 j = 0; j < num_units; j++)
+        {
+            const f32 dx = check.xs[i] - check.xs[j];
+            const f32 dy = check.ys[i] - check.ys[j];
+            const f32 dist_sq = dx * dx + dy * dy;
+            if (j == i || dist_sq >= SEPARATION_RADIUS * SEPARATION_RADIUS)
+                continue;
+            const f32 weight = 1.0f / std::sqrt(dist_sq + 1e-12f) - 1.0f / SEPARATION_RADIUS;
+            sum_x += dx * weight;
+            sum_y += dy * weight;
+        }
+        const f32 length = std::sqrt(sum_x * sum_x + sum_y * sum_y);
+        if (length > 1.0f)
+        {
+            sum_x /= length;
+            sum_y /= length;
+        }
+        worst_error = std::max({ worst_error, std::abs(sum_x - check.push_x[i]), std::abs(sum_y - check.push_y[i]) });
+    }
+
+    u32 differ = 0;
+    for (u32 i = 0; i < num_units; i++)
+        differ += single.xs[i] != parallel.xs[i] || single.ys[i] != parallel.ys[i];
+
+    const SeparationStats &stats = check.getStats();
+    Log::info("\t%u units converging for %u ticks, %u cells of %.2f at the end",
+            num_units, num_ticks, stats.cells, stats.cell_size);
+    Log::info("\tone core:     %8.3f ms/tick", single_ms);
+    Log::info("\t%2u threads:   %8.3f ms/tick, %u units end up elsewhere",
+            pool.size() + 1, parallel_ms, differ);
+    Log::info("\toverlapping pairs: %u without separation, %u with", overlapping(stacked), overlapping(single));
+    Log::info("\tgrid against all pairs: %.2e worst difference%s",
+            worst_error, worst_error > 1e-3f ? ", MISMATCH" : "");
+
+    return worst_error > 1e-3f;
+}
+
+u32 Bench::chunkDeterminism(u32 seed)
+{
+    Log::info("Bench: chunk generation order (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const s32 radius = 2;
+
+    std::vector<v2i> coords;
+    for (s32 y = -radius; y <= radius; y++)
+        for (s32 x = -radius; x <= radius; x++)
+            coords.push_back(v2i { x, y });
+
+    // Everything generation fills in, byte for byte
+    auto contents = [](const Chunk &chunk)
+    {
+        std::vector<u8> bytes;
+        auto append = [&](const void *data, size_t size)
+        {
+            const u8 *first = (const u8 *) data;
+            bytes.insert(bytes.end(), first, first + size);
+        };
+        append(chunk.material_indices, sizeof(chunk.material_indices));
+        append(chunk.navigable, sizeof(chunk.navigable));
+        append(chunk.heights.data(), chunk.heights.size() * sizeof(f32));
+        append(chunk.vertices.data(), chunk.vertices.size() * sizeof(TerrainVertex));
+        append(&chunk.min_height, sizeof(f32));
+        append(&chunk.max_height, sizeof(f32));
+        return bytes;
+    };
+
+    auto generate = [&](const KDTree &kd, v2i coord)
+    {
+        return contents(Chunk(v2f { coord.x * chunk_size, coord.y * chunk_size }, seed, chunk_size, kd));
+    };
+
+    KDTree kd;
+    kd.add(Terrain::generateBiomePoints(seed));
+
+    std::vector<std::vector<u8>> in_order(coords.size());
+    const f64 ms = timeMs([&]{
+        for (size_t i = 0; i < coords.size(); i++)
+            in_order[i] = generate(kd, coords[i]);
+    });
+
+    u32 differ = 0;
+
+    // Shuffled, with the global rand() state disturbed in between, and
+    // from fresh biome points
+    KDTree again;
+    again.add(Terrain::generateBiomePoints(seed));
+
+    std::vector<size_t> order(coords.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(seed));
+
+    srand(seed + 1);
+    for (size_t i : order)
+    {
+        rand();
+        differ += generate(again, coords[i]) != in_order[i];
+    }
+
+    // All at once on the pool
+    ThreadPool pool(ThreadPool::defaultThreadCount());
+    std::vector<std::vector<u8>> parallel(coords.size());
+    pool.parallelFor(coords.size(), 1, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; i++)
+            parallel[order[i]] = generate(kd, coords[order[i]]);
+    });
+    for (size_t i = 0; i < coords.size(); i++)
+        differ += parallel[i] != in_order[i];
+
+    // Another seed has to change the world
+    u32 same_as_other_seed = 0;
+    KDTree other;
+    other.add(Terrain::generateBiomePoints(seed + 1));
+    for (size_t i = 0; i < coords.size(); i++)
+    {
+        const Chunk chunk(v2f { coords[i].x * chunk_size, coords[i].y * chunk_size }, seed + 1, chunk_size, other);
+        same_as_other_seed += contents(chunk) == in_order[i];
+    }
+
+    Log::info("\t%zu chunks, %8.3f ms each, %zu bytes compared per chunk",
+            coords.size(), ms / coords.size(), in_order[0].size());
+    Log::info("\t%u differ when shuffled or in parallel, %u the same with seed %u%s",
+            differ, same_as_other_seed, seed + 1,
+            differ || same_as_other_seed ? ", MISMATCH" : "");
+
+    return differ + same_as_other_seed;
+}
+
+u32 Bench::chunkStore(u32 seed)
+{
+    Log::info("Bench: chunk store (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const s32 radius = 2;
+    const std::string directory = (std::filesystem::temp_directory_path() / "dz_bench_chunk_store").string();
+    std::filesystem::remove_all(directory);
+
+    std::vector<v2i> coords;
+    for (s32 y = -radius; y <= radius; y++)
+        for (s32 x = -radius; x <= radius; x++)
+            coords.push_back(v2i { x, y });
+
+    KDTree kd;
+    kd.add(Terrain::generateBiomePoints(seed));
+
+    auto same = [](const Chunk &a, const Chunk &b)
+    {
+        return a.heights == b.heights
+            && memcmp(a.material_indices, b.material_indices, sizeof(a.material_indices)) == 0
+            && memcmp(a.navigable, b.navigable, sizeof(a.navigable)) == 0
+            && memcmp(a.los_indices, b.los_indices, sizeof(a.los_indices)) == 0
+            && memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(TerrainVertex)) == 0
+            && a.min_height == b.min_height
+            && a.max_height == b.max_height;
+    };
+
+    // Some explored tiles, as an evicted chunk would have
+    std::vector<Chunk> generated;
+    const f64 generate_ms = timeMs([&]{
+        for (v2i coord : coords)
+            generated.emplace_back(v2f { coord.x * chunk_size, coord.y * chunk_size }, seed, chunk_size, kd);
+    });
+    for (Chunk &chunk : generated)
+        memset(chunk.los_indices, LOS_EXPLORED, TILES_PER_SIDE * 8);
+
+    u32 mismatches = 0;
+    f64 save_ms;
+    {
+        ChunkStore store(directory, seed, chunk_size);
+        save_ms = timeMs([&]{
+            for (size_t i = 0; i < coords.size(); i++)
+                store.save(coords[i], generated[i]);
+        });
+        store.flush();
+    }
+
+    // A fresh store, as on the next run, with the files in the page cache
+    ChunkStoreStats stats;
+    f64 load_ms;
+    {
+        ChunkStore store(directory, seed, chunk_size);
+        std::vector<std::optional<Chunk>> loaded(coords.size());
+        load_ms = timeMs([&]{
+            for (size_t i = 0; i < coords.size(); i++)
+                loaded[i] = store.load(coords[i]);
+        });
+
+        for (size_t i = 0; i < coords.size(); i++)
+            mismatches += !loaded[i] || !same(*loaded[i], generated[i]);
+
+        // Never saved
+        mismatches += store.load(v2i { radius + 1, 0 }).has_value();
+        stats = store.getStats();
+    }
+
+    // One flipped byte in a record, then a region from another version
+    const std::string region_path = directory + "/" + std::to_string(seed) + "/r.0.0.dzr";
+    u32 corrupt = 0;
+    u32 restarted = 0;
+    {
+        std::fstream file(region_path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(REGION_HEADER_BYTES + offsetof(ChunkRecord, navigable) + 100);
+        file.put((char) 0x5a);
+    }
+    {
+        ChunkStore store(directory, seed, chunk_size);
+        mismatches += store.load(v2i { 0, 0 }).has_value();
+        mismatches += !store.load(v2i { 1, 0 }).has_value();
+        corrupt = store.getStats().corrupt;
+    }
+    {
+        std::fstream file(region_path, std::ios::in | std::ios::out | std::ios::binary);
+        const u32 old_version = CHUNK_STORE_VERSION + 1;
+        file.seekp(offsetof(RegionHeader, version));
+        file.write((const char *) &old_version, sizeof(old_version));
+    }
+    {
+        ChunkStore store(directory, seed, chunk_size);
+        mismatches += store.load(v2i { 1, 0 }).has_value();
+        restarted = store.getStats().misses;
+    }
+
+    u64 disk_bytes = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(directory + "/" + std::to_string(seed)))
+    {
+        struct stat info;
+        if (stat(entry.path().c_str(), &info) == 0)
+            disk_bytes += (u64) info.st_blocks * 512;
+    }
+    std::filesystem::remove_all(directory);
+
+    Log::info("\t%zu chunks in %u regions", coords.size(), stats.regions);
+    Log::info("\tcold, generated:  %8.3f ms/chunk", generate_ms / coords.size());
+    Log::info("\tsaved:            %8.3f ms/chunk", save_ms / coords.size());
+    Log::info("\twarm, mapped:     %8.3f ms/chunk (%.0fx faster than generating)",
+            load_ms / coords.size(), generate_ms / load_ms);
+    Log::info("\t%.1f KB on disk per chunk, %u corrupt and %u restarted detected%s",
+            disk_bytes / 1024.0 / coords.size(), corrupt, restarted,
+            mismatches || corrupt != 1 || restarted != 1 ? ", MISMATCH" : "");
+
+    return mismatches + (corrupt != 1) + (restarted != 1);
+}
+
+u32 Bench::worldSave(u32 seed)
+{
+    Log::info("Bench: world save (seed %u)", seed);
+
+    const f32 chunk_size = 100.0f;
+    const f32 world_half = 1000.0f;
+    const u32 num_units = 10000;
+    const std::string path = (std::filesystem::temp_directory_path() / "dz_bench_world.dzsave").string();
+
+    auto backend = std::make_unique<DZNullBackend>();
+    DZRenderer renderer(std::move(backend));
+
+    // A few kinds of unit, and ids reused after deaths so some entities
+    // have later versions
+    std::vector<Model> kinds;
+    for (u32 i = 0; i < 4; i++)
+    {
+        std::vector<DZMesh> meshes;
+        for (u32 j = 0; j <= i; j++)
+            meshes.push_back(renderer.createMesh(MeshData::UnitPlane()));
+        kinds.push_back(Model { meshes, i % 2 == 0, i > 0, 1.0f + i });
+    }
+
+    srand(seed);
+    auto frand = [] { return (f32) rand() / RAND_MAX * 2.0f - 1.0f; };
+
+    entt::registry registry;
+    std::vector<entt::entity> units;
+    for (u32 i = 0; i < num_units + num_units / 10; i++)
+    {
+        const entt::entity unit = registry.create();
+        Transform &transform = registry.emplace<Transform>(unit);
+        transform.pos = glm::vec3(frand() * world_half, frand() * world_half, frand() * 5.0f);
+        transform.rotation.z = frand() * 3.14159f;
+        registry.emplace<MoveSpeed>(unit, (u32) (rand() % 10 + 1));
+        registry.emplace<Health>(unit, (u32) (rand() % 100));
+        registry.emplace<Team>(unit, (u32) (rand() % 4));
+        registry.emplace<Model>(unit, kinds[rand() % kinds.size()]);
+        if (i % 3 == 0)
+            registry.emplace<LineOfSight>(unit, (u32) (rand() % 15 + 1));
+        units.push_back(unit);
+    }
+    for (u32 i = 0; i < num_units / 5; i++)
+        registry.destroy(units[i * 5]);
+    for (u32 i = 0; i < num_units / 10; i++)
+    {
+        const entt::entity unit = registry.create();
+        registry.emplace<Transform>(unit);
+        registry.emplace<Model>(unit, kinds[0]);
+    }
+
+    // Explored tiles on resident chunks and on ones evicted earlier
+    Terrain terrain(renderer, chunk_size, seed);
+    KDTree kd;
+    kd.add(Terrain::generateBiomePoints(seed));
+    for (s32 y = -1; y <= 1; y++)
+    {
+        for (s32 x = -1; x <= 1; x++)
+        {
+            Chunk &chunk = terrain.chunks.insert(v2i { x, y },
+                    Chunk(v2f { x * chunk_size, y * chunk_size }, seed, chunk_size, kd));
+            memset(chunk.los_indices, LOS_EXPLORED, TILES_PER_SIDE * (x + 2) * 8);
+        }
+    }
+    for (s32 i = 0; i < 16; i++)
+    {
+        PersistedChunk &saved = terrain.persisted[v2i { 5 + i % 4, 5 + i / 4 }];
+        memset(saved.los_indices, LOS_EXPLORED, sizeof(saved.los_indices));
+        memset(saved.navigable, i % 2, sizeof(saved.navigable));
+    }
+
+    Camera camera;
+    camera.target = glm::vec3(120.0f, -40.0f, 0.0f);
+    camera.position = camera.target + glm::vec3(10.0f, 10.0f, 10.0f);
+    camera.zoom_level = 42.0f;
+
+    auto ids = [](const entt::registry &registry)
+    {
+        const auto &entities = *registry.storage<entt::entity>();
+        return std::make_pair(std::vector<entt::entity>(entities.data(), entities.data() + entities.size()), entities.free_list());
+    };
+
+    const std::vector<u8> before = WorldSaver::snapshot(registry, terrain, camera);
+    const auto ids_before = ids(registry);
+
+    WorldSaver saver;
+    const f64 save_ms = timeMs([&]{ saver.save(registry, terrain, camera, path); });
+    const bool written = saver.wait();
+    const WorldSaveStats stats = saver.getStats();
+
+    // Play on a little before loading
+    registry.view<Transform>().each([](Transform &transform) { transform.pos.x += 1.0f; });
+    for (u32 i = 0; i < 100; i++)
+        registry.destroy(units[i * 5 + 1]);
+    (void) registry.create();
+    terrain.clear(renderer);
+    camera.target = glm::vec3(0.0f);
+
+    u32 mismatches = !written;
+    bool loaded = false;
+    const f64 load_ms = timeMs([&]{ loaded = saver.load(path, registry, terrain, camera, renderer); });
+    mismatches += !loaded;
+    mismatches += WorldSaver::snapshot(registry, terrain, camera) != before;
+    mismatches += ids(registry) != ids_before;
+
+    // One flipped byte, the world is left as it was
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(sizeof(WorldSaveHeader) + 1000);
+        file.put((char) 0x5a);
+    }
+    registry.view<Transform>().each([](Transform &transform) { transform.pos.x += 1.0f; });
+    const std::vector<u8> played = WorldSaver::snapshot(registry, terrain, camera);
+    mismatches += saver.load(path, registry, terrain, camera, renderer);
+    mismatches += WorldSaver::snapshot(registry, terrain, camera) != played;
+
+    // A valid checksum over entities that do not read back, the last
+    // Model index is out of range
+    {
+        std::vector<u8> malformed = before;
+        const size_t entities_end = malformed.size() - sizeof(u32) - stats.chunks * (sizeof(v2i) + 2 * TILES_PER_CHUNK);
+        memset(malformed.data() + entities_end - sizeof(u32), 0xff, sizeof(u32));
+
+        WorldSaveHeader header;
+        memcpy(&header, malformed.data(), sizeof(header));
+        header.checksum = ChunkStore::checksum(malformed.data() + sizeof(header), header.payload_bytes);
+        memcpy(malformed.data(), &header, sizeof(header));
+
+        mismatches += WorldSaver::restore(malformed, registry, terrain, camera, renderer);
+        mismatches += WorldSaver::snapshot(registry, terrain, camera) != played;
+    }
+
+    std::filesystem::remove(path);
+
+    // With a ChunkStore, as the game world has. Chunks evicted into it
+    // before the save are explored further after it, another is stored
+    // for the first time and the resident one is cleared into the store.
+    const std::string directory = (std::filesystem::temp_directory_path() / "dz_bench_world_store").string();
+    std::filesystem::remove_all(directory);
+    WorldSaveStats store_stats {};
+    u32 store_mismatches = 0;
+    {
+        Terrain stored(renderer, chunk_size, seed, directory);
+        auto explored = [&](v2i coord, u32 rows)
+        {
+            Chunk chunk(v2f { coord.x * chunk_size, coord.y * chunk_size }, seed, chunk_size, kd);
+            memset(chunk.los_indices, LOS_EXPLORED, TILES_PER_SIDE * rows);
+            return chunk;
+        };
+
+        for (s32 i = 0; i < 8; i++)
+            stored.store->save(v2i { 10 + i, 0 }, explored(v2i { 10 + i, 0 }, i + 1));
+        stored.chunks.insert(v2i { 0, 0 }, explored(v2i { 0, 0 }, 4));
+
+        const std::vector<u8> saved = WorldSaver::snapshot(registry, stored, camera, &store_stats);
+        store_mismatches += store_stats.chunks != 9;
+
+        stored.store->save(v2i { 10, 0 }, explored(v2i { 10, 0 }, TILES_PER_SIDE));
+        stored.store->save(v2i { 30, 0 }, explored(v2i { 30, 0 }, TILES_PER_SIDE));
+        stored.clear(renderer);
+        store_mismatches += !stored.store->load(v2i { 0, 0 }).has_value();
+
+        store_mismatches += !WorldSaver::restore(saved, registry, stored, camera, renderer);
+        store_mismatches += WorldSaver::snapshot(registry, stored, camera) != saved;
+        store_mismatches += stored.store->load(v2i { 30, 0 }).has_value();
+
+        const std::optional<Chunk> evicted = stored.store->load(v2i { 10, 0 });
+        const Chunk expected = explored(v2i { 10, 0 }, 1);
+        store_mismatches += !evicted
+            || memcmp(evicted->los_indices, expected.los_indices, sizeof(expected.los_indices)) != 0;
+    }
+    std::filesystem::remove_all(directory);
+    mismatches += store_mismatches;
+
+    Log::info("\t%u entities, %u models, %u chunks, %.1f KB",
+            stats.entities, stats.models, stats.chunks, stats.bytes / 1024.0);
+    Log::info("\tsave %.2f ms on the game thread (snapshot %.2f ms), %.2f ms writing in the background",
+            save_ms, stats.snapshot_ms, stats.write_ms);
+    Log::info("\twith a chunk store: %u chunks, snapshot %.2f ms, %u mismatches",
+            store_stats.chunks, store_stats.snapshot_ms, store_mismatches);
+    Log::info("\tload %.2f ms, %u mismatches%s",
+            load_ms, mismatches, mismatches ? ", MISMATCH" : "");
+
+    return mismatches;
+}
@@ -92,27 +92,7 @@ glm::vec3 Camera::getViewDirection() const
     return this->position - this->target;
 }
 
-std::array<glm::vec3, 4> Camera::getFrustrumBounds(glm::vec2 screen_dim) const
+Frustum Camera::getFrustum(glm::vec2 screen_dim) const
 {
-    glm::vec3 view_dir  = this->getViewDirection();
-    glm::vec3 left_vec = glm::cross(view_dir, glm::vec3(0.0f, 0.0f, 1.0f));
-    glm::vec3 camera_up = glm::cross(left_vec, view_dir);
-
-    left_vec = glm::normalize(left_vec);
-    camera_up = glm::normalize(camera_up);
-
-    return {
-        this->position 
-            + screen_dim.y / this->zoom_level * camera_up
-            + screen_dim.x / this->zoom_level * left_vec,
-        this->position 
-            + screen_dim.y / this->zoom_level * camera_up
-            - screen_dim.x / this->zoom_level * left_vec,
-        this->position 
-            - screen_dim.y / this->zoom_level * camera_up
-            - screen_dim.x / this->zoom_level * left_vec,
-        this->position 
-            - screen_dim.y / this->zoom_level * camera_up
-            + screen_dim.x / this->zoom_level * left_vec,
-    };
+    return Frustum::fromMatrix(this->getProjectionMatrix(screen_dim) * this->getViewMatrix());
 }
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+#include "chunk_generator.h"
+#include "logger.h"
+
+ChunkGenerator::ChunkGenerator(
+        u32 seed,
+        f32 chunk_size,
+        const KDTree &kd,
+        u32 num_workers,
+        ChunkStore *store
+    )
+    : seed { seed }
+    , chunk_size { chunk_size }
+    , kd { kd }
+    , store { store }
+    , focus { 0.0f, 0.0f }
+    , building { 0 }
+    , generated { 0 }
+    , loaded { 0 }
+    , total_generation_ms { 0.0 }
+    , generated_this_window { 0 }
+    , chunks_per_second { 0.0 }
+    , window_start { std::chrono::steady_clock::now() }
+    , pool { std::make_unique<ThreadPool>(num_workers) }
+{
+    Log::verbose("Chunk generator started with %d workers", pool->size());
+}
+
+bool ChunkGenerator::request(v2f origin)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.contains(origin))
+            return false;
+
+        pending.insert(origin);
+        queued.push_back(origin);
+    }
+
+    // One job per request, the job itself decides which origin to build
+    pool->enqueue([this]{ generateNext(); });
+    return true;
+}
+
+bool ChunkGenerator::isPending(v2f origin)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.contains(origin);
+}
+
+void ChunkGenerator::setFocus(v2f focus)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->focus = focus;
+}
+
+std::vector<std::pair<v2f, Chunk>> ChunkGenerator::collect()
+{
+    std::vector<std::pair<v2f, Chunk>> ret;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    ret.swap(completed);
+    for (const auto &entry : ret)
+        pending.erase(entry.first);
+
+    generated_this_window += ret.size();
+
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> window = now - window_start;
+    if (window.count() >= 1.0)
+    {
+        chunks_per_second = generated_this_window / window.count();
+        if (generated_this_window > 0)
+        {
+            Log::verbose("Chunk generation: %.1f chunks/s (%.2f ms/chunk avg)",
+                    chunks_per_second,
+                    total_generation_ms / generated);
+        }
+        generated_this_window = 0;
+        window_start = now;
+    }
+
+    return ret;
+}
+
+void ChunkGenerator::cancel()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (const v2f &origin : queued)
+        pending.erase(origin);
+    queued.clear();
+
+    built.wait(lock, [&]{ return building == 0; });
+    for (const auto &entry : completed)
+        pending.erase(entry.first);
+    completed.clear();
+}
+
+ChunkGenStats ChunkGenerator::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ChunkGenStats {
+        generated,
+        loaded,
+        chunks_per_second,
+        generated ? total_generation_ms / generated : 0.0
+    };
+}
+
+void ChunkGenerator::generateNext()
+{
+    v2f origin;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queued.empty())
+            return;
+
+        auto nearest = std::min_element(
+                queued.begin(),
+                queued.end(),
+                [&](const v2f &a, const v2f &b)
+                {
+                    return a.distanceSqFrom(focus) < b.distanceSqFrom(focus);
+                }
+            );
+        origin = *nearest;
+        queued.erase(nearest);
+        building++;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Origins are whole multiples of chunk_size
+    const v2i coord {
+        (s32) std::floor(origin.x / chunk_size + 0.5f),
+        (s32) std::floor(origin.y / chunk_size + 0.5f)
+    };
+
+    std::optional<Chunk> saved;
+    if (store)
+        saved = store->load(coord);
+
+    const bool from_store = saved.has_value();
+    if (!saved)
+    {
+        saved.emplace(origin, seed, chunk_size, kd);
+        if (store)
+            store->save(coord, *saved);
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> elapsed = end - start;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    completed.emplace_back(origin, std::move(*saved));
+    generated += 1;
+    loaded += from_store;
+    total_generation_ms += elapsed.count();
+    building--;
+    built.notify_all();
+}
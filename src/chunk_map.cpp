@@ -0,0 +1,137 @@
+#include "chunk_map.h"
+#include "terrain.h"
+
+// Keeps probe sequences short, the table is tiny next to the chunks
+#define CHUNK_MAP_INITIAL_CAPACITY (256)
+#define CHUNK_MAP_MAX_LOAD (0.5)
+
+ChunkMap::ChunkMap()
+    : slots(CHUNK_MAP_INITIAL_CAPACITY)
+    , count { 0 }
+    , change_epoch { 0 }
+{
+}
+
+ChunkMap::~ChunkMap() = default;
+
+u32 ChunkMap::hash(v2i coord)
+{
+    u64 key = (u64) (u32) coord.x | (u64) (u32) coord.y << 32;
+    key *= 0x9e3779b97f4a7c15ull;
+    return (u32) (key >> 32);
+}
+
+// Slot holding coord, or the empty slot where it would go
+u32 ChunkMap::probe(v2i coord) const
+{
+    const u32 mask = slots.size() - 1;
+    u32 i = hash(coord) & mask;
+
+    while (slots[i].chunk
+           && (slots[i].coord.x != coord.x || slots[i].coord.y != coord.y))
+    {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+Chunk *ChunkMap::find(v2i coord) const
+{
+    return slots[probe(coord)].chunk.get();
+}
+
+bool ChunkMap::contains(v2i coord) const
+{
+    return this->find(coord) != nullptr;
+}
+
+Chunk &ChunkMap::insert(v2i coord, Chunk &&chunk)
+{
+    if (count + 1 > slots.size() * CHUNK_MAP_MAX_LOAD)
+        grow();
+
+    Slot &slot = slots[probe(coord)];
+    if (!slot.chunk)
+    {
+        slot.coord = coord;
+        slot.chunk = std::make_unique<Chunk>(std::move(chunk));
+        count++;
+        change_epoch++;
+        slot.inserted_at = change_epoch;
+    }
+
+    return *slot.chunk;
+}
+
+bool ChunkMap::erase(v2i coord)
+{
+    const u32 mask = slots.size() - 1;
+    u32 hole = probe(coord);
+
+    if (!slots[hole].chunk)
+        return false;
+
+    slots[hole].chunk.reset();
+    count--;
+    change_epoch++;
+
+    // Pull back every following entry whose home slot is at or before
+    // the hole, so lookups never stop early at it
+    for (u32 i = (hole + 1) & mask; slots[i].chunk; i = (i + 1) & mask)
+    {
+        const u32 home = hash(slots[i].coord) & mask;
+        const bool between = hole <= i
+            ? hole < home && home <= i
+            : hole < home || home <= i;
+
+        if (!between)
+        {
+            slots[hole] = std::move(slots[i]);
+            hole = i;
+        }
+    }
+
+    return true;
+}
+
+void ChunkMap::clear()
+{
+    for (auto &slot : slots)
+        slot.chunk.reset();
+    count = 0;
+    change_epoch++;
+}
+
+u32 ChunkMap::size() const
+{
+    return count;
+}
+
+u32 ChunkMap::capacity() const
+{
+    return slots.size();
+}
+
+u64 ChunkMap::epoch() const
+{
+    return change_epoch;
+}
+
+u64 ChunkMap::insertedAt(v2i coord) const
+{
+    const Slot &slot = slots[probe(coord)];
+    return slot.chunk ? slot.inserted_at : 0;
+}
+
+void ChunkMap::grow()
+{
+    std::vector<Slot> old = std::move(slots);
+    slots = std::vector<Slot>(old.size() * 2);
+
+    for (auto &slot : old)
+    {
+        if (slot.chunk)
+            slots[probe(slot.coord)] = std::move(slot);
+    }
+}
@@ -0,0 +1,287 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunk_store.h"
+#include "logger.h"
+
+namespace
+{
+    s32 floorDiv(s32 a, s32 b)
+    {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    const size_t PAYLOAD_OFFSET = offsetof(ChunkRecord, heights);
+    const size_t PAYLOAD_BYTES = sizeof(ChunkRecord) - PAYLOAD_OFFSET;
+}
+
+ChunkStore::ChunkStore(const std::string &directory, u32 seed, f32 chunk_size)
+    : directory { directory + "/" + std::to_string(seed) }
+    , seed { seed }
+    , chunk_size { chunk_size }
+    , loads { 0 }
+    , saves { 0 }
+    , misses { 0 }
+    , corrupt { 0 }
+{
+    std::error_code error;
+    std::filesystem::create_directories(this->directory, error);
+    if (error)
+        Log::error("Chunk store: cannot create %s: %s", this->directory.c_str(), error.message().c_str());
+}
+
+ChunkStore::~ChunkStore()
+{
+    for (auto &[coord, region] : regions)
+    {
+        munmap(region.data, REGION_FILE_BYTES);
+        close(region.fd);
+    }
+}
+
+std::optional<Chunk> ChunkStore::load(v2i coord)
+{
+    const ChunkRecord *saved = record(coord);
+    if (!saved || !isWritten(saved))
+    {
+        misses++;
+        return std::nullopt;
+    }
+
+    const u8 *payload = (const u8 *) saved + PAYLOAD_OFFSET;
+    if (checksum(payload, PAYLOAD_BYTES) != saved->checksum)
+    {
+        Log::error("Chunk store: chunk (%d, %d) failed its checksum", coord.x, coord.y);
+        corrupt++;
+        return std::nullopt;
+    }
+
+    Chunk chunk(
+            v2f { coord.x * chunk_size, coord.y * chunk_size },
+            chunk_size,
+            std::vector<f32>(saved->heights, saved->heights + VERTS_PER_CHUNK));
+
+    memcpy(chunk.material_indices, saved->material_indices, sizeof(chunk.material_indices));
+    memcpy(chunk.navigable, saved->navigable, sizeof(chunk.navigable));
+    memcpy(chunk.los_indices, saved->los_indices, sizeof(chunk.los_indices));
+
+    loads++;
+    return chunk;
+}
+
+bool ChunkStore::save(v2i coord, const Chunk &chunk)
+{
+    ChunkRecord *saved = record(coord);
+    if (!saved)
+        return false;
+
+    beginWrite(saved);
+    memcpy(saved->heights, chunk.heights.data(), sizeof(saved->heights));
+    memcpy(saved->material_indices, chunk.material_indices, sizeof(saved->material_indices));
+    memcpy(saved->navigable, chunk.navigable, sizeof(saved->navigable));
+    memcpy(saved->los_indices, chunk.los_indices, sizeof(saved->los_indices));
+    endWrite(saved);
+
+    saves++;
+    return true;
+}
+
+bool ChunkStore::saveTiles(v2i coord, const u8 *los_indices, const u8 *navigable)
+{
+    ChunkRecord *saved = record(coord);
+    if (!saved || !isWritten(saved))
+        return false;
+
+    beginWrite(saved);
+    memcpy(saved->navigable, navigable, sizeof(saved->navigable));
+    memcpy(saved->los_indices, los_indices, sizeof(saved->los_indices));
+    endWrite(saved);
+
+    saves++;
+    return true;
+}
+
+void ChunkStore::erase(v2i coord)
+{
+    ChunkRecord *saved = record(coord);
+    if (saved)
+        saved->state = 0;
+}
+
+void ChunkStore::forEach(const std::function<void(v2i coord, const ChunkRecord &record)> &fn)
+{
+    std::vector<v2i> on_disk;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+    {
+        v2i region;
+        if (sscanf(entry.path().filename().c_str(), "r.%d.%d.dzr", &region.x, &region.y) == 2)
+            on_disk.push_back(region);
+    }
+
+    for (v2i region : on_disk)
+    {
+        u8 *data;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            data = openRegion(region);
+        }
+        if (!data)
+            continue;
+
+        for (u32 index = 0; index < REGION_CHUNKS; index++)
+        {
+            const ChunkRecord *saved = (const ChunkRecord *) (data + REGION_HEADER_BYTES + index * CHUNK_RECORD_BYTES);
+            if (!isWritten(saved)
+                    || checksum((const u8 *) saved + PAYLOAD_OFFSET, PAYLOAD_BYTES) != saved->checksum)
+                continue;
+
+            fn(v2i { region.x * REGION_SIDE + (s32) (index % REGION_SIDE), region.y * REGION_SIDE + (s32) (index / REGION_SIDE) }, *saved);
+        }
+    }
+}
+
+// Unmarked while the payload changes, so a reader or a crash in
+// between never takes half a chunk for a whole one
+void ChunkStore::beginWrite(ChunkRecord *saved)
+{
+    saved->state = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ChunkStore::endWrite(ChunkRecord *saved)
+{
+    saved->checksum = checksum((const u8 *) saved + PAYLOAD_OFFSET, PAYLOAD_BYTES);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    saved->state = CHUNK_RECORD_WRITTEN;
+}
+
+// Pairs with the fences in beginWrite and endWrite, the payload read
+// after it is the one that was marked written
+bool ChunkStore::isWritten(const ChunkRecord *saved)
+{
+    const bool written = saved->state == CHUNK_RECORD_WRITTEN;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return written;
+}
+
+void ChunkStore::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[coord, region] : regions)
+        msync(region.data, REGION_FILE_BYTES, MS_ASYNC);
+}
+
+ChunkStoreStats ChunkStore::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ChunkStoreStats { loads, saves, misses, corrupt, (u32) regions.size() };
+}
+
+ChunkRecord *ChunkStore::record(v2i coord)
+{
+    const v2i region { floorDiv(coord.x, REGION_SIDE), floorDiv(coord.y, REGION_SIDE) };
+    const u32 index = (coord.y - region.y * REGION_SIDE) * REGION_SIDE + (coord.x - region.x * REGION_SIDE);
+
+    u8 *data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data = openRegion(region);
+    }
+
+    if (!data)
+        return nullptr;
+    return (ChunkRecord *) (data + REGION_HEADER_BYTES + index * CHUNK_RECORD_BYTES);
+}
+
+// Called with mutex held
+u8 *ChunkStore::openRegion(v2i region)
+{
+    auto found = regions.find(region);
+    if (found != regions.end())
+        return found->second.data;
+
+    const std::string path = directory + "/r." + std::to_string(region.x) + "." + std::to_string(region.y) + ".dzr";
+
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        Log::error("Chunk store: cannot open %s", path.c_str());
+        return nullptr;
+    }
+
+    const RegionHeader expected {
+        CHUNK_STORE_MAGIC,
+        CHUNK_STORE_VERSION,
+        seed,
+        chunk_size,
+        CHUNK_RECORD_BYTES,
+        region.x,
+        region.y
+    };
+
+    // Anything else is started over, the chunks can be generated again
+    RegionHeader header {};
+    struct stat info {};
+    const bool usable = fstat(fd, &info) == 0
+        && info.st_size == REGION_FILE_BYTES
+        && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(&header, &expected, sizeof(header)) == 0;
+
+    if (!usable)
+    {
+        if (info.st_size != 0)
+            Log::verbose("Chunk store: starting %s over", path.c_str());
+
+        // Truncating first drops the old records, the file stays sparse
+        if (ftruncate(fd, 0) != 0
+            || ftruncate(fd, REGION_FILE_BYTES) != 0
+            || pwrite(fd, &expected, sizeof(expected), 0) != sizeof(expected))
+        {
+            Log::error("Chunk store: cannot create %s", path.c_str());
+            close(fd);
+            return nullptr;
+        }
+    }
+
+    void *data = mmap(nullptr, REGION_FILE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        Log::error("Chunk store: cannot map %s", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    regions.emplace(region, Region { fd, (u8 *) data });
+    return (u8 *) data;
+}
+
+// FNV-1a, but 64 bits at a time with a shift to mix the high bits
+// down, folded to 32
+u32 ChunkStore::checksum(const u8 *data, size_t size)
+{
+    u64 hash = 0xcbf29ce484222325ull ^ size;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+
+    hash ^= hash >> 32;
+    return (u32) hash;
+}
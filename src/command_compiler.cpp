@@ -0,0 +1,410 @@
+#include <algorithm>
+
+#include "command_compiler.h"
+
+namespace
+{
+    const u32 SLOT_TEXTURE  = 1u << 31;
+    const u32 SLOT_FRAGMENT = 1u << 30;
+
+    // Where the backend puts the texture array on every SET_PIPELINE
+    const u32 PIPELINE_TEXTURE_SLOT = SLOT_TEXTURE | SLOT_FRAGMENT | 0;
+
+    template <typename T>
+    u32 slotOf(const Binding<T> &binding, bool texture)
+    {
+        return (texture ? SLOT_TEXTURE : 0)
+             | (binding.shader_stage == ShaderStage::FRAGMENT ? SLOT_FRAGMENT : 0)
+             | binding.binding;
+    }
+
+    template <typename T>
+    Binding<T> bindingOf(u32 slot, T resource, size_t offset)
+    {
+        const ShaderStage stage =
+            (slot & SLOT_FRAGMENT) ? ShaderStage::FRAGMENT : ShaderStage::VERTEX;
+        return Binding<T> { stage, resource, slot & ~(SLOT_TEXTURE | SLOT_FRAGMENT), offset };
+    }
+
+    DZMesh meshOf(const DZRenderCommand &command)
+    {
+        switch (command.type)
+        {
+            case DZRenderCommand::DRAW_MESH:
+                return command.mesh;
+            case DZRenderCommand::DRAW_INSTANCED:
+                return command.instanced_draw.mesh;
+            default:
+                return command.indexed_draw.mesh;
+        }
+    }
+
+    // First entry of a slot sorted state at or after slot
+    template <typename B>
+    typename std::vector<B>::iterator lowerSlot(std::vector<B> &bound, u32 slot)
+    {
+        return std::lower_bound(bound.begin(), bound.end(), slot,
+                [](const B &b, u32 slot) { return b.slot < slot; });
+    }
+
+    bool sameCommand(const DZRenderCommand &a, const DZRenderCommand &b)
+    {
+        if (a.type != b.type)
+            return false;
+        if (a.type == DZRenderCommand::DRAW_MESH)
+            return a.mesh == b.mesh;
+        if (a.type == DZRenderCommand::DRAW_INSTANCED)
+            return a.instanced_draw.mesh == b.instanced_draw.mesh
+                && a.instanced_draw.instance_count == b.instanced_draw.instance_count
+                && a.instanced_draw.base_instance == b.instanced_draw.base_instance;
+        return a.indexed_draw.mesh == b.indexed_draw.mesh
+            && a.indexed_draw.index_buffer == b.indexed_draw.index_buffer
+            && a.indexed_draw.index_count == b.indexed_draw.index_count;
+    }
+
+    u32 dropped(u32 in, u32 out)
+    {
+        return in > out ? in - out : 0;
+    }
+}
+
+DZCommandCompiler::DZCommandCompiler()
+    : sort_draws { true }
+    , has_clear_color { false }
+    , clear_color { 0.0f }
+    , stats {}
+{}
+
+const CommandCompileStats &DZCommandCompiler::getStats() const
+{
+    return stats;
+}
+
+u64 DZCommandCompiler::sortKey(u32 pass, DZPipeline pipeline, DZMesh mesh, u32 sequence)
+{
+    const u64 pipeline_mask = (1ull << SORT_KEY_PIPELINE_BITS) - 1;
+    const u64 mesh_mask     = (1ull << SORT_KEY_MESH_BITS) - 1;
+    const u64 sequence_mask = (1ull << SORT_KEY_SEQUENCE_BITS) - 1;
+
+    // Handles past the field width only group worse, the sequence still
+    // keeps every key distinct within a pass
+    return ((u64) pass << (SORT_KEY_PIPELINE_BITS + SORT_KEY_MESH_BITS + SORT_KEY_SEQUENCE_BITS))
+         | (((u64) pipeline & pipeline_mask) << (SORT_KEY_MESH_BITS + SORT_KEY_SEQUENCE_BITS))
+         | (((u64) mesh & mesh_mask) << SORT_KEY_SEQUENCE_BITS)
+         | ((u64) sequence & sequence_mask);
+}
+
+void DZCommandCompiler::capture(const std::vector<DZRenderCommand> &commands)
+{
+    draws.clear();
+    bound_states.clear();
+    has_clear_color = false;
+    stats = {};
+    stats.commands_in = commands.size();
+
+    DZPipeline pipeline = DZInvalid;
+    std::vector<Bound> bound;
+    u32 pass = 0;
+    bool pass_has_draws = false;
+
+    auto bind = [&](const Bound &binding)
+    {
+        auto it = lowerSlot(bound, binding.slot);
+        if (it != bound.end() && it->slot == binding.slot)
+            *it = binding;
+        else
+            bound.insert(it, binding);
+    };
+
+    for (const auto &command : commands)
+    {
+        switch (command.type)
+        {
+            case DZRenderCommand::SET_PIPELINE:
+                if (pass_has_draws)
+                {
+                    pass++;
+                    pass_has_draws = false;
+                }
+                pipeline = command.pipeline;
+                bind(Bound { PIPELINE_TEXTURE_SLOT, DZInvalid, 0 });
+                stats.pipelines_dropped++;
+                break;
+            case DZRenderCommand::SET_CLEAR_COLOR:
+                has_clear_color = true;
+                clear_color = command.clear_color;
+                break;
+            case DZRenderCommand::BIND_BUFFER:
+                bind(Bound {
+                        slotOf(command.buffer_binding, false),
+                        command.buffer_binding.resource,
+                        command.buffer_binding.offset });
+                stats.buffer_binds_dropped++;
+                break;
+            case DZRenderCommand::BIND_TEXTURE:
+                bind(Bound {
+                        slotOf(command.texture_binding, true),
+                        command.texture_binding.resource,
+                        command.texture_binding.offset });
+                stats.texture_binds_dropped++;
+                break;
+            case DZRenderCommand::DRAW_MESH:
+            case DZRenderCommand::DRAW_INDEXED:
+            case DZRenderCommand::DRAW_INSTANCED:
+            {
+                Draw draw;
+                draw.key = 0;
+                draw.pass = pass;
+                draw.pipeline = pipeline;
+                draw.state_begin = bound_states.size();
+                draw.state_count = bound.size();
+                draw.command = command;
+                bound_states.insert(bound_states.end(), bound.begin(), bound.end());
+                draws.push_back(draw);
+                pass_has_draws = true;
+                break;
+            }
+            default:
+                Log::warning("Invalid render command %d dropped while compiling", command.type);
+                break;
+        }
+    }
+
+    stats.draws = draws.size();
+    stats.passes = draws.empty() ? 0 : pass + 1;
+    stats.unsorted =
+        stats.passes > (1u << SORT_KEY_PASS_BITS)
+        || stats.draws > (1u << SORT_KEY_SEQUENCE_BITS);
+}
+
+u32 DZCommandCompiler::stateChanges(u32 begin, u32 end) const
+{
+    u32 changes = 0;
+    for (u32 i = begin + 1; i < end; i++)
+    {
+        const Bound *prev = bound_states.data() + draws[i - 1].state_begin;
+        const Bound *prev_end = prev + draws[i - 1].state_count;
+        const Bound *next = bound_states.data() + draws[i].state_begin;
+        const Bound *next_end = next + draws[i].state_count;
+
+        for (; next != next_end; next++)
+        {
+            while (prev != prev_end && prev->slot < next->slot)
+                prev++;
+            changes += prev == prev_end || prev->slot != next->slot || !prev->sameAs(*next);
+        }
+    }
+    return changes;
+}
+
+void DZCommandCompiler::sortPasses()
+{
+    const u64 sequence_mask = (1ull << SORT_KEY_SEQUENCE_BITS) - 1;
+
+    auto byKey = [](const Draw &a, const Draw &b) { return a.key < b.key; };
+    auto bySequence = [sequence_mask](const Draw &a, const Draw &b)
+    {
+        return (a.key & sequence_mask) < (b.key & sequence_mask);
+    };
+
+    for (u32 i = 0; i < draws.size(); i++)
+    {
+        Draw &draw = draws[i];
+        draw.key = sortKey(draw.pass, draw.pipeline, meshOf(draw.command), i);
+    }
+
+    // Draws are captured in queue order, so every pass is already one
+    // range. Grouping by mesh saves nothing when each draw binds its own
+    // buffers anyway, a pass only stays sorted if that needs no more
+    // binds than the queue did.
+    u32 begin = 0;
+    while (begin < draws.size())
+    {
+        u32 end = begin;
+        while (end < draws.size() && draws[end].pass == draws[begin].pass)
+            end++;
+
+        const u32 queued = stateChanges(begin, end);
+        std::sort(draws.begin() + begin, draws.begin() + end, byKey);
+
+        if (stateChanges(begin, end) > queued)
+        {
+            std::sort(draws.begin() + begin, draws.begin() + end, bySequence);
+            stats.passes_in_queue_order++;
+        }
+
+        begin = end;
+    }
+}
+
+void DZCommandCompiler::emit(std::vector<DZRenderCommand> &out)
+{
+    if (has_clear_color)
+        out.push_back(DZRenderCommand::SetClearColor(clear_color));
+
+    // What the backend will have set when it gets to each draw
+    DZPipeline pipeline = DZInvalid;
+    std::vector<Bound> bound;
+
+    auto bind = [&](const Bound &binding)
+    {
+        auto it = lowerSlot(bound, binding.slot);
+        if (it != bound.end() && it->slot == binding.slot)
+            *it = binding;
+        else
+            bound.insert(it, binding);
+    };
+
+    auto boundAt = [&](u32 slot) -> const Bound *
+    {
+        auto it = lowerSlot(bound, slot);
+        return it != bound.end() && it->slot == slot ? &*it : nullptr;
+    };
+
+    u32 pipelines = 0;
+    u32 buffer_binds = 0;
+    u32 texture_binds = 0;
+
+    for (const Draw &draw : draws)
+    {
+        const Bound *state = bound_states.data() + draw.state_begin;
+        const Bound *state_end = state + draw.state_count;
+
+        // A texture bound over the texture array only goes away by
+        // setting the pipeline again
+        bool reset_texture = false;
+        for (const Bound *b = state; b != state_end; b++)
+        {
+            if (b->slot != PIPELINE_TEXTURE_SLOT || b->resource != DZInvalid)
+                continue;
+            const Bound *current = boundAt(PIPELINE_TEXTURE_SLOT);
+            reset_texture = current && current->resource != DZInvalid;
+        }
+
+        if (draw.pipeline != DZInvalid && (draw.pipeline != pipeline || reset_texture))
+        {
+            out.push_back(DZRenderCommand::SetPipeline(draw.pipeline));
+            pipeline = draw.pipeline;
+            pipelines++;
+            bind(Bound { PIPELINE_TEXTURE_SLOT, DZInvalid, 0 });
+        }
+
+        for (const Bound *b = state; b != state_end; b++)
+        {
+            const Bound *current = boundAt(b->slot);
+            if (current && current->sameAs(*b))
+                continue;
+            // Only setting the pipeline puts the texture array back
+            if (b->resource == DZInvalid)
+                continue;
+
+            bind(*b);
+
+            if (b->slot & SLOT_TEXTURE)
+            {
+                out.push_back(DZRenderCommand::BindTexture(bindingOf<DZTexture>(b->slot, b->resource, b->offset)));
+                texture_binds++;
+            }
+            else
+            {
+                out.push_back(DZRenderCommand::BindBuffer(bindingOf<DZBuffer>(b->slot, b->resource, b->offset)));
+                buffer_binds++;
+            }
+        }
+
+        out.push_back(draw.command);
+    }
+
+    // capture counted every state command in, what is left is dropped
+    stats.pipelines_dropped = dropped(stats.pipelines_dropped, pipelines);
+    stats.buffer_binds_dropped = dropped(stats.buffer_binds_dropped, buffer_binds);
+    stats.texture_binds_dropped = dropped(stats.texture_binds_dropped, texture_binds);
+    stats.commands_out = out.size();
+}
+
+void DZCommandCompiler::compile(
+        const std::vector<DZRenderCommand> &commands,
+        std::vector<DZRenderCommand> &out
+    )
+{
+    out.clear();
+    capture(commands);
+
+    if (sort_draws && !stats.unsorted)
+        sortPasses();
+
+    emit(out);
+}
+
+bool DZCommandCompiler::sameDraws(
+        const std::vector<DZRenderCommand> &a,
+        const std::vector<DZRenderCommand> &b
+    )
+{
+    DZCommandCompiler from;
+    DZCommandCompiler to;
+    from.capture(a);
+    to.capture(b);
+
+    if (from.draws.size() != to.draws.size()
+     || from.has_clear_color != to.has_clear_color
+     || (from.has_clear_color && from.clear_color != to.clear_color))
+        return false;
+
+    // Every binding the draw saw in a is there in b, b may have more
+    auto covers = [&](const Draw &wanted, const Draw &got)
+    {
+        if (wanted.pipeline != got.pipeline || !sameCommand(wanted.command, got.command))
+            return false;
+
+        const Bound *want = from.bound_states.data() + wanted.state_begin;
+        const Bound *want_end = want + wanted.state_count;
+        const Bound *have = to.bound_states.data() + got.state_begin;
+        const Bound *have_end = have + got.state_count;
+
+        for (; want != want_end; want++)
+        {
+            while (have != have_end && have->slot < want->slot)
+                have++;
+            if (have == have_end || have->slot != want->slot || !have->sameAs(*want))
+                return false;
+        }
+        return true;
+    };
+
+    // The passes of a in order, each matched against as many draws of b
+    // in any order. The draws needing the most state are matched first.
+    u32 begin = 0;
+    while (begin < from.draws.size())
+    {
+        u32 end = begin;
+        while (end < from.draws.size() && from.draws[end].pass == from.draws[begin].pass)
+            end++;
+
+        std::vector<u32> wanted;
+        for (u32 i = begin; i < end; i++)
+            wanted.push_back(i);
+        std::stable_sort(wanted.begin(), wanted.end(),
+                [&](u32 x, u32 y) { return from.draws[x].state_count > from.draws[y].state_count; });
+
+        std::vector<bool> used(end - begin, false);
+        for (u32 i : wanted)
+        {
+            bool found = false;
+            for (u32 j = begin; j < end && !found; j++)
+            {
+                if (!used[j - begin] && covers(from.draws[i], to.draws[j]))
+                {
+                    used[j - begin] = true;
+                    found = true;
+                }
+            }
+            if (!found)
+                return false;
+        }
+
+        begin = end;
+    }
+
+    return true;
+}
@@ -0,0 +1,119 @@
+#include "frustum.h"
+
+#include <algorithm>
+#include <cfloat>
+
+Frustum Frustum::fromMatrix(const glm::mat4 &view_projection)
+{
+    // Gribb and Hartmann, the planes are sums of the matrix rows
+    auto row = [&](int i)
+    {
+        return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+    };
+
+    Frustum frustum;
+    frustum.planes = {
+        row(3) + row(0),
+        row(3) - row(0),
+        row(3) + row(1),
+        row(3) - row(1),
+        row(3) + row(2),
+        row(3) - row(2)
+    };
+
+    for (glm::vec4 &plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    const glm::mat4 inverse = glm::inverse(view_projection);
+    for (int i = 0; i < 8; i++)
+    {
+        const glm::vec4 corner = inverse * glm::vec4(
+                i & 1 ? 1.0f : -1.0f,
+                i & 2 ? 1.0f : -1.0f,
+                i & 4 ? 1.0f : -1.0f,
+                1.0f
+            );
+        frustum.corners[i] = glm::vec3(corner) / corner.w;
+    }
+
+    return frustum;
+}
+
+bool Frustum::intersectsBox(glm::vec3 min, glm::vec3 max) const
+{
+    for (const glm::vec4 &plane : planes)
+    {
+        // The corner furthest along the normal
+        const glm::vec3 far_corner(
+                plane.x >= 0.0f ? max.x : min.x,
+                plane.y >= 0.0f ? max.y : min.y,
+                plane.z >= 0.0f ? max.z : min.z
+            );
+
+        if (glm::dot(glm::vec3(plane), far_corner) + plane.w < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+bool Frustum::intersectsSphere(glm::vec3 center, f32 radius) const
+{
+    for (const glm::vec4 &plane : planes)
+    {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+            return false;
+    }
+
+    return true;
+}
+
+std::optional<AArect2f> Frustum::groundBounds(f32 z_min, f32 z_max) const
+{
+    // The frustum cut to the slab is convex, its corners are frustum
+    // corners inside the slab and edges crossing the slab's faces
+    v2f lo { FLT_MAX, FLT_MAX };
+    v2f hi { -FLT_MAX, -FLT_MAX };
+
+    auto add = [&](glm::vec3 p)
+    {
+        lo = v2f { std::min(lo.x, p.x), std::min(lo.y, p.y) };
+        hi = v2f { std::max(hi.x, p.x), std::max(hi.y, p.y) };
+    };
+
+    for (int a = 0; a < 8; a++)
+    {
+        for (int axis = 1; axis < 8; axis <<= 1)
+        {
+            if (a & axis)
+                continue;
+
+            const glm::vec3 from = corners[a];
+            const glm::vec3 to = corners[a | axis];
+            const f32 dz = to.z - from.z;
+
+            if (dz == 0.0f)
+            {
+                if (from.z >= z_min && from.z <= z_max)
+                {
+                    add(from);
+                    add(to);
+                }
+                continue;
+            }
+
+            const f32 t0 = std::max(std::min((z_min - from.z) / dz, (z_max - from.z) / dz), 0.0f);
+            const f32 t1 = std::min(std::max((z_min - from.z) / dz, (z_max - from.z) / dz), 1.0f);
+            if (t0 > t1)
+                continue;
+
+            add(from + (to - from) * t0);
+            add(from + (to - from) * t1);
+        }
+    }
+
+    if (lo.x > hi.x)
+        return std::nullopt;
+
+    return AArect2f { lo, hi - lo };
+}
@@ -1,6 +1,78 @@
 #include "gui.h"
 
+#include <algorithm>
+
 GUI::GUI(){
     selection.pos = {0, 0};
     selection.dim = {0, 0};
 }
+
+Frustum GUI::selection_frustum(const Camera &camera, glm::vec2 screen_dim) const
+{
+    // Drag box in normalised device coordinates, y up, at least
+    // SELECTION_MIN_PIXELS wide either way
+    const f32 pad_x = std::max(SELECTION_MIN_PIXELS - std::abs(selection.dim.x), 0) / 2.0f;
+    const f32 pad_y = std::max(SELECTION_MIN_PIXELS - std::abs(selection.dim.y), 0) / 2.0f;
+
+    const f32 left   = std::min(selection.pos.x, selection.pos.x + selection.dim.x) - pad_x;
+    const f32 right  = std::max(selection.pos.x, selection.pos.x + selection.dim.x) + pad_x;
+    const f32 top    = std::min(selection.pos.y, selection.pos.y + selection.dim.y) - pad_y;
+    const f32 bottom = std::max(selection.pos.y, selection.pos.y + selection.dim.y) + pad_y;
+
+    const f32 x0 = left / screen_dim.x * 2.0f - 1.0f;
+    const f32 x1 = right / screen_dim.x * 2.0f - 1.0f;
+    const f32 y0 = -bottom / screen_dim.y * 2.0f + 1.0f;
+    const f32 y1 = -top / screen_dim.y * 2.0f + 1.0f;
+
+    // Stretches the box over the whole of clip space
+    glm::mat4 box(1.0f);
+    box[0][0] = 2.0f / (x1 - x0);
+    box[1][1] = 2.0f / (y1 - y0);
+    box[3][0] = -(x0 + x1) / (x1 - x0);
+    box[3][1] = -(y0 + y1) / (y1 - y0);
+
+    return Frustum::fromMatrix(box * camera.getProjectionMatrix(screen_dim) * camera.getViewMatrix());
+}
+
+AArect2f GUI::selection_to_worldspace(const Camera &camera, glm::vec2 screen_dim, f32 z_min, f32 z_max) const
+{
+    const std::optional<AArect2f> ground = selection_frustum(camera, screen_dim).groundBounds(z_min, z_max);
+    if (!ground)
+        return AArect2f { v2f { 0.0f, 0.0f }, v2f { 0.0f, 0.0f } };
+    return *ground;
+}
+
+std::vector<entt::entity> GUI::select_units(
+        const entt::registry &registry,
+        const SpatialHash &spatial,
+        const Camera &camera,
+        glm::vec2 screen_dim,
+        f32 z_min,
+        f32 z_max) const
+{
+    std::vector<entt::entity> selected;
+
+    const Frustum frustum = selection_frustum(camera, screen_dim);
+    const std::optional<AArect2f> ground = frustum.groundBounds(z_min - ENTITY_CULL_MARGIN, z_max + ENTITY_CULL_MARGIN);
+    if (!ground)
+        return selected;
+
+    const AArect2f near {
+        v2f { ground->pos.x - ENTITY_CULL_MARGIN, ground->pos.y - ENTITY_CULL_MARGIN },
+        v2f { ground->dim.x + 2 * ENTITY_CULL_MARGIN, ground->dim.y + 2 * ENTITY_CULL_MARGIN }
+    };
+
+    spatial.forEachNear(near, [&](entt::entity entity)
+    {
+        const Model *model = registry.try_get<Model>(entity);
+        const Transform *transform = registry.try_get<Transform>(entity);
+        if (!model || !transform)
+            return;
+
+        const f32 scale = std::max({ transform->scale.x, transform->scale.y, transform->scale.z });
+        if (frustum.intersectsSphere(transform->pos, model->radius * scale))
+            selected.push_back(entity);
+    });
+
+    return selected;
+}
@@ -0,0 +1,119 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include "common.h"
+#include "logger.h"
+#include "renderer.h"
+#include "null_renderer.h"
+#include "scene.h"
+#include "entity.h"
+#include "transform.h"
+#include "tick_systems.h"
+#include "thread_pool.h"
+#include "simulation.h"
+#include "bench.h"
+
+// The simulation without a window or GPU, on DZNullBackend. Streams the
+// terrain around a fixed point, spawns units heading for it and runs
+// the tick systems as fast as they go, then reports how long they took.
+// Exits with 1 if anything was sent to the renderer that would not have
+// worked on a real one, or with --bench if any bench check failed.
+int main(int argc, char *argv[])
+{
+    Log::setLogLevel(Log::LogLevel::INFO);
+
+    u32 tick_rate = DEFAULT_TICK_RATE;
+    u32 num_ticks = 300;
+    u32 num_units = 1000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--bench")
+        {
+            return Bench::runAll() ? 1 : 0;
+        }
+
+        if (i + 1 >= argc)
+            break;
+
+        if (arg == "--tick-rate")
+            tick_rate = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--ticks")
+            num_ticks = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--units")
+            num_units = std::max(atoi(argv[++i]), 0);
+    }
+
+    auto backend = std::make_unique<DZNullBackend>();
+    const DZNullBackend &null_backend = *backend;
+    DZRenderer renderer(std::move(backend));
+
+    const std::vector<DZShader> shaders 
+        = renderer.compileShaders("", { "vertexMain", "fragmentMain" });
+    const DZPipeline pipeline = renderer.createPipeline(shaders[0], shaders[1]);
+
+    Scene scene(renderer, pipeline, pipeline, pipeline, pipeline);
+    scene.camera.target = glm::vec3(120.0f, 80.0f, 0.0f);
+    const v2f focus { scene.camera.target.x, scene.camera.target.y };
+
+    // Everything within the prefetch radius, before anything moves
+    const u32 side = 2 * scene.terrain.prefetch_radius + 1;
+    const auto load_start = std::chrono::steady_clock::now();
+    while (scene.terrain.chunks.size() < side * side)
+    {
+        scene.terrain.stream(renderer, focus);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const std::chrono::duration<double, std::milli> load_ms = std::chrono::steady_clock::now() - load_start;
+
+    srand(616u);
+    for (u32 i = 0; i < num_units; i++)
+    {
+        const entt::entity unit = scene.registry.create();
+        Transform transform;
+        transform.pos = glm::vec3(
+                focus.x + (rand() % 300) - 150.0f,
+                focus.y + (rand() % 300) - 150.0f,
+                0.0f);
+        scene.registry.emplace<Transform>(unit, transform);
+        scene.registry.emplace<LineOfSight>(unit, 5u);
+        scene.registry.emplace<MoveSpeed>(unit, rand() % 10u + 2u);
+    }
+
+    ThreadPool pool(ThreadPool::defaultThreadCount());
+    TickSystems tick_systems(pool);
+    addTickSystems(tick_systems);
+
+    const f64 tick_seconds = 1.0 / tick_rate;
+    std::vector<f64> system_ms(tick_systems.getTimings().size(), 0.0);
+    f64 total_ms = 0.0;
+    f64 worst_ms = 0.0;
+
+    for (u32 tick = 0; tick < num_ticks; tick++)
+    {
+        scene.terrain.stream(renderer, focus);
+        tick_systems.run(scene, pool, tick_seconds);
+
+        total_ms += tick_systems.getFrameMs();
+        worst_ms = std::max(worst_ms, tick_systems.getFrameMs());
+        for (size_t i = 0; i < system_ms.size(); i++)
+            system_ms[i] += tick_systems.getTimings()[i].duration_ms;
+    }
+
+    Log::info("Headless: %u units, %u ticks at %u Hz, %u pool threads",
+            num_units, num_ticks, tick_rate, pool.size());
+    Log::info("\tterrain loaded in:    %8.3f ms, %u chunks", load_ms.count(), scene.terrain.chunks.size());
+    Log::info("\ttick:                 %8.3f ms average, %.3f ms worst, budget %.3f ms",
+            total_ms / num_ticks, worst_ms, tick_seconds * 1e3);
+    for (size_t i = 0; i < system_ms.size(); i++)
+        Log::info("\t  %-20s %8.3f ms", tick_systems.getTimings()[i].name.c_str(), system_ms[i] / num_ticks);
+
+    const NullRenderStats &stats = null_backend.getStats();
+    Log::info("\trenderer:             %u meshes, %u buffers, %.1f MB uploaded, %u invalid handles",
+            stats.live_meshes, stats.live_buffers, stats.bytes_uploaded / (1024.0 * 1024.0), stats.invalid_handles);
+
+    return stats.invalid_handles ? 1 : 0;
+}
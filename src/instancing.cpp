@@ -0,0 +1,77 @@
+#include <algorithm>
+
+#include "instancing.h"
+
+InstanceBatcher::InstanceBatcher()
+    : draw_count { 0 }
+    , instance_count { 0 }
+{}
+
+u32 InstanceBatcher::getDrawCount() const
+{
+    return draw_count;
+}
+
+u32 InstanceBatcher::getInstanceCount() const
+{
+    return instance_count;
+}
+
+void InstanceBatcher::add(DZMesh mesh, const ModelInstance &instance)
+{
+    auto [it, inserted] = group_of.try_emplace(mesh, (u32) groups.size());
+    if (inserted)
+        groups.push_back(Group { mesh, {} });
+
+    groups[it->second].instances.push_back(instance);
+}
+
+void InstanceBatcher::flush(DZRenderer &renderer)
+{
+    // Meshes nobody drew this frame, their handles may be gone
+    const bool stale = std::any_of(groups.begin(), groups.end(),
+            [](const Group &group) { return group.instances.empty(); });
+    if (stale)
+    {
+        groups.erase(
+                std::remove_if(groups.begin(), groups.end(),
+                    [](const Group &group) { return group.instances.empty(); }),
+                groups.end());
+
+        group_of.clear();
+        for (u32 i = 0; i < groups.size(); i++)
+            group_of.emplace(groups[i].mesh, i);
+    }
+
+    staging.clear();
+    for (const Group &group : groups)
+        staging.insert(staging.end(), group.instances.begin(), group.instances.end());
+
+    draw_count = 0;
+    instance_count = staging.size();
+    if (staging.empty())
+        return;
+
+    const UniformSlice slice = renderer.allocateUniforms(
+            staging.data(), staging.size() * sizeof(ModelInstance));
+
+    renderer.enqueueCommand(
+            DZRenderCommand::BindBuffer(
+                Binding<DZBuffer>::Vertex(slice.buffer, 2, slice.offset)));
+
+    renderer.enqueueCommand(
+            DZRenderCommand::BindBuffer(
+                Binding<DZBuffer>::Fragment(slice.buffer, 1, slice.offset)));
+
+    u32 base_instance = 0;
+    for (Group &group : groups)
+    {
+        renderer.enqueueCommand(
+                DZRenderCommand::DrawInstanced(
+                    group.mesh, group.instances.size(), base_instance));
+
+        base_instance += group.instances.size();
+        group.instances.clear();
+        draw_count++;
+    }
+}
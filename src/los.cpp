@@ -0,0 +1,735 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "los.h"
+#include "terrain.h"
+#include "entity.h"
+#include "transform.h"
+
+#if defined(__SSE2__)
+#   define LOS_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+namespace
+{
+    const LOSStamp NO_STAMP { v2i { 0, 0 }, -1.0f, {} };
+    const std::vector<s32> NO_DISC;
+
+    s32 floorDiv(s32 a, s32 b)
+    {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    // Half width of row dy of a disc, -1 if the row misses it
+    s32 halfWidth(const std::vector<s32> &disc, s32 dy)
+    {
+        dy = std::abs(dy);
+        return dy < (s32) disc.size() ? disc[dy] : -1;
+    }
+}
+
+FogOfWar::FogOfWar(entt::registry &registry, ChunkMap &chunks, f32 chunk_size)
+    : registry { registry }
+    , chunks { chunks }
+    , tile_width { chunk_size / TILES_PER_SIDE }
+    , occlusion { false }
+    , needs_rebuild { false }
+    , chunk_epoch { chunks.epoch() }
+    , stats {}
+{
+    chunks.forEach([&](v2i coord, Chunk &) { resident[coord] = chunks.insertedAt(coord); });
+    registry.on_destroy<LOSStamp>().connect<&FogOfWar::onStampDestroyed>(*this);
+}
+
+FogOfWar::~FogOfWar()
+{
+    registry.on_destroy<LOSStamp>().disconnect<&FogOfWar::onStampDestroyed>(*this);
+}
+
+const std::vector<s32> &FogOfWar::disc(f32 radius)
+{
+    if (radius < 0.0f)
+        return NO_DISC;
+
+    auto found = discs.find(radius);
+    if (found != discs.end())
+        return found->second;
+
+    std::vector<s32> &half_widths = discs[radius];
+    half_widths.resize((s32) radius + 1);
+    for (s32 dy = 0; dy <= (s32) radius; dy++)
+        half_widths[dy] = (s32) std::floor(std::sqrt(radius * radius - (f32) dy * dy));
+
+    return half_widths;
+}
+
+v2i FogOfWar::tileFromPos(v2f pos) const
+{
+    return v2i {
+        (s32) std::floor(pos.x / tile_width),
+        (s32) std::floor(pos.y / tile_width)
+    };
+}
+
+void FogOfWar::update()
+{
+    const u32 rebuilds = stats.rebuilds;
+    stats = {};
+    stats.rebuilds = rebuilds;
+
+    // Entities that lost their LineOfSight stop observing
+    auto orphaned = registry.view<LOSStamp>(entt::exclude<LineOfSight>);
+    std::vector<entt::entity> to_remove(orphaned.begin(), orphaned.end());
+    registry.remove<LOSStamp>(to_remove.begin(), to_remove.end());
+
+    if (needs_rebuild)
+        rebuild();
+    else if (chunk_epoch != chunks.epoch())
+        recountChunks();
+
+    registry
+        .view<Transform, LineOfSight>()
+        .each(
+                [&](entt::entity entity, const Transform &transform, const LineOfSight &los)
+                {
+                    stats.observers++;
+
+                    LOSStamp next {
+                        tileFromPos(v2f { transform.pos.x, transform.pos.y }),
+                        los.los / tile_width,
+                        {}
+                    };
+
+                    LOSStamp *current = registry.try_get<LOSStamp>(entity);
+
+                    if (current
+                        && current->center.x == next.center.x
+                        && current->center.y == next.center.y
+                        && current->radius == next.radius)
+                    {
+                        return;
+                    }
+
+                    if (occlusion)
+                    {
+                        next.runs = std::move(spare_runs);
+                        computeViewshed(next);
+                    }
+
+                    stats.restamped++;
+
+                    if (!current)
+                    {
+                        stamp(NO_STAMP, next);
+                        registry.emplace<LOSStamp>(entity, std::move(next));
+                        return;
+                    }
+
+                    stamp(*current, next);
+                    spare_runs = std::move(current->runs);
+                    *current = std::move(next);
+                }
+            );
+
+    fade();
+
+    stats.fading = fading.size();
+}
+
+void FogOfWar::setOcclusion(bool enabled)
+{
+    if (occlusion == enabled)
+        return;
+
+    occlusion = enabled;
+    needs_rebuild = true;
+}
+
+bool FogOfWar::getOcclusion() const
+{
+    return occlusion;
+}
+
+FogOfWarStats FogOfWar::getStats() const
+{
+    return stats;
+}
+
+void FogOfWar::gatherHeights(v2i center, const std::vector<s32> &half_widths)
+{
+    const s32 extent = (s32) half_widths.size() - 1;
+    const s32 side = 2 * extent + 1;
+    window_heights.resize(side * side);
+
+    for (s32 dy = -extent; dy <= extent; dy++)
+    {
+        const s32 half_width = half_widths[std::abs(dy)];
+        const s32 y = center.y + dy;
+        const s32 cy = floorDiv(y, TILES_PER_SIDE);
+        const s32 ly = y - cy * TILES_PER_SIDE;
+
+        f32 *out = &window_heights[(dy + extent) * side + extent - half_width];
+
+        // Same walk as addSpan, one chunk lookup per piece of the row
+        s32 x = center.x - half_width;
+        const s32 x1 = center.x + half_width;
+        while (x <= x1)
+        {
+            const s32 cx = floorDiv(x, TILES_PER_SIDE);
+            const s32 lx0 = x - cx * TILES_PER_SIDE;
+            const s32 lx1 = std::min(x1 - cx * TILES_PER_SIDE, TILES_PER_SIDE - 1);
+            const s32 count = lx1 - lx0 + 1;
+
+            const Chunk *chunk = chunks.find(v2i { cx, cy });
+            if (!chunk)
+            {
+                std::fill(out, out + count, 0.0f);
+            }
+            else
+            {
+                const f32 *row0 = &chunk->heights[ly * VERTS_PER_SIDE];
+                const f32 *row1 = row0 + VERTS_PER_SIDE;
+                for (s32 lx = lx0; lx <= lx1; lx++)
+                {
+                    out[lx - lx0] = 0.25f * (row0[lx] + row0[lx + 1]
+                                           + row1[lx] + row1[lx + 1]);
+                }
+            }
+
+            out += count;
+            x += count;
+        }
+    }
+}
+
+// XDraw: rings of growing Chebyshev distance, each tile taking the
+// horizon of the ray towards the centre from the two tiles of the
+// previous ring it passes between. Those are never further from the
+// centre than the tile itself, so the disc alone is enough.
+const std::vector<LOSViewshedStep> &FogOfWar::viewshedSteps(f32 radius)
+{
+    auto found = viewshed_steps.find(radius);
+    if (found != viewshed_steps.end())
+        return found->second;
+
+    const std::vector<s32> &half_widths = disc(radius);
+    const s32 extent = (s32) half_widths.size() - 1;
+    const s32 side = 2 * extent + 1;
+
+    auto at = [&](s32 dx, s32 dy) { return (u32) ((dy + extent) * side + dx + extent); };
+
+    std::vector<LOSViewshedStep> &steps = viewshed_steps[radius];
+
+    auto add = [&](s32 dx, s32 dy, s32 ring)
+    {
+        if (std::abs(dx) > half_widths[std::abs(dy)])
+            return;
+
+        LOSViewshedStep step {
+            at(dx, dy), at(0, 0), at(0, 0), 0.0f,
+            1.0f / std::sqrt((f32) (dx * dx + dy * dy))
+        };
+
+        if (ring > 1)
+        {
+            // Where the ray to the centre crosses the previous ring
+            const bool along_x = std::abs(dx) >= std::abs(dy);
+            const s32 major = along_x ? dx : dy;
+            const s32 minor = along_x ? dy : dx;
+            const s32 major_prev = major - (major > 0 ? 1 : -1);
+            const f32 t = (f32) minor * (ring - 1) / ring;
+            const s32 m0 = (s32) std::floor(t);
+            const s32 m1 = t > m0 ? m0 + 1 : m0;
+
+            step.behind0 = along_x ? at(major_prev, m0) : at(m0, major_prev);
+            step.behind1 = along_x ? at(major_prev, m1) : at(m1, major_prev);
+            step.frac = t - m0;
+        }
+
+        steps.push_back(step);
+    };
+
+    for (s32 ring = 1; ring <= extent; ring++)
+    {
+        for (s32 dx = -ring; dx <= ring; dx++)
+        {
+            add(dx, -ring, ring);
+            add(dx, ring, ring);
+        }
+        for (s32 dy = -ring + 1; dy <= ring - 1; dy++)
+        {
+            add(-ring, dy, ring);
+            add(ring, dy, ring);
+        }
+    }
+
+    return steps;
+}
+
+// Horizons are slopes from the eye, a tile is visible if its ground
+// rises to or above the horizon of the tiles in front of it
+void FogOfWar::computeViewshed(LOSStamp &stamp)
+{
+    stats.viewsheds++;
+
+    const std::vector<s32> &half_widths = disc(stamp.radius);
+    const std::vector<LOSViewshedStep> &steps = viewshedSteps(stamp.radius);
+    const s32 extent = (s32) half_widths.size() - 1;
+    const s32 side = 2 * extent + 1;
+    const u32 center = extent * side + extent;
+
+    gatherHeights(stamp.center, half_widths);
+    horizon.resize(side * side);
+    window_visible.resize(side * side);
+
+    const f32 eye = window_heights[center] + LOS_EYE_HEIGHT;
+    // Finite, so the first ring's lerp between the centre and itself is too
+    horizon[center] = -FLT_MAX;
+    window_visible[center] = 1;
+
+    for (const LOSViewshedStep &step : steps)
+    {
+        const f32 slope = (window_heights[step.index] - eye) * step.inv_distance;
+        const f32 h0 = horizon[step.behind0];
+        const f32 behind = h0 + (horizon[step.behind1] - h0) * step.frac;
+
+        horizon[step.index] = std::max(behind, slope);
+        window_visible[step.index] = slope >= behind;
+    }
+
+    stamp.runs.clear();
+    for (s32 dy = -extent; dy <= extent; dy++)
+    {
+        const s32 half_width = half_widths[std::abs(dy)];
+        const u8 *row = &window_visible[(dy + extent) * side + extent];
+
+        s32 run_start = INT32_MAX;
+        for (s32 dx = -half_width; dx <= half_width + 1; dx++)
+        {
+            const bool visible = dx <= half_width && row[dx];
+            if (visible && run_start == INT32_MAX)
+            {
+                run_start = dx;
+            }
+            else if (!visible && run_start != INT32_MAX)
+            {
+                stamp.runs.push_back(LOSRun { (s16) dy, (s16) run_start, (s16) (dx - 1) });
+                run_start = INT32_MAX;
+            }
+        }
+    }
+}
+
+void FogOfWar::stamp(const LOSStamp &from, const LOSStamp &to)
+{
+    // Viewsheds have no shape to diff against, add the new one before
+    // removing the old so shared tiles never drop to zero observers
+    if (!from.runs.empty() || !to.runs.empty())
+    {
+        applyRuns(to, 1);
+        applyRuns(from, -1);
+        return;
+    }
+
+    const std::vector<s32> &from_disc = disc(from.radius);
+    const std::vector<s32> &to_disc   = disc(to.radius);
+    const s32 from_extent = (s32) from_disc.size() - 1;
+    const s32 to_extent   = (s32) to_disc.size() - 1;
+
+    // Circles that do not overlap are cheaper to handle whole than to
+    // walk every row between them
+    if (from_extent >= 0 && to_extent >= 0
+        && (std::abs(from.center.x - to.center.x) > from_extent + to_extent
+            || std::abs(from.center.y - to.center.y) > from_extent + to_extent))
+    {
+        stamp(NO_STAMP, to);
+        stamp(from, NO_STAMP);
+        return;
+    }
+
+    s32 y_min = INT32_MAX;
+    s32 y_max = INT32_MIN;
+    if (from_extent >= 0)
+    {
+        y_min = std::min(y_min, from.center.y - from_extent);
+        y_max = std::max(y_max, from.center.y + from_extent);
+    }
+    if (to_extent >= 0)
+    {
+        y_min = std::min(y_min, to.center.y - to_extent);
+        y_max = std::max(y_max, to.center.y + to_extent);
+    }
+
+    for (s32 y = y_min; y <= y_max; y++)
+    {
+        const s32 a = halfWidth(from_disc, y - from.center.y);
+        const s32 b = halfWidth(to_disc, y - to.center.y);
+
+        const s32 a0 = from.center.x - a;
+        const s32 a1 = from.center.x + a;
+        const s32 b0 = to.center.x - b;
+        const s32 b1 = to.center.x + b;
+
+        // Additions first, so a tile in both spans never drops to zero
+        // observers on the way
+        if (b >= 0)
+        {
+            if (a < 0)
+            {
+                addSpan(y, b0, b1, 1);
+            }
+            else
+            {
+                addSpan(y, b0, std::min(b1, a0 - 1), 1);
+                addSpan(y, std::max(b0, a1 + 1), b1, 1);
+            }
+        }
+
+        if (a >= 0)
+        {
+            if (b < 0)
+            {
+                addSpan(y, a0, a1, -1);
+            }
+            else
+            {
+                addSpan(y, a0, std::min(a1, b0 - 1), -1);
+                addSpan(y, std::max(a0, b1 + 1), a1, -1);
+            }
+        }
+    }
+}
+
+void FogOfWar::applyRuns(const LOSStamp &stamp, s32 delta)
+{
+    if (!stamp.runs.empty())
+    {
+        for (const LOSRun &run : stamp.runs)
+        {
+            addSpan(stamp.center.y + run.dy,
+                    stamp.center.x + run.x0,
+                    stamp.center.x + run.x1,
+                    delta);
+        }
+        return;
+    }
+
+    const std::vector<s32> &half_widths = disc(stamp.radius);
+    const s32 extent = (s32) half_widths.size() - 1;
+    for (s32 dy = -extent; dy <= extent; dy++)
+    {
+        const s32 half_width = half_widths[std::abs(dy)];
+        addSpan(stamp.center.y + dy,
+                stamp.center.x - half_width,
+                stamp.center.x + half_width,
+                delta);
+    }
+}
+
+void FogOfWar::unstamp(const LOSStamp &stamp)
+{
+    this->stamp(stamp, NO_STAMP);
+}
+
+void FogOfWar::addSpan(s32 y, s32 x0, s32 x1, s32 delta)
+{
+    const s32 cy = floorDiv(y, TILES_PER_SIDE);
+    const s32 ly = y - cy * TILES_PER_SIDE;
+
+    s32 x = x0;
+    while (x <= x1)
+    {
+        const s32 cx = floorDiv(x, TILES_PER_SIDE);
+        const s32 lx0 = x - cx * TILES_PER_SIDE;
+        const s32 lx1 = std::min(x1 - cx * TILES_PER_SIDE, TILES_PER_SIDE - 1);
+
+        x += lx1 - lx0 + 1;
+        stats.tiles_touched += lx1 - lx0 + 1;
+
+        // Tiles of chunks that are not resident are counted by recountChunks
+        // once the chunk arrives
+        Chunk *chunk = chunks.find(v2i { cx, cy });
+        if (!chunk)
+            continue;
+
+        u16 *observers = &chunk->observers[ly * TILES_PER_SIDE];
+        u8 *los = &chunk->los_indices[ly * TILES_PER_SIDE];
+
+        if (delta > 0)
+        {
+            addObservers(&observers[lx0], &los[lx0], lx1 - lx0 + 1);
+            chunk->los_dirty_rows |= 1ull << ly;
+        }
+        else
+            removeObservers(&observers[lx0], lx1 - lx0 + 1, v2i { cx * TILES_PER_SIDE + lx0, y });
+    }
+}
+
+// Observed tiles are always LOS_VISIBLE, so a new observer only needs
+// the row filled rather than a per-tile test
+void FogOfWar::addObservers(u16 *observers, u8 *los, s32 count)
+{
+    memset(los, LOS_VISIBLE, count);
+
+    s32 i = 0;
+#ifdef LOS_SSE2
+    const __m128i one = _mm_set1_epi16(1);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i *lane = (__m128i *) &observers[i];
+        _mm_storeu_si128(lane, _mm_add_epi16(_mm_loadu_si128(lane), one));
+    }
+#endif
+    for (; i < count; i++)
+        observers[i]++;
+}
+
+void FogOfWar::removeObservers(u16 *observers, s32 count, v2i first_tile)
+{
+    s32 i = 0;
+#ifdef LOS_SSE2
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i count_mask = _mm_set1_epi16(LOS_OBSERVER_MASK);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i *lane = (__m128i *) &observers[i];
+        const __m128i before = _mm_loadu_si128(lane);
+        const __m128i unobserved = _mm_cmpeq_epi16(_mm_and_si128(before, count_mask), zero);
+        const __m128i after = _mm_sub_epi16(before, _mm_andnot_si128(unobserved, one));
+        _mm_storeu_si128(lane, after);
+
+        // Two mask bits per lane, for the tiles that lost their last observer
+        u32 emptied = _mm_movemask_epi8(_mm_andnot_si128(unobserved, _mm_cmpeq_epi16(after, zero)));
+        while (emptied)
+        {
+            const s32 j = i + __builtin_ctz(emptied) / 2;
+            observers[j] = LOS_FADING_BIT;
+            fading.push_back(v2i { first_tile.x + j, first_tile.y });
+            emptied &= emptied - 1;
+            emptied &= emptied - 1;
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        if ((observers[i] & LOS_OBSERVER_MASK) == 0)
+            continue;
+
+        observers[i]--;
+
+        if (observers[i] == 0)
+        {
+            observers[i] = LOS_FADING_BIT;
+            fading.push_back(v2i { first_tile.x + i, first_tile.y });
+        }
+    }
+}
+
+void FogOfWar::fade()
+{
+    // Consecutive entries usually share a chunk
+    v2i cached_coord { INT32_MAX, INT32_MAX };
+    Chunk *cached = nullptr;
+
+    size_t kept = 0;
+    for (const v2i &tile : fading)
+    {
+        const v2i coord {
+            floorDiv(tile.x, TILES_PER_SIDE),
+            floorDiv(tile.y, TILES_PER_SIDE)
+        };
+
+        if (coord.x != cached_coord.x || coord.y != cached_coord.y)
+        {
+            cached = chunks.find(coord);
+            cached_coord = coord;
+        }
+
+        if (!cached)
+            continue;
+
+        const u32 index = (tile.y - coord.y * TILES_PER_SIDE) * TILES_PER_SIDE
+                        + (tile.x - coord.x * TILES_PER_SIDE);
+
+        u16 &observers = cached->observers[index];
+        u8 &los = cached->los_indices[index];
+
+        // Seen again, stays visible
+        if (observers & LOS_OBSERVER_MASK)
+        {
+            observers &= ~LOS_FADING_BIT;
+            continue;
+        }
+
+        if (los > LOS_EXPLORED)
+        {
+            los--;
+            cached->los_dirty_rows |= 1ull << (index / TILES_PER_SIDE);
+        }
+
+        if (los <= LOS_EXPLORED)
+        {
+            observers &= ~LOS_FADING_BIT;
+            continue;
+        }
+
+        fading[kept++] = tile;
+    }
+
+    fading.resize(kept);
+}
+
+void FogOfWar::resetChunk(v2i coord, Chunk &chunk)
+{
+    // Anything still brighter than explored fades unless restamped
+    for (u32 i = 0; i < TILES_PER_SIDE * TILES_PER_SIDE; i++)
+    {
+        chunk.observers[i] = 0;
+        if (chunk.los_indices[i] > LOS_EXPLORED)
+        {
+            chunk.observers[i] = LOS_FADING_BIT;
+            fading.push_back(v2i {
+                coord.x * TILES_PER_SIDE + (s32) (i % TILES_PER_SIDE),
+                coord.y * TILES_PER_SIDE + (s32) (i / TILES_PER_SIDE)
+            });
+        }
+    }
+}
+
+void FogOfWar::rebuild()
+{
+    fading.clear();
+    resident.clear();
+
+    chunks.forEach([&](v2i coord, Chunk &chunk)
+    {
+        resetChunk(coord, chunk);
+        resident[coord] = chunks.insertedAt(coord);
+    });
+
+    // Heights may have changed with the chunks, and the mode with them
+    registry
+        .view<LOSStamp>()
+        .each(
+                [&](LOSStamp &stamp)
+                {
+                    if (occlusion)
+                        computeViewshed(stamp);
+                    else
+                        stamp.runs.clear();
+
+                    this->stamp(NO_STAMP, stamp);
+                }
+            );
+
+    chunk_epoch = chunks.epoch();
+    needs_rebuild = false;
+    stats.rebuilds++;
+}
+
+void FogOfWar::recountChunks()
+{
+    // Left, regenerated or new since the last update
+    std::vector<v2i> changed;
+    for (auto it = resident.begin(); it != resident.end();)
+    {
+        if (chunks.insertedAt(it->first) == it->second)
+        {
+            ++it;
+            continue;
+        }
+
+        changed.push_back(it->first);
+        it = resident.erase(it);
+    }
+    const size_t left = changed.size();
+
+    chunks.forEach([&](v2i coord, Chunk &)
+    {
+        if (resident.try_emplace(coord, chunks.insertedAt(coord)).second)
+            changed.push_back(coord);
+    });
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end(),
+                [](v2i a, v2i b) { return a.x == b.x && a.y == b.y; }),
+            changed.end());
+
+    auto isChanged = [&](v2i coord)
+    {
+        return std::binary_search(changed.begin(), changed.end(), coord);
+    };
+
+    // Stamps whose disc reaches a changed chunk. With occlusion the
+    // heights there are part of their viewshed as well.
+    std::vector<LOSStamp *> affected;
+    registry
+        .view<LOSStamp>()
+        .each(
+                [&](LOSStamp &stamp)
+                {
+                    const s32 extent = (s32) disc(stamp.radius).size() - 1;
+                    const s32 cx0 = floorDiv(stamp.center.x - extent, TILES_PER_SIDE);
+                    const s32 cx1 = floorDiv(stamp.center.x + extent, TILES_PER_SIDE);
+                    const s32 cy0 = floorDiv(stamp.center.y - extent, TILES_PER_SIDE);
+                    const s32 cy1 = floorDiv(stamp.center.y + extent, TILES_PER_SIDE);
+
+                    for (s32 cy = cy0; cy <= cy1; cy++)
+                    {
+                        for (s32 cx = cx0; cx <= cx1; cx++)
+                        {
+                            if (isChanged(v2i { cx, cy }))
+                            {
+                                affected.push_back(&stamp);
+                                return;
+                            }
+                        }
+                    }
+                }
+            );
+
+    // Taken off the chunks that kept their counts, then put back once
+    // the changed chunks start over, so no stamp is counted twice
+    for (LOSStamp *stamp : affected)
+        unstamp(*stamp);
+
+    // Only chunks that were counted before can have tiles on the list
+    if (left)
+    {
+        fading.erase(std::remove_if(fading.begin(), fading.end(),
+                    [&](v2i tile)
+                    {
+                        return isChanged(v2i { floorDiv(tile.x, TILES_PER_SIDE), floorDiv(tile.y, TILES_PER_SIDE) });
+                    }),
+                fading.end());
+    }
+
+    for (v2i coord : changed)
+    {
+        if (Chunk *chunk = chunks.find(coord))
+            resetChunk(coord, *chunk);
+    }
+
+    for (LOSStamp *stamp : affected)
+    {
+        if (occlusion)
+            computeViewshed(*stamp);
+        else
+            stamp->runs.clear();
+
+        this->stamp(NO_STAMP, *stamp);
+    }
+
+    chunk_epoch = chunks.epoch();
+    stats.chunks_recounted = changed.size();
+    stats.stamps_recounted = affected.size();
+}
+
+void FogOfWar::onStampDestroyed(entt::registry &registry, entt::entity entity)
+{
+    unstamp(registry.get<LOSStamp>(entity));
+}
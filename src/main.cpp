@@ -25,6 +25,8 @@
 #include "common.h"
 #include "logger.h"
 #include "renderer.h"
+#include "command_compiler.h"
+#include "metal_renderer.h"
 #include "camera.h"
 #include "asset.h"
 #include "terrain.h"
@@ -37,6 +39,10 @@
 #include "input.h"
 #include "world.h"
 #include "window.h"
+#include "bench.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include "simulation.h"
 
 const glm::vec3 north(-1.0f, -1.0f, 0.0f);
 const glm::vec3 south(1.0f, 1.0f, 0.0f);
@@ -48,6 +54,24 @@ int main(int argc, char *argv[])
     // TODO: Set log level with option or defines
     Log::setLogLevel(Log::LogLevel::VERBOSE);
 
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+    {
+        return Bench::runAll() ? 1 : 0;
+    }
+
+    u32 tick_rate = DEFAULT_TICK_RATE;
+    bool validate_frames = false;
+    bool compile_commands = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--validate-frames")
+            validate_frames = true;
+        else if (std::string(argv[i]) == "--compile-commands")
+            compile_commands = true;
+        else if (std::string(argv[i]) == "--tick-rate" && i + 1 < argc)
+            tick_rate = std::max(atoi(argv[i + 1]), 1);
+    }
+
     // INITIALIZE WINDOW
     DZWindow window("DZMKII", 1024, 768);
     
@@ -61,12 +85,14 @@ int main(int argc, char *argv[])
     auto terrain_shader_src = *ass_man.getTextFile("shaders/terrain_shader.metal");
     auto fow_shader_src     = *ass_man.getTextFile("shaders/LOS_shader.metal");
 
-    DZRenderer renderer(window);
+    DZRenderer renderer(std::make_unique<DZMetalBackend>(window));
+    renderer.validate_in_flight = validate_frames;
+    renderer.compile_commands = compile_commands;
 
     std::vector<DZShader> gui_shaders 
         = renderer.compileShaders(gui_shader_src, {"vertexMain", "fragmentMain"});
     std::vector<DZShader> basic_shaders 
-        = renderer.compileShaders(basic_shader_src, {"vertexMain", "fragmentMain"});
+        = renderer.compileShaders(basic_shader_src, {"vertexMain", "fragmentMain", "vertexInstanced"});
     std::vector<DZShader> terrain_shaders 
         = renderer.compileShaders(terrain_shader_src, {"vertexMain", "fragmentMain"});
     std::vector<DZShader> fow_shaders 
@@ -74,7 +100,7 @@ int main(int argc, char *argv[])
 
     // TODO: Handle more gracefully
     if(gui_shaders.size()     != 2) exit(1);
-    if(basic_shaders.size()   != 2) exit(1);
+    if(basic_shaders.size()   != 3) exit(1);
     if(terrain_shaders.size() != 2) exit(1);
     if(fow_shaders.size()     != 2) exit(1);
 
@@ -82,6 +108,8 @@ int main(int argc, char *argv[])
         = renderer.createPipeline(gui_shaders[0], gui_shaders[1]);
     DZPipeline basic_pipeline 
         = renderer.createPipeline(basic_shaders[0], basic_shaders[1]);
+    DZPipeline instanced_pipeline 
+        = renderer.createPipeline(basic_shaders[2], basic_shaders[1]);
     DZPipeline terrain_pipeline 
         = renderer.createPipeline(terrain_shaders[0], terrain_shaders[1]);
     DZPipeline fow_pipeline
@@ -183,9 +211,14 @@ int main(int argc, char *argv[])
 
     // CREATE WORLD
 
+    // Runs the game systems that do not depend on each other at the same
+    // time, and the ones that split their work into pieces
+    ThreadPool system_pool(ThreadPool::defaultThreadCount());
+
     World world {
-        Scene(renderer, terrain_pipeline, basic_pipeline, gui_pipeline, fow_pipeline),
-        {},
+        Scene(renderer, terrain_pipeline, instanced_pipeline, gui_pipeline, fow_pipeline, DEFAULT_CHUNK_STORE_DIRECTORY),
+        GameSystems(system_pool),
+        TickSystems(system_pool),
         {}
     };
 
@@ -211,13 +244,15 @@ int main(int argc, char *argv[])
     loser_plane_data.translate(glm::vec3(-0.5, -0.5, 0.0));
     DZMesh loser_mesh = renderer.createMesh(loser_plane_data);
 
+    // Drawn instanced, so the units can share one Model
+    Model loser_model = Model::fromMeshes(std::vector<DZMesh> { loser_mesh });
+
     for (int i = 0; i < 10; i++)
     {
         const entt::entity c = world.scene.registry.create();
         Transform loser_transform;
         loser_transform.pos = glm::vec3((rand() % 200) * 1.0f,(rand() % 200) * 1.0f, 0.0f);
         world.scene.registry.emplace<Transform>(c, loser_transform);
-        Model loser_model = Model::fromMeshes(renderer, std::vector<DZMesh> { loser_mesh });
         world.scene.registry.emplace<Model>(c, loser_model);
         world.scene.registry.emplace<LineOfSight>(c, 5u);
         world.scene.registry.emplace<MoveSpeed>(c, rand() % 10u + 2u);
@@ -225,11 +260,23 @@ int main(int argc, char *argv[])
 
     // SET WORLD SYSTEMS
 
-    world.game_systems.push_back(&GameSystem::inputActions);
-    world.game_systems.push_back(&GameSystem::cameraMovement);
-    world.game_systems.push_back(&GameSystem::terrainGeneration);
-    world.game_systems.push_back(&GameSystem::unitMovement);
-    world.game_systems.push_back(&GameSystem::LOS);
+    world.game_systems.add("inputActions", &GameSystem::inputActions,
+            SystemAccess()
+                .reads(RESOURCE_CAMERA | RESOURCE_SPATIAL)
+                .reads<Transform>()
+                .writes(RESOURCE_RENDERER | RESOURCE_CHUNKS | RESOURCE_FOG | RESOURCE_GUI | RESOURCE_SETTINGS)
+                .writes<Selected>()
+                .onMainThread());
+    world.game_systems.add("cameraMovement", &GameSystem::cameraMovement,
+            SystemAccess()
+                .writes(RESOURCE_CAMERA));
+    world.game_systems.add("terrainGeneration", &GameSystem::terrainGeneration,
+            SystemAccess()
+                .reads(RESOURCE_CAMERA)
+                .writes(RESOURCE_RENDERER | RESOURCE_CHUNKS)
+                .onMainThread());
+
+    addTickSystems(world.tick_systems);
 
     world.render_systems.push_back(&RenderSystem::updateData);
     world.render_systems.push_back(&RenderSystem::terrain);
@@ -240,13 +287,17 @@ int main(int argc, char *argv[])
     // DEBUG WORLD
 
     World model_view_world = {
-        Scene(renderer, terrain_pipeline, basic_pipeline, gui_pipeline, fow_pipeline),
-        {},
+        Scene(renderer, terrain_pipeline, instanced_pipeline, gui_pipeline, fow_pipeline),
+        GameSystems(system_pool),
+        TickSystems(system_pool),
         {}
     };
 
     model_view_world.scene.camera.ortho = false;
-    model_view_world.game_systems.push_back(&GameSystem::debugControl);
+    model_view_world.game_systems.add("debugControl", &GameSystem::debugControl,
+            SystemAccess()
+                .writes(RESOURCE_CAMERA | RESOURCE_SETTINGS)
+                .writes<Transform>());
     model_view_world.render_systems.push_back(&RenderSystem::updateData);
     model_view_world.render_systems.push_back(&RenderSystem::models);
 
@@ -281,6 +332,9 @@ int main(int argc, char *argv[])
         glm::vec3(0.0)
     };
 
+    Simulation simulation(tick_rate);
+    Log::verbose("Simulating at %u ticks per second", simulation.getTickRate());
+
     while(true)
     {
         elapsed_time += delta_time;
@@ -293,6 +347,13 @@ int main(int argc, char *argv[])
         if (input.quit)
             goto quit;
 
+        // Only waits when the GPU is FRAMES_IN_FLIGHT frames behind
+        renderer.beginFrame();
+
+        // The ticks started last frame ran alongside the GPU, what they
+        // left is what this frame draws
+        simulation.finish();
+
         if (input.key[DZKey::F] && !input.key_prev[DZKey::F])
         {
             if (curr_world == &world)
@@ -301,14 +362,46 @@ int main(int argc, char *argv[])
                 curr_world = &world;
         }
 
-        renderer.waitForRenderFinish();
+        curr_world->scene.screen_dim = screen_dim;
+        curr_world->game_systems.run(renderer, curr_world->scene, input, gui, system_pool, delta_time);
+        GameSystem::saveAndLoad(renderer, curr_world->scene, input, gui, system_pool, delta_time);
+
+        if (input.key[DZKey::T] && !input.key_prev[DZKey::T])
+        {
+            curr_world->game_systems.logTimings();
+            curr_world->tick_systems.logTimings();
+
+            if (renderer.compile_commands)
+            {
+                const CommandCompileStats &compiled = renderer.getCompileStats();
+                Log::info("Render commands: %u queued, %u executed, %u draws in %u passes, %u left in queue order%s",
+                        compiled.commands_in, compiled.commands_out, compiled.draws, compiled.passes,
+                        compiled.passes_in_queue_order, compiled.unsorted ? ", unsorted" : "");
+                Log::info("\tdropped %u pipelines, %u buffer binds, %u texture binds",
+                        compiled.pipelines_dropped, compiled.buffer_binds_dropped, compiled.texture_binds_dropped);
+            }
+            if (renderer.validate_in_flight)
+                Log::info("\t%u writes to data the GPU was reading", renderer.getInFlightViolations());
+        }
 
-        for (auto system : curr_world->game_systems)
-            system(renderer, curr_world->scene, input, gui, delta_time);
+        curr_world->scene.tick_alpha = simulation.getAlpha();
    
         for (auto system : curr_world->render_systems)
             system(renderer, curr_world->scene, input, screen_dim, gui, elapsed_time);
 
+        {
+            World *ticking = curr_world;
+            const f64 tick_seconds = simulation.getTickSeconds();
+            simulation.begin(
+                    simulation.accumulate(delta_time),
+                    [ticking, tick_seconds, &system_pool](u32 ticks)
+                    {
+                        for (u32 i = 0; i < ticks; i++)
+                            ticking->tick_systems.run(ticking->scene, system_pool, tick_seconds);
+                    }
+                );
+        }
+
         // Texture preview
         //renderer.enqueueCommand(
         //        DZRenderCommand::SetPipeline(curr_world->scene.gui_pipeline));
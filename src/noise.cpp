@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define NOISE_X86 1
+#   include <immintrin.h>
+#endif
+
+#include "noise.h"
+
+namespace
+{
+    // siv::PerlinNoise::noise2D samples the 3D noise at this fixed z,
+    // so iz is always 0 and fz and its fade are constants
+    const f32 NOISE_Z      = (f32) SIVPERLIN_DEFAULT_Z;
+    const f32 NOISE_Z_FADE = NOISE_Z * NOISE_Z * NOISE_Z * (NOISE_Z * (NOISE_Z * 6 - 15) + 10);
+
+    inline f32 fade(f32 t)
+    {
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
+
+    inline f32 lerp(f32 a, f32 b, f32 t)
+    {
+        return a + (b - a) * t;
+    }
+
+    inline f32 grad(s32 hash, f32 x, f32 y, f32 z)
+    {
+        const s32 h = hash & 15;
+        const f32 u = h < 8 ? x : y;
+        const f32 v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+        return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+    }
+
+    inline f32 noiseScalar(const s32 *perm, f32 x, f32 y)
+    {
+        const f32 _x = std::floor(x);
+        const f32 _y = std::floor(y);
+
+        const s32 ix = static_cast<s32>(_x) & 255;
+        const s32 iy = static_cast<s32>(_y) & 255;
+
+        const f32 fx = x - _x;
+        const f32 fy = y - _y;
+        const f32 fz = NOISE_Z;
+
+        const f32 u = fade(fx);
+        const f32 v = fade(fy);
+
+        const s32 A = (perm[ix] + iy) & 255;
+        const s32 B = (perm[ix + 1] + iy) & 255;
+
+        const s32 AA = perm[A];
+        const s32 AB = perm[A + 1];
+        const s32 BA = perm[B];
+        const s32 BB = perm[B + 1];
+
+        const f32 p0 = grad(perm[AA],     fx,     fy,     fz);
+        const f32 p1 = grad(perm[BA],     fx - 1, fy,     fz);
+        const f32 p2 = grad(perm[AB],     fx,     fy - 1, fz);
+        const f32 p3 = grad(perm[BB],     fx - 1, fy - 1, fz);
+        const f32 p4 = grad(perm[AA + 1], fx,     fy,     fz - 1);
+        const f32 p5 = grad(perm[BA + 1], fx - 1, fy,     fz - 1);
+        const f32 p6 = grad(perm[AB + 1], fx,     fy - 1, fz - 1);
+        const f32 p7 = grad(perm[BB + 1], fx - 1, fy - 1, fz - 1);
+
+        const f32 r0 = lerp(lerp(p0, p1, u), lerp(p2, p3, u), v);
+        const f32 r1 = lerp(lerp(p4, p5, u), lerp(p6, p7, u), v);
+
+        return lerp(r0, r1, NOISE_Z_FADE);
+    }
+
+    void octaveScalar(
+            const s32 *perm,
+            const f32 *xs, const f32 *ys, f32 *out,
+            u32 count, s32 octaves, f32 persistence
+        )
+    {
+        for (u32 i = 0; i < count; i++)
+        {
+            f32 x = xs[i];
+            f32 y = ys[i];
+            f32 result = 0.0f;
+            f32 amplitude = 1.0f;
+
+            for (s32 o = 0; o < octaves; o++)
+            {
+                result += noiseScalar(perm, x, y) * amplitude;
+                x *= 2;
+                y *= 2;
+                amplitude *= persistence;
+            }
+
+            out[i] = result;
+        }
+    }
+
+#ifdef NOISE_X86
+
+    // SSE4.1, 4 lanes. There is no gather, so the permutation lookups
+    // go through memory, everything else stays in registers.
+
+    __attribute__((target("sse4.1")))
+    inline __m128i gather4(const s32 *perm, __m128i idx)
+    {
+        alignas(16) s32 i[4];
+        _mm_store_si128((__m128i *) i, idx);
+        return _mm_setr_epi32(perm[i[0]], perm[i[1]], perm[i[2]], perm[i[3]]);
+    }
+
+    __attribute__((target("sse4.1")))
+    inline __m128 fade4(__m128 t)
+    {
+        __m128 r = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+        r = _mm_add_ps(_mm_mul_ps(t, r), _mm_set1_ps(10.0f));
+        return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), r);
+    }
+
+    __attribute__((target("sse4.1")))
+    inline __m128 lerp4(__m128 a, __m128 b, __m128 t)
+    {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+    }
+
+    __attribute__((target("sse4.1")))
+    inline __m128 grad4(__m128i hash, __m128 x, __m128 y, __m128 z)
+    {
+        const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+
+        const __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+        const __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+        const __m128 hx  = _mm_castsi128_ps(_mm_or_si128(
+                    _mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+                    _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+
+        const __m128 u = _mm_blendv_ps(y, x, lt8);
+        const __m128 v = _mm_blendv_ps(_mm_blendv_ps(z, x, hx), y, lt4);
+
+        // Bit 0 flips the sign of u, bit 1 the sign of v
+        const __m128 sign_u = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+        const __m128 sign_v = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+
+        return _mm_add_ps(_mm_xor_ps(u, sign_u), _mm_xor_ps(v, sign_v));
+    }
+
+    __attribute__((target("sse4.1")))
+    inline __m128 noise4(const s32 *perm, __m128 x, __m128 y)
+    {
+        const __m128i mask = _mm_set1_epi32(255);
+        const __m128i one  = _mm_set1_epi32(1);
+        const __m128 onef  = _mm_set1_ps(1.0f);
+
+        const __m128 _x = _mm_floor_ps(x);
+        const __m128 _y = _mm_floor_ps(y);
+
+        const __m128i ix = _mm_and_si128(_mm_cvttps_epi32(_x), mask);
+        const __m128i iy = _mm_and_si128(_mm_cvttps_epi32(_y), mask);
+
+        const __m128 fx  = _mm_sub_ps(x, _x);
+        const __m128 fy  = _mm_sub_ps(y, _y);
+        const __m128 fz  = _mm_set1_ps(NOISE_Z);
+        const __m128 fx1 = _mm_sub_ps(fx, onef);
+        const __m128 fy1 = _mm_sub_ps(fy, onef);
+        const __m128 fz1 = _mm_sub_ps(fz, onef);
+
+        const __m128 u = fade4(fx);
+        const __m128 v = fade4(fy);
+
+        const __m128i A = _mm_and_si128(_mm_add_epi32(gather4(perm, ix), iy), mask);
+        const __m128i B = _mm_and_si128(_mm_add_epi32(gather4(perm, _mm_add_epi32(ix, one)), iy), mask);
+
+        const __m128i AA = gather4(perm, A);
+        const __m128i AB = gather4(perm, _mm_add_epi32(A, one));
+        const __m128i BA = gather4(perm, B);
+        const __m128i BB = gather4(perm, _mm_add_epi32(B, one));
+
+        const __m128 p0 = grad4(gather4(perm, AA), fx,  fy,  fz);
+        const __m128 p1 = grad4(gather4(perm, BA), fx1, fy,  fz);
+        const __m128 p2 = grad4(gather4(perm, AB), fx,  fy1, fz);
+        const __m128 p3 = grad4(gather4(perm, BB), fx1, fy1, fz);
+        const __m128 p4 = grad4(gather4(perm, _mm_add_epi32(AA, one)), fx,  fy,  fz1);
+        const __m128 p5 = grad4(gather4(perm, _mm_add_epi32(BA, one)), fx1, fy,  fz1);
+        const __m128 p6 = grad4(gather4(perm, _mm_add_epi32(AB, one)), fx,  fy1, fz1);
+        const __m128 p7 = grad4(gather4(perm, _mm_add_epi32(BB, one)), fx1, fy1, fz1);
+
+        const __m128 r0 = lerp4(lerp4(p0, p1, u), lerp4(p2, p3, u), v);
+        const __m128 r1 = lerp4(lerp4(p4, p5, u), lerp4(p6, p7, u), v);
+
+        return lerp4(r0, r1, _mm_set1_ps(NOISE_Z_FADE));
+    }
+
+    __attribute__((target("sse4.1")))
+    void octaveSSE41(
+            const s32 *perm,
+            const f32 *xs, const f32 *ys, f32 *out,
+            u32 count, s32 octaves, f32 persistence
+        )
+    {
+        u32 i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(xs + i);
+            __m128 y = _mm_loadu_ps(ys + i);
+            __m128 result = _mm_setzero_ps();
+            f32 amplitude = 1.0f;
+
+            for (s32 o = 0; o < octaves; o++)
+            {
+                result = _mm_add_ps(result, _mm_mul_ps(noise4(perm, x, y), _mm_set1_ps(amplitude)));
+                x = _mm_add_ps(x, x);
+                y = _mm_add_ps(y, y);
+                amplitude *= persistence;
+            }
+
+            _mm_storeu_ps(out + i, result);
+        }
+
+        octaveScalar(perm, xs + i, ys + i, out + i, count - i, octaves, persistence);
+    }
+
+    // AVX2, 8 lanes, permutation lookups are hardware gathers
+
+    __attribute__((target("avx2")))
+    inline __m256i gather8(const s32 *perm, __m256i idx)
+    {
+        return _mm256_i32gather_epi32(perm, idx, 4);
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256 fade8(__m256 t)
+    {
+        __m256 r = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+        r = _mm256_add_ps(_mm256_mul_ps(t, r), _mm256_set1_ps(10.0f));
+        return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), r);
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256 lerp8(__m256 a, __m256 b, __m256 t)
+    {
+        return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z)
+    {
+        const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+
+        const __m256 lt8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+        const __m256 lt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+        const __m256 hx  = _mm256_castsi256_ps(_mm256_or_si256(
+                    _mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+                    _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+
+        const __m256 u = _mm256_blendv_ps(y, x, lt8);
+        const __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, hx), y, lt4);
+
+        const __m256 sign_u = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+        const __m256 sign_v = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+
+        return _mm256_add_ps(_mm256_xor_ps(u, sign_u), _mm256_xor_ps(v, sign_v));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256 noise8(const s32 *perm, __m256 x, __m256 y)
+    {
+        const __m256i mask = _mm256_set1_epi32(255);
+        const __m256i one  = _mm256_set1_epi32(1);
+        const __m256 onef  = _mm256_set1_ps(1.0f);
+
+        const __m256 _x = _mm256_floor_ps(x);
+        const __m256 _y = _mm256_floor_ps(y);
+
+        const __m256i ix = _mm256_and_si256(_mm256_cvttps_epi32(_x), mask);
+        const __m256i iy = _mm256_and_si256(_mm256_cvttps_epi32(_y), mask);
+
+        const __m256 fx  = _mm256_sub_ps(x, _x);
+        const __m256 fy  = _mm256_sub_ps(y, _y);
+        const __m256 fz  = _mm256_set1_ps(NOISE_Z);
+        const __m256 fx1 = _mm256_sub_ps(fx, onef);
+        const __m256 fy1 = _mm256_sub_ps(fy, onef);
+        const __m256 fz1 = _mm256_sub_ps(fz, onef);
+
+        const __m256 u = fade8(fx);
+        const __m256 v = fade8(fy);
+
+        const __m256i A = _mm256_and_si256(_mm256_add_epi32(gather8(perm, ix), iy), mask);
+        const __m256i B = _mm256_and_si256(_mm256_add_epi32(gather8(perm, _mm256_add_epi32(ix, one)), iy), mask);
+
+        const __m256i AA = gather8(perm, A);
+        const __m256i AB = gather8(perm, _mm256_add_epi32(A, one));
+        const __m256i BA = gather8(perm, B);
+        const __m256i BB = gather8(perm, _mm256_add_epi32(B, one));
+
+        const __m256 p0 = grad8(gather8(perm, AA), fx,  fy,  fz);
+        const __m256 p1 = grad8(gather8(perm, BA), fx1, fy,  fz);
+        const __m256 p2 = grad8(gather8(perm, AB), fx,  fy1, fz);
+        const __m256 p3 = grad8(gather8(perm, BB), fx1, fy1, fz);
+        const __m256 p4 = grad8(gather8(perm, _mm256_add_epi32(AA, one)), fx,  fy,  fz1);
+        const __m256 p5 = grad8(gather8(perm, _mm256_add_epi32(BA, one)), fx1, fy,  fz1);
+        const __m256 p6 = grad8(gather8(perm, _mm256_add_epi32(AB, one)), fx,  fy1, fz1);
+        const __m256 p7 = grad8(gather8(perm, _mm256_add_epi32(BB, one)), fx1, fy1, fz1);
+
+        const __m256 r0 = lerp8(lerp8(p0, p1, u), lerp8(p2, p3, u), v);
+        const __m256 r1 = lerp8(lerp8(p4, p5, u), lerp8(p6, p7, u), v);
+
+        return lerp8(r0, r1, _mm256_set1_ps(NOISE_Z_FADE));
+    }
+
+    __attribute__((target("avx2")))
+    void octaveAVX2(
+            const s32 *perm,
+            const f32 *xs, const f32 *ys, f32 *out,
+            u32 count, s32 octaves, f32 persistence
+        )
+    {
+        u32 i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(xs + i);
+            __m256 y = _mm256_loadu_ps(ys + i);
+            __m256 result = _mm256_setzero_ps();
+            f32 amplitude = 1.0f;
+
+            for (s32 o = 0; o < octaves; o++)
+            {
+                result = _mm256_add_ps(result, _mm256_mul_ps(noise8(perm, x, y), _mm256_set1_ps(amplitude)));
+                x = _mm256_add_ps(x, x);
+                y = _mm256_add_ps(y, y);
+                amplitude *= persistence;
+            }
+
+            _mm256_storeu_ps(out + i, result);
+        }
+
+        octaveScalar(perm, xs + i, ys + i, out + i, count - i, octaves, persistence);
+    }
+
+#endif // NOISE_X86
+}
+
+PerlinBatch::PerlinBatch(const siv::PerlinNoise &perlin)
+    : path { bestPath() }
+{
+    const auto &state = perlin.serialize();
+    for (u32 i = 0; i < 512; i++)
+        perm[i] = state[i & 255];
+}
+
+PerlinBatch::Path PerlinBatch::bestPath()
+{
+#ifdef NOISE_X86
+    if (__builtin_cpu_supports("avx2"))
+        return Path::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return Path::SSE41;
+#endif
+    return Path::SCALAR;
+}
+
+const char *PerlinBatch::pathName(Path path)
+{
+    switch (path)
+    {
+        case Path::AVX2:  return "AVX2";
+        case Path::SSE41: return "SSE4.1";
+        default:          return "scalar";
+    }
+}
+
+void PerlinBatch::octave2D(
+        const f32 *xs,
+        const f32 *ys,
+        f32 *out,
+        u32 count,
+        s32 octaves,
+        f32 persistence
+    ) const
+{
+    octaves = std::min(octaves, NOISE_MAX_OCTAVES);
+
+    switch (path)
+    {
+#ifdef NOISE_X86
+        case Path::AVX2:
+            octaveAVX2(perm.data(), xs, ys, out, count, octaves, persistence);
+            break;
+        case Path::SSE41:
+            octaveSSE41(perm.data(), xs, ys, out, count, octaves, persistence);
+            break;
+#endif
+        default:
+            octaveScalar(perm.data(), xs, ys, out, count, octaves, persistence);
+            break;
+    }
+}
+
+void PerlinBatch::octave2DGrid(
+        f32 x0,
+        f32 y0,
+        f32 step,
+        u32 nx,
+        u32 ny,
+        f32 *out,
+        s32 octaves,
+        f32 persistence
+    ) const
+{
+    std::vector<f32> xs(nx);
+    std::vector<f32> ys(nx);
+
+    for (u32 i = 0; i < nx; i++)
+        xs[i] = x0 + i * step;
+
+    for (u32 j = 0; j < ny; j++)
+    {
+        std::fill(ys.begin(), ys.end(), y0 + j * step);
+        this->octave2D(xs.data(), ys.data(), out + j * nx, nx, octaves, persistence);
+    }
+}
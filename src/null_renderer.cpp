@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cstring>
+
+#include "logger.h"
+
+#include "null_renderer.h"
+
+DZNullBackend::DZNullBackend()
+    : num_shaders { 0 }
+    , num_pipelines { 0 }
+    , num_textures { 0 }
+    , num_texture_arrays { 0 }
+    , latency { 0 }
+    , executed_frames { 0 }
+    , finished_frames { 0 }
+    , stats {}
+{}
+
+const NullRenderStats &DZNullBackend::getStats() const
+{
+    return stats;
+}
+
+void DZNullBackend::waitForRenderFinish()
+{
+    waitForFrame(executed_frames);
+}
+
+void DZNullBackend::waitForFrame(u64 frame)
+{
+    frame = std::min(frame, executed_frames);
+    if (frame <= finished_frames)
+        return;
+
+    finished_frames = frame;
+    stats.stalls++;
+}
+
+u64 DZNullBackend::finishedFrame()
+{
+    return finished_frames;
+}
+
+bool DZNullBackend::validMesh(DZMesh mesh) const
+{
+    return mesh < meshes.size() && meshes[mesh].live;
+}
+
+bool DZNullBackend::validBuffer(DZBuffer buffer) const
+{
+    return buffer < buffers.size() && buffers[buffer].live;
+}
+
+void DZNullBackend::execute(const std::vector<DZRenderCommand> &commands)
+{
+    for (const auto &command : commands)
+    {
+        bool valid = true;
+
+        switch (command.type)
+        {
+            case DZRenderCommand::SET_PIPELINE:
+                valid = command.pipeline < num_pipelines;
+                break;
+            case DZRenderCommand::SET_CLEAR_COLOR:
+                break;
+            case DZRenderCommand::BIND_BUFFER:
+                valid = validBuffer(command.buffer_binding.resource);
+                break;
+            case DZRenderCommand::BIND_TEXTURE:
+                valid = command.texture_binding.resource < num_textures;
+                break;
+            case DZRenderCommand::DRAW_MESH:
+                valid = validMesh(command.mesh);
+                stats.draws++;
+                break;
+            case DZRenderCommand::DRAW_INDEXED:
+            {
+                const auto &draw = command.indexed_draw;
+                valid = validMesh(draw.mesh)
+                     && validBuffer(draw.index_buffer)
+                     && draw.index_count * sizeof(u16) <= buffers[draw.index_buffer].contents.size();
+                stats.draws++;
+                break;
+            }
+            case DZRenderCommand::DRAW_INSTANCED:
+                valid = validMesh(command.instanced_draw.mesh);
+                stats.draws++;
+                stats.instances += command.instanced_draw.instance_count;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+
+        if (!valid)
+        {
+            Log::warning("Render command %d names a resource that does not exist", command.type);
+            stats.invalid_handles++;
+        }
+    }
+
+    last_frame = commands;
+    stats.commands += commands.size();
+    stats.frames++;
+
+    executed_frames++;
+    if (executed_frames > latency)
+        finished_frames = std::max(finished_frames, executed_frames - latency);
+}
+
+std::vector<DZShader> DZNullBackend::compileShaders(
+        std::string, std::vector<std::string> main_fns
+    )
+{
+    std::vector<DZShader> ret;
+    for (size_t i = 0; i < main_fns.size(); i++)
+        ret.push_back(num_shaders++);
+    return ret;
+}
+
+DZPipeline DZNullBackend::createPipeline(
+        DZShader vertex_shader, DZShader fragment_shader
+    )
+{
+    if (vertex_shader >= num_shaders || fragment_shader >= num_shaders)
+    {
+        Log::error("Creating a pipeline from shaders that do not exist");
+        stats.invalid_handles++;
+        return DZInvalid;
+    }
+
+    return num_pipelines++;
+}
+
+DZMesh DZNullBackend::addMesh(NullMesh &&mesh)
+{
+    mesh.live = true;
+    stats.live_meshes++;
+    stats.bytes_uploaded += mesh.vertices.size() + mesh.indices.size() * sizeof(u32);
+
+    if (!free_meshes.empty())
+    {
+        DZMesh ret = free_meshes.back();
+        free_meshes.pop_back();
+        meshes[ret] = std::move(mesh);
+        return ret;
+    }
+
+    meshes.push_back(std::move(mesh));
+    return meshes.size() - 1;
+}
+
+DZMesh DZNullBackend::createMesh(const MeshData &mesh_data)
+{
+    NullMesh mesh;
+    mesh.num_elements = 
+        !mesh_data.indices.empty() 
+        ? mesh_data.indices.size() 
+        : mesh_data.vertices.size();
+    mesh.primitive_type = mesh_data.primitive_type;
+
+    const u8 *vertices = (const u8 *) mesh_data.vertices.data();
+    mesh.vertices.assign(vertices, vertices + mesh_data.vertices.size() * sizeof(Vertex));
+    mesh.indices = mesh_data.indices;
+
+    return addMesh(std::move(mesh));
+}
+
+DZMesh DZNullBackend::createMesh(
+        const void *vertices,
+        size_t size,
+        u32 num_vertices,
+        PrimitiveType primitive_type
+    )
+{
+    NullMesh mesh;
+    mesh.num_elements = num_vertices;
+    mesh.primitive_type = primitive_type;
+    mesh.vertices.assign((const u8 *) vertices, (const u8 *) vertices + size);
+
+    return addMesh(std::move(mesh));
+}
+
+void DZNullBackend::releaseMesh(DZMesh mesh)
+{
+    if (!validMesh(mesh))
+    {
+        Log::warning("Releasing a mesh that does not exist");
+        stats.invalid_handles++;
+        return;
+    }
+
+    meshes[mesh] = NullMesh {};
+    free_meshes.push_back(mesh);
+    stats.live_meshes--;
+}
+
+DZBuffer DZNullBackend::createBufferOfSize(size_t size, StorageMode mode)
+{
+    NullBuffer buffer { true, mode, std::vector<u8>(size, 0) };
+    stats.live_buffers++;
+
+    if (!free_buffers.empty())
+    {
+        DZBuffer ret = free_buffers.back();
+        free_buffers.pop_back();
+        buffers[ret] = std::move(buffer);
+        return ret;
+    }
+
+    buffers.push_back(std::move(buffer));
+    return buffers.size() - 1;
+}
+
+void DZNullBackend::setBufferOfSize(DZBuffer buffer, void *data, size_t size)
+{
+    if (!validBuffer(buffer) || size > buffers[buffer].contents.size())
+    {
+        Log::warning("Writing past the end of a buffer or to one that does not exist");
+        stats.invalid_handles++;
+        return;
+    }
+
+    memcpy(buffers[buffer].contents.data(), data, size);
+    stats.bytes_uploaded += size;
+}
+
+void DZNullBackend::setBufferRange(DZBuffer buffer, size_t offset, const void *data, size_t size)
+{
+    if (!validBuffer(buffer) || offset + size > buffers[buffer].contents.size())
+    {
+        Log::warning("Writing past the end of a buffer or to one that does not exist");
+        stats.invalid_handles++;
+        return;
+    }
+
+    memcpy(buffers[buffer].contents.data() + offset, data, size);
+    stats.bytes_uploaded += size;
+}
+
+void DZNullBackend::releaseBuffer(DZBuffer buffer)
+{
+    if (!validBuffer(buffer))
+    {
+        Log::warning("Releasing a buffer that does not exist");
+        stats.invalid_handles++;
+        return;
+    }
+
+    buffers[buffer] = NullBuffer {};
+    free_buffers.push_back(buffer);
+    stats.live_buffers--;
+}
+
+DZTexture DZNullBackend::createTexture(TextureData &texture_data)
+{
+    stats.bytes_uploaded += texture_data.data.size();
+    return num_textures++;
+}
+
+DZTextureArray DZNullBackend::createTextureArray(
+        std::vector<TextureData> texture_datas
+    )
+{
+    if (texture_datas.empty())
+    {
+        Log::error("No textures provided for texture array.");
+        return DZInvalid;
+    }
+
+    for (const auto &texture_data : texture_datas)
+        stats.bytes_uploaded += texture_data.data.size();
+
+    return num_texture_arrays++;
+}
@@ -0,0 +1,835 @@
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+#include "pathfinding.h"
+
+namespace
+{
+    // Steps by ChunkFlow::dir, east first and counter-clockwise. Side s
+    // of a chunk (east north west south) is crossed with step 2 * s.
+    const s32 STEP_X[8] = { 1, 1, 0, -1, -1, -1,  0,  1 };
+    const s32 STEP_Y[8] = { 0, 1, 1,  1,  0, -1, -1, -1 };
+
+    const u32 NO_PORTAL = 0xffffffffu;
+    const u32 START_PORTAL = 0xfffffffeu;
+
+    struct PortalEntry
+    {
+        u32 priority;
+        u32 cost;
+        v2i coord;
+        u32 portal;
+
+        bool operator>(const PortalEntry &other) const
+        {
+            return priority > other.priority;
+        }
+    };
+
+    using PortalQueue = std::priority_queue<
+        PortalEntry,
+        std::vector<PortalEntry>,
+        std::greater<PortalEntry>
+    >;
+
+    s32 floorDiv(s32 a, s32 b)
+    {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    bool sameCoord(v2i a, v2i b)
+    {
+        return a.x == b.x && a.y == b.y;
+    }
+
+    v2i chunkOf(v2i tile)
+    {
+        return v2i {
+            floorDiv(tile.x, TILES_PER_SIDE),
+            floorDiv(tile.y, TILES_PER_SIDE)
+        };
+    }
+
+    u32 localIndex(v2i tile, v2i coord)
+    {
+        return (tile.y - coord.y * TILES_PER_SIDE) * TILES_PER_SIDE
+             + (tile.x - coord.x * TILES_PER_SIDE);
+    }
+
+    v2i globalTile(v2i coord, u32 index)
+    {
+        return v2i {
+            coord.x * TILES_PER_SIDE + (s32) (index % TILES_PER_SIDE),
+            coord.y * TILES_PER_SIDE + (s32) (index / TILES_PER_SIDE)
+        };
+    }
+
+    // Unit vector for a ChunkFlow::dir, zero at the goal and off the field
+    v2f flowStep(u8 dir)
+    {
+        if (dir >= FLOW_AT_GOAL)
+            return v2f { 0.0f, 0.0f };
+
+        const f32 scale = (dir & 1) ? (f32) M_SQRT1_2 : 1.0f;
+        return v2f { STEP_X[dir] * scale, STEP_Y[dir] * scale };
+    }
+
+    bool walkable(const Chunk &chunk, s32 x, s32 y)
+    {
+        return chunk.navigable[y * TILES_PER_SIDE + x] == 0;
+    }
+
+    u32 octile(v2i a, v2i b)
+    {
+        const u32 dx = std::abs(a.x - b.x);
+        const u32 dy = std::abs(a.y - b.y);
+        return PATH_STRAIGHT_COST * std::max(dx, dy)
+             + (PATH_DIAGONAL_COST - PATH_STRAIGHT_COST) * std::min(dx, dy);
+    }
+
+    // Diagonal steps need both straight neighbours open, so tiles joined
+    // by straight steps are all that reach each other
+    void labelRegions(const Chunk &chunk, std::vector<u16> &regions)
+    {
+        regions.assign(TILES_PER_CHUNK, 0);
+
+        std::vector<u32> open;
+        u16 next = 1;
+        for (u32 first = 0; first < TILES_PER_CHUNK; first++)
+        {
+            if (regions[first] || chunk.navigable[first] != 0)
+                continue;
+
+            regions[first] = next;
+            open.push_back(first);
+            while (!open.empty())
+            {
+                const u32 tile = open.back();
+                open.pop_back();
+
+                const s32 x = tile % TILES_PER_SIDE;
+                const s32 y = tile / TILES_PER_SIDE;
+                for (u32 d = 0; d < 8; d += 2)
+                {
+                    const s32 nx = x + STEP_X[d];
+                    const s32 ny = y + STEP_Y[d];
+                    if (nx < 0 || ny < 0 || nx >= TILES_PER_SIDE || ny >= TILES_PER_SIDE)
+                        continue;
+
+                    const u32 n = ny * TILES_PER_SIDE + nx;
+                    if (regions[n] || chunk.navigable[n] != 0)
+                        continue;
+
+                    regions[n] = next;
+                    open.push_back(n);
+                }
+            }
+            next++;
+        }
+    }
+
+    u32 sideOf(const ChunkNav &nav, u32 portal)
+    {
+        u32 side = 0;
+        while (portal >= nav.side_begin[side + 1])
+            side++;
+        return side;
+    }
+}
+
+Pathfinder::Pathfinder(ChunkMap &chunks, f32 chunk_size)
+    : chunks { chunks }
+    , chunk_size { chunk_size }
+    , tile_width { chunk_size / TILES_PER_SIDE }
+    , nav_version { 0 }
+    , use_counter { 0 }
+    , pruned_epoch { chunks.epoch() }
+    , stats {}
+{
+}
+
+v2i Pathfinder::tileFromPos(v2f pos) const
+{
+    return v2i {
+        (s32) std::floor(pos.x / tile_width),
+        (s32) std::floor(pos.y / tile_width)
+    };
+}
+
+v2f Pathfinder::posFromTile(v2i tile) const
+{
+    return v2f {
+        (tile.x + 0.5f) * tile_width,
+        (tile.y + 0.5f) * tile_width
+    };
+}
+
+PathStats Pathfinder::getStats() const
+{
+    return stats;
+}
+
+void Pathfinder::invalidate(v2i coord)
+{
+    navs.erase(coord);
+    edges.erase({ coord, 0 });
+    edges.erase({ coord, 1 });
+    edges.erase({ v2i { coord.x - 1, coord.y }, 0 });
+    edges.erase({ v2i { coord.x, coord.y - 1 }, 1 });
+    nav_version++;
+}
+
+void Pathfinder::prune()
+{
+    if (pruned_epoch == chunks.epoch())
+        return;
+
+    for (auto it = navs.begin(); it != navs.end();)
+        it = chunks.contains(it->first) ? std::next(it) : navs.erase(it);
+
+    for (auto it = edges.begin(); it != edges.end();)
+    {
+        const v2i coord = it->first.first;
+        const v2i other = it->first.second == 0
+            ? v2i { coord.x + 1, coord.y }
+            : v2i { coord.x, coord.y + 1 };
+        it = chunks.contains(coord) && chunks.contains(other) ? std::next(it) : edges.erase(it);
+    }
+
+    for (auto &field : flow_fields)
+    {
+        for (auto it = field->chunk_flows.begin(); it != field->chunk_flows.end();)
+            it = chunks.contains(it->first) ? std::next(it) : field->chunk_flows.erase(it);
+    }
+
+    routes.clear();
+    pruned_epoch = chunks.epoch();
+}
+
+// Dial's algorithm: a step costs at most PATH_DIAGONAL_COST, so every
+// open tile fits in a ring of that many + 1 buckets by cost. Seeds can
+// be far apart, they join when the sweep reaches their cost.
+void Pathfinder::localDijkstra(
+        const Chunk &chunk,
+        const std::vector<PortalSeed> &seeds,
+        u32 *cost,
+        u8 *dir
+    )
+{
+    const u32 ring = PATH_DIAGONAL_COST + 1;
+    thread_local std::array<std::vector<u32>, PATH_DIAGONAL_COST + 1> buckets;
+    thread_local std::vector<PortalSeed> sorted;
+
+    std::fill(cost, cost + TILES_PER_CHUNK, PATH_UNREACHABLE);
+    std::fill(dir, dir + TILES_PER_CHUNK, FLOW_NONE);
+
+    for (auto &bucket : buckets)
+        bucket.clear();
+
+    sorted.clear();
+    for (const PortalSeed &seed : seeds)
+        if (chunk.navigable[seed.tile] == 0)
+            sorted.push_back(seed);
+    std::sort(sorted.begin(), sorted.end(),
+            [](const PortalSeed &a, const PortalSeed &b) { return a.cost < b.cost; });
+
+    size_t next_seed = 0;
+    u32 pending = 0;
+    u32 current = 0;
+
+    while (pending || next_seed < sorted.size())
+    {
+        if (!pending && current < sorted[next_seed].cost)
+            current = sorted[next_seed].cost;
+
+        for (; next_seed < sorted.size() && sorted[next_seed].cost == current; next_seed++)
+        {
+            const PortalSeed &seed = sorted[next_seed];
+            if (seed.cost >= cost[seed.tile])
+                continue;
+
+            cost[seed.tile] = seed.cost;
+            dir[seed.tile] = seed.dir;
+            buckets[current % ring].push_back(seed.tile);
+            pending++;
+        }
+
+        std::vector<u32> &bucket = buckets[current % ring];
+        while (!bucket.empty())
+        {
+            const u32 tile = bucket.back();
+            bucket.pop_back();
+            pending--;
+
+            // Superseded by a cheaper way in
+            if (cost[tile] != current)
+                continue;
+
+            const s32 x = tile % TILES_PER_SIDE;
+            const s32 y = tile / TILES_PER_SIDE;
+
+            for (u32 d = 0; d < 8; d++)
+            {
+                const s32 nx = x + STEP_X[d];
+                const s32 ny = y + STEP_Y[d];
+                if (nx < 0 || ny < 0 || nx >= TILES_PER_SIDE || ny >= TILES_PER_SIDE)
+                    continue;
+                if (!walkable(chunk, nx, ny))
+                    continue;
+
+                // No cutting corners past blocked tiles
+                if ((d & 1) && (!walkable(chunk, nx, y) || !walkable(chunk, x, ny)))
+                    continue;
+
+                const u32 n = ny * TILES_PER_SIDE + nx;
+                const u32 nc = current + ((d & 1) ? PATH_DIAGONAL_COST : PATH_STRAIGHT_COST);
+                if (nc < cost[n])
+                {
+                    cost[n] = nc;
+                    dir[n] = (d + 4) & 7;
+                    buckets[nc % ring].push_back(n);
+                    pending++;
+                }
+            }
+        }
+
+        current++;
+    }
+}
+
+const EdgeEntrances &Pathfinder::edgeEntrances(v2i coord, u32 axis)
+{
+    const v2i other = axis == 0
+        ? v2i { coord.x + 1, coord.y }
+        : v2i { coord.x, coord.y + 1 };
+
+    const u64 inserted_a = chunks.insertedAt(coord);
+    const u64 inserted_b = chunks.insertedAt(other);
+
+    EdgeEntrances &edge = edges[{ coord, axis }];
+    if (edge.inserted_at[0] == inserted_a && edge.inserted_at[1] == inserted_b)
+        return edge;
+
+    edge.inserted_at[0] = inserted_a;
+    edge.inserted_at[1] = inserted_b;
+    edge.offsets.clear();
+
+    if (!inserted_a || !inserted_b)
+        return edge;
+
+    const Chunk &a = *chunks.find(coord);
+    const Chunk &b = *chunks.find(other);
+    const s32 last = TILES_PER_SIDE - 1;
+
+    s32 run_start = -1;
+    for (s32 o = 0; o <= TILES_PER_SIDE; o++)
+    {
+        const bool open = o < TILES_PER_SIDE && (axis == 0
+            ? walkable(a, last, o) && walkable(b, 0, o)
+            : walkable(a, o, last) && walkable(b, o, 0));
+
+        if (open && run_start < 0)
+        {
+            run_start = o;
+        }
+        else if (!open && run_start >= 0)
+        {
+            const s32 length = o - run_start;
+            const s32 pieces = (length + PATH_MAX_ENTRANCE - 1) / PATH_MAX_ENTRANCE;
+            for (s32 p = 0; p < pieces; p++)
+            {
+                const s32 begin = run_start + p * length / pieces;
+                const s32 end = run_start + (p + 1) * length / pieces;
+                edge.offsets.push_back(begin + (end - begin) / 2);
+            }
+            run_start = -1;
+        }
+    }
+
+    return edge;
+}
+
+const ChunkNav *Pathfinder::chunkNav(v2i coord)
+{
+    const Chunk *chunk = chunks.find(coord);
+    if (!chunk)
+        return nullptr;
+
+    // Nothing it depends on can change without a new epoch
+    auto cached = navs.find(coord);
+    if (cached != navs.end() && cached->second.checked_epoch == chunks.epoch())
+        return &cached->second;
+
+    // West and south edges belong to the neighbours
+    const std::array<const std::vector<s32> *, 4> sides {
+        &edgeEntrances(coord, 0).offsets,
+        &edgeEntrances(coord, 1).offsets,
+        &edgeEntrances(v2i { coord.x - 1, coord.y }, 0).offsets,
+        &edgeEntrances(v2i { coord.x, coord.y - 1 }, 1).offsets
+    };
+
+    const u64 inserted_at = chunks.insertedAt(coord);
+
+    ChunkNav &nav = navs[coord];
+    if (nav.inserted_at == inserted_at
+        && nav.sides[0] == *sides[0] && nav.sides[1] == *sides[1]
+        && nav.sides[2] == *sides[2] && nav.sides[3] == *sides[3])
+    {
+        nav.checked_epoch = chunks.epoch();
+        return &nav;
+    }
+
+    stats.chunk_navs_built++;
+
+    const s32 last = TILES_PER_SIDE - 1;
+    nav.inserted_at = inserted_at;
+    nav.checked_epoch = chunks.epoch();
+    nav.portals.clear();
+    labelRegions(*chunk, nav.regions);
+
+    for (u32 side = 0; side < 4; side++)
+    {
+        nav.sides[side] = *sides[side];
+        nav.side_begin[side] = nav.portals.size();
+
+        for (s32 o : nav.sides[side])
+        {
+            const s32 x = side == 0 ? last : side == 2 ? 0 : o;
+            const s32 y = side == 1 ? last : side == 3 ? 0 : o;
+            nav.portals.push_back(y * TILES_PER_SIDE + x);
+        }
+    }
+    nav.side_begin[4] = nav.portals.size();
+
+    const u32 count = nav.portals.size();
+    nav.cost.assign(count * count, PATH_UNREACHABLE);
+
+    std::vector<u32> cost(TILES_PER_CHUNK);
+    std::vector<u8> dir(TILES_PER_CHUNK);
+
+    // Symmetric, the last portal's row is filled by the others
+    for (u32 i = 0; i + 1 < count; i++)
+    {
+        localDijkstra(*chunk, { PortalSeed { nav.portals[i], 0, FLOW_AT_GOAL } }, cost.data(), dir.data());
+
+        nav.cost[i * count + i] = 0;
+        for (u32 j = i + 1; j < count; j++)
+        {
+            nav.cost[i * count + j] = cost[nav.portals[j]];
+            nav.cost[j * count + i] = cost[nav.portals[j]];
+        }
+    }
+    if (count)
+        nav.cost[count * count - 1] = 0;
+
+    return &nav;
+}
+
+bool Pathfinder::findPath(v2f from, v2f to, std::vector<v2f> &waypoints)
+{
+    prune();
+    waypoints.clear();
+
+    const v2i start = tileFromPos(from);
+    const v2i goal = tileFromPos(to);
+    const v2i start_coord = chunkOf(start);
+    const v2i goal_coord = chunkOf(goal);
+
+    const Chunk *start_chunk = chunks.find(start_coord);
+    const Chunk *goal_chunk = chunks.find(goal_coord);
+    if (!start_chunk || !goal_chunk)
+        return false;
+    if (goal_chunk->navigable[localIndex(goal, goal_coord)] != 0)
+        return false;
+
+    // Starts in one region reach the same portals and share routes, a
+    // blocked start reaches nothing
+    const u32 start_region = chunkNav(start_coord)->regions[localIndex(start, start_coord)];
+    if (start_region == 0)
+        return false;
+
+    auto cached = routes.find({ start_coord, start_region, goal });
+    if (cached != routes.end()
+        && cached->second.chunk_epoch == chunks.epoch()
+        && cached->second.nav_version == nav_version)
+    {
+        stats.route_cache_hits++;
+        for (const v2i &tile : cached->second.portal_tiles)
+            waypoints.push_back(posFromTile(tile));
+        waypoints.push_back(to);
+        return true;
+    }
+
+    stats.searches++;
+
+    std::vector<u32> goal_cost(TILES_PER_CHUNK);
+    std::vector<u8> dir(TILES_PER_CHUNK);
+    localDijkstra(
+            *goal_chunk,
+            { PortalSeed { localIndex(goal, goal_coord), 0, FLOW_AT_GOAL } },
+            goal_cost.data(),
+            dir.data()
+        );
+
+    Route route { chunks.epoch(), nav_version, {} };
+
+    // Within one chunk the tile search is the whole answer
+    if (sameCoord(start_coord, goal_coord)
+        && goal_cost[localIndex(start, start_coord)] != PATH_UNREACHABLE)
+    {
+        routes[{ start_coord, start_region, goal }] = route;
+        waypoints.push_back(to);
+        return true;
+    }
+
+    std::vector<u32> start_cost(TILES_PER_CHUNK);
+    localDijkstra(
+            *start_chunk,
+            { PortalSeed { localIndex(start, start_coord), 0, FLOW_AT_GOAL } },
+            start_cost.data(),
+            dir.data()
+        );
+
+    struct Visit
+    {
+        u32 cost;
+        v2i parent_coord;
+        u32 parent_portal;
+        bool closed;
+    };
+
+    // By chunk then portal, the goal tile is portal NO_PORTAL of its chunk
+    std::map<v2i, std::vector<Visit>> visits;
+    Visit goal_visit { PATH_UNREACHABLE, {}, 0, false };
+    PortalQueue open;
+
+    auto visitsOf = [&](v2i coord, const ChunkNav &nav) -> std::vector<Visit> &
+    {
+        std::vector<Visit> &chunk_visits = visits[coord];
+        if (chunk_visits.empty())
+            chunk_visits.assign(nav.portals.size(), Visit { PATH_UNREACHABLE, {}, 0, false });
+        return chunk_visits;
+    };
+
+    auto relax = [&](Visit &visit, v2i coord, u32 portal, u32 cost, v2i parent_coord, u32 parent_portal, u32 heuristic)
+    {
+        if (visit.closed || cost >= visit.cost)
+            return;
+
+        visit = Visit { cost, parent_coord, parent_portal, false };
+        open.push({ cost + heuristic, cost, coord, portal });
+    };
+
+    const ChunkNav &start_nav = *chunkNav(start_coord);
+    std::vector<Visit> &start_visits = visitsOf(start_coord, start_nav);
+    for (u32 i = 0; i < start_nav.portals.size(); i++)
+    {
+        const u32 cost = start_cost[start_nav.portals[i]];
+        if (cost == PATH_UNREACHABLE)
+            continue;
+
+        relax(start_visits[i], start_coord, i, cost, start_coord, START_PORTAL,
+              octile(globalTile(start_coord, start_nav.portals[i]), goal));
+    }
+
+    bool found = false;
+    while (!open.empty())
+    {
+        const PortalEntry entry = open.top();
+        open.pop();
+
+        if (entry.portal == NO_PORTAL)
+        {
+            found = true;
+            break;
+        }
+
+        const ChunkNav &nav = *chunkNav(entry.coord);
+        std::vector<Visit> &chunk_visits = visitsOf(entry.coord, nav);
+
+        Visit &visit = chunk_visits[entry.portal];
+        if (visit.closed || entry.cost > visit.cost)
+            continue;
+        visit.closed = true;
+
+        const u32 count = nav.portals.size();
+
+        if (sameCoord(entry.coord, goal_coord))
+        {
+            const u32 cost = goal_cost[nav.portals[entry.portal]];
+            if (cost != PATH_UNREACHABLE)
+                relax(goal_visit, goal_coord, NO_PORTAL, entry.cost + cost, entry.coord, entry.portal, 0);
+        }
+
+        for (u32 j = 0; j < count; j++)
+        {
+            const u32 via = nav.cost[entry.portal * count + j];
+            if (j == entry.portal || via == PATH_UNREACHABLE)
+                continue;
+
+            relax(chunk_visits[j], entry.coord, j, entry.cost + via, entry.coord, entry.portal,
+                  octile(globalTile(entry.coord, nav.portals[j]), goal));
+        }
+
+        // The matching portal on the other side of the edge
+        const u32 side = sideOf(nav, entry.portal);
+        const v2i neighbour {
+            entry.coord.x + STEP_X[2 * side],
+            entry.coord.y + STEP_Y[2 * side]
+        };
+
+        if (const ChunkNav *other = chunkNav(neighbour))
+        {
+            const u32 j = other->side_begin[(side + 2) & 3] + entry.portal - nav.side_begin[side];
+            relax(visitsOf(neighbour, *other)[j], neighbour, j, entry.cost + PATH_STRAIGHT_COST,
+                  entry.coord, entry.portal, octile(globalTile(neighbour, other->portals[j]), goal));
+        }
+    }
+
+    if (!found)
+        return false;
+
+    // Walk the parents back from the goal
+    const Visit *visit = &goal_visit;
+    while (visit->parent_portal != START_PORTAL)
+    {
+        const v2i coord = visit->parent_coord;
+        const u32 portal = visit->parent_portal;
+        route.portal_tiles.push_back(globalTile(coord, navs[coord].portals[portal]));
+        visit = &visits[coord][portal];
+    }
+    std::reverse(route.portal_tiles.begin(), route.portal_tiles.end());
+
+    for (const v2i &tile : route.portal_tiles)
+        waypoints.push_back(posFromTile(tile));
+    waypoints.push_back(to);
+
+    routes[{ start_coord, start_region, goal }] = std::move(route);
+    return true;
+}
+
+FlowField &Pathfinder::flowField(v2i goal)
+{
+    use_counter++;
+
+    for (auto &field : flow_fields)
+    {
+        if (!sameCoord(field->goal, goal))
+            continue;
+
+        field->last_used = use_counter;
+        if (field->chunk_epoch != chunks.epoch() || field->nav_version != nav_version)
+            computePortalCosts(*field);
+        return *field;
+    }
+
+    if (flow_fields.size() < PATH_FLOW_FIELD_CACHE)
+    {
+        flow_fields.push_back(std::make_unique<FlowField>());
+    }
+    else
+    {
+        auto oldest = std::min_element(flow_fields.begin(), flow_fields.end(),
+                [](const auto &a, const auto &b) { return a->last_used < b->last_used; });
+        std::rotate(oldest, oldest + 1, flow_fields.end());
+        flow_fields.back() = std::make_unique<FlowField>();
+    }
+
+    FlowField &field = *flow_fields.back();
+    field.goal = goal;
+    field.generation = 0;
+    field.last_used = use_counter;
+    computePortalCosts(field);
+    return field;
+}
+
+// Dijkstra over the portal graph outwards from the goal
+void Pathfinder::computePortalCosts(FlowField &field)
+{
+    stats.flow_fields_built++;
+
+    field.chunk_epoch = chunks.epoch();
+    field.nav_version = nav_version;
+    field.generation++;
+    field.portal_costs.clear();
+
+    const v2i goal_coord = chunkOf(field.goal);
+    const Chunk *goal_chunk = chunks.find(goal_coord);
+    if (!goal_chunk || goal_chunk->navigable[localIndex(field.goal, goal_coord)] != 0)
+        return;
+
+    PortalQueue open;
+
+    auto relax = [&](v2i coord, const ChunkNav &nav, u32 portal, u32 cost)
+    {
+        std::vector<u32> &costs = field.portal_costs[coord];
+        if (costs.empty())
+            costs.assign(nav.portals.size(), PATH_UNREACHABLE);
+
+        if (cost < costs[portal])
+        {
+            costs[portal] = cost;
+            open.push({ cost, cost, coord, portal });
+        }
+    };
+
+    std::vector<u32> cost(TILES_PER_CHUNK);
+    std::vector<u8> dir(TILES_PER_CHUNK);
+    localDijkstra(
+            *goal_chunk,
+            { PortalSeed { localIndex(field.goal, goal_coord), 0, FLOW_AT_GOAL } },
+            cost.data(),
+            dir.data()
+        );
+
+    const ChunkNav &goal_nav = *chunkNav(goal_coord);
+    for (u32 i = 0; i < goal_nav.portals.size(); i++)
+    {
+        if (cost[goal_nav.portals[i]] != PATH_UNREACHABLE)
+            relax(goal_coord, goal_nav, i, cost[goal_nav.portals[i]]);
+    }
+
+    while (!open.empty())
+    {
+        const PortalEntry entry = open.top();
+        open.pop();
+
+        if (entry.cost > field.portal_costs[entry.coord][entry.portal])
+            continue;
+
+        const ChunkNav &nav = *chunkNav(entry.coord);
+        const u32 count = nav.portals.size();
+
+        for (u32 j = 0; j < count; j++)
+        {
+            const u32 via = nav.cost[entry.portal * count + j];
+            if (j != entry.portal && via != PATH_UNREACHABLE)
+                relax(entry.coord, nav, j, entry.cost + via);
+        }
+
+        const u32 side = sideOf(nav, entry.portal);
+        const v2i neighbour {
+            entry.coord.x + STEP_X[2 * side],
+            entry.coord.y + STEP_Y[2 * side]
+        };
+
+        if (const ChunkNav *other = chunkNav(neighbour))
+        {
+            const u32 j = other->side_begin[(side + 2) & 3] + entry.portal - nav.side_begin[side];
+            relax(neighbour, *other, j, entry.cost + PATH_STRAIGHT_COST);
+        }
+    }
+}
+
+const ChunkFlow *Pathfinder::chunkFlow(FlowField &field, v2i coord)
+{
+    auto found = field.chunk_flows.find(coord);
+    if (found != field.chunk_flows.end() && found->second->generation == field.generation)
+        return found->second.get();
+
+    const Chunk *chunk = chunks.find(coord);
+    if (!chunk)
+        return nullptr;
+
+    const ChunkNav &nav = *chunkNav(coord);
+
+    // Each portal is seeded with the cost of stepping across its edge,
+    // the search then finds whether going out there is the best way
+    std::vector<PortalSeed> seeds;
+    std::vector<u32> seed_costs(nav.portals.size(), PATH_UNREACHABLE);
+
+    for (u32 side = 0; side < 4; side++)
+    {
+        const v2i neighbour {
+            coord.x + STEP_X[2 * side],
+            coord.y + STEP_Y[2 * side]
+        };
+
+        auto costs = field.portal_costs.find(neighbour);
+        if (costs == field.portal_costs.end())
+            continue;
+
+        const ChunkNav &other = *chunkNav(neighbour);
+        for (u32 i = nav.side_begin[side]; i < nav.side_begin[side + 1]; i++)
+        {
+            const u32 j = other.side_begin[(side + 2) & 3] + i - nav.side_begin[side];
+            if (costs->second[j] == PATH_UNREACHABLE)
+                continue;
+
+            seed_costs[i] = costs->second[j] + PATH_STRAIGHT_COST;
+            seeds.push_back(PortalSeed { nav.portals[i], seed_costs[i], (u8) (2 * side) });
+        }
+    }
+
+    const v2i goal_coord = chunkOf(field.goal);
+    if (sameCoord(coord, goal_coord))
+        seeds.push_back(PortalSeed { localIndex(field.goal, goal_coord), 0, FLOW_AT_GOAL });
+
+    const u64 inserted_at = chunks.insertedAt(coord);
+
+    if (found != field.chunk_flows.end())
+    {
+        ChunkFlow &flow = *found->second;
+        if (flow.inserted_at == inserted_at
+            && flow.nav_version == nav_version
+            && flow.seeds == seed_costs)
+        {
+            flow.generation = field.generation;
+            return &flow;
+        }
+    }
+
+    std::unique_ptr<ChunkFlow> &flow = field.chunk_flows[coord];
+    if (!flow)
+        flow = std::make_unique<ChunkFlow>();
+
+    stats.chunk_flows_built++;
+
+    flow->inserted_at = inserted_at;
+    flow->nav_version = nav_version;
+    flow->generation = field.generation;
+    flow->seeds = std::move(seed_costs);
+    localDijkstra(*chunk, seeds, flow->cost, flow->dir);
+
+    return flow.get();
+}
+
+v2f Pathfinder::flowDirection(v2f goal, v2f pos)
+{
+    prune();
+
+    FlowField &field = flowField(tileFromPos(goal));
+
+    const v2i tile = tileFromPos(pos);
+    const v2i coord = chunkOf(tile);
+
+    const ChunkFlow *flow = chunkFlow(field, coord);
+    if (!flow)
+        return v2f { 0.0f, 0.0f };
+
+    return flowStep(flow->dir[localIndex(tile, coord)]);
+}
+
+const FlowField &Pathfinder::prepareFlow(v2f goal, const std::vector<v2i> &coords)
+{
+    prune();
+
+    FlowField &field = flowField(tileFromPos(goal));
+    for (v2i coord : coords)
+        chunkFlow(field, coord);
+
+    return field;
+}
+
+v2f Pathfinder::flowDirection(const FlowField &field, v2f pos) const
+{
+    const v2i tile = tileFromPos(pos);
+    const v2i coord = chunkOf(tile);
+
+    auto found = field.chunk_flows.find(coord);
+    if (found == field.chunk_flows.end() || found->second->generation != field.generation)
+        return v2f { 0.0f, 0.0f };
+
+    return flowStep(found->second->dir[localIndex(tile, coord)]);
+}
@@ -3,9 +3,14 @@
 #include "renderer.h"
 #include "model.h"
 
-Scene::Scene(DZRenderer &renderer, DZPipeline terrain_pipeline, DZPipeline model_pipeline, DZPipeline gui_pipeline, DZPipeline fow_pipeline) 
-    : terrain(renderer, 100.0f, 616u)
+Scene::Scene(DZRenderer &renderer, DZPipeline terrain_pipeline, DZPipeline model_pipeline, DZPipeline gui_pipeline, DZPipeline fow_pipeline,
+        const std::string &store_directory) 
+    : terrain(renderer, 100.0f, 616u, store_directory)
     , sun({1.0f, 1.0f, 1.0f})
+    , fog(registry, terrain.chunks, terrain.chunk_size)
+    , pathfinder(terrain.chunks, terrain.chunk_size)
+    , spatial(registry, SPATIAL_CELL_SIZE)
+    , separation(SEPARATION_RADIUS)
     , terrain_pipeline(terrain_pipeline)
     , model_pipeline(model_pipeline)
     , gui_pipeline(gui_pipeline)
@@ -14,10 +19,10 @@ Scene::Scene(DZRenderer &renderer, DZPipeline terrain_pipeline, DZPipeline model
 
     this->LOS_ON = 1;
     this->debug_texture = 0;
+    this->tick_alpha = 1.0f;
+    this->screen_dim = glm::vec2(1.0f);
 
-    this->scene_uniform_buffer 
-        = renderer.createBufferOfSize(sizeof(SceneUniforms));
-
-    this->light_buffer 
-        = renderer.createBufferOfSize(sizeof(DynamicPointLightData));
+    this->uniforms.scene = UniformSlice { DZInvalid, 0 };
+    this->uniforms.light = UniformSlice { DZInvalid, 0 };
+    this->uniforms.terrain = TerrainTileBindings { DZInvalid, DZInvalid };
 }
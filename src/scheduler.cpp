@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+
+#include "scheduler.h"
+#include "logger.h"
+
+u32 nextComponentAccessBit()
+{
+    static std::atomic<u32> next { 0 };
+
+    // Past 48 component types the bits are shared, which only makes
+    // systems wait on each other when they would not have to
+    const u32 component_bits = SYSTEM_ACCESS_BITS - SYSTEM_RESOURCE_BITS;
+    return SYSTEM_RESOURCE_BITS + next.fetch_add(1) % component_bits;
+}
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    f64 msBetween(Clock::time_point from, Clock::time_point to)
+    {
+        const std::chrono::duration<double, std::milli> elapsed = to - from;
+        return elapsed.count();
+    }
+
+    // Shared with the pool jobs, which can outlive SystemGraph::run when
+    // the calling thread picked up their system first
+    struct Frame
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+
+        std::vector<std::vector<u32>> dependents;
+        std::vector<u32> waiting_on;
+        std::deque<u32> ready;
+        std::deque<u32> main_ready;
+        u32 finished;
+    };
+}
+
+SystemGraph::SystemGraph(ThreadPool &pool)
+    : pool { pool }
+    , frame_ms { 0.0 }
+{}
+
+void SystemGraph::addNode(const char *name, SystemAccess access)
+{
+    accesses.push_back(access);
+    timings.push_back(SystemTiming { name, 0.0, 0.0, access.main_thread, false });
+}
+
+const std::vector<SystemTiming> &SystemGraph::getTimings() const
+{
+    return timings;
+}
+
+f64 SystemGraph::getFrameMs() const
+{
+    return frame_ms;
+}
+
+void SystemGraph::run(const std::function<void(u32)> &invoke)
+{
+    const u32 count = accesses.size();
+    const auto frame_start = Clock::now();
+    const std::thread::id caller = std::this_thread::get_id();
+
+    auto frame = std::make_shared<Frame>();
+    frame->dependents.resize(count);
+    frame->waiting_on.assign(count, 0);
+    frame->finished = 0;
+
+    std::vector<std::vector<u32>> prerequisites(count);
+    for (u32 j = 0; j < count; j++)
+    {
+        for (u32 i = 0; i < j; i++)
+        {
+            if (!accesses[i].conflictsWith(accesses[j]))
+                continue;
+
+            frame->dependents[i].push_back(j);
+            frame->waiting_on[j]++;
+            prerequisites[j].push_back(i);
+        }
+    }
+
+    std::function<void(u32)> execute;
+
+    // With the frame locked
+    auto launch = [&](u32 index)
+    {
+        if (accesses[index].main_thread)
+        {
+            frame->main_ready.push_back(index);
+            return;
+        }
+
+        frame->ready.push_back(index);
+        pool.enqueue([frame, &execute]
+        {
+            u32 index;
+            {
+                std::lock_guard<std::mutex> lock(frame->mutex);
+                if (frame->ready.empty())
+                    return;
+                index = frame->ready.front();
+                frame->ready.pop_front();
+            }
+            execute(index);
+        });
+    };
+
+    execute = [&](u32 index)
+    {
+        const auto start = Clock::now();
+        invoke(index);
+        const auto end = Clock::now();
+
+        std::lock_guard<std::mutex> lock(frame->mutex);
+        timings[index].start_ms = msBetween(frame_start, start);
+        timings[index].duration_ms = msBetween(start, end);
+        timings[index].main_thread = std::this_thread::get_id() == caller;
+
+        for (u32 next : frame->dependents[index])
+            if (--frame->waiting_on[next] == 0)
+                launch(next);
+
+        frame->finished++;
+        frame->changed.notify_all();
+    };
+
+    {
+        std::unique_lock<std::mutex> lock(frame->mutex);
+        for (u32 i = 0; i < count; i++)
+            if (frame->waiting_on[i] == 0)
+                launch(i);
+
+        // The calling thread runs its own systems and helps with the
+        // others rather than sitting idle
+        while (frame->finished < count)
+        {
+            std::deque<u32> &queue = !frame->main_ready.empty() ? frame->main_ready : frame->ready;
+            if (queue.empty())
+            {
+                frame->changed.wait(lock);
+                continue;
+            }
+
+            const u32 index = queue.front();
+            queue.pop_front();
+
+            lock.unlock();
+            execute(index);
+            lock.lock();
+        }
+    }
+
+    frame_ms = msBetween(frame_start, Clock::now());
+
+    // Longest chain through the graph by how long each system took
+    std::vector<f64> finish(count, 0.0);
+    std::vector<s32> previous(count, -1);
+    s32 last = -1;
+    for (u32 j = 0; j < count; j++)
+    {
+        for (u32 i : prerequisites[j])
+        {
+            if (finish[i] > finish[j])
+            {
+                finish[j] = finish[i];
+                previous[j] = i;
+            }
+        }
+        finish[j] += timings[j].duration_ms;
+        timings[j].critical = false;
+
+        if (last < 0 || finish[j] > finish[last])
+            last = j;
+    }
+
+    for (s32 i = last; i >= 0; i = previous[i])
+        timings[i].critical = true;
+}
+
+void SystemGraph::logTimings() const
+{
+    f64 work_ms = 0.0;
+    f64 critical_ms = 0.0;
+    for (const SystemTiming &timing : timings)
+    {
+        work_ms += timing.duration_ms;
+        if (timing.critical)
+            critical_ms += timing.duration_ms;
+    }
+
+    Log::info("Systems: %.3f ms frame, %.3f ms of work, %.3f ms critical path (*)",
+            frame_ms, work_ms, critical_ms);
+
+    std::vector<const SystemTiming *> by_start;
+    for (const SystemTiming &timing : timings)
+        by_start.push_back(&timing);
+    std::stable_sort(by_start.begin(), by_start.end(),
+            [](const SystemTiming *a, const SystemTiming *b) { return a->start_ms < b->start_ms; });
+
+    for (const SystemTiming *timing : by_start)
+    {
+        Log::info("\t%c %-20s at %8.3f ms, took %8.3f ms on %s",
+                timing->critical ? '*' : ' ',
+                timing->name.c_str(),
+                timing->start_ms,
+                timing->duration_ms,
+                timing->main_thread ? "main" : "pool");
+    }
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+
+#include "simulation.h"
+
+Simulation::Simulation(u32 tick_rate)
+    : tick_rate  { std::max(tick_rate, 1u) }
+    , accumulator { 0.0 }
+    , tick_count { 0 }
+    , busy { false }
+    , stopping { false }
+{
+    thread = std::thread([this]{ threadLoop(); });
+}
+
+Simulation::~Simulation()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]{ return !busy; });
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+void Simulation::setTickRate(u32 tick_rate)
+{
+    this->tick_rate = std::max(tick_rate, 1u);
+}
+
+u32 Simulation::getTickRate() const
+{
+    return tick_rate;
+}
+
+f64 Simulation::getTickSeconds() const
+{
+    return 1.0 / tick_rate;
+}
+
+u64 Simulation::getTickCount() const
+{
+    return tick_count;
+}
+
+u32 Simulation::accumulate(f64 frame_seconds)
+{
+    const f64 tick_seconds = getTickSeconds();
+    accumulator += frame_seconds;
+
+    u32 ticks = (u32) (accumulator / tick_seconds);
+    accumulator -= ticks * tick_seconds;
+
+    if (ticks > MAX_TICKS_PER_FRAME)
+        ticks = MAX_TICKS_PER_FRAME;
+
+    tick_count += ticks;
+    return ticks;
+}
+
+f32 Simulation::getAlpha() const
+{
+    return (f32) std::clamp(accumulator / getTickSeconds(), 0.0, 1.0);
+}
+
+void Simulation::begin(u32 n, std::function<void(u32)> ticks)
+{
+    finish();
+
+    if (n == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = [n, ticks = std::move(ticks)]{ ticks(n); };
+        busy = true;
+    }
+    changed.notify_all();
+}
+
+void Simulation::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]{ return !busy; });
+}
+
+void Simulation::threadLoop()
+{
+    while (true)
+    {
+        std::function<void()> ticks;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this]{ return stopping || job; });
+
+            if (stopping)
+                return;
+
+            ticks = std::move(job);
+            job = nullptr;
+        }
+
+        ticks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy = false;
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,239 @@
+#include "spatial_hash.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+SpatialHash::SpatialHash(entt::registry &registry, f32 cell_size)
+    : registry { registry }
+    , cell_size { cell_size }
+    , entities { 0 }
+    , moved { 0 }
+{
+    registry.on_destroy<SpatialEntry>().connect<&SpatialHash::onEntryDestroyed>(*this);
+}
+
+SpatialHash::~SpatialHash()
+{
+    registry.on_destroy<SpatialEntry>().disconnect<&SpatialHash::onEntryDestroyed>(*this);
+}
+
+void SpatialHash::update()
+{
+    moved = 0;
+
+    // Entities that lost their Transform leave the grid
+    auto orphaned = registry.view<SpatialEntry>(entt::exclude<Transform>);
+    std::vector<entt::entity> to_remove(orphaned.begin(), orphaned.end());
+    registry.remove<SpatialEntry>(to_remove.begin(), to_remove.end());
+
+    auto added = registry.view<Transform>(entt::exclude<SpatialEntry>);
+    std::vector<entt::entity> to_add(added.begin(), added.end());
+    for (entt::entity entity : to_add)
+    {
+        const Transform &transform = registry.get<Transform>(entity);
+        SpatialEntry &entry = registry.emplace<SpatialEntry>(
+                entity, SpatialEntry { cellOf(v2f { transform.pos.x, transform.pos.y }), 0 });
+        insert(entity, entry);
+    }
+
+    registry
+        .view<Transform, SpatialEntry>()
+        .each(
+                [&](entt::entity entity, const Transform &transform, SpatialEntry &entry)
+                {
+                    const v2i cell = cellOf(v2f { transform.pos.x, transform.pos.y });
+                    if (cell.x == entry.cell.x && cell.y == entry.cell.y)
+                        return;
+
+                    remove(entry);
+                    entry.cell = cell;
+                    insert(entity, entry);
+                    moved++;
+                }
+            );
+}
+
+void SpatialHash::insert(entt::entity entity, SpatialEntry &entry)
+{
+    std::vector<entt::entity> &cell = cells[keyOf(entry.cell)];
+    entry.index = cell.size();
+    cell.push_back(entity);
+    entities++;
+}
+
+// Swaps the last entity of the cell into the gap
+void SpatialHash::remove(const SpatialEntry &entry)
+{
+    auto found = cells.find(keyOf(entry.cell));
+    std::vector<entt::entity> &cell = found->second;
+
+    const entt::entity last = cell.back();
+    cell[entry.index] = last;
+    registry.get<SpatialEntry>(last).index = entry.index;
+    cell.pop_back();
+
+    if (cell.empty())
+        cells.erase(found);
+    entities--;
+}
+
+void SpatialHash::onEntryDestroyed(entt::registry &registry, entt::entity entity)
+{
+    remove(registry.get<SpatialEntry>(entity));
+}
+
+v2i SpatialHash::cellOf(v2f pos) const
+{
+    return v2i {
+        (s32) std::floor(pos.x / cell_size),
+        (s32) std::floor(pos.y / cell_size)
+    };
+}
+
+u64 SpatialHash::keyOf(v2i cell)
+{
+    return ((u64) (u32) cell.x << 32) | (u32) cell.y;
+}
+
+v2i SpatialHash::cellOfKey(u64 key)
+{
+    return v2i { (s32) (u32) (key >> 32), (s32) (u32) key };
+}
+
+void SpatialHash::findInRect(AArect2f rect, std::vector<entt::entity> &out) const
+{
+    const v2f max = rect.pos + rect.dim;
+    forEachNear(rect, [&](entt::entity entity)
+    {
+        const std::optional<v2f> pos = posOf(entity);
+        if (pos && pos->x >= rect.pos.x && pos->x <= max.x && pos->y >= rect.pos.y && pos->y <= max.y)
+            out.push_back(entity);
+    });
+}
+
+void SpatialHash::findInRadius(v2f pos, f32 radius, std::vector<entt::entity> &out) const
+{
+    const AArect2f bounds {
+        v2f { pos.x - radius, pos.y - radius },
+        v2f { 2 * radius, 2 * radius }
+    };
+
+    const f64 radius_sq = (f64) radius * radius;
+    forEachNear(bounds, [&](entt::entity entity)
+    {
+        const std::optional<v2f> at = posOf(entity);
+        if (at && at->distanceSqFrom(pos) <= radius_sq)
+            out.push_back(entity);
+    });
+}
+
+std::vector<entt::entity> SpatialHash::findNClosest(v2f pos, u32 n) const
+{
+    using Candidate = std::pair<f64, entt::entity>;
+
+    // Max heap of the n closest so far, the furthest on top
+    std::priority_queue<Candidate> closest;
+    auto consider = [&](entt::entity entity)
+    {
+        const std::optional<v2f> at = posOf(entity);
+        if (!at)
+            return;
+
+        const f64 distance_sq = at->distanceSqFrom(pos);
+        if (closest.size() < n)
+            closest.emplace(distance_sq, entity);
+        else if (distance_sq < closest.top().first)
+        {
+            closest.pop();
+            closest.emplace(distance_sq, entity);
+        }
+    };
+
+    const v2i center = cellOf(pos);
+    // How far pos is from the nearest edge of its own cell
+    const f32 edge = std::min({
+            pos.x - center.x * cell_size,
+            (center.x + 1) * cell_size - pos.x,
+            pos.y - center.y * cell_size,
+            (center.y + 1) * cell_size - pos.y
+        });
+
+    u32 seen = 0;
+    for (s32 ring = 0; n > 0 && seen < entities; ring++)
+    {
+        // Nothing in this ring or beyond can beat the furthest kept
+        const f64 ring_distance = ring > 0 ? (ring - 1) * cell_size + edge : 0.0;
+        if (closest.size() == n && ring_distance * ring_distance >= closest.top().first)
+            break;
+
+        // Once a ring has more cells than the grid, finish with one pass
+        // over every cell at least that far out
+        if (8ull * ring > cells.size())
+        {
+            for (const auto &[key, cell_entities] : cells)
+            {
+                const v2i cell = cellOfKey(key);
+                if (std::max(std::abs(cell.x - center.x), std::abs(cell.y - center.y)) < ring)
+                    continue;
+                for (entt::entity entity : cell_entities)
+                    consider(entity);
+            }
+            break;
+        }
+
+        auto visit = [&](s32 x, s32 y)
+        {
+            auto found = cells.find(keyOf(v2i { x, y }));
+            if (found == cells.end())
+                return;
+            for (entt::entity entity : found->second)
+                consider(entity);
+            seen += found->second.size();
+        };
+
+        if (ring == 0)
+        {
+            visit(center.x, center.y);
+            continue;
+        }
+
+        for (s32 i = -ring; i <= ring; i++)
+        {
+            visit(center.x + i, center.y - ring);
+            visit(center.x + i, center.y + ring);
+        }
+        for (s32 i = -ring + 1; i <= ring - 1; i++)
+        {
+            visit(center.x - ring, center.y + i);
+            visit(center.x + ring, center.y + i);
+        }
+    }
+
+    std::vector<entt::entity> nearest(closest.size());
+    for (size_t i = nearest.size(); i > 0; i--)
+    {
+        nearest[i - 1] = closest.top().second;
+        closest.pop();
+    }
+    return nearest;
+}
+
+std::optional<v2f> SpatialHash::posOf(entt::entity entity) const
+{
+    const Transform *transform = registry.try_get<Transform>(entity);
+    if (!transform)
+        return std::nullopt;
+    return v2f { transform->pos.x, transform->pos.y };
+}
+
+f32 SpatialHash::getCellSize() const
+{
+    return cell_size;
+}
+
+SpatialHashStats SpatialHash::getStats() const
+{
+    return SpatialHashStats { entities, (u32) cells.size(), moved };
+}
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "steering.h"
+
+#if defined(__SSE2__)
+#   define STEERING_SSE2
+#   include <emmintrin.h>
+#endif
+
+// Sorted units per job, a few runs of neighbours each
+#define SEPARATION_PIECE (256)
+// Grid cells per unit at most, coarser cells past that so a spread out
+// group does not allocate a huge grid
+#define SEPARATION_MAX_CELLS_PER_UNIT (4)
+
+Separation::Separation(f32 radius)
+    : radius { radius }
+    , origin_x { 0.0f }
+    , origin_y { 0.0f }
+    , cell_size { radius }
+    , grid_w { 0 }
+    , grid_h { 0 }
+    , stats {}
+{
+}
+
+void Separation::compute(ThreadPool *jobs)
+{
+    const u32 count = xs.size();
+    push_x.assign(count, 0.0f);
+    push_y.assign(count, 0.0f);
+
+    if (count == 0)
+    {
+        stats = SeparationStats { 0, 0, cell_size };
+        return;
+    }
+
+    sort();
+
+    if (jobs)
+        jobs->parallelFor(count, SEPARATION_PIECE, [&](u32 begin, u32 end) { computeRange(begin, end); });
+    else
+        computeRange(0, count);
+
+    stats = SeparationStats { count, (u32) (grid_w * grid_h), cell_size };
+}
+
+void Separation::sort()
+{
+    const u32 count = xs.size();
+
+    f32 min_x = FLT_MAX, min_y = FLT_MAX;
+    f32 max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for (u32 i = 0; i < count; i++)
+    {
+        min_x = std::min(min_x, xs[i]);
+        max_x = std::max(max_x, xs[i]);
+        min_y = std::min(min_y, ys[i]);
+        max_y = std::max(max_y, ys[i]);
+    }
+
+    // Cells at least radius wide, so neighbours are at most a cell away.
+    // The last term keeps units spread along a line from making one
+    // very long row.
+    const f32 width = max_x - min_x;
+    const f32 height = max_y - min_y;
+    const f32 max_cells = (f32) count * SEPARATION_MAX_CELLS_PER_UNIT;
+    cell_size = std::max({ radius, std::sqrt(width * height / max_cells), std::max(width, height) / max_cells });
+
+    origin_x = min_x;
+    origin_y = min_y;
+    grid_w = (s32) (width / cell_size) + 1;
+    grid_h = (s32) (height / cell_size) + 1;
+
+    // Two passes of a counting sort, sizes then places
+    unit_cell.resize(count);
+    cell_start.assign(grid_w * grid_h + 1, 0);
+    for (u32 i = 0; i < count; i++)
+    {
+        const s32 cx = std::min((s32) ((xs[i] - origin_x) / cell_size), grid_w - 1);
+        const s32 cy = std::min((s32) ((ys[i] - origin_y) / cell_size), grid_h - 1);
+        unit_cell[i] = cy * grid_w + cx;
+        cell_start[unit_cell[i] + 1]++;
+    }
+
+    for (size_t c = 1; c < cell_start.size(); c++)
+        cell_start[c] += cell_start[c - 1];
+
+    sorted_x.resize(count);
+    sorted_y.resize(count);
+    sorted_unit.resize(count);
+
+    // The starts are advanced while placing and shifted back after
+    for (u32 i = 0; i < count; i++)
+    {
+        const u32 slot = cell_start[unit_cell[i]]++;
+        sorted_x[slot] = xs[i];
+        sorted_y[slot] = ys[i];
+        sorted_unit[slot] = i;
+    }
+
+    for (size_t c = cell_start.size() - 1; c > 0; c--)
+        cell_start[c] = cell_start[c - 1];
+    cell_start[0] = 0;
+}
+
+void Separation::computeRange(u32 begin, u32 end)
+{
+    const f32 radius_sq = radius * radius;
+    const f32 inv_radius = 1.0f / radius;
+    // Keeps units on the same spot from dividing by zero, their push
+    // is zero either way
+    const f32 epsilon = 1e-12f;
+
+    const f32 *__restrict px = sorted_x.data();
+    const f32 *__restrict py = sorted_y.data();
+
+    for (u32 s = begin; s < end; s++)
+    {
+        const f32 x = px[s];
+        const f32 y = py[s];
+        const u32 cell = unit_cell[sorted_unit[s]];
+        const s32 cx = cell % grid_w;
+        const s32 cy = cell / grid_w;
+
+        const s32 x0 = std::max(cx - 1, 0);
+        const s32 x1 = std::min(cx + 1, grid_w - 1);
+
+        f32 sum_x = 0.0f;
+        f32 sum_y = 0.0f;
+
+        for (s32 row = std::max(cy - 1, 0); row <= std::min(cy + 1, grid_h - 1); row++)
+        {
+            u32 j = cell_start[row * grid_w + x0];
+            const u32 last = cell_start[row * grid_w + x1 + 1];
+
+#ifdef STEERING_SSE2
+            const __m128 vx = _mm_set1_ps(x);
+            const __m128 vy = _mm_set1_ps(y);
+            const __m128 vradius_sq = _mm_set1_ps(radius_sq);
+            const __m128 vinv_radius = _mm_set1_ps(inv_radius);
+            const __m128 vepsilon = _mm_set1_ps(epsilon);
+            const __m128 one = _mm_set1_ps(1.0f);
+            __m128 acc_x = _mm_setzero_ps();
+            __m128 acc_y = _mm_setzero_ps();
+
+            for (; j + 4 <= last; j += 4)
+            {
+                const __m128 dx = _mm_sub_ps(vx, _mm_loadu_ps(&px[j]));
+                const __m128 dy = _mm_sub_ps(vy, _mm_loadu_ps(&py[j]));
+                const __m128 dist_sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+                // dx * (1 / d - 1 / r) is 1 - d / r along the direction
+                const __m128 inv_dist = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(dist_sq, vepsilon)));
+                const __m128 near = _mm_cmplt_ps(dist_sq, vradius_sq);
+                const __m128 weight = _mm_and_ps(near, _mm_sub_ps(inv_dist, vinv_radius));
+
+                acc_x = _mm_add_ps(acc_x, _mm_mul_ps(dx, weight));
+                acc_y = _mm_add_ps(acc_y, _mm_mul_ps(dy, weight));
+            }
+
+            alignas(16) f32 lanes_x[4];
+            alignas(16) f32 lanes_y[4];
+            _mm_store_ps(lanes_x, acc_x);
+            _mm_store_ps(lanes_y, acc_y);
+            sum_x += (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+            sum_y += (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+#endif
+            for (; j < last; j++)
+            {
+                const f32 dx = x - px[j];
+                const f32 dy = y - py[j];
+                const f32 dist_sq = dx * dx + dy * dy;
+                if (dist_sq >= radius_sq)
+                    continue;
+
+                const f32 weight = 1.0f / std::sqrt(dist_sq + epsilon) - inv_radius;
+                sum_x += dx * weight;
+                sum_y += dy * weight;
+            }
+        }
+
+        const f32 length = std::sqrt(sum_x * sum_x + sum_y * sum_y);
+        if (length > 1.0f)
+        {
+            sum_x /= length;
+            sum_y /= length;
+        }
+
+        push_x[sorted_unit[s]] = sum_x;
+        push_y[sorted_unit[s]] = sum_y;
+    }
+}
+
+const SeparationStats &Separation::getStats() const
+{
+    return stats;
+}
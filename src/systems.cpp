@@ -6,7 +6,7 @@
 #include "model.h"
 #include "SDL_keycode.h"
 #include "light.h"
-#include "movement.h"
+#include "chunk_generator.h"
 
 
 void GameSystem::inputActions(GAMESYSTEM_ARGS)
@@ -17,11 +17,27 @@ void GameSystem::inputActions(GAMESYSTEM_ARGS)
     }
 
     if (input.key[DZKey::C])
-        scene.terrain.chunks.clear();
+        scene.terrain.clear(renderer);
 
     if (!input.mouse.left_button_down && input.mouse_prev.left_button_down)
     {
+        gui.selection.dim = v2i {input.mouse.pos.x - gui.selection.pos.x, input.mouse.pos.y - gui.selection.pos.y};
 
+        const std::vector<entt::entity> units = gui.select_units(
+                scene.registry,
+                scene.spatial,
+                scene.camera,
+                scene.screen_dim,
+                scene.terrain.min_height,
+                scene.terrain.max_height);
+
+        // Shift adds to the selection
+        if (!input.modifier.shift)
+            scene.registry.clear<Selected>();
+        for (entt::entity unit : units)
+            scene.registry.emplace_or_replace<Selected>(unit);
+
+        Log::verbose("Selected %zu units", scene.registry.view<Selected>().size());
     }
     
     if(input.key[DZKey::L] && !input.key_prev[DZKey::L])
@@ -36,6 +52,20 @@ void GameSystem::inputActions(GAMESYSTEM_ARGS)
         }
         Log::verbose("LOS: %d", scene.LOS_ON);
     }
+
+    if (input.key[DZKey::O] && !input.key_prev[DZKey::O])
+    {
+        scene.fog.setOcclusion(!scene.fog.getOcclusion());
+        Log::verbose("LOS occlusion: %d", scene.fog.getOcclusion());
+    }
+}
+
+void GameSystem::saveAndLoad(GAMESYSTEM_ARGS)
+{
+    if (input.key[DZKey::F5] && !input.key_prev[DZKey::F5])
+        scene.saver.save(scene.registry, scene.terrain, scene.camera, DEFAULT_WORLD_SAVE_PATH);
+    if (input.key[DZKey::F9] && !input.key_prev[DZKey::F9])
+        scene.saver.load(DEFAULT_WORLD_SAVE_PATH, scene.registry, scene.terrain, scene.camera, renderer);
 }
 
 void GameSystem::debugControl(GAMESYSTEM_ARGS)
@@ -106,60 +136,14 @@ void GameSystem::cameraMovement(GAMESYSTEM_ARGS)
         scene.camera.move(glm::vec3(-1.0f, 1.0f, 0.0f));
 }
 
-void GameSystem::unitMovement(GAMESYSTEM_ARGS)
-{
-    scene.registry
-        .view<Transform, MoveSpeed>()
-        .each(
-                [&](auto &transform, auto &move_speed)
-                {
-                    updateMovement(
-                            move_speed.speed * delta_time, 
-                            transform, 
-                            v3f
-                            {
-                                scene.camera.target.x, 
-                                scene.camera.target.y, 
-                                scene.camera.target.z
-                            }, 
-                            616u, 
-                            scene.terrain
-                        );
-                }
-            );
-
-}
-
-void GameSystem::LOS(GAMESYSTEM_ARGS)
-{    
-    for (int i = 0; i < 9; i++)
-    {
-        for(auto &los_index : scene.terrain.visible[i]->los_indices)
-        {
-            if(los_index > 100) los_index -= 1;
-        }
-    }
-
-    scene.registry
-        .view<Transform, LineOfSight>()
-        .each(
-                [&](auto &transform, auto &los)
-                {
-                    scene.terrain.updateLOS(transform.pos.xy(), los.los); 
-                }
-            );
-}
-
 void GameSystem::terrainGeneration(GAMESYSTEM_ARGS)
 {
-        for (int i = -1; i <= 1; i++)
-        {
-            for (int j = -1; j <= 1; j++)
-            {
-                scene.terrain.createChunk(renderer, scene.camera.target.xy() + glm::vec2(i * 100.0f, j * 100.0f));
-            }
-        }
-        scene.terrain.getVisible(scene.camera);
+    Terrain &terrain = scene.terrain;
+
+    terrain.stream(renderer, v2f { scene.camera.target.x, scene.camera.target.y });
+    terrain.getVisible(scene.camera, scene.screen_dim);
+    terrain.updateLOD(renderer, scene.camera);
+    scene.uniforms.terrain = terrain.uploadTiles(renderer);
 }
 
 void RenderSystem::updateData(RENDERSYSTEM_ARGS)
@@ -171,8 +155,7 @@ void RenderSystem::updateData(RENDERSYSTEM_ARGS)
         10.0f
     };
 
-    renderer
-        .setBufferOfSize(scene.light_buffer, &light_data, sizeof(DynamicPointLightData));
+    scene.uniforms.light = renderer.allocateUniforms(&light_data, sizeof(DynamicPointLightData));
 
     SceneUniforms uniforms = {
         scene.camera.getCameraData(screen_dim),
@@ -183,136 +166,212 @@ void RenderSystem::updateData(RENDERSYSTEM_ARGS)
         elapsed_time
     };
 
-    renderer.setBufferOfSize(scene.scene_uniform_buffer, &uniforms, sizeof(SceneUniforms));
-
-    scene.terrain.updateUniforms(renderer, scene.terrain.visible);
+    scene.uniforms.scene = renderer.allocateUniforms(&uniforms, sizeof(SceneUniforms));
 
-    for (int i = 0; i < 9; i++)
+    scene.uniforms.chunks.clear();
+    for (const VisibleChunk &visible : scene.terrain.visible)
     {
-        if (scene.terrain.visible[i])
-        {
-            scene.terrain.visible[i]->updateUniforms(renderer, i);
-        }
+        scene.uniforms.chunks.push_back(
+                visible.chunk->updateUniforms(renderer, scene.terrain.neighbourSlots(visible.coord)));
     }
 }
 
 void RenderSystem::terrain(RENDERSYSTEM_ARGS)
 {    
+    const FrameUniforms &uniforms = scene.uniforms;
+
     renderer.enqueueCommand(
             DZRenderCommand::SetPipeline(scene.terrain.terrain_pipeline));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(scene.scene_uniform_buffer, 0)
+                    Binding<DZBuffer>::Fragment(uniforms.scene.buffer, 0, uniforms.scene.offset)
                 ));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Vertex(scene.scene_uniform_buffer, 0)
+                    Binding<DZBuffer>::Vertex(uniforms.scene.buffer, 0, uniforms.scene.offset)
                 ));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(scene.light_buffer, 3)
+                    Binding<DZBuffer>::Fragment(uniforms.light.buffer, 3, uniforms.light.offset)
                 ));
 
     renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(
-                        scene.terrain.terrain_uniform_buffer, 2)
+                    Binding<DZBuffer>::Fragment(uniforms.terrain.materials, 2)
+                    )
+            );
+
+    renderer.enqueueCommand(
+                DZRenderCommand::BindBuffer(
+                    Binding<DZBuffer>::Fragment(uniforms.terrain.los, 4)
                     )
             );
-        
-    for (int i = 0; i < 9; i++)
+
+    for (size_t i = 0; i < scene.terrain.visible.size(); i++)
     {
-        if (!scene.terrain.visible[i])
-            continue;
+        const VisibleChunk &visible = scene.terrain.visible[i];
 
         renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
                     Binding<DZBuffer>::Vertex(
-                        scene.terrain.visible[i]->local_uniforms_buffer, 2)));
+                        uniforms.chunks[i].buffer, 2, uniforms.chunks[i].offset)));
 
         renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
                     Binding<DZBuffer>::Fragment(
-                        scene.terrain.visible[i]->local_uniforms_buffer, 1)));
+                        uniforms.chunks[i].buffer, 1, uniforms.chunks[i].offset)));
 
         renderer.enqueueCommand(
-                 DZRenderCommand::DrawMesh(
-                     scene.terrain.visible[i]->mesh));
+                 DZRenderCommand::DrawIndexed(
+                     visible.chunk->mesh,
+                     visible.lod.buffer,
+                     visible.lod.count));
     }
 }
 
 void RenderSystem::models(RENDERSYSTEM_ARGS)
 {
+    const FrameUniforms &uniforms = scene.uniforms;
+
     renderer.enqueueCommand(DZRenderCommand::SetPipeline(scene.model_pipeline));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(scene.scene_uniform_buffer, 0)
+                    Binding<DZBuffer>::Fragment(uniforms.scene.buffer, 0, uniforms.scene.offset)
                 ));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Vertex(scene.scene_uniform_buffer, 0)
+                    Binding<DZBuffer>::Vertex(uniforms.scene.buffer, 0, uniforms.scene.offset)
                 ));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(scene.light_buffer, 3)
+                    Binding<DZBuffer>::Fragment(uniforms.light.buffer, 3, uniforms.light.offset)
                 ));
 
-    scene.registry
-        .view<Transform, Model>()
-        .each(
-                [&](const auto &transform, const auto &model)
-                {
-                    model.render(renderer, transform);
-                }
-            );
+    // Drawn between the last two simulation ticks, one draw per mesh
+    auto draw = [&](entt::entity entity, const Transform &transform, const Model &model, const Frustum *frustum)
+    {
+        const PreviousTransform *previous = scene.registry.try_get<PreviousTransform>(entity);
+        const Transform drawn = previous
+            ? interpolate(previous->transform, transform, scene.tick_alpha)
+            : transform;
+
+        const f32 scale = std::max({ drawn.scale.x, drawn.scale.y, drawn.scale.z });
+        if (frustum && !frustum->intersectsSphere(drawn.pos, model.radius * scale))
+            return;
+
+        const ModelInstance instance {
+            drawn.asMat4(),
+            model.textured,
+            model.lit,
+            0,
+            0
+        };
+
+        for (const auto &mesh : model.meshes)
+            scene.model_instances.add(mesh, instance);
+    };
+
+    // Only the cells under the frustum are visited, unless they hold
+    // most entities anyway. The margin covers model sizes and how far a
+    // unit is drawn from where it was hashed.
+    const Frustum frustum = scene.camera.getFrustum(screen_dim);
+    const std::optional<AArect2f> ground = frustum.groundBounds(
+            scene.terrain.min_height - ENTITY_CULL_MARGIN,
+            scene.terrain.max_height + ENTITY_CULL_MARGIN);
+
+    bool by_cell = false;
+    if (ground)
+    {
+        const AArect2f near {
+            v2f { ground->pos.x - ENTITY_CULL_MARGIN, ground->pos.y - ENTITY_CULL_MARGIN },
+            v2f { ground->dim.x + 2 * ENTITY_CULL_MARGIN, ground->dim.y + 2 * ENTITY_CULL_MARGIN }
+        };
+
+        const u32 limit = scene.spatial.getStats().entities * ENTITY_CULL_SCAN_FRACTION;
+        by_cell = scene.spatial.forEachNearUpTo(near, limit, [&](entt::entity entity)
+        {
+            const Model *model = scene.registry.try_get<Model>(entity);
+            const Transform *transform = scene.registry.try_get<Transform>(entity);
+            if (model && transform)
+                draw(entity, *transform, *model, &frustum);
+        });
+    }
+
+    if (by_cell)
+    {
+        // Not hashed until the next tick, or in a world without ticks
+        scene.registry
+            .view<Transform, Model>(entt::exclude<SpatialEntry>)
+            .each(
+                    [&](entt::entity entity, const Transform &transform, const Model &model)
+                    {
+                        draw(entity, transform, model, nullptr);
+                    }
+                );
+    }
+    else
+    {
+        scene.registry
+            .view<Transform, Model>()
+            .each(
+                    [&](entt::entity entity, const Transform &transform, const Model &model)
+                    {
+                        draw(entity, transform, model, &frustum);
+                    }
+                );
+    }
+
+    scene.model_instances.flush(renderer);
 }
 
 void RenderSystem::fow(RENDERSYSTEM_ARGS)
 {
+    const FrameUniforms &uniforms = scene.uniforms;
+
     renderer.enqueueCommand(DZRenderCommand::SetPipeline(scene.fow_pipeline));
 
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Vertex(scene.scene_uniform_buffer, 0)
+                    Binding<DZBuffer>::Vertex(uniforms.scene.buffer, 0, uniforms.scene.offset)
                 ));
 
     renderer.enqueueCommand(
             DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(scene.scene_uniform_buffer, 0)
+                    Binding<DZBuffer>::Fragment(uniforms.scene.buffer, 0, uniforms.scene.offset)
                 ));
 
     renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
-                    Binding<DZBuffer>::Fragment(
-                        scene.terrain.terrain_uniform_buffer, 1)
+                    Binding<DZBuffer>::Fragment(uniforms.terrain.los, 1)
                     )
             );
 
-    for (int i = 0; i < 9; i++)
+    for (size_t i = 0; i < scene.terrain.visible.size(); i++)
     {
-        if (!scene.terrain.visible[i])
-            continue;
+        const VisibleChunk &visible = scene.terrain.visible[i];
 
         renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
                     Binding<DZBuffer>::Vertex(
-                        scene.terrain.visible[i]->local_uniforms_buffer, 2)));
+                        uniforms.chunks[i].buffer, 2, uniforms.chunks[i].offset)));
 
         renderer.enqueueCommand(
                 DZRenderCommand::BindBuffer(
                     Binding<DZBuffer>::Fragment(
-                        scene.terrain.visible[i]->local_uniforms_buffer, 2)));
+                        uniforms.chunks[i].buffer, 2, uniforms.chunks[i].offset)));
 
         renderer.enqueueCommand(
-                 DZRenderCommand::DrawMesh(
-                     scene.terrain.visible[i]->mesh));
+                 DZRenderCommand::DrawIndexed(
+                     visible.chunk->mesh,
+                     visible.lod.buffer,
+                     visible.lod.count));
 
     }
 
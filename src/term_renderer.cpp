@@ -1,5 +1,6 @@
 #include "term_renderer.h"
 #include <algorithm>
+#include <cstring>
 
 DZTermRenderer::DZTermRenderer(int width, int height)
     : width(width)
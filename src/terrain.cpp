@@ -1,8 +1,12 @@
 #include "terrain.h"
-#include "input.h"
+#include "chunk_generator.h"
+#include "chunk_store.h"
 #include "logger.h"
 #include "renderer.h"
 #include "geometry.h"
+#include "noise.h"
+#include "hash_rng.h"
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -11,229 +15,198 @@
 #include <queue>
 #include <time.h>    
 
-KDTree::KDTree(){}
-
-
 void KDTree::add(const std::array<BiomePoint, VORONOI_BIOMES> &bpoints)
 {
-    this->root = new BNode(bpoints[0]);
-
-    root->x_bound_left   = INFINITY;
-    root->x_bound_right  = INFINITY;
-    root->y_bound_bottom = INFINITY;
-    root->y_bound_top    = INFINITY;
-
-    for(int i = 1; i < VORONOI_BIOMES; i++)
-    {
-            root->add_recur_x(bpoints[i]);
-    }
-
-    return;
+    this->nodes = bpoints;
+    this->build(0, VORONOI_BIOMES, 0);
 }
 
-void BNode::add_recur_x(const BiomePoint &bp)
+void KDTree::build(u32 lo, u32 hi, u32 depth)
 {
-    Log::verbose("IN KD: %d", bp.biome);
-    if(bp.position.x > p.position.x)
-    {
-        if(right_child == nullptr)
-        {
-            right_child = new BNode(bp);
-
-            right_child->x_bound_left   = p.position.x;
-            right_child->x_bound_right  = this->x_bound_right;
-            right_child->y_bound_bottom = this->y_bound_bottom;
-            right_child->y_bound_top    = this->y_bound_top;
-
-            right_child->parent = this;
-
-            return;
-        }
-        right_child->add_recur_y(bp);
-    }
-    else
-    {
-        if(left_child == nullptr)
-        {
-            left_child = new BNode(bp);
+    if (hi - lo <= 1)
+        return;
 
-            left_child->x_bound_left   = this->x_bound_left;
-            left_child->x_bound_right  = p.position.x;
-            left_child->y_bound_bottom = this->y_bound_bottom;
-            left_child->y_bound_top    = this->y_bound_top;
+    u32 mid = (lo + hi) / 2;
+    bool split_x = depth % 2 == 0;
 
+    std::nth_element(
+            nodes.begin() + lo,
+            nodes.begin() + mid,
+            nodes.begin() + hi,
+            [split_x](const BiomePoint &a, const BiomePoint &b)
+            {
+                return split_x 
+                    ? a.position.x < b.position.x 
+                    : a.position.y < b.position.y;
+            }
+        );
 
-            left_child->parent = this;
-            return;
-        }
-        left_child->add_recur_y(bp);
-    }
+    build(lo, mid, depth + 1);
+    build(mid + 1, hi, depth + 1);
 }
 
-void BNode::add_recur_y(const BiomePoint &bp)
+const BiomePoint &KDTree::find_nearest(v2f pos) const
 {
-    if(bp.position.y > p.position.y)
-    {
-        if(right_child == nullptr)
-        {
-            right_child = new BNode(bp);
-
-            right_child->x_bound_left   = this->x_bound_left;
-            right_child->x_bound_right  = this->x_bound_right;
-            right_child->y_bound_bottom = this->y_bound_bottom;
-            right_child->y_bound_top    = p.position.y;
+    u32 best = 0;
+    f64 best_distance = INFINITY;
 
-            right_child->parent = this;
-            return;
-        }
-        right_child->add_recur_x(bp);
-    }
-    else 
+    auto visit = [&](auto &self, u32 lo, u32 hi, u32 depth) -> void
     {
-        if(left_child == nullptr)
-        {
-            left_child = new BNode(bp);
-
-            left_child->x_bound_left   = this->x_bound_left;
-            left_child->x_bound_right  = this->x_bound_right;
-            left_child->y_bound_bottom = p.position.y;
-            left_child->y_bound_top    = this->y_bound_top;
+        if (lo >= hi)
+            return;
 
+        u32 mid = (lo + hi) / 2;
+        const BiomePoint &node = nodes[mid];
 
-            left_child->parent = this;
-            return;
+        f64 distance = node.position.distanceSqFrom(pos);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = mid;
         }
-        left_child->add_recur_x(bp);
-    }
-}
 
-std::vector<BiomePoint> KDTree::find_n_closest(v2f pos, s32 n)
-{
-    struct PriorityQueueEntry
-    {
-        float best_possible_distance;
-        BNode *node;
+        f64 diff = depth % 2 == 0 
+            ? pos.x - node.position.x 
+            : pos.y - node.position.y;
 
-        bool operator<(const PriorityQueueEntry &other) const
+        // Near side first, far side only if the splitting line is closer
+        // than the best point so far
+        if (diff <= 0)
         {
-            return this->best_possible_distance > other.best_possible_distance;
+            self(self, lo, mid, depth + 1);
+            if (diff * diff < best_distance)
+                self(self, mid + 1, hi, depth + 1);
+        }
+        else
+        {
+            self(self, mid + 1, hi, depth + 1);
+            if (diff * diff < best_distance)
+                self(self, lo, mid, depth + 1);
         }
     };
 
+    visit(visit, 0, VORONOI_BIOMES, 0);
+
+    return nodes[best];
+}
+
+std::vector<BiomePoint> KDTree::find_n_closest(v2f pos, s32 n) const
+{
     struct BestSoFarEntry
     {
-        float best_possible_distance;
-        BNode *node;
+        f64 distance;
+        u32 node;
 
         bool operator<(const BestSoFarEntry &other) const
         {
-            return this->best_possible_distance < other.best_possible_distance;
+            return this->distance < other.distance;
         }
     };
 
-    bool closestfound = false;
-    bool tosearch;
-    
-    // Stores up to n best so far nodes
-    std::priority_queue<BestSoFarEntry> best_so_far;
-    // Prioritizes those branches that could result in the closest possible points
-    std::priority_queue<PriorityQueueEntry> queue;
+    if (n <= 0)
+        return {};
 
-    queue.push(PriorityQueueEntry{0, root});
-
-    PriorityQueueEntry curr;
+    // Max-heap of up to n best so far nodes, worst on top
+    std::priority_queue<BestSoFarEntry> best_so_far;
 
-    while(!queue.empty())
+    auto visit = [&](auto &self, u32 lo, u32 hi, u32 depth) -> void
     {
-        v2f bestpossible_left, bestpossible_right;
+        if (lo >= hi)
+            return;
 
-        curr = queue.top();
-        queue.pop();
+        u32 mid = (lo + hi) / 2;
+        const BiomePoint &node = nodes[mid];
 
-        best_so_far.push(BestSoFarEntry{(float) curr.node->p.position.distanceFrom(pos), curr.node});
-        
-        if (best_so_far.size() > n)
+        f64 distance = node.position.distanceSqFrom(pos);
+        if (best_so_far.size() < (size_t) n)
         {
-            best_so_far.pop();
+            best_so_far.push(BestSoFarEntry{distance, mid});
         }
-        
-        float left_distance, right_distance;
-        if(curr.node->left_child != nullptr)
+        else if (distance < best_so_far.top().distance)
         {
-            BNode *node = curr.node->left_child;
-            bestpossible_left = {
-                    std::min(std::max(node->x_bound_left, pos.x ), node->x_bound_right),
-                    std::min(std::max(node->y_bound_bottom, pos.y), node->y_bound_top)
-                };
-            left_distance  = bestpossible_left.distanceFrom(pos);
-
-            if(best_so_far.size() < n || left_distance < best_so_far.top().best_possible_distance)
-            {
-                queue.push(PriorityQueueEntry{left_distance,  curr.node->left_child});
-            }
+            best_so_far.pop();
+            best_so_far.push(BestSoFarEntry{distance, mid});
         }
 
-        if(curr.node->right_child != nullptr)
+        f64 diff = depth % 2 == 0 
+            ? pos.x - node.position.x 
+            : pos.y - node.position.y;
+
+        u32 near_lo = diff <= 0 ? lo : mid + 1;
+        u32 near_hi = diff <= 0 ? mid : hi;
+        u32 far_lo  = diff <= 0 ? mid + 1 : lo;
+        u32 far_hi  = diff <= 0 ? hi : mid;
+
+        self(self, near_lo, near_hi, depth + 1);
+
+        if (best_so_far.size() < (size_t) n 
+            || diff * diff < best_so_far.top().distance)
         {
-            BNode *node = curr.node->right_child;
-            bestpossible_right = {
-                    std::min(std::max(node->x_bound_left, pos.x), node->x_bound_right),
-                    std::min(std::max(node->y_bound_bottom, pos.y), node->y_bound_top)
-                };
-            right_distance = bestpossible_right.distanceFrom(pos);
-
-            if(best_so_far.size() < n || right_distance < best_so_far.top().best_possible_distance)
-            {
-                queue.push(PriorityQueueEntry{right_distance, curr.node->right_child});
-            }
+            self(self, far_lo, far_hi, depth + 1);
         }
-    }
+    };
+
+    visit(visit, 0, VORONOI_BIOMES, 0);
 
-    std::vector<BiomePoint> bps;
-    while(!best_so_far.empty())
+    std::vector<BiomePoint> bps(best_so_far.size());
+    for (s32 i = bps.size() - 1; i >= 0; i--)
     {
-        bps.push_back(best_so_far.top().node->p);
+        bps[i] = nodes[best_so_far.top().node];
         best_so_far.pop();
     }
 
     return bps;
 }
 
-MeshData genMeshFromTiles(std::vector<Tile> tiles)
+void KDTree::find_in_radius(v2f pos, f32 radius, std::vector<BiomePoint> &out) const
 {
-    std::vector<Vertex> vertices;
-    std::vector<u32> indices;
- 
-    for (auto tile : tiles)
+    const f64 radius_sq = (f64) radius * radius;
+
+    auto visit = [&](auto &self, u32 lo, u32 hi, u32 depth) -> void
     {
-        indices.push_back(vertices.size());
-        indices.push_back(vertices.size() + 1);
-        indices.push_back(vertices.size() + 2);
-        indices.push_back(vertices.size());
-        indices.push_back(vertices.size() + 2);
-        indices.push_back(vertices.size() + 3);
-
-        vertices.push_back(tile.vertices[0]);
-        vertices.push_back(tile.vertices[1]);
-        vertices.push_back(tile.vertices[2]);
-        vertices.push_back(tile.vertices[3]);
-    }
+        if (lo >= hi)
+            return;
+
+        u32 mid = (lo + hi) / 2;
+        const BiomePoint &node = nodes[mid];
+
+        if (node.position.distanceSqFrom(pos) <= radius_sq)
+            out.push_back(node);
 
-    return MeshData { 
-        vertices,
-        indices,
-        PrimitiveType::TRIANGLE
+        f64 diff = depth % 2 == 0 
+            ? pos.x - node.position.x 
+            : pos.y - node.position.y;
+
+        if (diff <= radius)
+            self(self, lo, mid, depth + 1);
+        if (diff >= -radius)
+            self(self, mid + 1, hi, depth + 1);
     };
+
+    visit(visit, 0, VORONOI_BIOMES, 0);
+}
+
+TerrainVertex::TerrainVertex(glm::vec3 pos, glm::vec3 normal)
+    : pos { pos.x, pos.y, pos.z }
+    , normal {
+        (s8) std::round(std::clamp(normal.x, -1.0f, 1.0f) * 127.0f),
+        (s8) std::round(std::clamp(normal.y, -1.0f, 1.0f) * 127.0f),
+        (s8) std::round(std::clamp(normal.z, -1.0f, 1.0f) * 127.0f),
+        0
+    }
+{
 }
 
 Chunk::Chunk(
         v2f chunk_start, 
         u32 seed, 
         f32 chunk_size,
-        const std::array<BiomePoint, VORONOI_BIOMES> &bps
-        //KDTree *kd,
+        const KDTree &kd
     )
-    : mesh_registered(false)
+    : los_dirty_rows(0)
+    , tile_slot(TERRAIN_NO_SLOT)
+    , mesh_registered(false)
+    , last_used(0)
 {
     Log::verbose("Setting up chunk...");
 
@@ -249,115 +222,90 @@ Chunk::Chunk(
     f32 noise_scale = 16.0f;
     u32 octaves = 9;
 
-    srand(seed);
+    // Keyed by the chunk's coordinates, so what a tile gets does not
+    // depend on which chunks were made before or on which thread
+    const HashRNG rng(seed, v2i {
+            (s32) std::floor(chunk_start.x / chunk_size + 0.5f),
+            (s32) std::floor(chunk_start.y / chunk_size + 0.5f)
+        });
 
     const siv::PerlinNoise perlin(seed);
+    const PerlinBatch batch(perlin);
 
-    std::vector<Tile> tiles;
-
-    glm::vec3 normals[(TILES_PER_SIDE + 1) * (TILES_PER_SIDE + 1)];
-
-    memset(normals, 0, sizeof(glm::vec3) * (TILES_PER_SIDE + 1) * (TILES_PER_SIDE + 1));
     memset(navigable, 0, sizeof(char) * TILES_PER_SIDE * TILES_PER_SIDE);
+    // Tiles between the material bands below keep this rather than
+    // whatever the memory held
+    memset(material_indices, 0, sizeof(material_indices));
+
+    Log::verbose("\tSampling heights...");
+
+    // Neighbouring tiles share corners, so sample every grid vertex once.
+    // heights[y * VERTS_PER_SIDE + x] is the corner at (x, y) * tile_width.
+    std::vector<f32> heights(VERTS_PER_CHUNK);
+
+    batch.octave2DGrid(
+            startx * perlin_scale,
+            starty * perlin_scale,
+            tile_width * perlin_scale,
+            VERTS_PER_SIDE, VERTS_PER_SIDE,
+            heights.data(),
+            octaves
+        );
 
+    for (f32 &h : heights)
+        h = noise_scale * h * h;
 
-    Log::verbose("\tChunk construction started...");
-
-    for (u32 i = 0; i < TILES_PER_SIDE; i++)
-    {
-        for (u32 j = 0; j < TILES_PER_SIDE; j++)
-        {
-            const f32 x_pos = i * tile_width;
-            const f32 y_pos = j * tile_width;
-            const f32 x_pos2 = (i + 1) * tile_width;
-            const f32 y_pos2 = (j + 1) * tile_width;
-                         
-            glm::vec3 corners[4] = {
-                 glm::vec3(x_pos,  y_pos,  0.0f),
-                 glm::vec3(x_pos,  y_pos2, 0.0f),
-                 glm::vec3(x_pos2, y_pos2, 0.0f),
-                 glm::vec3(x_pos2, y_pos,  0.0f)
-            };
-
-            for (u32 i = 0; i < 4; i++)
-            {
-                f32 noise = noise_scale * std::powf(perlin.octave2D((startx + corners[i].x) * perlin_scale, (starty + corners[i].y) * perlin_scale, octaves), 2);
-                corners[i].z = noise;
-            }
-
-            Tile tile;
-                
-            glm::vec3 normal1 = glm::normalize(glm::cross(corners[2] - corners[0], corners[1] - corners[0]));
-
-            normals[i * TILES_PER_SIDE + j]     += normal1;
-            normals[i * TILES_PER_SIDE + (j+1)] += normal1;
-            normals[(i+1) * TILES_PER_SIDE + j] += normal1;
-
-            glm::vec3 normal2 = glm::normalize(glm::cross(corners[3] - corners[0], corners[2] - corners[0]));
-
-            normals[i * TILES_PER_SIDE + j]         += normal2;
-            normals[(i+1) * TILES_PER_SIDE + j]     += normal2;
-            normals[(i+1) * TILES_PER_SIDE + (j+1)] += normal2;
-
-            tile.vertices[0] = {corners[0], glm::vec4(0.0f), glm::vec4(1.0), glm::vec4(0.0f), glm::vec4(0.0f)};
-            tile.vertices[1] = {corners[1], glm::vec4(0.0f), glm::vec4(1.0), glm::vec4(0.0f), glm::vec4(0.0f)};
-            tile.vertices[2] = {corners[2], glm::vec4(0.0f), glm::vec4(1.0), glm::vec4(0.0f), glm::vec4(0.0f)};
-            tile.vertices[3] = {corners[3], glm::vec4(0.0f), glm::vec4(1.0), glm::vec4(0.0f), glm::vec4(0.0f)};
-            
-            tiles.push_back(tile);
-        }
-    }
-
-    Log::verbose("\tGenerating normals...");
-
-    for (u32 i = 0; i < TILES_PER_SIDE; i++)
-    {
-        for (u32 j = 0; j < TILES_PER_SIDE; j++)
-        {
-             tiles[i * TILES_PER_SIDE + j].vertices[0].normal = glm::vec4(glm::normalize(normals[i     * TILES_PER_SIDE + j    ]), 0.0f);
-             tiles[i * TILES_PER_SIDE + j].vertices[1].normal = glm::vec4(glm::normalize(normals[i     * TILES_PER_SIDE + (j+1)]), 0.0f);
-             tiles[i * TILES_PER_SIDE + j].vertices[2].normal = glm::vec4(glm::normalize(normals[(i+1) * TILES_PER_SIDE + (j+1)]), 0.0f);
-             tiles[i * TILES_PER_SIDE + j].vertices[3].normal = glm::vec4(glm::normalize(normals[(i+1) * TILES_PER_SIDE + j    ]), 0.0f);
-
-             tiles[i * TILES_PER_SIDE + j].vertices[0].calculateTangentAndBitangent();
-             tiles[i * TILES_PER_SIDE + j].vertices[1].calculateTangentAndBitangent();
-             tiles[i * TILES_PER_SIDE + j].vertices[2].calculateTangentAndBitangent();
-             tiles[i * TILES_PER_SIDE + j].vertices[3].calculateTangentAndBitangent();
-        }
-    }
+    this->buildVertices(heights, tile_width);
 
     Log::verbose("\tSetting LOS indices...");
 
     memset(this->los_indices, 0, TILES_PER_SIDE * TILES_PER_SIDE);
+    memset(this->observers, 0, sizeof(this->observers));
 
     Log::verbose("\tGenerating material indices...");
 
+    // TODO: Fix this one weird thing doctors (jklmn, ronja) hate
+    // The material noise is sampled at the same corners as the heights.
+    // It asks for 200 octaves, PerlinBatch stops at NOISE_MAX_OCTAVES
+    // where the rest no longer changes the result.
+    const s32 material_octaves = 200;
+    const siv::PerlinNoise otherperlin(1010620);
+    std::vector<f32> material_noise(VERTS_PER_CHUNK);
+
+    PerlinBatch(otherperlin).octave2DGrid(
+            startx * perlin_scale,
+            starty * perlin_scale,
+            tile_width * perlin_scale,
+            VERTS_PER_SIDE, VERTS_PER_SIDE,
+            material_noise.data(),
+            material_octaves
+        );
+
     // Texture
     for(u32 i = 0; i < TILES_PER_SIDE; i++)
     {
         for (u32 j = 0; j < TILES_PER_SIDE; j++)
         {
-            Tile tile = tiles[i * TILES_PER_SIDE + j];
+            const f32 height = (heights[j       * VERTS_PER_SIDE + i]
+                             + heights[(j + 1) * VERTS_PER_SIDE + i]
+                             + heights[(j + 1) * VERTS_PER_SIDE + i + 1]
+                             + heights[j       * VERTS_PER_SIDE + i + 1]) / 4;
+
+            // Corners in the order the old per-tile quads used
+            const f32 corner_noise[4] = {
+                material_noise[j       * VERTS_PER_SIDE + i],
+                material_noise[(j + 1) * VERTS_PER_SIDE + i],
+                material_noise[(j + 1) * VERTS_PER_SIDE + i + 1],
+                material_noise[j       * VERTS_PER_SIDE + i + 1]
+            };
+
             for (u32 k = 0; k < 4; k++)
             {
-                // TODO: Fix this one weird thing doctors (jklmn, ronja) hate
-                f32 _perlin_scale = perlin_scale;
-                f32 _noise_scale = noise_scale;
-                u32 _octaves = 200;
-                int otherseed = 1010620;
-                const siv::PerlinNoise otherperlin(otherseed);
-                u32 index = i * TILES_PER_SIDE + j;
-                f32 height = (tiles[index].vertices[0].pos.z 
-                           + tiles[index].vertices[1].pos.z 
-                           + tiles[index].vertices[2].pos.z 
-                           + tiles[index].vertices[3].pos.z) / 4;
-
-                f32 noise = _noise_scale * otherperlin.octave2D((startx + tile.vertices[k].pos.x) * _perlin_scale, (starty + tile.vertices[k].pos.y) * perlin_scale, _octaves) + height/4;
+                f32 noise = noise_scale * corner_noise[k] + height/4;
                 //Log::verbose("noise: %f", noise);
                 if(noise <= -4.5)
                 {
-                    // TODO: make perlin, not seeded noise
-                    u32 chance = rand() % 10;
+                    u32 chance = rng.below(RNG_STREAM_MATERIAL, (j * TILES_PER_SIDE + i) * 4 + k, 10);
                     if(chance >= 5)
                         this->material_indices[j * TILES_PER_SIDE + i] = 0;
                     else
@@ -389,7 +337,7 @@ Chunk::Chunk(
 
                 else if (noise > 8.5) 
                 {
-                    u32 chance = rand() % 10;
+                    u32 chance = rng.below(RNG_STREAM_MATERIAL, (j * TILES_PER_SIDE + i) * 4 + k, 10);
                     if(chance >= 5)
                         this->material_indices[j * TILES_PER_SIDE + i] = 6;
                     else
@@ -399,6 +347,22 @@ Chunk::Chunk(
         }
     }
 
+    const auto [lowest, highest] = std::minmax_element(heights.begin(), heights.end());
+    this->min_height = *lowest;
+    this->max_height = *highest;
+    this->heights = std::move(heights);
+
+    // A biome point only contributes to a tile if its weight 8 / d^2 is
+    // at least 0.001, i.e. d <= BIOME_CUTOFF_RADIUS. Gather every point
+    // that can reach some tile of this chunk once, instead of scanning
+    // all VORONOI_BIOMES points per tile.
+    std::vector<BiomePoint> candidates;
+    kd.find_in_radius(
+            v2f { startx + chunk_size / 2, starty + chunk_size / 2 },
+            BIOME_CUTOFF_RADIUS + chunk_size * M_SQRT1_2,
+            candidates
+        );
+
     for (u32 i = 0; i < TILES_PER_CHUNK; i++)
     {
         //float xpos = i / TILES_PER_CHUNK + startx;
@@ -410,21 +374,12 @@ Chunk::Chunk(
 
         memset(reciprocal_distance_table, 0, sizeof(f64) * NUM_BIOMES);
 
-        f64 min_dist = INFINITY;
-        u32 biome_min_dist = 0;
-
-        for(u32 j = 0; j < VORONOI_BIOMES; j++)
+        for(const BiomePoint &bp : candidates)
         {
-            const BiomePoint &bp = bps[j];
             f64 sq_distance = bp.position.distanceSqFrom(pos);
-            if (min_dist > sq_distance )
-            {
-                min_dist = sq_distance;
-                biome_min_dist = bp.biome;
-            }
             f64 recip_dist = 8.0 / sq_distance;
             if (recip_dist < 0.001) {
-                recip_dist = 0.0;
+                continue;
             }
             reciprocal_distance_table[bp.biome] += recip_dist;
             total_reciprocal_distances += recip_dist;
@@ -433,7 +388,7 @@ Chunk::Chunk(
         if (total_reciprocal_distances != 0.0)
         {
 
-            f64 biome_selector = ((f64)rand() / RAND_MAX) * total_reciprocal_distances;
+            f64 biome_selector = rng.unit(RNG_STREAM_BIOME_BLEND, i) * total_reciprocal_distances;
 
             u8 selected_biome = 0;
 
@@ -454,18 +409,89 @@ Chunk::Chunk(
         }
         else
         {
-            material_indices[i] += biome_min_dist * NUM_TEXTURES_PER_BIOME;
+            // Nothing close enough to blend, fall back to the Voronoi cell
+            material_indices[i] += kd.find_nearest(pos).biome * NUM_TEXTURES_PER_BIOME;
         }
 
         //material_indices[i] += selected_biome + 1 * NUM_TEXTURES_PER_BIOME;
     }
     // TODO: Check each material index w neighbors, make sure they are not one of a kind
     // wrt biome
+}
+
+Chunk::Chunk(v2f chunk_start, f32 chunk_size, std::vector<f32> heights)
+    : los_dirty_rows(0)
+    , tile_slot(TERRAIN_NO_SLOT)
+    , mesh_registered(false)
+    , last_used(0)
+{
+    transform.pos = glm::vec3(chunk_start.x, chunk_start.y, 0.0);
+    transform.scale = glm::vec3(1.0f);
+    transform.rotation = glm::vec3(0.0);
+
+    memset(this->material_indices, 0, sizeof(this->material_indices));
+    memset(this->navigable, 0, sizeof(this->navigable));
+    memset(this->los_indices, 0, sizeof(this->los_indices));
+    memset(this->observers, 0, sizeof(this->observers));
+
+    this->buildVertices(heights, chunk_size / TILES_PER_SIDE);
+
+    const auto [lowest, highest] = std::minmax_element(heights.begin(), heights.end());
+    this->min_height = *lowest;
+    this->max_height = *highest;
+    this->heights = std::move(heights);
+}
+
+// Positions and normals from the corner heights. Normals are summed
+// over the triangles around each corner, split the same way as the
+// index buffer, see Terrain::generateIndices.
+void Chunk::buildVertices(const std::vector<f32> &heights, f32 tile_width)
+{
+    std::vector<glm::vec3> normals(VERTS_PER_CHUNK, glm::vec3(0.0f));
+
+    auto corner = [&](u32 x, u32 y)
+    {
+        return glm::vec3(x * tile_width, y * tile_width, heights[y * VERTS_PER_SIDE + x]);
+    };
+
+    for (u32 y = 0; y < TILES_PER_SIDE; y++)
+    {
+        for (u32 x = 0; x < TILES_PER_SIDE; x++)
+        {
+            const u32 i0 = y       * VERTS_PER_SIDE + x;
+            const u32 i1 = (y + 1) * VERTS_PER_SIDE + x;
+            const u32 i2 = (y + 1) * VERTS_PER_SIDE + x + 1;
+            const u32 i3 = y       * VERTS_PER_SIDE + x + 1;
+
+            const glm::vec3 c0 = corner(x,     y);
+            const glm::vec3 c1 = corner(x,     y + 1);
+            const glm::vec3 c2 = corner(x + 1, y + 1);
+            const glm::vec3 c3 = corner(x + 1, y);
 
-    Log::verbose("\tGenerating mesh data...");
+            glm::vec3 normal1 = glm::normalize(glm::cross(c2 - c0, c1 - c0));
 
-    MeshData mesh_data = genMeshFromTiles(tiles);
-    this->mesh_data = mesh_data;
+            normals[i0] += normal1;
+            normals[i1] += normal1;
+            normals[i2] += normal1;
+
+            glm::vec3 normal2 = glm::normalize(glm::cross(c3 - c0, c2 - c0));
+
+            normals[i0] += normal2;
+            normals[i2] += normal2;
+            normals[i3] += normal2;
+        }
+    }
+
+    this->vertices.resize(VERTS_PER_CHUNK);
+
+    for (u32 y = 0; y < VERTS_PER_SIDE; y++)
+    {
+        for (u32 x = 0; x < VERTS_PER_SIDE; x++)
+        {
+            const u32 index = y * VERTS_PER_SIDE + x;
+            this->vertices[index] = TerrainVertex(corner(x, y), glm::normalize(normals[index]));
+        }
+    }
 }
 
 v2f Chunk::getPosFromTileIndex(u32 tile_index, f32 tile_width)
@@ -475,14 +501,42 @@ v2f Chunk::getPosFromTileIndex(u32 tile_index, f32 tile_width)
     return v2f{transform.pos.x + x * tile_width, transform.pos.y + y * tile_width}; 
 }
 
-void Chunk::updateUniforms(DZRenderer &renderer, s32 chunk_index)
+// Interpolates on the same two triangles per tile the index buffer
+// draws, split along the (x, y) to (x + 1, y + 1) diagonal, so the
+// result is on the LOD 0 mesh rather than a bilinear patch near it
+f32 Chunk::heightAt(v2f local, f32 tile_width) const
+{
+    const f32 tx = std::clamp(local.x / tile_width, 0.0f, (f32) TILES_PER_SIDE);
+    const f32 ty = std::clamp(local.y / tile_width, 0.0f, (f32) TILES_PER_SIDE);
+    const u32 x = std::min((u32) tx, (u32) TILES_PER_SIDE - 1);
+    const u32 y = std::min((u32) ty, (u32) TILES_PER_SIDE - 1);
+    const f32 fx = tx - x;
+    const f32 fy = ty - y;
+
+    const f32 *row0 = &this->heights[y * VERTS_PER_SIDE + x];
+    const f32 *row1 = row0 + VERTS_PER_SIDE;
+
+    const f32 h0 = row0[0];
+    const f32 h1 = row1[0];
+    const f32 h2 = row1[1];
+    const f32 h3 = row0[1];
+
+    if (fy > fx)
+        return h0 + fy * (h1 - h0) + fx * (h2 - h1);
+    return h0 + fx * (h3 - h0) + fy * (h2 - h3);
+}
+
+UniformSlice Chunk::updateUniforms(DZRenderer &renderer, const std::array<s32, 9> &neighbour_slots)
 {
     if (!this->mesh_registered)
     {
         Log::verbose("\tRegistering mesh with renderer...");
-        this->mesh = renderer.createMesh(this->mesh_data);
-        this->local_uniforms_buffer = 
-            renderer.createBufferOfSize(sizeof(ChunkData), StorageMode::MANAGED);
+        this->mesh = renderer.createMesh(
+                this->vertices.data(),
+                this->vertices.size() * sizeof(TerrainVertex),
+                this->vertices.size(),
+                PrimitiveType::TRIANGLE
+            );
         this->mesh_registered = true;
 
         Log::verbose("\tMesh registered...");
@@ -490,22 +544,38 @@ void Chunk::updateUniforms(DZRenderer &renderer, s32 chunk_index)
 
     ChunkData chunk_data;
 
-    chunk_data.chunk_index = chunk_index;
+    memcpy(chunk_data.neighbour_slots, neighbour_slots.data(), sizeof(chunk_data.neighbour_slots));
     chunk_data.model_matrix = this->transform.asMat4();
 
-    renderer.setBufferOfSize(
-            local_uniforms_buffer, 
-            &chunk_data, 
-            sizeof(ChunkData)
-        );
+    return renderer.allocateUniforms(&chunk_data, sizeof(ChunkData));
+}
+
+void Chunk::releaseGPU(DZRenderer &renderer)
+{
+    if (!this->mesh_registered)
+        return;
+
+    renderer.releaseMesh(this->mesh);
+    this->mesh_registered = false;
 }
 
-Terrain::Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed)
+size_t Chunk::memoryUsage() const
+{
+    size_t bytes = sizeof(Chunk)
+                 + this->vertices.capacity() * sizeof(TerrainVertex)
+                 + this->heights.capacity() * sizeof(f32);
+
+    if (this->mesh_registered)
+        bytes += this->vertices.size() * sizeof(TerrainVertex) + sizeof(ChunkData);
+
+    return bytes;
+}
+
+Terrain::Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed, const std::string &store_directory)
     : chunk_size { chunk_size }
     , seed { seed }
 {
     AssetManager ass_man;
-    srand(seed);
 
     // NO NO NO NO NO NO NO NO NO NO NO NO NO NO NO NO NO NO NO NO
     auto terrain_shader_src = *ass_man.getTextFile("shaders/terrain_shader.metal");
@@ -514,9 +584,40 @@ Terrain::Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed)
     this->terrain_pipeline 
         = renderer.createPipeline(terrain_shaders[0], terrain_shaders[1]);
 
-    this->terrain_uniform_buffer = renderer.createBufferOfSize(sizeof(MegaChunkData));
+    this->min_height = 0.0f;
+    this->max_height = 0.0f;
+
+    this->bps = generateBiomePoints(seed);
+    this->kd.add(this->bps);
+
+    this->prefetch_radius = DEFAULT_PREFETCH_RADIUS;
+    this->memory_budget = DEFAULT_TERRAIN_MEMORY_BUDGET;
+    this->cache_frame = 0;
+    this->evictions = 0;
+    if (!store_directory.empty())
+        this->store = std::make_unique<ChunkStore>(store_directory, seed, chunk_size);
+    this->generator = std::make_unique<ChunkGenerator>(
+            seed, chunk_size, this->kd, ThreadPool::defaultThreadCount(), this->store.get());
+    this->tiles = std::make_unique<TerrainTiles>(renderer);
+
+    Log::verbose("Terrain established"); 
+}
+
+Terrain::~Terrain()
+{
+    // Workers may still be saving, they are joined first
+    this->generator.reset();
+
+    if (!this->store)
+        return;
 
-    memset(this->visible.data(), 0, sizeof(Chunk*) * 9);
+    this->chunks.forEach([&](v2i coord, const Chunk &chunk) { this->store->save(coord, chunk); });
+    this->store->flush();
+}
+
+std::array<BiomePoint, VORONOI_BIOMES> Terrain::generateBiomePoints(u32 seed)
+{
+    const HashRNG rng(seed);
 
     std::array<BiomePoint, VORONOI_BIOMES> biome_arr;
     biome_arr[0].position = v2f{0.0, 0.0};
@@ -526,8 +627,8 @@ Terrain::Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed)
     {
 
         biome_arr[i].position = v2f {
-            (float) (rand() % WORLDSIZE - WORLDSIZE/2),
-            (float) (rand() % WORLDSIZE - WORLDSIZE/2)
+            (float) ((s32) rng.below(RNG_STREAM_BIOME_POINTS, 2 * i, WORLDSIZE) - WORLDSIZE/2),
+            (float) ((s32) rng.below(RNG_STREAM_BIOME_POINTS, 2 * i + 1, WORLDSIZE) - WORLDSIZE/2)
         };
         f32 start_distance = biome_arr[i].position.distanceFrom(v2f {0.0f, 0.0f}); 
 
@@ -561,11 +662,67 @@ Terrain::Terrain(DZRenderer &renderer, f32 chunk_size, u32 seed)
         else
             biome_arr[i].biome = BIOME_DEFAULT;
     }
-    //kd.add(biome_arr);
-    //
-    this->bps = std::move(biome_arr);
 
-    Log::verbose("Terrain established"); 
+    return biome_arr;
+}
+
+u32 Terrain::lodKey(u32 level, u32 north, u32 east, u32 south, u32 west)
+{
+    return level
+        | std::max(north, level) << 2
+        | std::max(east,  level) << 4
+        | std::max(south, level) << 6
+        | std::max(west,  level) << 8;
+}
+
+std::vector<u16> Terrain::generateIndices(u32 lod_key)
+{
+    static_assert(VERTS_PER_CHUNK <= 65536, "Terrain grid too large for u16 indices");
+    static_assert(TILES_PER_SIDE % (1 << (TERRAIN_LOD_LEVELS - 1)) == 0,
+            "Coarsest LOD must divide the chunk evenly");
+
+    const u32 step  = 1 << (lod_key & 3);
+    const u32 north = 1 << (lod_key >> 2 & 3);
+    const u32 east  = 1 << (lod_key >> 4 & 3);
+    const u32 south = 1 << (lod_key >> 6 & 3);
+    const u32 west  = 1 << (lod_key >> 8 & 3);
+
+    // Moves a vertex on an edge down to the nearest vertex the neighbour
+    // on that side also has. Triangles touching the edge stretch over the
+    // coarser spacing, the ones that collapse are dropped below.
+    auto vertex = [&](u32 x, u32 y) -> u16
+    {
+        if (x == 0)              y -= y % west;
+        if (x == TILES_PER_SIDE) y -= y % east;
+        if (y == 0)              x -= x % south;
+        if (y == TILES_PER_SIDE) x -= x % north;
+        return y * VERTS_PER_SIDE + x;
+    };
+
+    std::vector<u16> indices;
+    indices.reserve(INDICES_PER_CHUNK / (step * step));
+
+    auto triangle = [&](u16 a, u16 b, u16 c)
+    {
+        if (a != b && b != c && a != c)
+            indices.insert(indices.end(), { a, b, c });
+    };
+
+    for (u32 y = 0; y < TILES_PER_SIDE; y += step)
+    {
+        for (u32 x = 0; x < TILES_PER_SIDE; x += step)
+        {
+            const u16 i0 = vertex(x,        y);
+            const u16 i1 = vertex(x,        y + step);
+            const u16 i2 = vertex(x + step, y + step);
+            const u16 i3 = vertex(x + step, y);
+
+            triangle(i0, i1, i2);
+            triangle(i0, i2, i3);
+        }
+    }
+
+    return indices;
 }
 
 v2f Terrain::getChunkOriginFromPos(v2f pos)
@@ -583,123 +740,229 @@ v2f Terrain::getChunkOriginFromPos(v2f pos)
     return chunk_start;
 }
 
-void Terrain::createChunk(DZRenderer &renderer, glm::vec2 pos_in_chunk)
+void Terrain::requestChunk(glm::vec2 pos_in_chunk)
 {
     v2f chunkpos {
         pos_in_chunk.x,
         pos_in_chunk.y
     };
 
-    v2f origin = this->getChunkOriginFromPos(chunkpos);
-
     // Verify no chunk already contains pos
-    if(this->chunks.contains(origin))
+    if (Chunk *chunk = this->chunks.find(this->getChunkCoordFromPos(chunkpos)))
     {
+        chunk->last_used = this->cache_frame;
         return;
     }
 
-    Log::verbose("\tCreating chunk...");
-
-    Chunk chunk(origin, seed, chunk_size, this->bps);
+    v2f origin = this->getChunkOriginFromPos(chunkpos);
 
-    this->chunks.emplace(origin, chunk);
+    if (this->generator->request(origin))
+        Log::verbose("\tRequested chunk (%.0f, %.0f)", origin.x, origin.y);
 }
 
-Chunk* Terrain::getChunkFromPos(v2f pos)
+void Terrain::stream(DZRenderer &renderer, v2f focus)
 {
-    v2f origin = this->getChunkOriginFromPos(pos);
-    if(this->chunks.contains(origin))
+    const s32 radius = this->prefetch_radius;
+
+    this->generator->setFocus(focus);
+
+    // Request ring by ring so the visible chunks are queued first
+    for (s32 ring = 0; ring <= radius; ring++)
     {
-        // [] operator requires a default cosntructor for Chunk
-        // so instead of &this->chunks[origin]
-        return &this->chunks.find(origin)->second;
+        for (s32 i = -ring; i <= ring; i++)
+        {
+            for (s32 j = -ring; j <= ring; j++)
+            {
+                if (std::max(std::abs(i), std::abs(j)) != ring)
+                    continue;
+
+                this->requestChunk(
+                        glm::vec2(focus.x + i * this->chunk_size, focus.y + j * this->chunk_size));
+            }
+        }
     }
-    return nullptr;
-}
 
-float glsl_mod(float x, float y) 
-{
-    return x - y * floor(x / y);
+    this->collectChunks();
+    this->evictChunks(renderer, focus);
 }
 
-int Terrain::getTileIndexFromPos(v2f pos)
+u32 Terrain::collectChunks()
 {
-    const f32 tile_width = chunk_size / TILES_PER_SIDE;
-    int x = floor(glsl_mod(pos.x, chunk_size) / tile_width);
-    int y = floor(glsl_mod(pos.y, chunk_size) / tile_width);
-    return y * TILES_PER_SIDE + x;
+    auto finished = this->generator->collect();
+
+    for (auto &entry : finished)
+    {
+        // Chunk origins are whole multiples of chunk_size, sample the
+        // middle so rounding cannot land in the neighbour
+        const v2i coord = this->getChunkCoordFromPos(
+                v2f { entry.first.x + chunk_size / 2, entry.first.y + chunk_size / 2 });
+
+        // A duplicate request
+        if (this->chunks.contains(coord))
+            continue;
+
+        Chunk &chunk = this->chunks.insert(coord, std::move(entry.second));
+        chunk.last_used = this->cache_frame;
+        this->min_height = std::min(this->min_height, chunk.min_height);
+        this->max_height = std::max(this->max_height, chunk.max_height);
+
+        auto saved = this->persisted.find(coord);
+        if (saved != this->persisted.end())
+        {
+            memcpy(chunk.los_indices, saved->second.los_indices, sizeof(chunk.los_indices));
+            memcpy(chunk.navigable, saved->second.navigable, sizeof(chunk.navigable));
+            this->persisted.erase(saved);
+        }
+    }
+
+    return finished.size();
 }
 
-void Terrain::updateLOS(glm::vec2 pos, int LOS)
+void Terrain::evictChunks(DZRenderer &renderer, v2f focus)
 {
-    circ2f circle {
-        v2f {
-            pos.x,
-            pos.y
-        },
-        (float) LOS
-    };
+    const v2i focus_coord = this->getChunkCoordFromPos(focus);
 
-    AArect2f los_rect {
-        v2f{
-            circle.pos.x - circle.radius,
-            circle.pos.y - circle.radius
-        },
-        v2f {
-            circle.radius * 2,
-            circle.radius * 2
-        }
+    struct Candidate
+    {
+        u64 last_used;
+        s32 distance;
+        v2i coord;
     };
 
-    f32 tile_width = chunk_size / TILES_PER_SIDE;
-
-    v2f origin = getChunkOriginFromPos(v2f{pos.x, pos.y});
+    // What evicted chunks keep counts against the budget too
+    size_t bytes_used = this->persisted.size() * sizeof(PersistedChunk);
+    std::vector<Candidate> candidates;
 
-    for (int i = -1; i <= 1; i++)
+    this->chunks.forEach([&](v2i coord, const Chunk &chunk)
     {
-        for (int j = -1; j <= 1; j++)
-        {
-            v2f nbor_origin = origin + v2f { i * chunk_size, j * chunk_size };
-            auto chunk_rect = AArect2f {
-                nbor_origin,
-                v2f { chunk_size, chunk_size}
-            };
+        bytes_used += chunk.memoryUsage();
 
-            if (chunk_rect.collidesWith(circle))
+        const s32 dx = std::abs(coord.x - focus_coord.x);
+        const s32 dy = std::abs(coord.y - focus_coord.y);
+        if (std::max(dx, dy) <= (s32) prefetch_radius)
+            return;
+
+        candidates.push_back(Candidate { chunk.last_used, dx * dx + dy * dy, coord });
+    });
+
+    this->cache_frame++;
+
+    if (bytes_used <= this->memory_budget)
+        return;
+
+    std::sort(
+            candidates.begin(),
+            candidates.end(),
+            [](const Candidate &a, const Candidate &b)
             {
-                if (auto intersection = los_rect.getIntersectingRect(chunk_rect))
-                {
-                    Chunk *chunk = this->getChunkFromPos(intersection->pos);
-
-                    if (!chunk) continue;
-
-                    v2f origin {
-                        chunk->transform.pos.x,
-                        chunk->transform.pos.y
-                    };
-
-                    int n_tiles_x = intersection->dim.x / tile_width;
-                    int n_tiles_y = intersection->dim.y / tile_width;
-                    for(int i = 0; i < n_tiles_x; i++)
-                    {
-                        for(int j = 0; j < n_tiles_y; j++)
-                        {
-                            v2f tile_center = {
-                                intersection->pos.x + tile_width * (i + 0.5f),
-                                intersection->pos.y + tile_width * (j + 0.5f)
-                            };
-
-                            if (tile_center.distanceFrom(circle.pos) <= circle.radius)
-                            {
-                                int index = this->getTileIndexFromPos(tile_center);
-                                chunk->los_indices[index] = 255;
-                            }
-                        }
-                    }
-                }
+                if (a.last_used != b.last_used)
+                    return a.last_used < b.last_used;
+                return a.distance > b.distance;
             }
+        );
+
+    for (const Candidate &candidate : candidates)
+    {
+        if (bytes_used <= this->memory_budget)
+            break;
+
+        Chunk &chunk = *this->chunks.find(candidate.coord);
+
+        // The store keeps the whole chunk, persisted is only needed
+        // without one
+        if (!this->store || !this->store->save(candidate.coord, chunk))
+        {
+            PersistedChunk &saved = this->persisted[candidate.coord];
+            memcpy(saved.los_indices, chunk.los_indices, sizeof(saved.los_indices));
+            memcpy(saved.navigable, chunk.navigable, sizeof(saved.navigable));
+            bytes_used += sizeof(PersistedChunk);
         }
+
+        bytes_used -= chunk.memoryUsage();
+        chunk.releaseGPU(renderer);
+        this->tiles->release(chunk);
+        this->chunks.erase(candidate.coord);
+        this->evictions++;
+
+        Log::verbose("\tEvicted chunk (%d, %d)", candidate.coord.x, candidate.coord.y);
     }
+
+    Log::verbose("Terrain cache: %u resident, %.1f of %.1f MB, %llu evictions",
+            this->chunks.size(),
+            bytes_used / (1024.0 * 1024.0),
+            this->memory_budget / (1024.0 * 1024.0),
+            (unsigned long long) this->evictions);
+}
+
+void Terrain::clear(DZRenderer &renderer)
+{
+    this->generator->cancel();
+
+    // Explored tiles come back with the chunks
+    this->chunks.forEach([&](v2i coord, Chunk &chunk)
+    {
+        if (this->store)
+            this->store->save(coord, chunk);
+        chunk.releaseGPU(renderer);
+    });
+    if (this->store)
+        this->store->flush();
+    this->tiles->releaseAll();
+
+    this->chunks.clear();
+    this->persisted.clear();
+    this->visible.clear();
+}
+
+TerrainCacheStats Terrain::getCacheStats() const
+{
+    TerrainCacheStats stats;
+    stats.resident = this->chunks.size();
+    stats.persisted = this->persisted.size();
+    stats.bytes_used = this->persisted.size() * sizeof(PersistedChunk);
+    stats.memory_budget = this->memory_budget;
+    stats.evictions = this->evictions;
+
+    this->chunks.forEach([&](v2i, const Chunk &chunk) { stats.bytes_used += chunk.memoryUsage(); });
+
+    return stats;
+}
+
+v2i Terrain::getChunkCoordFromPos(v2f pos) const
+{
+    return v2i {
+        (s32) std::floor(pos.x / chunk_size),
+        (s32) std::floor(pos.y / chunk_size)
+    };
+}
+
+Chunk* Terrain::getChunkFromPos(v2f pos)
+{
+    return this->chunks.find(this->getChunkCoordFromPos(pos));
+}
+
+f32 Terrain::heightAt(v2f pos) const
+{
+    const v2i coord = this->getChunkCoordFromPos(pos);
+    const Chunk *chunk = this->chunks.find(coord);
+    if (!chunk)
+        return 0.0f;
+
+    const v2f local { pos.x - coord.x * chunk_size, pos.y - coord.y * chunk_size };
+    return chunk->heightAt(local, chunk_size / TILES_PER_SIDE);
+}
+
+float glsl_mod(float x, float y) 
+{
+    return x - y * floor(x / y);
+}
+
+int Terrain::getTileIndexFromPos(v2f pos)
+{
+    const f32 tile_width = chunk_size / TILES_PER_SIDE;
+    int x = floor(glsl_mod(pos.x, chunk_size) / tile_width);
+    int y = floor(glsl_mod(pos.y, chunk_size) / tile_width);
+    return y * TILES_PER_SIDE + x;
 }
 
 void Terrain::termRender(DZTermRenderer &term, glm::vec2 pos)
@@ -717,9 +980,8 @@ void Terrain::termRender(DZTermRenderer &term, glm::vec2 pos)
     term_origin.x = center.x - termdim.x/2;
     term_origin.y = center.y - termdim.y/2;
 
-    for (auto &map_entry : this->chunks)
+    this->chunks.forEach([&](v2i, Chunk &chunk)
     {
-        Chunk &chunk = map_entry.second;
         v2i termcoord;
         termcoord.x = floor(chunk.transform.pos.x / tile_width);
         termcoord.y = floor(chunk.transform.pos.y / tile_width);
@@ -742,52 +1004,153 @@ void Terrain::termRender(DZTermRenderer &term, glm::vec2 pos)
                 }
             }
         }
-    }
+    });
 }
 
-void Terrain::getVisible(Camera &camera)
+void Terrain::getVisible(const Camera &camera, glm::vec2 screen_dim)
 {
-    std::array<Chunk*, 9> new_visible;
-        for (int i = -1; i <= 1; i++)
+    this->visible.clear();
+
+    const Frustum frustum = camera.getFrustum(screen_dim);
+    const std::optional<AArect2f> ground = frustum.groundBounds(this->min_height, this->max_height);
+    if (!ground)
+        return;
+
+    const v2i first = this->getChunkCoordFromPos(ground->pos);
+    const v2i last = this->getChunkCoordFromPos(ground->pos + ground->dim);
+
+    for (s32 y = first.y; y <= last.y; y++)
+    {
+        for (s32 x = first.x; x <= last.x; x++)
         {
-            for (int j = -1; j <= 1; j++)
+            const v2i coord { x, y };
+            Chunk *chunk = this->chunks.find(coord);
+
+            // Missing chunks are tested with the heights seen so far
+            const glm::vec3 min(x * chunk_size, y * chunk_size, chunk ? chunk->min_height : this->min_height);
+            const glm::vec3 max((x + 1) * chunk_size, (y + 1) * chunk_size, chunk ? chunk->max_height : this->max_height);
+            if (!frustum.intersectsBox(min, max))
+                continue;
+
+            if (!chunk)
             {
-                visible[(j+1) * 3 + (i + 1)] 
-                    = getChunkFromPos(
-                            v2f
-                            {
-                                camera.target.x + chunk_size * i,
-                                camera.target.y + chunk_size * j
-                            }
-                        );
+                this->requestChunk(glm::vec2((x + 0.5f) * chunk_size, (y + 0.5f) * chunk_size));
+                continue;
             }
+
+            chunk->last_used = this->cache_frame;
+            this->visible.push_back(VisibleChunk { coord, chunk, LODIndexBuffer { DZInvalid, 0 } });
         }
-    visible = new_visible;
+    }
+
+    const v2f target { camera.target.x, camera.target.y };
+    auto distance = [&](const VisibleChunk &chunk)
+    {
+        const v2f center { (chunk.coord.x + 0.5f) * chunk_size, (chunk.coord.y + 0.5f) * chunk_size };
+        return center.distanceSqFrom(target);
+    };
+
+    std::sort(
+            this->visible.begin(),
+            this->visible.end(),
+            [&](const VisibleChunk &a, const VisibleChunk &b) { return distance(a) < distance(b); }
+        );
+
+    if (this->visible.size() > MAX_VISIBLE_CHUNKS)
+        this->visible.resize(MAX_VISIBLE_CHUNKS);
+}
+
+u32 Terrain::selectLOD(const Camera &camera, v2f chunk_origin) const
+{
+    // The orthographic projection spans 2 * screen / zoom_level world
+    // units, so a world unit is zoom_level / 2 pixels at any resolution
+    const f32 tile_pixels = chunk_size / TILES_PER_SIDE * camera.zoom_level / 2.0f;
+
+    u32 level = 0;
+    while (level + 1 < TERRAIN_LOD_LEVELS
+           && tile_pixels * (2 << level) <= LOD_MAX_QUAD_PIXELS)
+    {
+        level++;
+    }
+
+    // One level coarser for every whole chunk between the camera target
+    // and the chunk
+    const f32 dx = std::max({ chunk_origin.x - camera.target.x, 0.0f, camera.target.x - (chunk_origin.x + chunk_size) });
+    const f32 dy = std::max({ chunk_origin.y - camera.target.y, 0.0f, camera.target.y - (chunk_origin.y + chunk_size) });
+    level += (u32) (std::sqrt(dx * dx + dy * dy) / chunk_size);
+
+    return std::min(level, (u32) TERRAIN_LOD_LEVELS - 1);
 }
 
-void Terrain::updateUniforms(DZRenderer &renderer, std::array<Chunk*, 9> visible) const
+void Terrain::updateLOD(DZRenderer &renderer, const Camera &camera)
 {
-    MegaChunkData mega_chunk_data;
-    for (int i = 0; i < 9; i++)
+    std::map<v2i, u32> levels;
+    for (const VisibleChunk &chunk : visible)
     {
-        if (visible[i])
+        levels[chunk.coord] = selectLOD(
+                camera, v2f { chunk.chunk->transform.pos.x, chunk.chunk->transform.pos.y });
+    }
+
+    for (VisibleChunk &chunk : visible)
+    {
+        const u32 level = levels[chunk.coord];
+
+        // Edges facing a chunk that is not drawn need no stitching
+        auto neighbour = [&](s32 dx, s32 dy)
         {
-            memcpy(
-                    &mega_chunk_data.material_indices[i * TILES_PER_SIDE * TILES_PER_SIDE],
-                    visible[i]->material_indices,
-                    TILES_PER_SIDE * TILES_PER_SIDE
-                );
-            memcpy(
-                    &mega_chunk_data.los_indices[i * TILES_PER_SIDE * TILES_PER_SIDE],
-                    visible[i]->los_indices,
-                    TILES_PER_SIDE * TILES_PER_SIDE
-                );
+            auto found = levels.find(v2i { chunk.coord.x + dx, chunk.coord.y + dy });
+            return found == levels.end() ? level : found->second;
+        };
+
+        const u32 key = lodKey(
+                level,
+                neighbour(0, 1),
+                neighbour(1, 0),
+                neighbour(0, -1),
+                neighbour(-1, 0)
+            );
+
+        auto it = lod_index_buffers.find(key);
+        if (it == lod_index_buffers.end())
+        {
+            std::vector<u16> indices = generateIndices(key);
+            const size_t size = indices.size() * sizeof(u16);
+
+            LODIndexBuffer lod_buffer {
+                renderer.createBufferOfSize(size, StorageMode::MANAGED),
+                (u32) indices.size()
+            };
+            renderer.setBufferOfSize(lod_buffer.buffer, indices.data(), size);
+
+            it = lod_index_buffers.emplace(key, lod_buffer).first;
+
+            Log::verbose("\tBuilt terrain LOD indices %#x (%u triangles)",
+                    key, lod_buffer.count / 3);
         }
+
+        chunk.lod = it->second;
     }
+}
 
-    renderer.setBufferOfSize(
-            terrain_uniform_buffer, 
-            &mega_chunk_data, 
-            sizeof(MegaChunkData)
-        );
+TerrainTileBindings Terrain::uploadTiles(DZRenderer &renderer)
+{
+    std::vector<Chunk*> chunks;
+    for (const VisibleChunk &chunk : this->visible)
+        chunks.push_back(chunk.chunk);
+
+    return this->tiles->upload(renderer, chunks);
+}
+
+std::array<s32, 9> Terrain::neighbourSlots(v2i coord) const
+{
+    std::array<s32, 9> slots;
+    for (s32 dy = -1; dy <= 1; dy++)
+    {
+        for (s32 dx = -1; dx <= 1; dx++)
+        {
+            const Chunk *chunk = this->chunks.find(v2i { coord.x + dx, coord.y + dy });
+            slots[(dy + 1) * 3 + (dx + 1)] = this->tiles->slotOf(chunk);
+        }
+    }
+    return slots;
 }
@@ -0,0 +1,192 @@
+#include "terrain_tiles.h"
+#include "terrain.h"
+
+#include <cstring>
+
+#define SLOT_BYTES (TILES_PER_CHUNK)
+#define ALL_ROWS   (~0ull)
+
+static_assert(TILES_PER_SIDE == 64, "LOS rows are tracked in a u64");
+
+TerrainTiles::TerrainTiles(DZRenderer &renderer)
+    : uploads { 0 }
+    , stats {}
+{
+    copies.resize(renderer.getFramesInFlight(), Copy { DZInvalid, DZInvalid, {}, {} });
+    allocate(renderer, TERRAIN_TILE_SLOTS);
+}
+
+void TerrainTiles::allocate(DZRenderer &renderer, u32 slot_count)
+{
+    releaseAll();
+    slots.assign(slot_count, Slot { nullptr, 0 });
+
+    const std::vector<u8> zeroes(SLOT_BYTES, 0);
+
+    for (Copy &copy : copies)
+    {
+        // The GPU may still read the old ones, the renderer frees them
+        // once it is done
+        if (copy.materials != DZInvalid)
+        {
+            renderer.releaseBuffer(copy.materials);
+            renderer.releaseBuffer(copy.los);
+        }
+
+        copy.materials = renderer.createBufferOfSize(slot_count * SLOT_BYTES, StorageMode::MANAGED);
+        copy.los = renderer.createBufferOfSize(slot_count * SLOT_BYTES, StorageMode::MANAGED);
+        copy.stale_materials.assign(slot_count, false);
+        copy.stale_rows.assign(slot_count, 0);
+
+        renderer.setBufferRange(copy.materials, TERRAIN_NO_SLOT * SLOT_BYTES, zeroes.data(), SLOT_BYTES);
+        renderer.setBufferRange(copy.los, TERRAIN_NO_SLOT * SLOT_BYTES, zeroes.data(), SLOT_BYTES);
+    }
+
+    Log::verbose("Terrain tiles: %u slots of %u bytes per frame in flight", slot_count, SLOT_BYTES * 2);
+}
+
+TerrainTileBindings TerrainTiles::upload(DZRenderer &renderer, const std::vector<Chunk*> &visible)
+{
+    uploads++;
+    stats = TerrainUploadStats {};
+    stats.full_copy_bytes = 2 * visible.size() * SLOT_BYTES;
+
+    // Half the slots spare for chunks that left the view
+    if (2 * visible.size() + 1 > slots.size())
+    {
+        u32 slot_count = slots.size();
+        while (2 * visible.size() + 1 > slot_count)
+            slot_count *= 2;
+        allocate(renderer, slot_count);
+    }
+
+    // Visible chunks first, so assign never takes a slot from one
+    for (Chunk *chunk : visible)
+    {
+        if (chunk->tile_slot != TERRAIN_NO_SLOT)
+            slots[chunk->tile_slot].last_used = uploads;
+    }
+
+    for (Chunk *chunk : visible)
+    {
+        if (chunk->tile_slot == TERRAIN_NO_SLOT)
+        {
+            assign(*chunk);
+            stats.assigned++;
+        }
+
+        if (chunk->los_dirty_rows)
+        {
+            for (Copy &copy : copies)
+                copy.stale_rows[chunk->tile_slot] |= chunk->los_dirty_rows;
+            chunk->los_dirty_rows = 0;
+        }
+    }
+
+    // beginFrame waited for the frame that last used this copy
+    Copy &copy = copies[renderer.getFrame() % copies.size()];
+    for (Chunk *chunk : visible)
+    {
+        const u32 slot = chunk->tile_slot;
+        if (copy.stale_materials[slot])
+        {
+            renderer.setBufferRange(copy.materials, slot * SLOT_BYTES, chunk->material_indices, SLOT_BYTES);
+            stats.material_bytes += SLOT_BYTES;
+            copy.stale_materials[slot] = false;
+        }
+
+        if (copy.stale_rows[slot])
+        {
+            uploadRows(renderer, copy.los, slot, chunk->los_indices, copy.stale_rows[slot]);
+            copy.stale_rows[slot] = 0;
+        }
+    }
+
+    return TerrainTileBindings { copy.materials, copy.los };
+}
+
+s32 TerrainTiles::slotOf(const Chunk *chunk) const
+{
+    if (!chunk || chunk->tile_slot == TERRAIN_NO_SLOT || slots[chunk->tile_slot].last_used != uploads)
+        return TERRAIN_NO_SLOT;
+    return chunk->tile_slot;
+}
+
+// Takes a free slot or the one least recently visible
+u32 TerrainTiles::assign(Chunk &chunk)
+{
+    u32 best = TERRAIN_NO_SLOT;
+    for (u32 i = TERRAIN_NO_SLOT + 1; i < slots.size(); i++)
+    {
+        if (!slots[i].chunk)
+        {
+            best = i;
+            break;
+        }
+
+        if (best == TERRAIN_NO_SLOT || slots[i].last_used < slots[best].last_used)
+            best = i;
+    }
+
+    if (slots[best].chunk)
+        slots[best].chunk->tile_slot = TERRAIN_NO_SLOT;
+
+    slots[best] = Slot { &chunk, uploads };
+    chunk.tile_slot = best;
+    chunk.los_dirty_rows = 0;
+
+    for (Copy &copy : copies)
+    {
+        copy.stale_materials[best] = true;
+        copy.stale_rows[best] = ALL_ROWS;
+    }
+
+    return best;
+}
+
+// One write per run of consecutive rows
+void TerrainTiles::uploadRows(DZRenderer &renderer, DZBuffer buffer, u32 slot, const u8 *los, u64 rows)
+{
+    while (rows)
+    {
+        const u32 first = __builtin_ctzll(rows);
+        const u64 from_first = rows >> first;
+        const u32 count = ~from_first ? __builtin_ctzll(~from_first) : 64 - first;
+
+        const size_t offset = first * TILES_PER_SIDE;
+        const size_t size = count * TILES_PER_SIDE;
+        renderer.setBufferRange(buffer, slot * SLOT_BYTES + offset, los + offset, size);
+        stats.los_bytes += size;
+
+        rows = first + count < 64 ? rows & (ALL_ROWS << (first + count)) : 0;
+    }
+}
+
+void TerrainTiles::release(Chunk &chunk)
+{
+    if (chunk.tile_slot == TERRAIN_NO_SLOT)
+        return;
+
+    slots[chunk.tile_slot] = Slot { nullptr, 0 };
+    chunk.tile_slot = TERRAIN_NO_SLOT;
+}
+
+void TerrainTiles::releaseAll()
+{
+    for (Slot &slot : slots)
+    {
+        if (slot.chunk)
+            slot.chunk->tile_slot = TERRAIN_NO_SLOT;
+        slot = Slot { nullptr, 0 };
+    }
+}
+
+u32 TerrainTiles::getSlotCount() const
+{
+    return slots.size();
+}
+
+const TerrainUploadStats &TerrainTiles::getStats() const
+{
+    return stats;
+}
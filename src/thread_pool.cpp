@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(u32 num_threads)
+    : stopping(false)
+{
+    if (num_threads == 0)
+        num_threads = 1;
+
+    for (u32 i = 0; i < num_threads; i++)
+        workers.emplace_back([this]{ workerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_available.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    job_available.notify_one();
+}
+
+u32 ThreadPool::size() const
+{
+    return workers.size();
+}
+
+namespace
+{
+    struct ParallelFor
+    {
+        const std::function<void(u32, u32)> *fn;
+        u32 count;
+        u32 piece_size;
+        u32 pieces;
+
+        std::atomic<u32> next;
+        std::atomic<u32> done;
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        // Helpers that start after the caller has returned find nothing
+        // left to take, so fn is never called once it is gone
+        void work()
+        {
+            u32 piece;
+            while ((piece = next.fetch_add(1)) < pieces)
+            {
+                const u32 begin = piece * piece_size;
+                (*fn)(begin, std::min(begin + piece_size, count));
+
+                if (done.fetch_add(1) + 1 == pieces)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            }
+        }
+    };
+}
+
+void ThreadPool::parallelFor(u32 count, u32 min_piece, const std::function<void(u32, u32)> &fn)
+{
+    if (count == 0)
+        return;
+
+    // A few pieces per thread so an uneven split still balances out
+    const u32 threads = size() + 1;
+    const u32 piece_size = std::max(std::max(min_piece, 1u), (count + 4 * threads - 1) / (4 * threads));
+    const u32 pieces = (count + piece_size - 1) / piece_size;
+
+    if (pieces == 1)
+    {
+        fn(0, count);
+        return;
+    }
+
+    auto state = std::make_shared<ParallelFor>();
+    state->fn = &fn;
+    state->count = count;
+    state->piece_size = piece_size;
+    state->pieces = pieces;
+    state->next = 0;
+    state->done = 0;
+
+    const u32 helpers = std::min(pieces - 1, size());
+    for (u32 i = 0; i < helpers; i++)
+        enqueue([state]{ state->work(); });
+
+    state->work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]{ return state->done.load() == pieces; });
+}
+
+u32 ThreadPool::defaultThreadCount()
+{
+    u32 hw = std::thread::hardware_concurrency();
+    return hw > 1 ? hw - 1 : 1;
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_available.wait(lock, [this]{ return stopping || !jobs.empty(); });
+
+            // Drop whatever is left on shutdown, nobody is waiting for it
+            if (stopping)
+                return;
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+
+#include "tick_systems.h"
+#include "entity.h"
+#include "movement.h"
+
+void TickSystem::previousTransforms(TICKSYSTEM_ARGS)
+{
+    auto view = scene.registry.view<Transform>();
+    for (entt::entity entity : view)
+        scene.registry.emplace_or_replace<PreviousTransform>(entity, view.get<Transform>(entity));
+}
+
+void TickSystem::unitMovement(TICKSYSTEM_ARGS)
+{
+    auto view = scene.registry.view<Transform, MoveSpeed>();
+    std::vector<entt::entity> units(view.begin(), view.end());
+
+    // Every unit heads for the same tile, so they all share one flow
+    // field. Fill it in where the units are first, after that it is
+    // only read and the units can move in parallel.
+    Separation &separation = scene.separation;
+    separation.xs.resize(units.size());
+    separation.ys.resize(units.size());
+
+    std::vector<v2i> coords;
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        const Transform &transform = view.get<Transform>(units[i]);
+        coords.push_back(scene.terrain.getChunkCoordFromPos(v2f { transform.pos.x, transform.pos.y }));
+        separation.xs[i] = transform.pos.x;
+        separation.ys[i] = transform.pos.y;
+    }
+    std::sort(coords.begin(), coords.end());
+    coords.erase(std::unique(coords.begin(), coords.end(),
+                [](v2i a, v2i b) { return a.x == b.x && a.y == b.y; }),
+            coords.end());
+
+    const v3f target { scene.camera.target.x, scene.camera.target.y, scene.camera.target.z };
+    const FlowField &field = scene.pathfinder.prepareFlow(v2f { target.x, target.y }, coords);
+
+    // From where every unit was before any of them moved
+    separation.compute(&jobs);
+
+    jobs.parallelFor(units.size(), 256, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; i++)
+        {
+            auto [transform, move_speed] = view.get<Transform, MoveSpeed>(units[i]);
+            const v2f flow = scene.pathfinder.flowDirection(
+                    field, v2f { transform.pos.x, transform.pos.y });
+
+            const v2f push { separation.push_x[i], separation.push_y[i] };
+
+            updateMovement(move_speed.speed * delta_time, transform, target, flow, push, scene.terrain);
+        }
+    });
+}
+
+void TickSystem::spatialIndex(TICKSYSTEM_ARGS)
+{
+    scene.spatial.update();
+}
+
+void TickSystem::LOS(TICKSYSTEM_ARGS)
+{
+    scene.fog.update();
+}
+
+void addTickSystems(TickSystems &systems)
+{
+    systems.add("previousTransforms", &TickSystem::previousTransforms,
+            SystemAccess()
+                .reads<Transform>()
+                .writes<PreviousTransform>());
+    systems.add("unitMovement", &TickSystem::unitMovement,
+            SystemAccess()
+                .reads(RESOURCE_CAMERA | RESOURCE_CHUNKS)
+                .writes(RESOURCE_PATHFINDER)
+                .reads<MoveSpeed>()
+                .writes<Transform>());
+    systems.add("spatialIndex", &TickSystem::spatialIndex,
+            SystemAccess()
+                .writes(RESOURCE_SPATIAL)
+                .reads<Transform>()
+                .writes<SpatialEntry>());
+    systems.add("LOS", &TickSystem::LOS,
+            SystemAccess()
+                .reads(RESOURCE_CHUNKS)
+                .writes(RESOURCE_FOG)
+                .reads<Transform, LineOfSight>()
+                .writes<LOSStamp>());
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "uniform_ring.h"
+#include "logger.h"
+
+UniformRing::UniformRing(DZRenderBackend &backend, u32 frames_in_flight, size_t frame_size)
+    : validate { false }
+    , backend { backend }
+    , regions(std::max(frames_in_flight, 1u))
+    , current { 0 }
+    , peak_bytes { 0 }
+{
+    for (Region &region : regions)
+    {
+        region.buffer = backend.createBufferOfSize(frame_size, StorageMode::SHARED);
+        region.size = frame_size;
+        region.used = 0;
+        region.frame = 0;
+    }
+}
+
+size_t UniformRing::getPeakBytes() const
+{
+    return peak_bytes;
+}
+
+u32 UniformRing::beginFrame(u64 frame, u64 finished)
+{
+    current = frame % regions.size();
+    Region &region = regions[current];
+
+    u32 violations = 0;
+    if (validate && region.frame > finished)
+    {
+        Log::error("Uniform ring region of frame %llu reused for frame %llu while the GPU may still read it",
+                (unsigned long long) region.frame, (unsigned long long) frame);
+        violations++;
+    }
+
+    for (DZBuffer buffer : region.retired)
+        backend.releaseBuffer(buffer);
+    region.retired.clear();
+
+    region.used = 0;
+    region.frame = frame;
+    return violations;
+}
+
+UniformSlice UniformRing::allocate(const void *data, size_t size)
+{
+    Region &region = regions[current];
+
+    const size_t offset = (region.used + UNIFORM_ALIGNMENT - 1) & ~(size_t) (UNIFORM_ALIGNMENT - 1);
+    if (offset + size > region.size)
+    {
+        // What was handed out this frame stays in the old buffer
+        region.retired.push_back(region.buffer);
+        region.size = std::max(region.size * 2, size);
+        region.buffer = backend.createBufferOfSize(region.size, StorageMode::SHARED);
+        region.used = 0;
+        Log::verbose("Uniform ring region grown to %zu bytes", region.size);
+        return allocate(data, size);
+    }
+
+    backend.setBufferRange(region.buffer, offset, data, size);
+    region.used = offset + size;
+    peak_bytes = std::max(peak_bytes, region.used);
+
+    return UniformSlice { region.buffer, offset };
+}
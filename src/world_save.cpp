@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <type_traits>
+
+#include "world_save.h"
+#include "chunk_store.h"
+#include "entity.h"
+#include "model.h"
+#include "transform.h"
+#include "logger.h"
+
+namespace
+{
+    f64 msSince(std::chrono::steady_clock::time_point start)
+    {
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    struct ChunkTiles
+    {
+        const u8 *los_indices;
+        const u8 *navigable;
+    };
+
+    bool sameModel(const Model &a, const Model &b)
+    {
+        return a.meshes == b.meshes
+            && a.textured == b.textured
+            && a.lit == b.lit
+            && a.radius == b.radius;
+    }
+
+    // Appends values as they are in memory. Models are written as their
+    // index in models, which gets every distinct one once.
+    struct SaveArchive
+    {
+        std::vector<u8> &bytes;
+        std::vector<Model> &models;
+        u32 last_model = 0;
+
+        template <typename T>
+        void operator()(const T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Only plain data is saved as it is");
+            const size_t at = bytes.size();
+            bytes.resize(at + sizeof(T));
+            memcpy(bytes.data() + at, &value, sizeof(T));
+        }
+
+        void operator()(const Model &model)
+        {
+            // Neighbouring entities are mostly the same kind
+            if (last_model >= models.size() || !sameModel(models[last_model], model))
+            {
+                auto found = std::find_if(models.begin(), models.end(),
+                        [&](const Model &other) { return sameModel(other, model); });
+                last_model = found - models.begin();
+                if (found == models.end())
+                    models.push_back(model);
+            }
+
+            (*this)(last_model);
+        }
+    };
+
+    // Reads what SaveArchive wrote, failed once anything is missing
+    struct LoadArchive
+    {
+        const u8 *at;
+        const u8 *end;
+        const std::vector<Model> &models;
+        bool failed = false;
+
+        template <typename T>
+        void operator()(T &value)
+        {
+            read(value);
+        }
+
+        // Counts of entities and components, none can be more than what
+        // is left, so a malformed save fails instead of looping for ever
+        void operator()(u32 &count)
+        {
+            read(count);
+            if (count > (size_t) (end - at) / sizeof(entt::entity))
+            {
+                failed = true;
+                count = 0;
+            }
+        }
+
+        void operator()(Model &model)
+        {
+            u32 index;
+            read(index);
+            if (failed || index >= models.size())
+            {
+                failed = true;
+                return;
+            }
+
+            model = models[index];
+        }
+
+        template <typename T>
+        void read(T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Only plain data is saved as it is");
+            if ((size_t) (end - at) < sizeof(T))
+            {
+                failed = true;
+                value = T {};
+                return;
+            }
+
+            memcpy(&value, at, sizeof(T));
+            at += sizeof(T);
+        }
+    };
+
+    // Everything the snapshot holds about the camera, field by field so
+    // padding is never saved
+    template <typename Archive, typename C>
+    void cameraFields(Archive &archive, C &camera)
+    {
+        archive(camera.position);
+        archive(camera.target);
+        archive(camera.zoom_level);
+        archive(camera.move_speed);
+        archive(camera.zoom_speed);
+        archive(camera.zoom_max);
+        archive(camera.zoom_min);
+        archive(camera.theta);
+        archive(camera.phi);
+        archive(camera.ortho);
+    }
+
+    // The component lists of the snapshot and the loader, kept in the
+    // same order
+    template <typename Snapshot, typename Archive>
+    void components(Snapshot &&snapshot, Archive &archive)
+    {
+        snapshot
+            .template get<entt::entity>(archive)
+            .template get<Transform>(archive)
+            .template get<MoveSpeed>(archive)
+            .template get<LineOfSight>(archive)
+            .template get<Health>(archive)
+            .template get<Team>(archive)
+            .template get<Model>(archive);
+    }
+}
+
+WorldSaver::WorldSaver()
+    : written { true }
+    , stats {}
+{
+}
+
+WorldSaver::~WorldSaver()
+{
+    wait();
+}
+
+std::vector<u8> WorldSaver::snapshot(const entt::registry &registry, const Terrain &terrain, const Camera &camera, WorldSaveStats *stats)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    // The model table goes before the entities, which fill it
+    std::vector<Model> models;
+    std::vector<u8> entities;
+    entities.reserve(registry.storage<entt::entity>()->size() * (sizeof(entt::entity) * 7 + sizeof(Transform) + 5 * sizeof(u32)));
+    SaveArchive entity_archive { entities, models };
+    components(entt::snapshot { registry }, entity_archive);
+
+    // Stored, persisted and resident chunks in one sorted list, so the
+    // same world always saves the same bytes. A resident chunk is newer
+    // than its stored copy.
+    std::map<v2i, ChunkTiles> chunks;
+    if (terrain.store)
+    {
+        terrain.store->forEach([&](v2i coord, const ChunkRecord &record)
+        {
+            chunks[coord] = ChunkTiles { record.los_indices, record.navigable };
+        });
+    }
+    for (const auto &[coord, saved] : terrain.persisted)
+        chunks[coord] = ChunkTiles { saved.los_indices, saved.navigable };
+    terrain.chunks.forEach([&](v2i coord, const Chunk &chunk)
+    {
+        chunks[coord] = ChunkTiles { chunk.los_indices, chunk.navigable };
+    });
+
+    std::vector<u8> data;
+    data.reserve(sizeof(WorldSaveHeader) + entities.size() + chunks.size() * (sizeof(v2i) + 2 * TILES_PER_CHUNK) + 4096);
+    data.resize(sizeof(WorldSaveHeader));
+
+    std::vector<Model> no_models;
+    SaveArchive archive { data, no_models };
+    cameraFields(archive, camera);
+
+    archive((u32) models.size());
+    for (const Model &model : models)
+    {
+        archive((u32) model.meshes.size());
+        for (DZMesh mesh : model.meshes)
+            archive((u64) mesh);
+        archive(model.textured);
+        archive(model.lit);
+        archive(model.radius);
+    }
+
+    archive((u64) entities.size());
+    data.insert(data.end(), entities.begin(), entities.end());
+
+    archive((u32) chunks.size());
+    for (const auto &[coord, tiles] : chunks)
+    {
+        archive(coord);
+        data.insert(data.end(), tiles.los_indices, tiles.los_indices + TILES_PER_CHUNK);
+        data.insert(data.end(), tiles.navigable, tiles.navigable + TILES_PER_CHUNK);
+    }
+
+    // Ids past the free list are destroyed ones kept for their versions
+    const u32 num_entities = registry.storage<entt::entity>()->free_list();
+
+    WorldSaveHeader header {};
+    header.magic = WORLD_SAVE_MAGIC;
+    header.version = WORLD_SAVE_VERSION;
+    header.seed = terrain.seed;
+    header.chunk_size = terrain.chunk_size;
+    header.entities = num_entities;
+    header.payload_bytes = data.size() - sizeof(WorldSaveHeader);
+    header.checksum = ChunkStore::checksum(data.data() + sizeof(WorldSaveHeader), header.payload_bytes);
+    memcpy(data.data(), &header, sizeof(header));
+
+    if (stats)
+    {
+        stats->entities = num_entities;
+        stats->models = models.size();
+        stats->chunks = chunks.size();
+        stats->bytes = data.size();
+        stats->snapshot_ms = msSince(start);
+    }
+
+    return data;
+}
+
+bool WorldSaver::restore(const std::vector<u8> &data, entt::registry &registry, Terrain &terrain, Camera &camera, DZRenderer &renderer)
+{
+    WorldSaveHeader header;
+    if (data.size() < sizeof(header))
+    {
+        Log::error("World save: %zu bytes is too short for a save", data.size());
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (header.magic != WORLD_SAVE_MAGIC || header.version != WORLD_SAVE_VERSION)
+    {
+        Log::error("World save: not a version %u save", WORLD_SAVE_VERSION);
+        return false;
+    }
+    if (header.seed != terrain.seed || header.chunk_size != terrain.chunk_size)
+    {
+        Log::error("World save: made with terrain seed %u, this one is %u", header.seed, terrain.seed);
+        return false;
+    }
+    if (header.payload_bytes != data.size() - sizeof(header)
+            || ChunkStore::checksum(data.data() + sizeof(header), header.payload_bytes) != header.checksum)
+    {
+        Log::error("World save: failed its checksum");
+        return false;
+    }
+
+    // Everything but the entities is read before the world is touched
+    std::vector<Model> models;
+    LoadArchive archive { data.data() + sizeof(header), data.data() + data.size(), models };
+
+    Camera saved_camera = camera;
+    cameraFields(archive, saved_camera);
+
+    u32 num_models;
+    archive(num_models);
+    for (u32 i = 0; i < num_models && !archive.failed; i++)
+    {
+        u32 num_meshes;
+        archive(num_meshes);
+
+        Model model { {}, false, false, MODEL_DEFAULT_RADIUS };
+        for (u32 j = 0; j < num_meshes && !archive.failed; j++)
+        {
+            u64 mesh;
+            archive(mesh);
+            model.meshes.push_back((DZMesh) mesh);
+        }
+        archive(model.textured);
+        archive(model.lit);
+        archive(model.radius);
+        models.push_back(std::move(model));
+    }
+
+    u64 entity_bytes;
+    archive(entity_bytes);
+    if (archive.failed || entity_bytes > (u64) (archive.end - archive.at))
+    {
+        Log::error("World save: cut short");
+        return false;
+    }
+    LoadArchive entity_archive { archive.at, archive.at + entity_bytes, models };
+    archive.at += entity_bytes;
+
+    std::map<v2i, PersistedChunk> chunks;
+    u32 num_chunks;
+    archive(num_chunks);
+    for (u32 i = 0; i < num_chunks && !archive.failed; i++)
+    {
+        v2i coord;
+        archive(coord);
+        if ((size_t) (archive.end - archive.at) < 2 * TILES_PER_CHUNK)
+        {
+            archive.failed = true;
+            break;
+        }
+
+        PersistedChunk &saved = chunks[coord];
+        memcpy(saved.los_indices, archive.at, TILES_PER_CHUNK);
+        memcpy(saved.navigable, archive.at + TILES_PER_CHUNK, TILES_PER_CHUNK);
+        archive.at += 2 * TILES_PER_CHUNK;
+    }
+
+    if (archive.failed || archive.at != archive.end)
+    {
+        Log::error("World save: cut short");
+        return false;
+    }
+
+    // Parsed into a scratch registry first, so a save whose entities do
+    // not read back leaves the world as it was
+    {
+        entt::registry scratch;
+        LoadArchive dry_run = entity_archive;
+        components(entt::snapshot_loader { scratch }, dry_run);
+        if (dry_run.failed || dry_run.at != dry_run.end)
+        {
+            Log::error("World save: entities do not match this version's components");
+            return false;
+        }
+    }
+
+    // Destroying the entities first lets the on_destroy hooks take them
+    // off the chunks they were stamped on. Clearing the entity storage
+    // as well frees every id, so the loader can give them back with the
+    // same versions.
+    registry.clear();
+    registry.storage<entt::entity>().clear();
+    components(entt::snapshot_loader { registry }, entity_archive);
+
+    // The chunks are generated or loaded again and get the saved tiles
+    // as they arrive. Stored chunks get them in the store, the ones
+    // stored since the save are generated again.
+    terrain.clear(renderer);
+    if (terrain.store)
+    {
+        std::vector<v2i> stored;
+        terrain.store->forEach([&](v2i coord, const ChunkRecord &) { stored.push_back(coord); });
+        for (v2i coord : stored)
+        {
+            auto saved = chunks.find(coord);
+            if (saved == chunks.end())
+                terrain.store->erase(coord);
+            else if (terrain.store->saveTiles(coord, saved->second.los_indices, saved->second.navigable))
+                chunks.erase(saved);
+        }
+    }
+    terrain.persisted = std::move(chunks);
+
+    camera = saved_camera;
+
+    Log::info("World save: loaded %u entities, %u models, %u chunks",
+            (u32) registry.storage<entt::entity>().free_list(), num_models, num_chunks);
+    return true;
+}
+
+void WorldSaver::save(const entt::registry &registry, const Terrain &terrain, const Camera &camera, const std::string &path)
+{
+    wait();
+
+    WorldSaveStats next {};
+    std::vector<u8> data = snapshot(registry, terrain, camera, &next);
+    stats = next;
+
+    writer = std::thread([this, path, data = std::move(data)]
+    {
+        const auto start = std::chrono::steady_clock::now();
+        written = write(path, data);
+        stats.write_ms = msSince(start);
+    });
+}
+
+bool WorldSaver::load(const std::string &path, entt::registry &registry, Terrain &terrain, Camera &camera, DZRenderer &renderer)
+{
+    wait();
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        Log::error("World save: cannot open %s", path.c_str());
+        return false;
+    }
+
+    std::vector<u8> data(file.tellg());
+    file.seekg(0);
+    if (!file.read((char *) data.data(), data.size()))
+    {
+        Log::error("World save: cannot read %s", path.c_str());
+        return false;
+    }
+
+    return restore(data, registry, terrain, camera, renderer);
+}
+
+bool WorldSaver::wait()
+{
+    if (writer.joinable())
+        writer.join();
+    return written;
+}
+
+WorldSaveStats WorldSaver::getStats()
+{
+    wait();
+    return stats;
+}
+
+// Written next to the old save and renamed over it, so a crash midway
+// leaves the old one
+bool WorldSaver::write(const std::string &path, const std::vector<u8> &data)
+{
+    const std::string partial = path + ".partial";
+    {
+        std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+        if (!file.write((const char *) data.data(), data.size()))
+        {
+            Log::error("World save: cannot write %s", partial.c_str());
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(partial, path, error);
+    if (error)
+    {
+        Log::error("World save: cannot replace %s: %s", path.c_str(), error.message().c_str());
+        return false;
+    }
+
+    Log::verbose("World save: wrote %zu bytes to %s", data.size(), path.c_str());
+    return true;
+}